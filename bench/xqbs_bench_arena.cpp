@@ -0,0 +1,131 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_arena.cpp
+*
+*/
+
+// Микробенчмарк загрузки графа объектов: построение списка из XQBS_new в
+// куче (как при разборе данных на старте) против построения в арене и
+// против открытия сохраненной арены одним отображением файла.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_arena.cpp
+// Запуск: ./a.out [количество узлов] [файл арены]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../xqbs_arena.h"
+#include "../xqbs_refbase_i.h"
+
+using namespace XQBS;
+
+#ifndef _WIN32
+
+// Узел списка в куче
+struct XQBS_BenchHeapNode { XQBS_BenchHeapNode* m_pNext; int64_t m_Key; int64_t m_Value[2]; };
+// Узел списка в арене
+struct XQBS_BenchArenaNode { XQBS_OffsetPtr<XQBS_BenchArenaNode> m_pNext; int64_t m_Key; int64_t m_Value[2]; };
+
+// Миллисекунды с момента start
+static double XQBS_BenchMs(IN std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e3;
+}
+
+// Следующий узел списка
+static const XQBS_BenchHeapNode* XQBS_BenchNext(IN const XQBS_BenchHeapNode* pNode) { return pNode->m_pNext; }
+static const XQBS_BenchArenaNode* XQBS_BenchNext(IN const XQBS_BenchArenaNode* pNode) { return pNode->m_pNext.Get(); }
+
+// Сумма ключей списка (обход, чтобы страницы арены действительно прочитались)
+template<typename N>
+static int64_t XQBS_BenchSum(IN const N* pNode)
+{
+    int64_t sum = 0;
+    for (; pNode; pNode = XQBS_BenchNext(pNode))
+        sum += pNode->m_Key;
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    const char* path = argc > 2 ? argv[2] : "xqbs_bench_arena.bin";
+
+    // Построение в куче
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    XQBS_BenchHeapNode* pHead = NULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        XQBS_BenchHeapNode* pNode = XQBS_new<XQBS_BenchHeapNode>();
+        pNode->m_pNext = pHead;
+        pNode->m_Key = int64_t(i);
+        pHead = pNode;
+    }
+    int64_t sum = XQBS_BenchSum(pHead);
+    printf("%-12s %12.2f ms (sum %lld)\n", "heap build", XQBS_BenchMs(start), (long long)sum);
+
+    while (pHead)
+    {
+        XQBS_BenchHeapNode* pNext = pHead->m_pNext;
+        XQBS_delete(pHead);
+        pHead = pNext;
+    }
+
+    // Построение в арене и сохранение
+    XQBS_MmapArena arena;
+    start = std::chrono::steady_clock::now();
+    if (!arena.Create(path, count * sizeof(XQBS_BenchArenaNode) * 2 + 4096))
+    {
+        perror("create");
+        return 1;
+    }
+    {
+        XQBS_ArenaScope scope(arena);
+        XQBS_BenchArenaNode* pNode = NULL;
+        for (size_t i = 0; i < count; ++i)
+        {
+            XQBS_BenchArenaNode* pNew = XQBS_new<XQBS_BenchArenaNode>();
+            pNew->m_pNext = pNode;
+            pNew->m_Key = int64_t(i);
+            pNode = pNew;
+        }
+        arena.SetRoot(pNode);
+    }
+    sum = XQBS_BenchSum(arena.Root<XQBS_BenchArenaNode>());
+    if (!arena.Close())
+    {
+        perror("close");
+        return 1;
+    }
+    printf("%-12s %12.2f ms (sum %lld)\n", "arena build", XQBS_BenchMs(start), (long long)sum);
+
+    // Открытие сохраненной арены
+    start = std::chrono::steady_clock::now();
+    if (!arena.Open(path))
+    {
+        perror("open");
+        return 1;
+    }
+    sum = XQBS_BenchSum(arena.Root<XQBS_BenchArenaNode>());
+    printf("%-12s %12.2f ms (sum %lld)\n", "arena open", XQBS_BenchMs(start), (long long)sum);
+
+    arena.Close();
+    remove(path);
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("XQBS_MmapArena is not available on this platform\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_atomicrefptr.cpp
+*
+*/
+
+// Микробенчмарк публикации данных для чтения: читатели получают ссылку на
+// текущую версию объекта, писатель раз в миллисекунду заменяет версию.
+// Блокировка std::mutex + AddRef против XQBS_AtomicRefPtr::Load.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_atomicrefptr.cpp
+// Запуск: ./a.out [количество итераций на поток]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_atomicrefptr.h"
+
+using namespace XQBS;
+
+// Тестовая версия данных
+struct XQBS_BenchConfig : public XQBS_RefBaseT<XQBS_BenchConfig> { int m_Payload; XQBS_BenchConfig() : m_Payload(1) {} };
+
+// Слот под блокировкой (прежний способ)
+class XQBS_BenchLockedSlot
+{
+private:
+    std::mutex                    m_Lock;
+    XQBS_RefPtr<XQBS_BenchConfig> m_p;
+public:
+    XQBS_RefPtr<XQBS_BenchConfig> Load(void) { std::lock_guard<std::mutex> lock(m_Lock); return m_p; }
+    void Store(IN XQBS_RefPtr<XQBS_BenchConfig> p) { std::lock_guard<std::mutex> lock(m_Lock); m_p.Swap(p); }
+};
+
+// Слот без блокировок
+class XQBS_BenchAtomicSlot
+{
+private:
+    XQBS_AtomicRefPtr<XQBS_BenchConfig> m_p;
+public:
+    XQBS_RefPtr<XQBS_BenchConfig> Load(void) { return m_p.Load(); }
+    void Store(IN XQBS_RefPtr<XQBS_BenchConfig> p) { m_p.Store(std::move(p)); }
+};
+
+// Выполнить iterations чтений в threads потоках, пока отдельный писатель
+// заменяет версию, возвращает количество чтений в секунду (в миллионах)
+template<typename S>
+static double XQBS_BenchRun(IN size_t threads, IN size_t iterations)
+{
+    S slot;
+    slot.Store(XQBS_adopt(XQBS_new<XQBS_BenchConfig>()));
+
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false), stop(false);
+    std::atomic<long> sum(0);
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {}
+            long local = 0;
+            for (size_t n = 0; n < iterations; ++n)
+                local += slot.Load()->m_Payload;
+            sum.fetch_add(local);
+        });
+    }
+
+    std::thread writer([&]()
+    {
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            slot.Store(XQBS_adopt(XQBS_new<XQBS_BenchConfig>()));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    while (ready.load() != threads) {}
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    stop.store(true);
+    writer.join();
+
+    return double(threads * iterations) / elapsed.count() / 1e6;
+}
+
+// Прогнать один вариант по всем количествам потоков
+template<typename S>
+static void XQBS_BenchCase(IN const char* name, IN const std::vector<size_t>& threads, IN size_t iterations)
+{
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        double mops = XQBS_BenchRun<S>(threads[i], threads[i] == 1 ? iterations : iterations / threads[i]);
+        printf("%-12s %8zu %14.2f\n", name, threads[i], mops);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+
+    std::vector<size_t> threads;
+    size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t t = 1; t < hw; t *= 2)
+        threads.push_back(t);
+    threads.push_back(hw);
+
+    printf("%-12s %8s %14s\n", "impl", "threads", "Mloads/s");
+    XQBS_BenchCase<XQBS_BenchLockedSlot>("mutex", threads, iterations);
+    XQBS_BenchCase<XQBS_BenchAtomicSlot>("atomic", threads, iterations);
+
+    return 0;
+}
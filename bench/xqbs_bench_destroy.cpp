@@ -0,0 +1,89 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_destroy.cpp
+*
+*/
+
+// Микробенчмарк разрушения контейнера указателей: поэлементный XQBS_destroy
+// против XQBS_destroy_range для объектов со счетчиком ссылок, тривиально
+// разрушаемых объектов и объектов с деструктором. Указатели перемешаны,
+// чтобы обход контейнера шел по памяти вразнобой, как в долгоживущем кеше.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_destroy.cpp
+// Запуск: ./a.out [количество объектов]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../xqbs_refbase.h"
+
+using namespace XQBS;
+
+// Тестовые объекты
+struct XQBS_BenchTrivial { int64_t m_Key; int64_t m_Value[3]; };
+struct XQBS_BenchString { std::string m_Value; XQBS_BenchString() : m_Value(8, 'x') {} };
+struct XQBS_BenchRef : public XQBS_RefBase { int64_t m_Value[3]; };
+
+// Создать count объектов в перемешанном порядке
+template<typename T>
+static std::vector<T*> XQBS_BenchMake(IN size_t count)
+{
+    std::vector<T*> v(count);
+    for (size_t i = 0; i < count; ++i)
+        v[i] = XQBS_new<T>();
+    std::shuffle(v.begin(), v.end(), std::mt19937(42));
+    return v;
+}
+
+// Время поэлементного разрушения, нс на объект
+template<typename T>
+static double XQBS_BenchEach(IN size_t count)
+{
+    std::vector<T*> v = XQBS_BenchMake<T>(count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < v.size(); ++i)
+        XQBS_destroy(v[i]);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / double(count);
+}
+
+// Время разрушения диапазоном, нс на объект
+template<typename T>
+static double XQBS_BenchRange(IN size_t count)
+{
+    std::vector<T*> v = XQBS_BenchMake<T>(count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    XQBS_destroy_range(v);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / double(count);
+}
+
+// Прогнать один тип объектов
+template<typename T>
+static void XQBS_BenchCase(IN const char* name, IN size_t count)
+{
+    double each = XQBS_BenchEach<T>(count);
+    double range = XQBS_BenchRange<T>(count);
+    printf("%-10s %12.2f %12.2f\n", name, each, range);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    printf("%-10s %12s %12s\n", "object", "each ns", "range ns");
+    XQBS_BenchCase<XQBS_BenchTrivial>("trivial", count);
+    XQBS_BenchCase<XQBS_BenchString>("string", count);
+    XQBS_BenchCase<XQBS_BenchRef>("refbase", count);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_epoch.cpp
+*
+*/
+
+// Микробенчмарк задержки последнего Release большого дерева объектов в
+// отпускающем потоке: уничтожение прямо в Release против отложенного
+// уничтожения фоновым потоком (XQBS_EpochStart).
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_epoch.cpp
+// Запуск: ./a.out [глубина дерева]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../xqbs_epoch.h"
+
+using namespace XQBS;
+
+// Узел дерева с четырьмя потомками
+struct XQBS_BenchTree : public XQBS_RefBase
+{
+    XQBS_BenchTree* m_pChildren[4]; // Потомки
+
+    XQBS_BenchTree(IN int depth)
+    {
+        for (int i = 0; i < 4; ++i)
+            m_pChildren[i] = depth > 0 ? new XQBS_BenchTree(depth - 1) : NULL;
+    }
+
+    ~XQBS_BenchTree()
+    {
+        for (int i = 0; i < 4; ++i)
+            XQBS_release(m_pChildren[i]);
+    }
+};
+
+// Время последнего Release дерева глубины depth в микросекундах
+static double XQBS_BenchRelease(IN int depth)
+{
+    XQBS_BenchTree* pTree = new XQBS_BenchTree(depth);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pTree->Release();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+    int depth = argc > 1 ? atoi(argv[1]) : 9;
+
+    printf("%-12s %14s\n", "mode", "release us");
+    printf("%-12s %14.1f\n", "inline", XQBS_BenchRelease(depth));
+
+    XQBS_EpochStart();
+    printf("%-12s %14.1f\n", "deferred", XQBS_BenchRelease(depth));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t count = XQBS_EpochFlush();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-12s %14.1f (%zu objects)\n", "flush", elapsed.count(), count);
+
+    XQBS_EpochStop();
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_fdcloser.cpp
+*
+*/
+
+// Микробенчмарк закрытия дескрипторов в потоке-владельце: деструктор
+// XQBS_SmartFd (close на месте) против XQBS_SmartFdDeferred (передача
+// дескриптора фоновому потоку XQBS_FdCloser). Дескрипторы - временные файлы
+// с данными, закрываются пачками, между пачками очередь успевает опустеть.
+// Измеряется только время в потоке-владельце.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_fdcloser.cpp
+// Запуск: ./a.out [количество пачек] [каталог для временных файлов]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../xqbs_fdcloser.h"
+
+using namespace XQBS;
+
+#ifndef _WIN32
+
+// Дескрипторов в одной пачке
+static const size_t XQBS_BENCH_BATCH = 256;
+
+// Открыть count временных файлов с данными
+static bool XQBS_BenchOpen(IN const std::string& dir, IN size_t count, OUT std::vector<int>& fds)
+{
+    static char s_Data[4096];
+    fds.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string path = dir + "/xqbs_bench_fd_" + std::to_string(i);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        ::unlink(path.c_str());
+        if (::write(fd, s_Data, sizeof(s_Data)) != ssize_t(sizeof(s_Data)))
+            return false;
+        fds.push_back(fd);
+    }
+    return true;
+}
+
+// Время закрытия одного дескриптора в потоке-владельце, нс
+template<typename G>
+static double XQBS_BenchRun(IN const std::string& dir, IN size_t batches)
+{
+    std::vector<int> fds;
+    double total = 0;
+    for (size_t b = 0; b < batches; ++b)
+    {
+        if (!XQBS_BenchOpen(dir, XQBS_BENCH_BATCH, fds))
+        {
+            perror("open");
+            exit(1);
+        }
+
+        std::vector<G> guards;
+        guards.reserve(fds.size());
+        for (size_t i = 0; i < fds.size(); ++i)
+            guards.emplace_back(fds[i]);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        guards.clear();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        total += elapsed.count();
+
+        XQBS_FdCloser::Instance().Drain();
+    }
+    return total * 1e9 / double(batches * XQBS_BENCH_BATCH);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t batches = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+    std::string dir = argc > 2 ? argv[2] : ".";
+
+    printf("%-12s %12s\n", "guard", "ns/close");
+    printf("%-12s %12.1f\n", "inline", XQBS_BenchRun<XQBS_SmartFd>(dir, batches));
+    printf("%-12s %12.1f\n", "deferred", XQBS_BenchRun<XQBS_SmartFdDeferred>(dir, batches));
+
+    XQBS_FdCloserStats stats = XQBS_FdCloser::Instance().Stats();
+    printf("closer: deferred %llu, inline %llu\n", (unsigned long long)stats.m_Deferred, (unsigned long long)stats.m_Inline);
+
+    XQBS_FdCloser::Instance().Shutdown();
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("XQBS_FdCloser is not available on this platform\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_mem.cpp
+*
+*/
+
+// Микробенчмарк создания большого графа объектов при старте:
+//  - XQBS_new_ctor2 (аргументы копируются в объект) против XQBS_new<T>(args...)
+//    (временные строки и буферы перемещаются в объект);
+//  - отдельный XQBS_new на каждый объект против одного блока XQBS_Batch.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_mem.cpp
+// Запуск: ./a.out [количество объектов]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../xqbs_mem.h"
+
+using namespace XQBS;
+
+// Узел графа: имя и буфер данных
+struct XQBS_BenchNode
+{
+    std::string       m_Name;   // Имя узла
+    std::vector<char> m_Buffer; // Данные узла
+
+    XQBS_BenchNode(IN const std::string& name, IN const std::vector<char>& buffer) : m_Name(name), m_Buffer(buffer) {}
+    XQBS_BenchNode(IN std::string&& name, IN std::vector<char>&& buffer) : m_Name(std::move(name)), m_Buffer(std::move(buffer)) {}
+};
+
+// Небольшой узел для сравнения пакетного и поштучного выделения
+struct XQBS_BenchSmall
+{
+    XQBS_BenchSmall* m_pNext; // Следующий узел
+    int              m_Value; // Значение
+
+    XQBS_BenchSmall() : m_pNext(NULL), m_Value(0) {}
+};
+
+// Время выполнения f в миллисекундах
+template<typename F>
+static double XQBS_BenchTime(IN F f)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    std::vector<XQBS_BenchNode*> nodes(count);
+
+    printf("%-24s %12s\n", "case", "ms");
+
+    double ms = XQBS_BenchTime([&]()
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            std::string name(48, char('a' + i % 26));
+            std::vector<char> buffer(256, char(i));
+            nodes[i] = XQBS_new_ctor2<XQBS_BenchNode>(name, buffer);
+        }
+    });
+    printf("%-24s %12.1f\n", "ctor2 (copy)", ms);
+    for (size_t i = 0; i < count; ++i)
+        XQBS_delete(nodes[i]);
+
+    ms = XQBS_BenchTime([&]()
+    {
+        for (size_t i = 0; i < count; ++i)
+            nodes[i] = XQBS_new<XQBS_BenchNode>(std::string(48, char('a' + i % 26)), std::vector<char>(256, char(i)));
+    });
+    printf("%-24s %12.1f\n", "variadic (move)", ms);
+    for (size_t i = 0; i < count; ++i)
+        XQBS_delete(nodes[i]);
+
+    std::vector<XQBS_BenchSmall*> small(count);
+    ms = XQBS_BenchTime([&]()
+    {
+        for (size_t i = 0; i < count; ++i)
+            small[i] = XQBS_new<XQBS_BenchSmall>();
+        for (size_t i = 0; i + 1 < count; ++i)
+            small[i]->m_pNext = small[i + 1];
+        for (size_t i = 0; i < count; ++i)
+            XQBS_delete(small[i]);
+    });
+    printf("%-24s %12.1f\n", "per-object new/delete", ms);
+
+    ms = XQBS_BenchTime([&]()
+    {
+        XQBS_Batch<XQBS_BenchSmall> batch(count);
+        for (size_t i = 0; i + 1 < count; ++i)
+            batch[i].m_pNext = &batch[i + 1];
+    });
+    printf("%-24s %12.1f\n", "batch new/delete", ms);
+
+    return 0;
+}
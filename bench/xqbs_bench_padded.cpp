@@ -0,0 +1,84 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_padded.cpp
+*
+*/
+
+// Микробенчмарк ложного разделения строк кеша: каждый поток делает
+// AddRef/Release только своему объекту, но объекты лежат в памяти подряд.
+// Обычный счетчик XQBS_RefCountAtomic против XQBS_RefCountPadded.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_padded.cpp
+// Запуск: ./a.out [количество итераций на поток]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refbase.h"
+
+using namespace XQBS;
+
+// Тестовые объекты
+struct XQBS_BenchPlain : public XQBS_RefBaseT<XQBS_BenchPlain> { int m_Payload; };
+struct XQBS_BenchPadded : public XQBS_RefBaseT<XQBS_BenchPadded, XQBS_RefCountPadded<> > { int m_Payload; };
+
+// Скрыть значение указателя от оптимизатора
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// threads потоков, каждый делает iterations пар AddRef/Release своему объекту
+// из соседних объектов в одном блоке памяти. Возвращает миллионы пар в секунду.
+// Счетчики не обнуляются, поэтому объекты не удаляются сами, а блок просто освобождается
+template<typename T>
+static double XQBS_BenchRun(IN size_t threads, IN size_t iterations)
+{
+    T* objects = static_cast<T*>(::operator new(threads * sizeof(T), std::align_val_t(XQBS_CACHE_LINE)));
+    for (size_t i = 0; i < threads; ++i)
+        ::new (static_cast<void*>(objects + i)) T();
+    std::vector<std::thread> workers;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads; ++i)
+    {
+        T* ptr = &objects[i];
+        workers.emplace_back([ptr, iterations]()
+        {
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                XQBS_BenchOpaque(ptr)->AddRef();
+                XQBS_BenchOpaque(ptr)->Release();
+            }
+        });
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    ::operator delete(objects, std::align_val_t(XQBS_CACHE_LINE));
+
+    return double(threads * iterations) / elapsed.count() / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000000;
+    size_t threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+
+    printf("%-10s %8s %8s %14s\n", "counter", "bytes", "threads", "Mpairs/s");
+    printf("%-10s %8zu %8zu %14.2f\n", "atomic", sizeof(XQBS_BenchPlain), threads, XQBS_BenchRun<XQBS_BenchPlain>(threads, iterations));
+    printf("%-10s %8zu %8zu %14.2f\n", "padded", sizeof(XQBS_BenchPadded), threads, XQBS_BenchRun<XQBS_BenchPadded>(threads, iterations));
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_recycle.cpp
+*
+*/
+
+// Микробенчмарк создания и уничтожения объекта с внутренним буфером:
+// XQBS_new + Release (деструктор, освобождение памяти объекта и буфера)
+// против XQBS_new_recycled + Release (Reset и возврат в пул своего типа).
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_recycle.cpp
+// Запуск: ./a.out [количество итераций на поток]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refrecycle.h"
+
+using namespace XQBS;
+
+// Размер внутреннего буфера тестового объекта
+static const size_t XQBS_BENCH_BUFFER = 512;
+
+// Тестовый объект без повторного использования
+class XQBS_BenchContext : public XQBS_RefBaseT<XQBS_BenchContext>
+{
+public:
+    std::string m_Buffer;
+    XQBS_BenchContext() { m_Buffer.reserve(XQBS_BENCH_BUFFER); }
+};
+
+// Тестовый объект с повторным использованием, буфер переживает Reset
+class XQBS_BenchRecycled final : public XQBS_RefBaseRecycled<XQBS_BenchRecycled>
+{
+public:
+    std::string m_Buffer;
+    XQBS_BenchRecycled() { m_Buffer.reserve(XQBS_BENCH_BUFFER); }
+    void Reset(void) { m_Buffer.clear(); }
+};
+
+// Создание объекта вариантом T
+template<typename T> struct XQBS_BenchFactory { static T* Create(void) { return XQBS_new<T>(); } };
+template<> struct XQBS_BenchFactory<XQBS_BenchRecycled> { static XQBS_BenchRecycled* Create(void) { return XQBS_new_recycled<XQBS_BenchRecycled>(); } };
+
+// Выполнить iterations циклов создания, заполнения и Release в threads потоках,
+// возвращает количество циклов в секунду (в миллионах)
+template<typename T>
+static double XQBS_BenchRun(IN size_t threads, IN size_t iterations)
+{
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {}
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                T* p = XQBS_BenchFactory<T>::Create();
+                p->m_Buffer.append(64, 'x');
+                p->Release();
+            }
+        });
+    }
+
+    while (ready.load() != threads) {}
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return double(threads * iterations) / elapsed.count() / 1e6;
+}
+
+// Прогнать один вариант по всем количествам потоков
+template<typename T>
+static void XQBS_BenchCase(IN const char* name, IN const std::vector<size_t>& threads, IN size_t iterations)
+{
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        double mops = XQBS_BenchRun<T>(threads[i], threads[i] == 1 ? iterations : iterations / threads[i]);
+        printf("%-12s %8zu %14.2f\n", name, threads[i], mops);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+
+    std::vector<size_t> threads;
+    size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t t = 1; t < hw; t *= 2)
+        threads.push_back(t);
+    threads.push_back(hw);
+
+    printf("%-12s %8s %14s\n", "impl", "threads", "Mcycles/s");
+    XQBS_BenchCase<XQBS_BenchContext>("new/delete", threads, iterations);
+    XQBS_BenchCase<XQBS_BenchRecycled>("recycled", threads, iterations);
+
+    XQBS_RecycleStats stats = XQBS_BenchRecycled::PoolStats();
+    printf("pool: hits %llu, misses %llu, recycled %llu, dropped %llu\n",
+        (unsigned long long)stats.m_Hits, (unsigned long long)stats.m_Misses,
+        (unsigned long long)stats.m_Recycled, (unsigned long long)stats.m_Dropped);
+
+    return 0;
+}
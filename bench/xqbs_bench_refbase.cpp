@@ -0,0 +1,144 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_refbase.cpp
+*
+*/
+
+// Микробенчмарк AddRef/Release: прежняя реализация XQBS_RefBase (виртуальные
+// AddRef/Release и последовательно согласованные атомарные операции, как у
+// InterlockedIncrement/InterlockedDecrement) против невиртуальной XQBS_RefBaseT.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_refbase.cpp
+// Запуск: ./a.out [количество итераций на поток]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refbase.h"
+
+using namespace XQBS;
+
+///////////////////////////////////////////////////////////////////////////////
+// Прежняя реализация счетчика ссылок: виртуальные функции и seq_cst
+class XQBS_RefBaseLegacy
+{
+private:
+
+    // Счетчик ссылок
+    std::atomic<LONG> m_RefCount;
+
+protected:
+
+    // Деструктор
+    virtual ~XQBS_RefBaseLegacy() {}
+
+public:
+
+    // Конструктор
+    XQBS_RefBaseLegacy() : m_RefCount(1) {}
+
+    // Удалить объект если количество ссылок на него равно нулю
+    virtual LONG Release(void)
+    {
+        LONG RefCount = m_RefCount.fetch_sub(1) - 1;
+        if ( 0 == RefCount )
+            delete this;
+        return RefCount;
+    }
+
+    // Добавить ссылку на объект
+    virtual LONG AddRef(void)
+    {
+        LONG RefCount = m_RefCount.fetch_add(1) + 1;
+        if (0 >= RefCount)
+            throw std::runtime_error("Invalid refcount value");
+        return RefCount;
+    }
+};
+
+// Тестовые объекты
+struct XQBS_BenchLegacy : public XQBS_RefBaseLegacy { int m_Payload; };
+struct XQBS_BenchRefBase : public XQBS_RefBase { int m_Payload; };
+struct XQBS_BenchRefBaseT : public XQBS_RefBaseT<XQBS_BenchRefBaseT> { int m_Payload; };
+
+// Скрыть значение указателя от оптимизатора, чтобы вызовы не свернулись и не девиртуализировались
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// Выполнить iterations пар AddRef/Release над объектом ptr в threads потоках,
+// возвращает количество пар в секунду (в миллионах)
+template<typename T>
+static double XQBS_BenchRun(IN T* ptr, IN size_t threads, IN size_t iterations)
+{
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            T* p = XQBS_BenchOpaque(ptr);
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {}
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                XQBS_BenchOpaque(p)->AddRef();
+                XQBS_BenchOpaque(p)->Release();
+            }
+        });
+    }
+
+    while (ready.load() != threads) {}
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return double(threads * iterations) / elapsed.count() / 1e6;
+}
+
+// Прогнать один вариант реализации по всем количествам потоков
+template<typename T>
+static void XQBS_BenchCase(IN const char* name, IN const std::vector<size_t>& threads, IN size_t iterations)
+{
+    T* ptr = new T();
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        double mops = XQBS_BenchRun(ptr, threads[i], threads[i] == 1 ? iterations : iterations / threads[i]);
+        printf("%-12s %8zu %14.2f\n", name, threads[i], mops);
+    }
+    ptr->Release();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000000;
+
+    std::vector<size_t> threads;
+    size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t t = 1; t < hw; t *= 2)
+        threads.push_back(t);
+    threads.push_back(hw);
+
+    printf("%-12s %8s %14s\n", "impl", "threads", "Mpairs/s");
+    XQBS_BenchCase<XQBS_BenchLegacy>("legacy", threads, iterations);
+    XQBS_BenchCase<XQBS_BenchRefBase>("RefBase", threads, iterations);
+    XQBS_BenchCase<XQBS_BenchRefBaseT>("RefBaseT", threads, iterations);
+
+    return 0;
+}
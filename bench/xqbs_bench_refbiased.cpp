@@ -0,0 +1,207 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_refbiased.cpp
+*
+*/
+
+// Смещенный счетчик ссылок XQBS_RefCountBiased:
+//  1. скорость AddRef/Release в потоке-владельце против XQBS_RefCountAtomic;
+//  2. нагрузочная проверка с передачей объектов между потоками: потоки-создатели
+//     раздают ссылки потокам-обработчикам, те пересылают их друг другу и отпускают,
+//     создатели завершаются раньше обработчиков. В конце число созданных и
+//     уничтоженных объектов должно совпасть, иначе программа завершается с кодом 1.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_refbiased.cpp
+// Запуск: ./a.out [итераций] [объектов на создателя]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refbiased.h"
+
+using namespace XQBS;
+
+// Счетчики созданных и уничтоженных объектов
+static std::atomic<size_t> g_Created(0);
+static std::atomic<size_t> g_Destroyed(0);
+
+// Тестовые объекты
+struct XQBS_BenchAtomic : public XQBS_RefBaseT<XQBS_BenchAtomic> { int m_Payload; };
+struct XQBS_BenchBiased : public XQBS_RefBaseT<XQBS_BenchBiased, XQBS_RefCountBiased>
+{
+    std::atomic<size_t> m_Payload;
+
+    XQBS_BenchBiased() : m_Payload(0) { g_Created.fetch_add(1, std::memory_order_relaxed); }
+    ~XQBS_BenchBiased() { g_Destroyed.fetch_add(1, std::memory_order_relaxed); }
+};
+
+// Скрыть значение указателя от оптимизатора
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// Количество пар AddRef/Release в секунду (в миллионах) в одном потоке
+template<typename T>
+static double XQBS_BenchOwner(IN size_t iterations)
+{
+    T* p = new T();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < iterations; ++n)
+    {
+        XQBS_BenchOpaque(p)->AddRef();
+        XQBS_BenchOpaque(p)->Release();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    p->Release();
+    return double(iterations) / elapsed.count() / 1e6;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Почтовый ящик потока-обработчика, каждое сообщение - это одна переданная ссылка
+struct XQBS_BenchMailbox
+{
+    std::mutex                                            m_Lock;
+    std::condition_variable                               m_Wake;
+    std::deque<std::pair<XQBS_BenchBiased*, unsigned> >  m_Queue; // объект и число пересылок
+};
+
+static std::vector<XQBS_BenchMailbox> g_Mailbox(4);
+static std::atomic<size_t> g_InFlight(0);
+static std::atomic<bool> g_ProducersDone(false);
+
+// Передать ссылку на объект обработчику
+static void XQBS_BenchSend(IN size_t to, IN XQBS_BenchBiased* p, IN unsigned hops)
+{
+    g_InFlight.fetch_add(1);
+    std::lock_guard<std::mutex> lock(g_Mailbox[to].m_Lock);
+    g_Mailbox[to].m_Queue.push_back(std::make_pair(p, hops));
+    g_Mailbox[to].m_Wake.notify_one();
+}
+
+// Поток-создатель: создает объекты и раздает на них ссылки
+static void XQBS_BenchProducer(IN unsigned seed, IN size_t objects)
+{
+    std::mt19937 rnd(seed);
+    for (size_t i = 0; i < objects; ++i)
+    {
+        XQBS_BenchBiased* p = new XQBS_BenchBiased();
+
+        // Несколько ссылок для обработчиков, взятых на локальном счетчике
+        unsigned shares = rnd() % 3;
+        for (unsigned s = 0; s < shares; ++s)
+        {
+            p->AddRef();
+            XQBS_BenchSend(rnd() % g_Mailbox.size(), p, 0);
+        }
+
+        // Пару локальных AddRef/Release для порядка
+        p->AddRef();
+        p->Release();
+
+        // Свою ссылку либо отпускаем сами, либо отдаем другому потоку
+        if (rnd() % 2)
+            XQBS_BenchSend(rnd() % g_Mailbox.size(), p, 0);
+        else
+            p->Release();
+    }
+}
+
+// Поток-обработчик: использует, пересылает и отпускает полученные ссылки
+static void XQBS_BenchConsumer(IN size_t self, IN unsigned seed)
+{
+    std::mt19937 rnd(seed);
+    XQBS_BenchMailbox& box = g_Mailbox[self];
+
+    for (;;)
+    {
+        std::pair<XQBS_BenchBiased*, unsigned> msg;
+        {
+            std::unique_lock<std::mutex> lock(box.m_Lock);
+            while (box.m_Queue.empty())
+            {
+                if (g_ProducersDone.load() && 0 == g_InFlight.load())
+                    return;
+                box.m_Wake.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            msg = box.m_Queue.front();
+            box.m_Queue.pop_front();
+        }
+
+        XQBS_BenchBiased* p = msg.first;
+        for (unsigned n = rnd() % 4; n > 0; --n)
+        {
+            p->AddRef();
+            p->m_Payload.fetch_add(1, std::memory_order_relaxed);
+            p->Release();
+        }
+
+        // Иногда берем дополнительную ссылку и пересылаем ее дальше
+        if (msg.second < 3 && rnd() % 3 == 0)
+        {
+            p->AddRef();
+            XQBS_BenchSend(rnd() % g_Mailbox.size(), p, msg.second + 1);
+        }
+
+        // Свою ссылку либо пересылаем, либо отпускаем
+        if (msg.second < 3 && rnd() % 2)
+            XQBS_BenchSend(rnd() % g_Mailbox.size(), p, msg.second + 1);
+        else
+            p->Release();
+
+        g_InFlight.fetch_sub(1);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000000;
+    size_t objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+
+    printf("%-12s %14s\n", "policy", "Mpairs/s");
+    printf("%-12s %14.2f\n", "atomic", XQBS_BenchOwner<XQBS_BenchAtomic>(iterations));
+    printf("%-12s %14.2f\n", "biased", XQBS_BenchOwner<XQBS_BenchBiased>(iterations));
+
+    // Нагрузочная проверка передачи объектов между потоками
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t before = g_Created.load();
+
+    std::vector<std::thread> consumers, producers;
+    for (size_t i = 0; i < g_Mailbox.size(); ++i)
+        consumers.emplace_back(XQBS_BenchConsumer, i, unsigned(100 + i));
+    for (unsigned i = 0; i < 4; ++i)
+        producers.emplace_back(XQBS_BenchProducer, i + 1, objects);
+
+    for (size_t i = 0; i < producers.size(); ++i)
+        producers[i].join();
+    g_ProducersDone.store(true);
+    for (size_t i = 0; i < consumers.size(); ++i)
+        consumers[i].join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    size_t created = g_Created.load(), destroyed = g_Destroyed.load();
+    printf("handoff: %zu objects in %.2f s, created %zu destroyed %zu\n",
+           created - before, elapsed.count(), created, destroyed);
+
+    if (created != destroyed)
+    {
+        printf("FAILED: %zu objects leaked\n", created - destroyed);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_refshm.cpp
+*
+*/
+
+// Микробенчмарк общего набора данных для нескольких рабочих процессов:
+// каждый процесс строит свою копию (как сейчас) против одного набора в
+// сегменте разделяемой памяти, который процессы находят через Lookup.
+// Выводится время до завершения всех процессов и частная (не разделяемая)
+// память самого большого процесса.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_refshm.cpp
+// Запуск: ./a.out [количество процессов] [размер набора в МБ]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+#include <chrono>
+#include <vector>
+
+#include "../xqbs_refshm.h"
+
+using namespace XQBS;
+
+#ifndef _WIN32
+
+// Имя сегмента бенчмарка
+static const char* XQBS_BENCH_SHM = "/xqbs_bench_refshm";
+
+// Набор данных в разделяемой памяти
+struct XQBS_BenchDataset : public XQBS_RefBaseShm<XQBS_BenchDataset>
+{
+    size_t                   m_Count; // Количество значений
+    XQBS_OffsetPtr<uint64_t> m_pData; // Значения
+
+    explicit XQBS_BenchDataset(IN size_t count) : m_Count(count) {}
+};
+
+// Заполнить набор значений
+static void XQBS_BenchFill(OUT uint64_t* pData, IN size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        pData[i] = i * 2654435761u;
+}
+
+// Сумма значений (обход, чтобы страницы действительно использовались)
+static uint64_t XQBS_BenchSum(IN const uint64_t* pData, IN size_t count)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i)
+        sum += pData[i];
+    return sum;
+}
+
+// Частная анонимная память текущего процесса (RssAnon), КБ
+static uint64_t XQBS_BenchPrivateKb(void)
+{
+    char line[256];
+    uint64_t kb = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+    while (f && fgets(line, sizeof(line), f))
+    {
+        if (0 == strncmp(line, "RssAnon:", 8))
+            kb = strtoull(line + 8, NULL, 10);
+    }
+    if (f)
+        fclose(f);
+    return kb;
+}
+
+// Рабочий процесс со своей копией набора, в kb - его частная память
+static int XQBS_BenchWorkerCopy(IN size_t count, OUT uint64_t& kb)
+{
+    std::vector<uint64_t> data(count);
+    XQBS_BenchFill(data.data(), count);
+    uint64_t sum = XQBS_BenchSum(data.data(), count);
+    kb = XQBS_BenchPrivateKb();
+    return sum ? 0 : 1;
+}
+
+// Рабочий процесс с общим набором, в kb - его частная память
+static int XQBS_BenchWorkerShared(IN size_t count, OUT uint64_t& kb)
+{
+    XQBS_ShmSegment segment;
+    if (!segment.Open(XQBS_BENCH_SHM))
+        return 1;
+    XQBS_RefPtr<XQBS_BenchDataset> p = segment.Lookup<XQBS_BenchDataset>("dataset");
+    if (!p || p->m_Count != count)
+        return 1;
+    uint64_t sum = XQBS_BenchSum(p->m_pData.Get(), count);
+    kb = XQBS_BenchPrivateKb();
+    return sum ? 0 : 1;
+}
+
+// Запустить processes рабочих процессов. Возвращает время до завершения
+// всех в мс, в maxPrivate - частную память самого большого процесса в МБ
+static double XQBS_BenchRun(IN size_t processes, IN size_t count, IN int (*pfnWorker)(size_t, uint64_t&), OUT double& maxPrivate)
+{
+    int fds[2];
+    if (0 != ::pipe(fds))
+    {
+        perror("pipe");
+        exit(1);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < processes; ++i)
+    {
+        pid_t pid = ::fork();
+        if (0 == pid)
+        {
+            uint64_t kb = 0;
+            int rc = pfnWorker(count, kb);
+            if (::write(fds[1], &kb, sizeof(kb)) != ssize_t(sizeof(kb)))
+                rc = 1;
+            _exit(rc);
+        }
+        if (pid < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < processes; ++i)
+    {
+        int status = 0;
+        ::wait(&status);
+        if (!WIFEXITED(status) || 0 != WEXITSTATUS(status))
+            printf("worker failed\n");
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    ::close(fds[1]);
+    uint64_t kb = 0, maxKb = 0;
+    while (::read(fds[0], &kb, sizeof(kb)) == ssize_t(sizeof(kb)))
+        maxKb = kb > maxKb ? kb : maxKb;
+    ::close(fds[0]);
+
+    maxPrivate = double(maxKb) / 1024.0;
+    return elapsed.count() * 1e3;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t processes = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+    size_t megabytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+    size_t count = megabytes * 1024 * 1024 / sizeof(uint64_t);
+
+    printf("%-10s %12s %14s\n", "dataset", "ms", "private MB");
+
+    double mb = 0;
+    double ms = XQBS_BenchRun(processes, count, &XQBS_BenchWorkerCopy, mb);
+    printf("%-10s %12.1f %14.1f\n", "copy", ms, mb);
+
+    XQBS_ShmSegment::Unlink(XQBS_BENCH_SHM);
+    XQBS_ShmSegment segment;
+    if (!segment.Create(XQBS_BENCH_SHM, count * sizeof(uint64_t) + (1 << 20)))
+    {
+        perror("shm");
+        return 1;
+    }
+    XQBS_BenchDataset* p = segment.New<XQBS_BenchDataset>(count);
+    p->m_pData = segment.NewArray<uint64_t>(count, p);
+    XQBS_BenchFill(p->m_pData.Get(), count);
+    segment.Publish("dataset", p);
+    p->Release();
+
+    ms = XQBS_BenchRun(processes, count, &XQBS_BenchWorkerShared, mb);
+    printf("%-10s %12.1f %14.1f\n", "shared", ms, mb);
+
+    segment.Unpublish<XQBS_BenchDataset>("dataset");
+    segment.Close();
+    XQBS_ShmSegment::Unlink(XQBS_BENCH_SHM);
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("XQBS_ShmSegment is not available on this platform\n");
+    return 0;
+}
+
+#endif
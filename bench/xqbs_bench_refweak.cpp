@@ -0,0 +1,132 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_refweak.cpp
+*
+*/
+
+// Микробенчмарк слабых ссылок XQBS_WeakPtr:
+//  - цена Lock() живого объекта против копирования сильной ссылки XQBS_RefPtr;
+//  - гонка Lock() в нескольких потоках с Release последней сильной ссылки:
+//    Lock() не должен вернуть объект после начала деструктора, деструктор
+//    вызывается ровно один раз, память освобождает последняя слабая ссылка.
+// Нарушения выводятся отдельной строкой.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_refweak.cpp
+// Запуск: ./a.out [количество итераций] [количество гонок]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refweak.h"
+
+using namespace XQBS;
+
+// Признак живого объекта
+static const uint32_t XQBS_BENCH_ALIVE = 0xA11FE;
+
+static std::atomic<long> g_Created(0);
+static std::atomic<long> g_Destroyed(0);
+
+// Тестовый объект иерархии со слабыми ссылками
+struct XQBS_BenchNode : public XQBS_WeakRefBase
+{
+    uint32_t m_State; // XQBS_BENCH_ALIVE, пока не начался деструктор
+
+    XQBS_BenchNode() : m_State(XQBS_BENCH_ALIVE) { g_Created.fetch_add(1, std::memory_order_relaxed); }
+    ~XQBS_BenchNode()
+    {
+        m_State = 0;
+        g_Destroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Время одной операции f, нс
+template<typename F>
+static double XQBS_BenchTime(IN size_t iterations, IN F f)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / double(iterations);
+}
+
+// rounds гонок: threads потоков вызывают Lock(), пока основной поток отпускает
+// свою сильную ссылку. После этого потоки больше не берут новых ссылок, и
+// последним Release становится Release одного из них. Возвращает количество нарушений
+static long XQBS_BenchRace(IN size_t rounds, IN size_t threads, OUT long& locked)
+{
+    std::atomic<long> errors(0), total(0);
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        XQBS_BenchNode* p = XQBS_new<XQBS_BenchNode>();
+        XQBS_WeakPtr<XQBS_BenchNode> weak(p);
+        std::atomic<size_t> ready(0);
+        std::atomic<bool> released(false);
+        std::vector<std::thread> workers;
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([&, weak]()
+            {
+                ready.fetch_add(1);
+                long n = 0;
+                while (!released.load(std::memory_order_relaxed))
+                {
+                    XQBS_RefPtr<XQBS_BenchNode> strong = weak.Lock();
+                    if (!strong)
+                        break;
+                    if (strong->m_State != XQBS_BENCH_ALIVE)
+                        errors.fetch_add(1);
+                    ++n;
+                }
+                total.fetch_add(n);
+            });
+        }
+
+        while (ready.load() != threads)
+            std::this_thread::yield();
+        p->Release();
+        released.store(true, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        if (!weak.Expired() || weak.Lock())
+            errors.fetch_add(1);
+    }
+    locked = total.load();
+    return errors.load();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+
+    XQBS_RefPtr<XQBS_BenchNode> strong(XQBS_new<XQBS_BenchNode>(), XQBS_AdoptRef());
+    XQBS_WeakPtr<XQBS_BenchNode> weak(strong);
+    long sum = 0;
+
+    printf("%-14s %12s\n", "operation", "ns");
+    printf("%-14s %12.2f\n", "RefPtr copy", XQBS_BenchTime(iterations, [&]() { XQBS_RefPtr<XQBS_BenchNode> p(strong); sum += p->m_State; }));
+    printf("%-14s %12.2f\n", "WeakPtr Lock", XQBS_BenchTime(iterations, [&]() { XQBS_RefPtr<XQBS_BenchNode> p = weak.Lock(); sum += p->m_State; }));
+    strong.Reset();
+    printf("%-14s %12.2f\n", "expired Lock", XQBS_BenchTime(iterations, [&]() { sum += weak.Lock() ? 1 : 0; }));
+    weak.Reset();
+
+    long locked = 0;
+    long errors = XQBS_BenchRace(rounds, 2, locked);
+    printf("race: %zu rounds, %ld locks, created %ld destroyed %ld\n", rounds, locked, g_Created.load(), g_Destroyed.load());
+    if (errors || g_Created.load() != g_Destroyed.load())
+        printf("race: %ld errors\n", errors);
+
+    return sum ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_sharded.cpp
+*
+*/
+
+// Микробенчмарк масштабирования AddRef/Release одного общего объекта,
+// который используют все потоки сразу: XQBS_RefCountAtomic против
+// XQBS_RefCountSharded при количестве потоков от 1 до N.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_sharded.cpp
+// Запуск: ./a.out [количество итераций на поток] [максимум потоков]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refsharded.h"
+
+using namespace XQBS;
+
+// Тестовые объекты
+struct XQBS_BenchAtomic : public XQBS_RefBaseT<XQBS_BenchAtomic> { int m_Payload; };
+struct XQBS_BenchSharded : public XQBS_RefBaseT<XQBS_BenchSharded, XQBS_RefCountSharded<> > { int m_Payload; };
+
+// Скрыть значение указателя от оптимизатора
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// threads потоков, каждый делает iterations пар AddRef/Release одному общему объекту.
+// Возвращает миллионы пар в секунду. Объект удаляется через Kill в конце
+template<typename T>
+static double XQBS_BenchRun(IN size_t threads, IN size_t iterations)
+{
+    T* pObject = XQBS_new<T>();
+    std::atomic<size_t> ready(0);
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([pObject, iterations, threads, &ready]()
+        {
+            // Потоки стартуют одновременно, чтобы мерить именно конкуренцию
+            ready.fetch_add(1);
+            while (ready.load() != threads)
+                ;
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                XQBS_BenchOpaque(pObject)->AddRef();
+                XQBS_BenchOpaque(pObject)->Release();
+            }
+        });
+    }
+
+    while (ready.load() != threads)
+        std::this_thread::yield();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    pObject->Kill();
+    return double(threads * iterations) / elapsed.count() / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    size_t maxThreads = argc > 2 ? strtoul(argv[2], NULL, 10) : std::max(1u, std::thread::hardware_concurrency());
+
+    printf("%8s %14s %14s\n", "threads", "atomic Mp/s", "sharded Mp/s");
+    for (size_t threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+    {
+        double atomic = XQBS_BenchRun<XQBS_BenchAtomic>(threads, iterations);
+        double sharded = XQBS_BenchRun<XQBS_BenchSharded>(threads, iterations);
+        printf("%8zu %14.2f %14.2f\n", threads, atomic, sharded);
+    }
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_slotmap.cpp
+*
+*/
+
+// Микробенчмарк графа объектов: перемешанные указатели на объекты
+// XQBS_RefBase, созданные через XQBS_new, против объектов подряд в
+// XQBS_SlotMap с 32-битными описателями. Измеряются полный обход (сумма
+// поля по всем объектам) и доступ по ссылке в случайном порядке: по
+// указателю и по описателю через Get.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_slotmap.cpp
+// Запуск: ./a.out [количество объектов]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "../xqbs_refbase.h"
+#include "../xqbs_slotmap.h"
+
+using namespace XQBS;
+
+// Тестовые объекты
+struct XQBS_BenchRef : public XQBS_RefBase { int64_t m_Value[3]; };
+struct XQBS_BenchSlot { int64_t m_Value[3]; };
+
+// Время одного прохода f, нс на объект
+template<typename F>
+static double XQBS_BenchTime(IN size_t count, IN F f, OUT int64_t& sum)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    sum = f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / double(count);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    std::mt19937 rng(42);
+
+    // Указатели на объекты в куче, перемешаны как в долгоживущем графе
+    std::vector<XQBS_BenchRef*> refs(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        refs[i] = XQBS_new<XQBS_BenchRef>();
+        refs[i]->m_Value[0] = int64_t(i);
+    }
+    std::shuffle(refs.begin(), refs.end(), rng);
+
+    // Те же объекты в таблице, описатели в том же перемешанном порядке
+    XQBS_SlotMap<XQBS_BenchSlot> map;
+    map.Reserve(count);
+    std::vector<XQBS_SlotHandle> handles(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        XQBS_BenchSlot s = { { int64_t(i), 0, 0 } };
+        handles[i] = map.Insert(s);
+    }
+    std::shuffle(handles.begin(), handles.end(), rng);
+
+    // Случайный порядок обращений по ссылкам
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = uint32_t(i);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    int64_t a = 0, b = 0;
+    printf("%-10s %12s %12s\n", "access", "pointer ns", "slotmap ns");
+
+    double pointer = XQBS_BenchTime(count, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < refs.size(); ++i)
+            sum += refs[i]->m_Value[0];
+        return sum;
+    }, a);
+    double slot = XQBS_BenchTime(count, [&]() {
+        int64_t sum = 0;
+        for (const XQBS_BenchSlot& s : map)
+            sum += s.m_Value[0];
+        return sum;
+    }, b);
+    printf("%-10s %12.2f %12.2f%s\n", "scan", pointer, slot, a == b ? "" : " (mismatch)");
+
+    pointer = XQBS_BenchTime(count, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < order.size(); ++i)
+            sum += refs[order[i]]->m_Value[0];
+        return sum;
+    }, a);
+    slot = XQBS_BenchTime(count, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < order.size(); ++i)
+            sum += map.Get(handles[order[i]])->m_Value[0];
+        return sum;
+    }, b);
+    printf("%-10s %12.2f %12.2f%s\n", "lookup", pointer, slot, a == b ? "" : " (mismatch)");
+
+    printf("%-10s %12zu %12zu\n", "bytes/ref", sizeof(XQBS_BenchRef*), sizeof(XQBS_SlotHandle));
+
+    XQBS_destroy_range(refs);
+    return 0;
+}
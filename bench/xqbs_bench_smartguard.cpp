@@ -0,0 +1,124 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_smartguard.cpp
+*
+*/
+
+// Микробенчмарк создания и уничтожения SmartGuard-а: прежняя реализация
+// (ссылка на указатель, теневая копия, указатель на функцию, значение сброса
+// и виртуальный деструктор) против XQBS_SmartGuard с функцией очистки,
+// известной при компиляции, XQBS_SmartGuardRef, который следит за переменной,
+// и XQBS_SmartGuardLink, на котором построены XQBS_SmartFree, XQBS_SmartDelete и т.п.
+//
+// Сборка: g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_smartguard.cpp
+// Запуск: ./a.out [количество итераций]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../xqbs_smartguard.h"
+
+using namespace XQBS;
+
+// Количество вызовов функции очистки, чтобы оптимизатор не выбросил работу
+static size_t g_Cleanups = 0;
+
+// Функция очистки
+static void XQBS_BenchCleanup(IN void* ptr) { if (ptr) ++g_Cleanups; }
+
+///////////////////////////////////////////////////////////////////////////////
+// Прежняя реализация SmartGuard-а
+template<typename P, typename F>
+class XQBS_SmartGuardLegacy
+{
+public:
+
+    XQBS_SmartGuardLegacy(IN P p, IN F f) : m_p(m_d), m_f(f), m_v(NULL), m_d(p) {}
+    virtual ~XQBS_SmartGuardLegacy() { Reset(); }
+
+    void Reset(void)
+    {
+        if (m_f && m_p != m_v)
+        {
+            m_f(m_p);
+            m_p = m_v;
+        }
+    }
+
+protected:
+
+    P&   m_p; // Ссылка на указатель для обратной связи
+    F    m_f; // Указатель на функцию
+    P    m_v; // Значение для инициализации
+    P    m_d; // Теневая копия указателя
+};
+
+// Скрыть значение указателя от оптимизатора
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// Скрыть значение указателя на функцию от оптимизатора, как это бывает,
+// когда SmartGuard создается в одной единице трансляции, а разрушается в другой
+template<typename F> static inline F XQBS_BenchOpaqueFn(F f)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(f));
+#endif
+    return f;
+}
+
+// Время выполнения f в наносекундах на итерацию
+template<typename F>
+static double XQBS_BenchTime(IN size_t iterations, IN F f)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < iterations; ++n)
+        f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / double(iterations);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000000;
+    static int s_Object;
+
+    printf("%-14s %8s %12s\n", "guard", "bytes", "ns/guard");
+
+    double ns = XQBS_BenchTime(iterations, [&]()
+    {
+        XQBS_SmartGuardLegacy<void*, void(*)(void*)> g(XQBS_BenchOpaque(&s_Object), XQBS_BenchOpaqueFn(&XQBS_BenchCleanup));
+    });
+    printf("%-14s %8zu %12.2f\n", "legacy", sizeof(XQBS_SmartGuardLegacy<void*, void(*)(void*)>), ns);
+
+    ns = XQBS_BenchTime(iterations, [&]()
+    {
+        XQBS_SmartGuard<void*, XQBS_GuardFn<&XQBS_BenchCleanup> > g(XQBS_BenchOpaque(&s_Object));
+    });
+    printf("%-14s %8zu %12.2f\n", "SmartGuard", sizeof(XQBS_SmartGuard<void*, XQBS_GuardFn<&XQBS_BenchCleanup> >), ns);
+
+    ns = XQBS_BenchTime(iterations, [&]()
+    {
+        void* p = XQBS_BenchOpaque(&s_Object);
+        XQBS_SmartGuardRef<void*, XQBS_GuardFn<&XQBS_BenchCleanup> > g(p);
+    });
+    printf("%-14s %8zu %12.2f\n", "SmartGuardRef", sizeof(XQBS_SmartGuardRef<void*, XQBS_GuardFn<&XQBS_BenchCleanup> >), ns);
+
+    ns = XQBS_BenchTime(iterations, [&]()
+    {
+        XQBS_SmartGuardLink<void*, XQBS_GuardFn<&XQBS_BenchCleanup> > g(XQBS_BenchOpaque(&s_Object));
+    });
+    printf("%-14s %8zu %12.2f\n", "SmartGuardLink", sizeof(XQBS_SmartGuardLink<void*, XQBS_GuardFn<&XQBS_BenchCleanup> >), ns);
+
+    return g_Cleanups == 4 * iterations ? 0 : 1;
+}
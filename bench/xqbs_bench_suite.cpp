@@ -0,0 +1,478 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_bench_suite.cpp
+*
+*/
+
+// Сводный бенчмарк общих заголовков xqbs с машиночитаемым результатом
+// для отслеживания регрессий между выпусками:
+//  - refcount: AddRef/Release без конкуренции и одного общего объекта
+//    из 1..N потоков (политики счетчика против std::shared_ptr);
+//  - guard:    создание и уничтожение XQBS_SmartGuard против обычного
+//    указателя и std::unique_ptr;
+//  - alloc:    XQBS_new/XQBS_delete против malloc/free, new/delete
+//    и std::make_unique.
+// Для каждого замера берется лучший из нескольких повторов.
+//
+// Сборка: cmake -S .. -B build && cmake --build build --target xqbs_bench_suite
+//     или g++ -O2 -std=c++17 -pthread -I.. xqbs_bench_suite.cpp
+// Запуск: ./xqbs_bench_suite [--iterations=N] [--threads=N] [--repeat=N]
+//                            [--filter=строка] [--json=файл] [--csv=файл]
+// Таблица печатается на stdout, если ни JSON, ни CSV не выводятся в "-" (stdout)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_mem.h"
+#include "../xqbs_refbase.h"
+#include "../xqbs_refbiased.h"
+#include "../xqbs_refsharded.h"
+#include "../xqbs_smartguard.h"
+
+using namespace XQBS;
+
+#define XQBS_STR2(x) #x
+#define XQBS_STR(x) XQBS_STR2(x)
+
+// Результат одного замера
+struct XQBS_BenchResult
+{
+    std::string m_Group;      // Группа: refcount, guard, alloc
+    std::string m_Name;       // Название замера
+    size_t      m_Threads;    // Количество потоков
+    size_t      m_Iterations; // Операций на поток
+    double      m_NsPerOp;    // Время одной операции в потоке, нс
+    double      m_Mops;       // Суммарная пропускная способность, миллионов операций в секунду
+};
+
+// Параметры запуска
+struct XQBS_BenchOptions
+{
+    size_t      m_Iterations; // Операций на поток
+    size_t      m_Threads;    // Максимум потоков для замеров с конкуренцией
+    size_t      m_Repeat;     // Количество повторов каждого замера
+    std::string m_Filter;     // Выполнять только замеры, в имени которых есть эта строка
+    std::string m_Json;       // Файл для JSON, "-" - stdout
+    std::string m_Csv;        // Файл для CSV, "-" - stdout
+};
+
+static XQBS_BenchOptions g_Options;
+static std::vector<XQBS_BenchResult> g_Results;
+
+// Количество вызовов функции очистки, чтобы оптимизатор не выбросил работу
+static size_t g_Cleanups = 0;
+
+// Функция очистки для замеров guard
+static void XQBS_BenchCleanup(IN int* ptr) { if (ptr) ++g_Cleanups; }
+
+// Скрыть значение указателя от оптимизатора
+template<typename T> static inline T* XQBS_BenchOpaque(T* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : "+r"(ptr));
+#endif
+    return ptr;
+}
+
+// Время выполнения f() в threads потоках, запущенных одновременно, в секундах.
+// f получает номер потока и выполняет все итерации сама
+template<typename F>
+static double XQBS_BenchWall(IN size_t threads, IN F f)
+{
+    if (1 == threads)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f(size_t(0));
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&f, &ready, &go, i]()
+        {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire))
+                ;
+            f(i);
+        });
+    }
+
+    while (ready.load() != threads)
+        std::this_thread::yield();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Выполнить замер group/name: лучший из m_Repeat повторов.
+// f(номер потока) выполняет iterations операций
+template<typename F>
+static void XQBS_BenchCase(IN const char* group, IN const char* name, IN size_t threads, IN F f)
+{
+    std::string full = std::string(group) + "/" + name;
+    if (!g_Options.m_Filter.empty() && std::string::npos == full.find(g_Options.m_Filter))
+        return;
+
+    double best = 0;
+    for (size_t r = 0; r < std::max<size_t>(1, g_Options.m_Repeat); ++r)
+    {
+        double wall = XQBS_BenchWall(threads, f);
+        if (0 == r || wall < best)
+            best = wall;
+    }
+
+    XQBS_BenchResult result;
+    result.m_Group = group;
+    result.m_Name = name;
+    result.m_Threads = threads;
+    result.m_Iterations = g_Options.m_Iterations;
+    result.m_NsPerOp = best * 1e9 / double(g_Options.m_Iterations);
+    result.m_Mops = double(threads * g_Options.m_Iterations) / best / 1e6;
+    g_Results.push_back(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// refcount
+
+struct XQBS_BenchAtomic : public XQBS_RefBaseT<XQBS_BenchAtomic> { int m_Payload; };
+struct XQBS_BenchVirtual : public XQBS_RefBase { int m_Payload; };
+struct XQBS_BenchBiased : public XQBS_RefBaseT<XQBS_BenchBiased, XQBS_RefCountBiased> { int m_Payload; };
+struct XQBS_BenchSharded : public XQBS_RefBaseT<XQBS_BenchSharded, XQBS_RefCountSharded<> > { int m_Payload; };
+
+// AddRef/Release одного объекта типа T из threads потоков
+template<typename T>
+static void XQBS_BenchRefCount(IN const char* name, IN size_t threads)
+{
+    T* pObject = XQBS_new<T>();
+    size_t iterations = g_Options.m_Iterations;
+    XQBS_BenchCase("refcount", name, threads, [pObject, iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+        {
+            XQBS_BenchOpaque(pObject)->AddRef();
+            XQBS_BenchOpaque(pObject)->Release();
+        }
+    });
+    pObject->Kill();
+}
+
+// Копирование и уничтожение std::shared_ptr одного объекта из threads потоков
+static void XQBS_BenchSharedPtr(IN const char* name, IN size_t threads)
+{
+    std::shared_ptr<int> pObject = std::make_shared<int>(0);
+    size_t iterations = g_Options.m_Iterations;
+    XQBS_BenchCase("refcount", name, threads, [&pObject, iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+        {
+            std::shared_ptr<int> pCopy(*XQBS_BenchOpaque(&pObject));
+            XQBS_BenchOpaque(&pCopy);
+        }
+    });
+}
+
+static void XQBS_BenchRefCountAll(void)
+{
+    // Без конкуренции
+    XQBS_BenchRefCount<XQBS_BenchAtomic>("uncontended/XQBS_RefCountAtomic", 1);
+    XQBS_BenchRefCount<XQBS_BenchVirtual>("uncontended/XQBS_RefBase", 1);
+    XQBS_BenchRefCount<XQBS_BenchBiased>("uncontended/XQBS_RefCountBiased", 1);
+    XQBS_BenchRefCount<XQBS_BenchSharded>("uncontended/XQBS_RefCountSharded", 1);
+    XQBS_BenchSharedPtr("uncontended/std::shared_ptr", 1);
+
+    // Один общий объект из 2..N потоков
+    for (size_t threads = 2; threads <= g_Options.m_Threads; threads = threads < g_Options.m_Threads && threads * 2 > g_Options.m_Threads ? g_Options.m_Threads : threads * 2)
+    {
+        XQBS_BenchRefCount<XQBS_BenchAtomic>("contended/XQBS_RefCountAtomic", threads);
+        XQBS_BenchRefCount<XQBS_BenchBiased>("contended/XQBS_RefCountBiased", threads);
+        XQBS_BenchRefCount<XQBS_BenchSharded>("contended/XQBS_RefCountSharded", threads);
+        XQBS_BenchSharedPtr("contended/std::shared_ptr", threads);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// guard
+
+// Функция очистки для std::unique_ptr
+struct XQBS_BenchDeleter
+{
+    void operator() (IN int* ptr) const { XQBS_BenchCleanup(ptr); }
+};
+
+// Объект для замеров guard и alloc
+struct XQBS_BenchObject
+{
+    int    m_Value;
+    double m_Data[5];
+
+    XQBS_BenchObject() : m_Value(1) { m_Data[0] = 0; }
+};
+
+static void XQBS_BenchGuardAll(void)
+{
+    static int s_Object;
+    size_t iterations = g_Options.m_Iterations;
+
+    // Только стоимость самого guard-а: функция очистки ничего не освобождает
+    XQBS_BenchCase("guard", "cleanup/raw", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            XQBS_BenchCleanup(XQBS_BenchOpaque(&s_Object));
+    });
+    XQBS_BenchCase("guard", "cleanup/std::unique_ptr", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            std::unique_ptr<int, XQBS_BenchDeleter> p(XQBS_BenchOpaque(&s_Object));
+    });
+    XQBS_BenchCase("guard", "cleanup/XQBS_SmartGuard", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            XQBS_SmartGuard<int*, XQBS_GuardFn<&XQBS_BenchCleanup> > g(XQBS_BenchOpaque(&s_Object));
+    });
+
+    // Владение объектом в куче
+    XQBS_BenchCase("guard", "owning/raw new+delete", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            delete XQBS_BenchOpaque(new XQBS_BenchObject());
+    });
+    XQBS_BenchCase("guard", "owning/std::unique_ptr", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            std::unique_ptr<XQBS_BenchObject> p(XQBS_BenchOpaque(new XQBS_BenchObject()));
+    });
+    XQBS_BenchCase("guard", "owning/XQBS_SmartDelete", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            XQBS_SmartDelete<XQBS_BenchObject*> g(XQBS_BenchOpaque(XQBS_new<XQBS_BenchObject>()));
+    });
+    XQBS_BenchCase("guard", "owning/XQBS_SmartFree", 1, [iterations](size_t)
+    {
+        for (size_t n = 0; n < iterations; ++n)
+            XQBS_SmartFree<void*> g(XQBS_BenchOpaque(malloc(sizeof(XQBS_BenchObject))));
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// alloc
+
+// Создание и удаление объекта в каждом из threads потоков
+static void XQBS_BenchAllocAll(void)
+{
+    size_t iterations = g_Options.m_Iterations;
+
+    for (size_t threads = 1; threads <= g_Options.m_Threads; threads = threads < g_Options.m_Threads && threads * 2 > g_Options.m_Threads ? g_Options.m_Threads : threads * 2)
+    {
+        XQBS_BenchCase("alloc", "object/malloc+free", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+                free(XQBS_BenchOpaque(malloc(sizeof(XQBS_BenchObject))));
+        });
+        XQBS_BenchCase("alloc", "object/new+delete", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+                delete XQBS_BenchOpaque(new XQBS_BenchObject());
+        });
+        XQBS_BenchCase("alloc", "object/std::make_unique", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                std::unique_ptr<XQBS_BenchObject> p = std::make_unique<XQBS_BenchObject>();
+                XQBS_BenchOpaque(p.get());
+            }
+        });
+        XQBS_BenchCase("alloc", "object/XQBS_new+XQBS_delete", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                XQBS_BenchObject* p = XQBS_BenchOpaque(XQBS_new<XQBS_BenchObject>());
+                XQBS_delete(p);
+            }
+        });
+
+        XQBS_BenchCase("alloc", "array256/malloc+free", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+                free(XQBS_BenchOpaque(malloc(256)));
+        });
+        XQBS_BenchCase("alloc", "array256/std::make_unique", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                std::unique_ptr<char[]> p = std::make_unique<char[]>(256);
+                XQBS_BenchOpaque(p.get());
+            }
+        });
+        XQBS_BenchCase("alloc", "array256/XQBS_new+XQBS_delete_size", threads, [iterations](size_t)
+        {
+            for (size_t n = 0; n < iterations; ++n)
+            {
+                char* p = XQBS_BenchOpaque(XQBS_new<char>(256));
+                XQBS_delete_size(p);
+            }
+        });
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Вывод результатов
+
+// Открыть файл для вывода, "-" - stdout
+static FILE* XQBS_BenchOpen(IN const std::string& path)
+{
+    if ("-" == path)
+        return stdout;
+
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+        fprintf(stderr, "xqbs_bench_suite: cannot open %s\n", path.c_str());
+    return f;
+}
+
+// Закрыть файл вывода
+static void XQBS_BenchClose(IN FILE* f)
+{
+    if (f != stdout)
+        fclose(f);
+}
+
+// Строка JSON: в именах замеров нет символов, требующих экранирования
+static void XQBS_BenchWriteJson(IN FILE* f)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"suite\": \"xqbs_bench_suite\",\n");
+#ifdef __VERSION__
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+#ifdef NDEBUG
+    fprintf(f, "  \"optimized\": true,\n");
+#else
+    fprintf(f, "  \"optimized\": false,\n");
+#endif
+    fprintf(f, "  \"mem_backend\": \"%s\",\n", XQBS_STR(XQBS_MEM_BACKEND));
+    fprintf(f, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(f, "  \"iterations\": %zu,\n", g_Options.m_Iterations);
+    fprintf(f, "  \"repeat\": %zu,\n", g_Options.m_Repeat);
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < g_Results.size(); ++i)
+    {
+        const XQBS_BenchResult& r = g_Results[i];
+        fprintf(f, "    {\"group\": \"%s\", \"name\": \"%s\", \"threads\": %zu, \"iterations\": %zu, \"ns_per_op\": %.3f, \"mops\": %.3f}%s\n",
+                r.m_Group.c_str(), r.m_Name.c_str(), r.m_Threads, r.m_Iterations, r.m_NsPerOp, r.m_Mops,
+                i + 1 < g_Results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+// CSV с заголовком, имена замеров не содержат запятых
+static void XQBS_BenchWriteCsv(IN FILE* f)
+{
+    fprintf(f, "group,name,threads,iterations,ns_per_op,mops\n");
+    for (size_t i = 0; i < g_Results.size(); ++i)
+    {
+        const XQBS_BenchResult& r = g_Results[i];
+        fprintf(f, "%s,%s,%zu,%zu,%.3f,%.3f\n",
+                r.m_Group.c_str(), r.m_Name.c_str(), r.m_Threads, r.m_Iterations, r.m_NsPerOp, r.m_Mops);
+    }
+}
+
+// Таблица для человека
+static void XQBS_BenchWriteText(IN FILE* f)
+{
+    fprintf(f, "%-10s %-40s %8s %12s %12s\n", "group", "name", "threads", "ns/op", "Mops/s");
+    for (size_t i = 0; i < g_Results.size(); ++i)
+    {
+        const XQBS_BenchResult& r = g_Results[i];
+        fprintf(f, "%-10s %-40s %8zu %12.2f %12.2f\n", r.m_Group.c_str(), r.m_Name.c_str(), r.m_Threads, r.m_NsPerOp, r.m_Mops);
+    }
+}
+
+// Значение параметра вида --name=value
+static const char* XQBS_BenchArg(IN const char* arg, IN const char* name)
+{
+    size_t length = strlen(name);
+    return 0 == strncmp(arg, name, length) && '=' == arg[length] ? arg + length + 1 : NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    g_Options.m_Iterations = 10000000;
+    g_Options.m_Threads = std::max(2u, std::min(16u, std::thread::hardware_concurrency()));
+    g_Options.m_Repeat = 3;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value;
+        if ((value = XQBS_BenchArg(argv[i], "--iterations")) != NULL)
+            g_Options.m_Iterations = std::max<size_t>(1, strtoul(value, NULL, 10));
+        else if ((value = XQBS_BenchArg(argv[i], "--threads")) != NULL)
+            g_Options.m_Threads = std::max<size_t>(1, strtoul(value, NULL, 10));
+        else if ((value = XQBS_BenchArg(argv[i], "--repeat")) != NULL)
+            g_Options.m_Repeat = std::max<size_t>(1, strtoul(value, NULL, 10));
+        else if ((value = XQBS_BenchArg(argv[i], "--filter")) != NULL)
+            g_Options.m_Filter = value;
+        else if ((value = XQBS_BenchArg(argv[i], "--json")) != NULL)
+            g_Options.m_Json = value;
+        else if ((value = XQBS_BenchArg(argv[i], "--csv")) != NULL)
+            g_Options.m_Csv = value;
+        else
+        {
+            fprintf(stderr, "usage: %s [--iterations=N] [--threads=N] [--repeat=N] [--filter=STR] [--json=FILE|-] [--csv=FILE|-]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    XQBS_BenchRefCountAll();
+    XQBS_BenchGuardAll();
+    XQBS_BenchAllocAll();
+
+    int result = 0;
+    if (!g_Options.m_Json.empty())
+    {
+        FILE* f = XQBS_BenchOpen(g_Options.m_Json);
+        if (f)
+        {
+            XQBS_BenchWriteJson(f);
+            XQBS_BenchClose(f);
+        }
+        else
+            result = 1;
+    }
+    if (!g_Options.m_Csv.empty())
+    {
+        FILE* f = XQBS_BenchOpen(g_Options.m_Csv);
+        if (f)
+        {
+            XQBS_BenchWriteCsv(f);
+            XQBS_BenchClose(f);
+        }
+        else
+            result = 1;
+    }
+    if ("-" != g_Options.m_Json && "-" != g_Options.m_Csv)
+        XQBS_BenchWriteText(stdout);
+
+    // Без фильтра замеры guard вызывали функцию очистки
+    if (!g_Cleanups && g_Options.m_Filter.empty())
+        return 1;
+
+    return result;
+}
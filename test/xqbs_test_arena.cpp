@@ -0,0 +1,124 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_test_arena.cpp
+*
+*/
+
+// Семейство XQBS_new/XQBS_delete и арена XQBS_MmapArena:
+//  1. XQBS_new и XQBS_new(size) внутри XQBS_ArenaScope размещают объекты в арене;
+//  2. XQBS_delete, XQBS_delete_ptr и XQBS_delete_size объектов арены (созданных
+//     как XQBS_new в области арены, так и XQBS_MmapArena::New/NewArray) ничего
+//     не делают: деструктор не вызывается, память остается в арене, указатель обнуляется;
+//  3. вне области арены XQBS_new и XQBS_delete работают как обычно.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "../xqbs_arena.h"
+#include "../xqbs_mem.h"
+#include "../xqbs_smartguard.h"
+
+using namespace XQBS;
+
+// Количество вызванных деструкторов XQBS_TestNode
+static int g_Destroyed = 0;
+
+// Объект с деструктором: в арене он не должен вызываться
+struct XQBS_TestNode
+{
+    int64_t m_Key;
+
+    explicit XQBS_TestNode(int64_t key = 0) : m_Key(key) {}
+    ~XQBS_TestNode() { ++g_Destroyed; }
+};
+
+// Объект, который можно создать XQBS_MmapArena::New
+struct XQBS_TestPlain
+{
+    int64_t m_Key;
+    int64_t m_Value;
+};
+
+static int g_Result = 0;
+
+// Проверить условие и сообщить об ошибке
+static void XQBS_TestCheck(IN bool condition, IN const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Result = 1;
+    }
+}
+
+int main()
+{
+    const char* pDir = getenv("TMPDIR");
+    std::string Path = std::string(pDir && *pDir ? pDir : "/tmp") + "/xqbs_test_arena." + std::to_string(getpid());
+
+    XQBS_MmapArena Arena;
+    if (!Arena.Create(Path.c_str(), 1 << 20))
+    {
+        printf("FAILED: cannot create arena %s\n", Path.c_str());
+        return 1;
+    }
+
+    // Объекты XQBS_new в области арены
+    XQBS_TestNode* pNode = NULL;
+    XQBS_TestNode* pSecond = NULL;
+    char* pChars = NULL;
+    {
+        int64_t First = 42, Second = 43;
+        XQBS_ArenaScope Scope(Arena);
+        pNode = XQBS_new_ctor1<XQBS_TestNode>(First);
+        pSecond = XQBS_new_ctor1<XQBS_TestNode>(Second);
+        pChars = XQBS_new<char>(100);
+    }
+    XQBS_TestCheck(Arena.Contains(pNode) && Arena.Contains(pSecond), "XQBS_new lands in arena");
+    XQBS_TestCheck(Arena.Contains(pChars), "XQBS_new(size) lands in arena");
+
+    XQBS_TestNode* pKeep = pNode;
+    XQBS_delete(pNode);
+    XQBS_delete_ptr(pSecond);
+    XQBS_TestCheck(NULL == pNode, "XQBS_delete resets pointer to arena object");
+    XQBS_TestCheck(0 == g_Destroyed, "XQBS_delete does not destroy arena objects");
+    XQBS_TestCheck(42 == pKeep->m_Key && 43 == pSecond->m_Key, "XQBS_delete keeps arena memory");
+
+    char* pKeepChars = pChars;
+    pKeepChars[99] = 'x';
+    XQBS_delete_size(pChars);
+    XQBS_TestCheck(NULL == pChars && 'x' == pKeepChars[99], "XQBS_delete_size keeps arena array");
+
+    // Объекты XQBS_MmapArena::New и NewArray
+    XQBS_TestPlain* pPlain = Arena.New<XQBS_TestPlain>();
+    pPlain->m_Key = 7;
+    XQBS_TestPlain* pKeepPlain = pPlain;
+    XQBS_delete(pPlain);
+    XQBS_TestCheck(NULL == pPlain && 7 == pKeepPlain->m_Key, "XQBS_delete of XQBS_MmapArena::New object");
+
+    int64_t* pArray = Arena.NewArray<int64_t>(16);
+    XQBS_delete_size(pArray);
+    XQBS_TestCheck(NULL == pArray, "XQBS_delete_size of XQBS_MmapArena::NewArray");
+
+    {
+        XQBS_SmartDelete<XQBS_TestPlain*> Guard(Arena.New<XQBS_TestPlain>());
+    }
+
+    // Вне области арены все как обычно
+    XQBS_TestNode* pHeap = XQBS_new<XQBS_TestNode>();
+    XQBS_TestCheck(!Arena.Contains(pHeap), "XQBS_new outside arena scope");
+    XQBS_delete(pHeap);
+    XQBS_TestCheck(1 == g_Destroyed, "XQBS_delete outside arena destroys object");
+
+    XQBS_TestCheck(Arena.Close(), "arena closed");
+    unlink(Path.c_str());
+
+    printf("%s\n", g_Result ? "FAILED" : "OK");
+    return g_Result;
+}
@@ -0,0 +1,138 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_test_destroy.cpp
+*
+*/
+
+// XQBS_destroy_range: каждая из трех ветвей, которые выбираются при компиляции:
+//  1. объекты со счетчиком ссылок получают Release (объект с лишней ссылкой остается жив);
+//  2. тривиально разрушаемые объекты возвращают память без деструкторов, статистика
+//     по типам учитывает весь диапазон;
+//  3. остальные объекты удаляются через XQBS_delete_ptr с вызовом деструктора.
+// Пустые указатели в диапазонах пропускаются.
+
+#ifndef XQBS_MEM_STATS_TYPES
+#define XQBS_MEM_STATS_TYPES
+#endif
+
+#include <stdio.h>
+
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "../xqbs_refbase.h"
+
+using namespace XQBS;
+
+enum { XQBS_TEST_COUNT = 1000 }; // Объектов в каждом диапазоне
+
+// Количество вызванных деструкторов
+static int g_Destroyed = 0;
+
+// Ветвь 1: объект со счетчиком ссылок
+struct XQBS_TestRef : public XQBS_RefBase
+{
+    ~XQBS_TestRef() { ++g_Destroyed; }
+};
+
+// Ветвь 2: тривиально разрушаемый объект
+struct XQBS_TestTrivial
+{
+    int64_t m_Key;
+    int64_t m_Value[3];
+};
+
+// Ветвь 3: объект с деструктором
+struct XQBS_TestString
+{
+    std::string m_Value;
+
+    XQBS_TestString() : m_Value(32, 'x') {}
+    ~XQBS_TestString() { ++g_Destroyed; }
+};
+
+static_assert(XQBS_IsRefCounted<XQBS_TestRef>::value, "XQBS_TestRef must take the Release branch");
+static_assert(!XQBS_IsRefCounted<XQBS_TestTrivial>::value && std::is_trivially_destructible<XQBS_TestTrivial>::value &&
+              !XQBS_NewExpression<XQBS_TestTrivial>::value, "XQBS_TestTrivial must take the batch free branch");
+static_assert(!XQBS_IsRefCounted<XQBS_TestString>::value && !std::is_trivially_destructible<XQBS_TestString>::value,
+              "XQBS_TestString must take the XQBS_delete_ptr branch");
+
+static int g_Result = 0;
+
+// Проверить условие и сообщить об ошибке
+static void XQBS_TestCheck(IN bool condition, IN const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Result = 1;
+    }
+}
+
+// Статистика типа T в снимке, пустая если тип не встречался
+template<typename T>
+static XQBS_MemTypeStats XQBS_TestType(IN const XQBS_MemStatsSnapshot& s)
+{
+    std::string Name = XQBS_Demangle(typeid(T).name());
+    for (size_t i = 0; i < s.m_Types.size(); ++i)
+    {
+        if (s.m_Types[i].m_Name == Name)
+            return s.m_Types[i];
+    }
+    return XQBS_MemTypeStats();
+}
+
+// Создать count объектов через XQBS_new, каждый десятый указатель пустой
+template<typename T>
+static std::vector<T*> XQBS_TestMake(IN size_t count)
+{
+    std::vector<T*> v;
+    for (size_t i = 0; i < count; ++i)
+    {
+        v.push_back(XQBS_new<T>());
+        if (0 == i % 10)
+            v.push_back(NULL);
+    }
+    return v;
+}
+
+int main()
+{
+    // Ветвь 1: Release
+    std::vector<XQBS_TestRef*> Refs = XQBS_TestMake<XQBS_TestRef>(XQBS_TEST_COUNT);
+    XQBS_TestRef* pShared = Refs.back();
+    pShared->AddRef();
+    g_Destroyed = 0;
+    XQBS_destroy_range(Refs);
+    XQBS_TestCheck(XQBS_TEST_COUNT - 1 == g_Destroyed, "refcounted range released");
+    pShared->Release();
+    XQBS_TestCheck(XQBS_TEST_COUNT == g_Destroyed, "object with extra reference survives the range");
+
+    // Ветвь 2: память без деструкторов
+    std::vector<XQBS_TestTrivial*> Trivial = XQBS_TestMake<XQBS_TestTrivial>(XQBS_TEST_COUNT);
+    XQBS_MemStatsSnapshot Before = XQBS_mem_stats();
+    XQBS_destroy_range(Trivial.begin(), Trivial.end());
+    XQBS_MemStatsSnapshot After = XQBS_mem_stats();
+    XQBS_TestCheck(After.m_Frees - Before.m_Frees == XQBS_TEST_COUNT, "trivial range frees every object");
+    XQBS_TestCheck(After.m_FreeBytes - Before.m_FreeBytes == XQBS_TEST_COUNT * sizeof(XQBS_TestTrivial),
+                   "trivial range frees object bytes");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestTrivial>(After).m_Deletes - XQBS_TestType<XQBS_TestTrivial>(Before).m_Deletes ==
+                   XQBS_TEST_COUNT, "trivial range counted by type");
+    XQBS_TestCheck(0 == XQBS_TestType<XQBS_TestTrivial>(After).LiveObjects(), "no live trivial objects");
+
+    // Ветвь 3: XQBS_delete_ptr
+    std::vector<XQBS_TestString*> Strings = XQBS_TestMake<XQBS_TestString>(XQBS_TEST_COUNT);
+    g_Destroyed = 0;
+    XQBS_TestString* Array[3] = { XQBS_new<XQBS_TestString>(), NULL, XQBS_new<XQBS_TestString>() };
+    XQBS_destroy_range(Strings);
+    XQBS_destroy_range(Array);
+    XQBS_TestCheck(XQBS_TEST_COUNT + 2 == g_Destroyed, "general range runs destructors");
+    XQBS_TestCheck(0 == XQBS_TestType<XQBS_TestString>(XQBS_mem_stats()).LiveObjects(), "no live general objects");
+
+    printf("%s\n", g_Result ? "FAILED" : "OK");
+    return g_Result;
+}
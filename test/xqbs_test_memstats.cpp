@@ -0,0 +1,139 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_test_memstats.cpp
+*
+*/
+
+// Статистика памяти семейства XQBS_new/XQBS_delete (xqbs_memstats.h).
+// Каждая функция семейства - XQBS_new, XQBS_new_ctor1..4, XQBS_new(size),
+// XQBS_delete, XQBS_delete_ptr, XQBS_delete_size - должна попадать в счетчики
+// потока и в разбивку по типам, в том числе для объектов, которые создаются
+// выражением new (виртуальный деструктор, выравнивание больше std::max_align_t).
+// После удаления всех объектов освобожденные байты равны выделенным.
+
+#ifndef XQBS_MEM_STATS_TYPES
+#define XQBS_MEM_STATS_TYPES
+#endif
+
+#include <stdio.h>
+
+#include <string>
+#include <typeinfo>
+
+#include "../xqbs_mem.h"
+
+using namespace XQBS;
+
+// Обычный объект, размещается прямо в менеджере памяти
+struct XQBS_TestObject
+{
+    int m_a, m_b, m_c, m_d;
+
+    XQBS_TestObject() : m_a(0), m_b(0), m_c(0), m_d(0) {}
+    explicit XQBS_TestObject(int a) : m_a(a), m_b(0), m_c(0), m_d(0) {}
+    XQBS_TestObject(int a, int b) : m_a(a), m_b(b), m_c(0), m_d(0) {}
+    XQBS_TestObject(int a, int b, int c) : m_a(a), m_b(b), m_c(c), m_d(0) {}
+    XQBS_TestObject(int a, int b, int c, int d) : m_a(a), m_b(b), m_c(c), m_d(d) {}
+};
+
+// Объекты с виртуальным деструктором создаются выражением new
+struct XQBS_TestBase
+{
+    virtual ~XQBS_TestBase() {}
+};
+
+struct XQBS_TestDerived : public XQBS_TestBase
+{
+    char m_Payload[100];
+};
+
+// Выравнивание больше std::max_align_t
+struct alignas(64) XQBS_TestWide
+{
+    char m_Payload[64];
+};
+
+static int g_Result = 0;
+
+// Проверить условие и сообщить об ошибке
+static void XQBS_TestCheck(IN bool condition, IN const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Result = 1;
+    }
+}
+
+// Статистика типа T в снимке, пустая если тип не встречался
+template<typename T>
+static XQBS_MemTypeStats XQBS_TestType(IN const XQBS_MemStatsSnapshot& s)
+{
+    std::string Name = XQBS_Demangle(typeid(T).name());
+    for (size_t i = 0; i < s.m_Types.size(); ++i)
+    {
+        if (s.m_Types[i].m_Name == Name)
+            return s.m_Types[i];
+    }
+    return XQBS_MemTypeStats();
+}
+
+int main()
+{
+    int a = 1, b = 2, c = 3, d = 4;
+    XQBS_MemStatsSnapshot Before = XQBS_mem_stats();
+    XQBS_TestCheck(Before.m_bEnabled, "statistics enabled");
+
+    XQBS_TestObject* p0 = XQBS_new<XQBS_TestObject>();
+    XQBS_TestObject* p1 = XQBS_new_ctor1<XQBS_TestObject>(a);
+    XQBS_TestObject* p2 = XQBS_new_ctor2<XQBS_TestObject>(a, b);
+    XQBS_TestObject* p3 = XQBS_new_ctor3<XQBS_TestObject>(a, b, c);
+    XQBS_TestObject* p4 = XQBS_new_ctor4<XQBS_TestObject>(a, b, c, d);
+    XQBS_TestObject* p5 = XQBS_new<XQBS_TestObject>(a, b);
+    char* pChars = XQBS_new<char>(1000);
+    XQBS_TestWide* pWide = XQBS_new<XQBS_TestWide>(3);
+    XQBS_TestBase* pBase = XQBS_new<XQBS_TestDerived>();
+    const uint64_t Allocs = 9;
+
+    XQBS_MemStatsSnapshot Created = XQBS_mem_stats();
+    printf("after XQBS_new:    %s", Created.ToText().c_str());
+
+    XQBS_TestCheck(Created.m_Allocs - Before.m_Allocs == Allocs, "XQBS_new allocations counted");
+    XQBS_TestCheck(Created.m_AllocBytes - Before.m_AllocBytes >=
+                   6 * sizeof(XQBS_TestObject) + 1000 + 3 * sizeof(XQBS_TestWide) + sizeof(XQBS_TestDerived),
+                   "XQBS_new bytes counted");
+    XQBS_TestCheck(Created.m_LiveBytes > Before.m_LiveBytes, "XQBS_new live bytes counted");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestObject>(Created).m_News == 6, "XQBS_new/XQBS_new_ctorN objects by type");
+    XQBS_TestCheck(XQBS_TestType<char>(Created).m_News == 1000, "XQBS_new(size) elements by type");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestWide>(Created).m_News == 3, "over-aligned XQBS_new(size) elements by type");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestDerived>(Created).m_News == 1, "virtual XQBS_new objects by type");
+
+    XQBS_delete(p0);
+    XQBS_delete(p1);
+    XQBS_delete_ptr(p2);
+    XQBS_delete_ptr(p3);
+    XQBS_delete(p4);
+    XQBS_delete(p5);
+    XQBS_delete_size(pChars);
+    XQBS_delete_size(pWide);
+    XQBS_delete(pBase);
+    XQBS_TestCheck(!p0 && !p1 && !p4 && !p5 && !pChars && !pWide && !pBase, "XQBS_delete resets pointers");
+
+    XQBS_MemStatsSnapshot Deleted = XQBS_mem_stats();
+    printf("after XQBS_delete: %s", Deleted.ToText().c_str());
+
+    XQBS_TestCheck(Deleted.m_Frees - Created.m_Frees == Allocs, "XQBS_delete frees counted");
+    XQBS_TestCheck(Deleted.m_FreeBytes - Before.m_FreeBytes == Created.m_AllocBytes - Before.m_AllocBytes,
+                   "XQBS_delete frees all XQBS_new bytes");
+    XQBS_TestCheck(Deleted.m_LiveBytes == Before.m_LiveBytes, "live bytes restored");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestObject>(Deleted).m_Deletes == 6, "XQBS_delete/XQBS_delete_ptr objects by type");
+    XQBS_TestCheck(XQBS_TestType<char>(Deleted).m_Deletes == 1000, "XQBS_delete_size elements by type");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestWide>(Deleted).LiveObjects() == 0, "over-aligned XQBS_delete_size by type");
+    XQBS_TestCheck(XQBS_TestType<XQBS_TestDerived>(Deleted).LiveBytes() == 0, "virtual XQBS_delete by real type");
+
+    printf("%s\n", g_Result ? "FAILED" : "OK");
+    return g_Result;
+}
@@ -0,0 +1,177 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_test_refbiased.cpp
+*
+*/
+
+// Повторное использование записей потоков XQBS_BiasedThread.
+// В каждом раунде запускаются и завершаются XQBS_TEST_THREADS потоков. Каждый поток
+// создает объекты со смещенным счетчиком и часть из них отпускает сам, часть передает
+// соседям по раунду, а часть оставляет следующему раунду: после завершения потока
+// такие объекты учитываются в m_Orphans его записи, и запись нельзя отдать новому
+// потоку, пока следующий раунд их не отпустит.
+// Проверяется, что:
+//  1. число записей не растет с числом раундов: одновременно заняты не больше
+//     XQBS_TEST_THREADS записей живыми потоками и не больше XQBS_TEST_THREADS
+//     записями с неотпущенными объектами предыдущего раунда;
+//  2. все созданные объекты уничтожены;
+//  3. в конце все записи свободны и у них нет объектов с неслитыми счетчиками.
+//
+// Запуск: xqbs_test_refbiased [раундов]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../xqbs_refbiased.h"
+
+using namespace XQBS;
+
+enum
+{
+    XQBS_TEST_THREADS = 4,  // Потоков в раунде
+    XQBS_TEST_OBJECTS = 64  // Объектов на поток
+};
+
+// Счетчики созданных и уничтоженных объектов
+static std::atomic<size_t> g_Created(0);
+static std::atomic<size_t> g_Destroyed(0);
+
+struct XQBS_TestBiased : public XQBS_RefBaseT<XQBS_TestBiased, XQBS_RefCountBiased>
+{
+    XQBS_TestBiased() { g_Created.fetch_add(1, std::memory_order_relaxed); }
+    ~XQBS_TestBiased() { g_Destroyed.fetch_add(1, std::memory_order_relaxed); }
+};
+
+typedef std::vector<XQBS_TestBiased*> XQBS_TestObjects;
+
+// Общие данные раунда
+struct XQBS_TestRound
+{
+    std::mutex          m_Lock;
+    XQBS_TestObjects    m_Exchange;  // Ссылки, переданные соседям по раунду
+    XQBS_TestObjects    m_Leftovers; // Ссылки, оставленные следующему раунду
+    std::atomic<size_t> m_Arrived;   // Потоки, заполнившие m_Exchange
+
+    XQBS_TestRound() : m_Arrived(0) {}
+};
+
+// Поток раунда: pPrev - предыдущий раунд, его остатки отпускаются этим раундом
+static void XQBS_TestWorker(IN XQBS_TestRound* pRound, IN XQBS_TestRound* pPrev, IN size_t index)
+{
+    XQBS_TestObjects Own, Exchange, Leftovers;
+
+    // Создание объектов занимает запись потока
+    for (size_t n = 0; n < XQBS_TEST_OBJECTS; ++n)
+    {
+        XQBS_TestBiased* p = new XQBS_TestBiased();
+        switch (n % 4)
+        {
+        case 0:  Own.push_back(p); break;                              // отпускает сам поток
+        case 1:  Exchange.push_back(p); break;                         // ссылка передается соседу
+        case 2:  p->AddRef(); Own.push_back(p); Exchange.push_back(p); break; // ссылка у обоих
+        default: Leftovers.push_back(p); break;                        // ссылка передается следующему раунду
+        }
+    }
+
+    // Остатки предыдущего раунда: их потоки уже завершились
+    if (pPrev)
+    {
+        for (size_t n = index; n < pPrev->m_Leftovers.size(); n += XQBS_TEST_THREADS)
+            pPrev->m_Leftovers[n]->Release();
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(pRound->m_Lock);
+        pRound->m_Exchange.insert(pRound->m_Exchange.end(), Exchange.begin(), Exchange.end());
+        pRound->m_Leftovers.insert(pRound->m_Leftovers.end(), Leftovers.begin(), Leftovers.end());
+    }
+
+    // Ждем, пока все потоки раунда передадут свои ссылки
+    pRound->m_Arrived.fetch_add(1, std::memory_order_acq_rel);
+    while (pRound->m_Arrived.load(std::memory_order_acquire) < XQBS_TEST_THREADS)
+        std::this_thread::yield();
+
+    // Чужие ссылки отпускаются, пока их владельцы еще живы или уже завершились
+    for (size_t n = index; n < pRound->m_Exchange.size(); n += XQBS_TEST_THREADS)
+        pRound->m_Exchange[n]->Release();
+
+    for (size_t n = 0; n < Own.size(); ++n)
+        Own[n]->Release();
+}
+
+// Число записей потоков
+static size_t XQBS_TestRecords(void)
+{
+    size_t Count = 0;
+    for (XQBS_BiasedThread* pThread = XQBS_BiasedThread::List().load(std::memory_order_acquire); pThread; pThread = pThread->m_pNext)
+        ++Count;
+    return Count;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t Rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+    size_t MaxRecords = 0;
+    int Result = 0;
+
+    XQBS_TestRound* pPrev = NULL;
+    for (size_t r = 0; r < Rounds; ++r)
+    {
+        XQBS_TestRound* pRound = new XQBS_TestRound();
+
+        std::vector<std::thread> Threads;
+        for (size_t n = 0; n < XQBS_TEST_THREADS; ++n)
+            Threads.push_back(std::thread(XQBS_TestWorker, pRound, pPrev, n));
+        for (size_t n = 0; n < Threads.size(); ++n)
+            Threads[n].join();
+
+        delete pPrev;
+        pPrev = pRound;
+
+        size_t Records = XQBS_TestRecords();
+        if (Records > MaxRecords)
+            MaxRecords = Records;
+        if (Records > 2 * XQBS_TEST_THREADS)
+        {
+            printf("round %zu: %zu thread records, expected at most %d\n", r, Records, 2 * XQBS_TEST_THREADS);
+            Result = 1;
+            break;
+        }
+    }
+
+    // Остатки последнего раунда отпускает отдельный поток, главный поток записи не занимает
+    if (pPrev)
+    {
+        std::thread([pPrev]() { for (size_t n = 0; n < pPrev->m_Leftovers.size(); ++n) pPrev->m_Leftovers[n]->Release(); }).join();
+        delete pPrev;
+    }
+
+    size_t Created = g_Created.load(), Destroyed = g_Destroyed.load();
+    if (Created != Destroyed)
+    {
+        printf("created %zu objects, destroyed %zu\n", Created, Destroyed);
+        Result = 1;
+    }
+
+    for (XQBS_BiasedThread* pThread = XQBS_BiasedThread::List().load(std::memory_order_acquire); pThread; pThread = pThread->m_pNext)
+    {
+        if (pThread->m_InUse.load() || pThread->m_Orphans.load() != 0)
+        {
+            printf("thread record %p: in use %d, orphans %lld\n", (void*)pThread,
+                   int(pThread->m_InUse.load()), (long long)pThread->m_Orphans.load());
+            Result = 1;
+        }
+    }
+
+    printf("rounds %zu, threads %zu, objects %zu, max thread records %zu: %s\n",
+           Rounds, Rounds * XQBS_TEST_THREADS, Created, MaxRecords, Result ? "FAILED" : "OK");
+    return Result;
+}
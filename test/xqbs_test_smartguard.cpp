@@ -0,0 +1,173 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_test_smartguard.cpp
+*
+*/
+
+// Гарды XQBS_SmartFree, XQBS_SmartDelete, XQBS_SmartDeleteArray, XQBS_SmartRelease,
+// XQBS_SmartFd и XQBS_SmartFdDeferred:
+//  1. конструктор (P p) владеет значением и очищает его в деструкторе;
+//  2. прежний конструктор (P& p, P v) следит за переменной вызывающего кода:
+//     очищает ее значение на момент деструктора и присваивает ей v, значение v
+//     не очищается;
+//  3. Reset, Detach и перемещение работают в обоих режимах, при перемещении
+//     слежение за переменной передается новому гарду;
+//  4. дескрипторы закрываются в обоих режимах, XQBS_SmartFdDeferred - после Drain.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <utility>
+#include <vector>
+
+#include "../xqbs_fdcloser.h"
+#include "../xqbs_smartguard.h"
+
+using namespace XQBS;
+
+// Количество вызванных деструкторов
+static int g_Destroyed = 0;
+
+struct XQBS_TestObject
+{
+    int m_Value;
+
+    XQBS_TestObject() : m_Value(0) {}
+    ~XQBS_TestObject() { ++g_Destroyed; }
+};
+
+struct XQBS_TestRef : public XQBS_RefBase
+{
+    ~XQBS_TestRef() { ++g_Destroyed; }
+};
+
+static int g_Result = 0;
+
+// Проверить условие и сообщить об ошибке
+static void XQBS_TestCheck(IN bool condition, IN const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Result = 1;
+    }
+}
+
+// Дескриптор открыт
+static bool XQBS_TestIsOpen(IN int fd)
+{
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+// Проверить гард дескриптора G в обоих режимах
+template<typename G>
+static void XQBS_TestFd(IN const char* name)
+{
+    int Pipe[2] = { -1, -1 };
+    if (pipe(Pipe) != 0)
+    {
+        printf("FAILED: %s: pipe\n", name);
+        g_Result = 1;
+        return;
+    }
+
+    int Read = Pipe[0], Write = Pipe[1];
+    {
+        G Owner(Read);
+        XQBS_TestCheck(Owner.IsValid() && Read == Owner.Get(), name);
+    }
+    {
+        G Linked(Pipe[1], -1);
+        XQBS_TestCheck(Linked.IsValid() && Write == Linked.Get(), name);
+    }
+    XQBS_FdCloser::Instance().Drain();
+    XQBS_TestCheck(-1 == Pipe[1], name);
+    XQBS_TestCheck(!XQBS_TestIsOpen(Read) && !XQBS_TestIsOpen(Write), name);
+}
+
+int main()
+{
+    // Владение значением
+    g_Destroyed = 0;
+    {
+        XQBS_SmartDelete<XQBS_TestObject*> Guard(XQBS_new<XQBS_TestObject>());
+        Guard->m_Value = 1;
+        XQBS_SmartDeleteArray<XQBS_TestObject*> Array(XQBS_new<XQBS_TestObject>(3));
+        XQBS_SmartFree<void*> Memory(malloc(16));
+    }
+    XQBS_TestCheck(4 == g_Destroyed, "owning guards clean up");
+
+    // Слежение за переменной: очищается значение на момент деструктора
+    g_Destroyed = 0;
+    XQBS_TestObject* pObject = XQBS_new<XQBS_TestObject>();
+    {
+        XQBS_SmartDelete<XQBS_TestObject*> Guard(pObject, NULL);
+        XQBS_delete(pObject);
+        pObject = XQBS_new<XQBS_TestObject>();
+    }
+    XQBS_TestCheck(NULL == pObject && 2 == g_Destroyed, "linked guard deletes current value");
+
+    // Значение v не очищается и присваивается переменной
+    g_Destroyed = 0;
+    XQBS_TestObject Keep;
+    pObject = XQBS_new<XQBS_TestObject>();
+    {
+        XQBS_SmartDelete<XQBS_TestObject*> Guard(pObject, &Keep);
+        XQBS_TestCheck(pObject == Guard.Get(), "linked guard reads variable");
+    }
+    XQBS_TestCheck(&Keep == pObject && 1 == g_Destroyed, "linked guard assigns reset value");
+    {
+        XQBS_SmartDelete<XQBS_TestObject*> Guard(pObject, &Keep);
+    }
+    XQBS_TestCheck(&Keep == pObject && 1 == g_Destroyed, "reset value is not cleaned up");
+
+    // Detach и Reset в режиме слежения
+    char* pChars = (char*)malloc(8);
+    {
+        XQBS_SmartFree<char*> Guard(pChars, NULL);
+        char* pDetached = Guard.Detach();
+        XQBS_TestCheck(NULL == pChars, "linked Detach assigns reset value");
+        Guard = pDetached;
+        XQBS_TestCheck(pDetached == pChars, "linked assignment writes variable");
+        Guard.Reset((char*)malloc(8));
+        XQBS_TestCheck(pChars && pChars != pDetached, "linked Reset(p) writes variable");
+    }
+    XQBS_TestCheck(NULL == pChars, "linked SmartFree resets variable");
+
+    // Перемещение передает слежение за переменной
+    g_Destroyed = 0;
+    XQBS_TestRef* pRef = new XQBS_TestRef();
+    {
+        std::vector<XQBS_SmartRelease<XQBS_TestRef*> > Guards;
+        Guards.push_back(XQBS_SmartRelease<XQBS_TestRef*>(pRef, NULL));
+        for (int n = 0; n < 16; ++n)
+            Guards.push_back(XQBS_SmartRelease<XQBS_TestRef*>(new XQBS_TestRef()));
+        XQBS_TestCheck(pRef == Guards[0].Get() && 0 == g_Destroyed, "moved guards keep values");
+    }
+    XQBS_TestCheck(NULL == pRef && 17 == g_Destroyed, "moved guards release once");
+
+    g_Destroyed = 0;
+    {
+        XQBS_TestObject* pFirst = XQBS_new<XQBS_TestObject>();
+        XQBS_SmartDelete<XQBS_TestObject*> Linked(pFirst, NULL);
+        XQBS_SmartDelete<XQBS_TestObject*> Owner(XQBS_new<XQBS_TestObject>());
+        Linked.Swap(Owner);
+        XQBS_TestCheck(0 == g_Destroyed && pFirst == Owner.Get(), "Swap exchanges modes");
+        Owner.Reset();
+        XQBS_TestCheck(1 == g_Destroyed && NULL == pFirst, "swapped guard resets variable");
+    }
+    XQBS_TestCheck(2 == g_Destroyed, "swapped guards clean up");
+
+    // Дескрипторы POSIX
+    XQBS_TestFd<XQBS_SmartFd>("XQBS_SmartFd closes descriptors");
+    XQBS_TestFd<XQBS_SmartFdDeferred>("XQBS_SmartFdDeferred closes descriptors");
+    XQBS_FdCloser::Instance().Shutdown();
+
+    printf("%s\n", g_Result ? "FAILED" : "OK");
+    return g_Result;
+}
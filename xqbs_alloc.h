@@ -0,0 +1,558 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_alloc.h
+*
+*/
+
+#ifndef XQBS_ALLOC_H
+#define XQBS_ALLOC_H
+
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif // !_WIN32
+
+#include "xqbs_defs.h"
+#include "xqbs_memstats.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Менеджер памяти на глобальных operator new/delete (прежнее поведение XQBS_new)
+struct XQBS_MemGlobal
+{
+    // Выделить size байт, при нехватке памяти генерируется std::bad_alloc
+    static void* Alloc(IN size_t size) { return ::operator new(size); }
+    // Освободить память, выделенную Alloc(size)
+    static void Free(IN void* ptr, IN size_t size) { (void)size; ::operator delete(ptr); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Менеджер памяти с кешем свободных блоков в каждом потоке.
+// Запросы до MAX_SIZE байт округляются до размерного класса и обслуживаются из
+// списка свободных блоков текущего потока без блокировок. Списки пополняются и
+// возвращаются пачками из общего пула, который защищен мьютексом на каждый класс.
+// Запросы больше MAX_SIZE уходят в глобальный operator new.
+// Память общего пула операционной системе не возвращается.
+class XQBS_MemThreadCache
+{
+public:
+
+    enum
+    {
+        MAX_SIZE   = 4096,  // Максимальный размер блока, обслуживаемого кешем
+        CLASSES    = 41,    // Количество размерных классов (класс 0 не используется)
+        CHUNK_SIZE = 65536  // Размер участка памяти, который нарезается на блоки
+    };
+
+    // Номер размерного класса для размера size (size <= MAX_SIZE):
+    // шаг 16 байт до 256, шаг 64 байта до 1024, шаг 256 байт до 4096
+    static XQBS_FORCEINLINE size_t SizeClass(IN size_t size)
+    {
+        if (size <= 256)
+            return size ? (size + 15) >> 4 : 1;
+        if (size <= 1024)
+            return 16 + ((size - 256 + 63) >> 6);
+        return 28 + ((size - 1024 + 255) >> 8);
+    }
+
+    // Размер блока размерного класса cls
+    static size_t ClassSize(IN size_t cls)
+    {
+        if (cls <= 16)
+            return cls << 4;
+        if (cls <= 28)
+            return 256 + ((cls - 16) << 6);
+        return 1024 + ((cls - 28) << 8);
+    }
+
+    // Количество блоков в пачке, которой поток обменивается с общим пулом
+    static size_t BatchSize(IN size_t cls)
+    {
+        size_t n = 8192 / ClassSize(cls);
+        return n < 4 ? 4 : (n > 64 ? 64 : n);
+    }
+
+    // Выделить size байт, при нехватке памяти генерируется std::bad_alloc
+    static XQBS_FORCEINLINE void* Alloc(IN size_t size)
+    {
+        if (XQBS_UNLIKELY(size > MAX_SIZE))
+            return ::operator new(size);
+
+        ThreadCache* pCache = ThreadSlot();
+        if (XQBS_UNLIKELY(!pCache))
+            return AllocSlow(size);
+
+        FreeList& List = pCache->m_Lists[SizeClass(size)];
+        if (XQBS_UNLIKELY(!List.m_pHead))
+            return AllocSlow(size);
+
+        void* ptr = List.m_pHead;
+        List.m_pHead = *static_cast<void**>(ptr);
+        List.m_Count--;
+        return ptr;
+    }
+
+    // Освободить память, выделенную Alloc(size)
+    static XQBS_FORCEINLINE void Free(IN void* ptr, IN size_t size)
+    {
+        if (XQBS_UNLIKELY(size > MAX_SIZE))
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        ThreadCache* pCache = ThreadSlot();
+        if (XQBS_UNLIKELY(!pCache))
+        {
+            FreeSlow(ptr, size);
+            return;
+        }
+
+        size_t cls = SizeClass(size);
+        FreeList& List = pCache->m_Lists[cls];
+        *static_cast<void**>(ptr) = List.m_pHead;
+        List.m_pHead = ptr;
+        if (XQBS_UNLIKELY(++List.m_Count > 2 * BatchSize(cls)))
+            Central().Push(cls, PopBatch(List, BatchSize(cls)));
+    }
+
+    // Вернуть все свободные блоки текущего потока в общий пул
+    static void FlushThread(void)
+    {
+        ThreadCache* pCache = ThreadSlot();
+        if (pCache)
+            pCache->Flush();
+    }
+
+private:
+
+    // Пачка блоков: односвязный список через первое слово блока
+    struct Batch
+    {
+        void*  m_pHead;  // Первый блок пачки
+        size_t m_Count;  // Количество блоков
+    };
+
+    // Список свободных блоков одного размерного класса в кеше потока
+    struct FreeList
+    {
+        void*  m_pHead;  // Первый свободный блок
+        size_t m_Count;  // Количество блоков в списке
+    };
+
+    // Кеш потока
+    struct ThreadCache
+    {
+        FreeList m_Lists[CLASSES];
+
+        // Вернуть все блоки в общий пул
+        void Flush(void)
+        {
+            for (size_t cls = 1; cls < CLASSES; ++cls)
+            {
+                FreeList& List = m_Lists[cls];
+                while (List.m_Count)
+                    Central().Push(cls, PopBatch(List, BatchSize(cls)));
+            }
+        }
+    };
+
+    // Обработчик завершения потока: возвращает блоки потока в общий пул
+    struct ThreadExit
+    {
+        ThreadCache m_Cache;
+
+        ThreadExit() { for (size_t cls = 0; cls < CLASSES; ++cls) { m_Cache.m_Lists[cls].m_pHead = NULL; m_Cache.m_Lists[cls].m_Count = 0; } }
+        ~ThreadExit() { ThreadDead() = true; ThreadSlot() = NULL; m_Cache.Flush(); }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Общий пул: стеки пачек по размерным классам
+    class CentralPool
+    {
+    private:
+
+        std::mutex         m_Lock[CLASSES];    // Блокировки классов
+        std::vector<Batch> m_Batches[CLASSES]; // Стеки пачек
+
+    public:
+
+        // Положить пачку в пул
+        void Push(IN size_t cls, IN Batch b)
+        {
+            if (!b.m_pHead)
+                return;
+            std::lock_guard<std::mutex> lock(m_Lock[cls]);
+            m_Batches[cls].push_back(b);
+        }
+
+        // Взять пачку из пула, при необходимости нарезав новый участок памяти
+        Batch Pop(IN size_t cls)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Lock[cls]);
+                if (!m_Batches[cls].empty())
+                {
+                    Batch b = m_Batches[cls].back();
+                    m_Batches[cls].pop_back();
+                    return b;
+                }
+            }
+            return Carve(cls);
+        }
+
+    private:
+
+        // Нарезать новый участок памяти на пачки: одну вернуть, остальные положить в пул
+        Batch Carve(IN size_t cls)
+        {
+            size_t size = ClassSize(cls), count = BatchSize(cls);
+            size_t batches = CHUNK_SIZE / (size * count);
+            if (!batches)
+                batches = 1;
+
+            char* pChunk = static_cast<char*>(::operator new(batches * count * size));
+            Batch first = { NULL, 0 };
+            for (size_t b = 0; b < batches; ++b)
+            {
+                char* pBatch = pChunk + b * count * size;
+                for (size_t i = 0; i < count; ++i)
+                    *reinterpret_cast<void**>(pBatch + i * size) = i + 1 < count ? pBatch + (i + 1) * size : NULL;
+                Batch batch = { pBatch, count };
+                if (0 == b)
+                    first = batch;
+                else
+                    Push(cls, batch);
+            }
+            return first;
+        }
+    };
+
+    // Общий пул (никогда не разрушается, чтобы переживать статические деструкторы)
+    static CentralPool& Central(void)
+    {
+        static CentralPool* s_pPool = new CentralPool();
+        return *s_pPool;
+    }
+
+    // Кеш текущего потока (без проверки инициализации thread_local)
+    static ThreadCache*& ThreadSlot(void)
+    {
+        static thread_local ThreadCache* t_pCache = NULL;
+        return t_pCache;
+    }
+
+    // Признак того, что текущий поток уже завершается
+    static bool& ThreadDead(void)
+    {
+        static thread_local bool t_Dead = false;
+        return t_Dead;
+    }
+
+    // Снять с начала списка пачку из count блоков (или сколько есть)
+    static Batch PopBatch(IN OUT FreeList& List, IN size_t count)
+    {
+        Batch b = { List.m_pHead, 0 };
+        void* pLast = NULL;
+        void* ptr = List.m_pHead;
+        while (ptr && b.m_Count < count)
+        {
+            pLast = ptr;
+            ptr = *static_cast<void**>(ptr);
+            b.m_Count++;
+        }
+        if (pLast)
+            *static_cast<void**>(pLast) = NULL;
+        List.m_pHead = ptr;
+        List.m_Count -= b.m_Count;
+        return b;
+    }
+
+    // Выделение, когда кеш потока пуст или еще не создан
+    static XQBS_NOINLINE void* AllocSlow(IN size_t size)
+    {
+        size_t cls = SizeClass(size);
+        ThreadCache* pCache = ThreadSlot();
+
+        if (!pCache && !ThreadDead())
+        {
+            // Первое обращение из потока: создаем кеш вместе с обработчиком завершения потока
+            static thread_local ThreadExit t_Exit;
+            pCache = &t_Exit.m_Cache;
+            ThreadSlot() = pCache;
+        }
+
+        Batch b = Central().Pop(cls);
+        void* ptr = b.m_pHead;
+        void* pRest = *static_cast<void**>(ptr);
+
+        if (!pCache)
+        {
+            // Поток завершается: лишние блоки сразу возвращаем в пул
+            Batch rest = { pRest, b.m_Count - 1 };
+            Central().Push(cls, rest);
+            return ptr;
+        }
+
+        FreeList& List = pCache->m_Lists[cls];
+        List.m_pHead = pRest;
+        List.m_Count = b.m_Count - 1;
+        return ptr;
+    }
+
+    // Освобождение в завершающемся потоке
+    static XQBS_NOINLINE void FreeSlow(IN void* ptr, IN size_t size)
+    {
+        *static_cast<void**>(ptr) = NULL;
+        Batch one = { ptr, 1 };
+        Central().Push(SizeClass(size), one);
+    }
+};
+
+// Менеджер памяти для семейства XQBS_new/XQBS_delete выбирается при компиляции:
+// -DXQBS_MEM_BACKEND=XQBS::XQBS_MemGlobal отдает память глобальным operator new/delete.
+// При любом менеджере память XQBS_new освобождается только XQBS_delete
+#ifndef XQBS_MEM_BACKEND
+#define XQBS_MEM_BACKEND _XQBS XQBS_MemThreadCache
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Точки подключения арен (см. xqbs_arena.h). Пока поток находится внутри
+// XQBS_ArenaScope, XQBS_mem_alloc берет память из арены этого потока, а
+// XQBS_mem_free для адресов любой открытой арены ничего не делает: память
+// арены освобождается только целиком. Цена проверок - чтение переменной потока
+// в XQBS_mem_alloc и одно сравнение в XQBS_mem_free, -DXQBS_NO_ARENA их убирает
+
+// Арена, в которую направлены выделения памяти потока
+struct XQBS_ArenaHook
+{
+    void*   m_pArena;                                 // Арена
+    void* (*m_pfnAlloc)(IN void* pArena, IN size_t size); // Выделение памяти в арене, при нехватке std::bad_alloc
+};
+
+// Арена текущего потока, NULL - выделения идут в менеджер памяти
+inline XQBS_ArenaHook*& XQBS_ArenaCurrent(void)
+{
+    static thread_local XQBS_ArenaHook* t_pHook = NULL;
+    return t_pHook;
+}
+
+// Диапазоны адресов открытых арен. Все поля инициализируются константами,
+// поэтому проверка в XQBS_mem_free не требует проверки инициализации, а
+// пока арен нет, она сводится к одному сравнению. Add и Remove редки и
+// выполняются под блокировкой, Contains блокировок не берет
+class XQBS_ArenaRanges
+{
+private:
+
+    enum { MAX = 16 }; // Наибольшее количество одновременно открытых арен
+
+    std::atomic<uintptr_t> m_Low;        // Наименьшее начало открытых арен
+    std::atomic<uintptr_t> m_High;       // Наибольший конец открытых арен
+    std::atomic<uintptr_t> m_Begin[MAX]; // Начала арен, ноль - слот свободен
+    std::atomic<uintptr_t> m_End[MAX];   // Концы арен
+    std::mutex             m_Lock;       // Блокировка Add и Remove
+
+    // Пересчитать общие границы (под блокировкой m_Lock)
+    void Update(void)
+    {
+        uintptr_t Low = UINTPTR_MAX, High = 0;
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            uintptr_t Begin = m_Begin[i].load(std::memory_order_acquire);
+            if (Begin)
+            {
+                Low = Begin < Low ? Begin : Low;
+                uintptr_t End = m_End[i].load(std::memory_order_relaxed);
+                High = End > High ? End : High;
+            }
+        }
+        m_Low.store(Low, std::memory_order_release);
+        m_High.store(High, std::memory_order_release);
+    }
+
+    // Адрес внутри общих границ: точная проверка по слотам
+    XQBS_NOINLINE bool ContainsSlow(IN uintptr_t addr) const
+    {
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            uintptr_t Begin = m_Begin[i].load(std::memory_order_acquire);
+            if (Begin && addr >= Begin && addr < m_End[i].load(std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+public:
+
+    // Конструктор
+    constexpr XQBS_ArenaRanges() : m_Low(UINTPTR_MAX), m_High(0), m_Begin(), m_End(), m_Lock() {}
+
+    // Единственный экземпляр
+    static XQBS_ArenaRanges& Instance(void)
+    {
+        static XQBS_ArenaRanges s_Ranges;
+        return s_Ranges;
+    }
+
+    // Добавить арену [begin, end). Возвращает false, если открыто слишком много арен
+    bool Add(IN const void* begin, IN const void* end)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            if (m_Begin[i].load(std::memory_order_relaxed) == 0)
+            {
+                m_End[i].store(reinterpret_cast<uintptr_t>(end), std::memory_order_relaxed);
+                m_Begin[i].store(reinterpret_cast<uintptr_t>(begin), std::memory_order_release);
+                Update();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Убрать арену, начинающуюся с begin
+    void Remove(IN const void* begin)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            if (m_Begin[i].load(std::memory_order_relaxed) == reinterpret_cast<uintptr_t>(begin))
+            {
+                m_Begin[i].store(0, std::memory_order_release);
+                m_End[i].store(0, std::memory_order_release);
+                Update();
+                return;
+            }
+        }
+    }
+
+    // Адрес принадлежит открытой арене
+    XQBS_FORCEINLINE bool Contains(IN const void* ptr) const
+    {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+        if (XQBS_LIKELY(addr < m_Low.load(std::memory_order_relaxed) || addr >= m_High.load(std::memory_order_relaxed)))
+            return false;
+        return ContainsSlow(addr);
+    }
+};
+
+// Выделить size байт через выбранный менеджер памяти (или в арене потока)
+XQBS_FORCEINLINE void* XQBS_mem_alloc(IN size_t size)
+{
+#ifndef XQBS_NO_ARENA
+    XQBS_ArenaHook* pArena = XQBS_ArenaCurrent();
+    if (XQBS_UNLIKELY(pArena != NULL))
+        return pArena->m_pfnAlloc(pArena->m_pArena, size);
+#endif
+
+    void* ptr = XQBS_MEM_BACKEND::Alloc(size);
+    XQBS_MemStatsAlloc(size);
+    return ptr;
+}
+
+// Адрес принадлежит открытой арене: такая память освобождается только вместе с ареной
+XQBS_FORCEINLINE bool XQBS_InArena(IN const void* ptr)
+{
+#ifndef XQBS_NO_ARENA
+    return XQBS_UNLIKELY(XQBS_ArenaRanges::Instance().Contains(ptr));
+#else
+    (void)ptr;
+    return false;
+#endif
+}
+
+// Освободить память, выделенную XQBS_mem_alloc(size). Память арены не освобождается
+XQBS_FORCEINLINE void XQBS_mem_free(IN void* ptr, IN size_t size)
+{
+    if (XQBS_InArena(ptr))
+        return;
+
+    XQBS_MemStatsFree(size);
+    XQBS_MEM_BACKEND::Free(ptr, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Большие буферы на больших страницах памяти (2 МБ): меньше промахов TLB при
+// проходе по буферам в сотни мегабайт. Порядок попыток:
+//  1. mmap с MAP_HUGETLB - заранее выделенные ядром большие страницы;
+//  2. mmap, выровненный на 2 МБ, с подсказкой MADV_HUGEPAGE - прозрачные большие страницы;
+//  3. если и подсказка не принята, остается обычный mmap.
+// Размер буфера округляется вверх до 2 МБ, освобождать его надо с тем же размером
+
+// Размер большой страницы
+static const size_t XQBS_HUGE_PAGE = 2 * 1024 * 1024;
+
+// Размер буфера size, округленный до большой страницы
+inline size_t XQBS_huge_size(IN size_t size) { return (size + XQBS_HUGE_PAGE - 1) & ~(XQBS_HUGE_PAGE - 1); }
+
+// Выделить буфер не меньше size байт на больших страницах, при нехватке памяти
+// генерируется std::bad_alloc. Память заполнена нулями
+inline void* XQBS_huge_alloc(IN size_t size)
+{
+    size_t bytes = XQBS_huge_size(size ? size : 1);
+    if (bytes < size)
+        throw std::bad_alloc();
+
+#ifdef _WIN32
+    void* ptr = ::operator new(bytes, std::align_val_t(XQBS_HUGE_PAGE));
+    memset(ptr, 0, bytes);
+    XQBS_MemStatsAlloc(bytes);
+    return ptr;
+#else
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+    void* ptr = ::mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (MAP_FAILED != ptr)
+    {
+        XQBS_MemStatsAlloc(bytes);
+        return ptr;
+    }
+#endif
+
+    // Больших страниц в резерве нет: берем на 2 МБ больше и обрезаем до выровненного участка
+    char* pRaw = static_cast<char*>(::mmap(NULL, bytes + XQBS_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (MAP_FAILED == static_cast<void*>(pRaw))
+        throw std::bad_alloc();
+
+    char* pBuffer = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pRaw) + XQBS_HUGE_PAGE - 1) & ~uintptr_t(XQBS_HUGE_PAGE - 1));
+    if (pBuffer != pRaw)
+        ::munmap(pRaw, pBuffer - pRaw);
+    if (pBuffer + bytes != pRaw + bytes + XQBS_HUGE_PAGE)
+        ::munmap(pBuffer + bytes, (pRaw + bytes + XQBS_HUGE_PAGE) - (pBuffer + bytes));
+
+#ifdef MADV_HUGEPAGE
+    ::madvise(pBuffer, bytes, MADV_HUGEPAGE);
+#endif
+    XQBS_MemStatsAlloc(bytes);
+    return pBuffer;
+#endif // _WIN32
+}
+
+// Освободить буфер, выделенный XQBS_huge_alloc(size)
+inline void XQBS_huge_free(IN void* ptr, IN size_t size)
+{
+    if (!ptr)
+        return;
+    XQBS_MemStatsFree(XQBS_huge_size(size ? size : 1));
+#ifdef _WIN32
+    (void)size;
+    ::operator delete(ptr, std::align_val_t(XQBS_HUGE_PAGE));
+#else
+    ::munmap(ptr, XQBS_huge_size(size ? size : 1));
+#endif // _WIN32
+}
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_ALLOC_H
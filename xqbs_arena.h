@@ -0,0 +1,324 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_arena.h
+*
+*/
+
+#ifndef XQBS_ARENA_H
+#define XQBS_ARENA_H
+
+#ifndef _WIN32
+
+#ifdef XQBS_NO_ARENA
+#error "xqbs_arena.h needs the arena hooks of XQBS_mem_alloc/XQBS_mem_free, remove -DXQBS_NO_ARENA"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_alloc.h"
+#include "xqbs_offsetptr.h"
+#include "xqbs_smartmmap.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Арена в отображенном в память файле для неизменяемых графов объектов,
+// которые долго строятся при старте. Граф строится один раз в арене, созданной
+// Create, сохраняется Close и при следующем старте открывается Open одним
+// mmap без выделения памяти и вызова конструкторов.
+//
+// Память выделяется сдвигом указателя (без блокировок, из любого потока) и
+// освобождается только целиком. Внутри XQBS_ArenaScope выделения семейства
+// XQBS_new текущего потока идут в арену, а XQBS_delete объектов арены ничего
+// не делает (ни деструктора, ни освобождения памяти). Отображение принадлежит
+// XQBS_SmartMmap и снимается в деструкторе арены или в Close.
+//
+// Объекты арены не должны содержать обычных указателей, указателей на
+// таблицы виртуальных функций и ссылок на память вне арены (std::string,
+// std::vector): между запусками программы арена отображается по другому
+// адресу. Связи внутри арены хранятся в XQBS_OffsetPtr, корень графа - в
+// заголовке арены (SetRoot/Root)
+class XQBS_MmapArena
+{
+private:
+
+    // Заголовок в начале файла арены
+    struct alignas(XQBS_CACHE_LINE) Header
+    {
+        char                  m_Magic[8];  // Сигнатура (Magic)
+        uint32_t              m_Version;   // Версия формата
+        uint32_t              m_HeaderSize; // Размер заголовка
+        uint64_t              m_Capacity;  // Размер арены при создании
+        std::atomic<uint64_t> m_Used;      // Занято байтов от начала файла, включая заголовок
+        uint64_t              m_Root;      // Смещение корня графа от начала файла, ноль - корня нет
+    };
+
+    enum { VERSION = 1 };
+
+    XQBS_SmartMmap m_Map;       // Отображение файла
+    std::string    m_Path;      // Путь к файлу
+    bool           m_bWritable; // Арена открыта для записи
+    XQBS_ArenaHook m_Hook;      // Точка подключения для XQBS_ArenaScope
+
+    // Арена не копируется
+    XQBS_MmapArena(const XQBS_MmapArena&);
+    XQBS_MmapArena& operator= (const XQBS_MmapArena&);
+
+    // Сигнатура файла арены
+    static const char* Magic(void) { return "XQBSARN"; }
+
+    // Заголовок арены
+    Header* GetHeader(void) const { return static_cast<Header*>(m_Map.Get()); }
+
+    // Выделение памяти для XQBS_ArenaScope
+    static void* HookAlloc(IN void* pArena, IN size_t size)
+    {
+        void* ptr = static_cast<XQBS_MmapArena*>(pArena)->Alloc(size);
+        if (!ptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    // Зарегистрировать адреса арены для XQBS_mem_free
+    bool Register(void)
+    {
+        if (XQBS_ArenaRanges::Instance().Add(m_Map.Get(), static_cast<char*>(m_Map.Get()) + m_Map.Size()))
+            return true;
+
+        m_Map.Reset();
+        errno = EMFILE;
+        return false;
+    }
+
+    // Снять отображение
+    void Unmap(void)
+    {
+        if (m_Map.IsMapped())
+        {
+            XQBS_ArenaRanges::Instance().Remove(m_Map.Get());
+            m_Map.Reset();
+        }
+        m_bWritable = false;
+    }
+
+public:
+
+    // Конструктор закрытой арены
+    XQBS_MmapArena() : m_bWritable(false)
+    {
+        m_Hook.m_pArena = this;
+        m_Hook.m_pfnAlloc = &XQBS_MmapArena::HookAlloc;
+    }
+
+    // Деструктор снимает отображение без сохранения (файл остается размером capacity)
+    ~XQBS_MmapArena() { Unmap(); }
+
+    // Создать пустую арену в файле path размером capacity байт (файл
+    // разреженный, место на диске занимают только использованные страницы).
+    // Возвращает false при ошибке, причина в errno
+    bool Create(IN const char* path, IN size_t capacity)
+    {
+        Unmap();
+        if (capacity < sizeof(Header))
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        bool bResult = 0 == ::ftruncate(fd, static_cast<off_t>(capacity)) && m_Map.Map(fd, capacity, 0, XQBS_MMAP_WRITE);
+
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        if (!bResult || !Register())
+            return false;
+
+        Header* pHeader = ::new (m_Map.Get()) Header;
+        memcpy(pHeader->m_Magic, Magic(), sizeof(pHeader->m_Magic));
+        pHeader->m_Version = VERSION;
+        pHeader->m_HeaderSize = sizeof(Header);
+        pHeader->m_Capacity = capacity;
+        pHeader->m_Used.store(sizeof(Header), std::memory_order_relaxed);
+        pHeader->m_Root = 0;
+
+        m_Path = path;
+        m_bWritable = true;
+        return true;
+    }
+
+    // Открыть сохраненную арену одним отображением файла, флаги XQBS_MMAP_*.
+    // По умолчанию только для чтения, с XQBS_MMAP_WRITE изменения попадают в
+    // файл. Возвращает false при ошибке, причина в errno (EINVAL - не арена)
+    bool Open(IN const char* path, IN unsigned flags = XQBS_MMAP_READ)
+    {
+        Unmap();
+        if (!m_Map.Map(path, flags))
+            return false;
+
+        const Header* pHeader = GetHeader();
+        if (m_Map.Size() < sizeof(Header) || 0 != memcmp(pHeader->m_Magic, Magic(), sizeof(pHeader->m_Magic)) ||
+            pHeader->m_Version != VERSION || pHeader->m_HeaderSize != sizeof(Header) ||
+            pHeader->m_Used.load(std::memory_order_relaxed) > m_Map.Size() ||
+            pHeader->m_Root >= pHeader->m_Used.load(std::memory_order_relaxed))
+        {
+            m_Map.Reset();
+            errno = EINVAL;
+            return false;
+        }
+
+        if (!Register())
+            return false;
+
+        m_Path = path;
+        m_bWritable = 0 != (flags & XQBS_MMAP_WRITE);
+        return true;
+    }
+
+    // Сохранить арену: записать страницы в файл, обрезать файл до занятого
+    // размера и снять отображение. Указатели на объекты арены становятся
+    // недействительными, граф снова доступен через Open
+    bool Close(void)
+    {
+        if (!m_Map.IsMapped())
+            return true;
+
+        bool bWritable = m_bWritable;
+        off_t Size = static_cast<off_t>(Used());
+        bool bResult = !bWritable || m_Map.Sync();
+        Unmap();
+
+        if (bWritable && bResult)
+            bResult = 0 == ::truncate(m_Path.c_str(), Size);
+        return bResult;
+    }
+
+    // Выделить size байт с выравниванием align (степень двойки).
+    // Возвращает NULL, если место кончилось или арена только для чтения
+    void* Alloc(IN size_t size, IN size_t align = alignof(std::max_align_t))
+    {
+        if (!m_bWritable)
+            return NULL;
+
+        Header* pHeader = GetHeader();
+        uint64_t Top = pHeader->m_Used.load(std::memory_order_relaxed), Begin;
+        do
+        {
+            Begin = (Top + align - 1) & ~uint64_t(align - 1);
+            if (Begin + size > m_Map.Size() || Begin + size < Begin)
+                return NULL;
+        }
+        while (!pHeader->m_Used.compare_exchange_weak(Top, Begin + size, std::memory_order_relaxed));
+
+        return static_cast<char*>(m_Map.Get()) + Begin;
+    }
+
+    // Создать объект типа T в арене, аргументы передаются конструктору.
+    // При нехватке места генерируется std::bad_alloc
+    template<typename T, typename... A>
+    T* New(A&&... args)
+    {
+        static_assert(!std::is_polymorphic<T>::value, "Arena objects cannot have virtual functions");
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+
+        void* ptr = Alloc(sizeof(T), alignof(T));
+        if (!ptr)
+            throw std::bad_alloc();
+        return ::new (ptr) T(std::forward<A>(args)...);
+    }
+
+    // Создать массив из count объектов типа T в арене
+    template<typename T>
+    T* NewArray(IN size_t count)
+    {
+        static_assert(!std::is_polymorphic<T>::value, "Arena objects cannot have virtual functions");
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+
+        void* ptr = count <= SIZE_MAX / sizeof(T) ? Alloc(count * sizeof(T), alignof(T)) : NULL;
+        if (!ptr)
+            throw std::bad_alloc();
+        T* first = static_cast<T*>(ptr);
+        for (size_t i = 0; i < count; ++i)
+            ::new (static_cast<void*>(first + i)) T();
+        return first;
+    }
+
+    // Запомнить корень графа (объект арены) в заголовке
+    void SetRoot(IN const void* ptr)
+    {
+        GetHeader()->m_Root = ptr ? static_cast<uint64_t>(static_cast<const char*>(ptr) - static_cast<const char*>(m_Map.Get())) : 0;
+    }
+
+    // Корень графа, NULL если он не задан
+    template<typename T>
+    T* Root(void) const
+    {
+        if (!m_Map.IsMapped() || !GetHeader()->m_Root)
+            return NULL;
+        return reinterpret_cast<T*>(static_cast<char*>(m_Map.Get()) + GetHeader()->m_Root);
+    }
+
+    // Адрес принадлежит арене
+    bool Contains(IN const void* ptr) const
+    {
+        return m_Map.IsMapped() && ptr >= m_Map.Get() && static_cast<const char*>(ptr) < static_cast<const char*>(m_Map.Get()) + m_Map.Size();
+    }
+
+    // Арена открыта
+    bool IsOpen(void) const { return m_Map.IsMapped(); }
+    // Арена открыта для записи
+    bool IsWritable(void) const { return m_bWritable; }
+    // Занято байтов, включая заголовок
+    size_t Used(void) const { return m_Map.IsMapped() ? static_cast<size_t>(GetHeader()->m_Used.load(std::memory_order_relaxed)) : 0; }
+    // Размер отображения
+    size_t Capacity(void) const { return m_Map.Size(); }
+
+    // Точка подключения для XQBS_ArenaScope
+    XQBS_ArenaHook* Hook(void) { return &m_Hook; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Направить выделения памяти семейства XQBS_new текущего потока (все, что
+// идет через XQBS_mem_alloc) в арену на время жизни объекта. Области могут
+// быть вложенными. Объекты с выравниванием больше std::max_align_t создаются
+// выражением new и в арену не попадают
+class XQBS_ArenaScope
+{
+private:
+
+    XQBS_ArenaHook* m_pPrev; // Арена внешней области
+
+    // Область не копируется
+    XQBS_ArenaScope(const XQBS_ArenaScope&);
+    XQBS_ArenaScope& operator= (const XQBS_ArenaScope&);
+
+public:
+
+    // Конструктор
+    explicit XQBS_ArenaScope(IN XQBS_MmapArena& arena) : m_pPrev(XQBS_ArenaCurrent()) { XQBS_ArenaCurrent() = arena.Hook(); }
+
+    // Деструктор
+    ~XQBS_ArenaScope() { XQBS_ArenaCurrent() = m_pPrev; }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !_WIN32
+
+#endif // !XQBS_ARENA_H
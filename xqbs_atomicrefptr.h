@@ -0,0 +1,284 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_atomicrefptr.h
+*
+*/
+
+#ifndef XQBS_ATOMICREFPTR_H
+#define XQBS_ATOMICREFPTR_H
+
+#include <atomic>
+#include <thread>
+
+#include "xqbs_defs.h"
+#include "xqbs_refptr.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Указатель-опасность (hazard pointer) потока для XQBS_AtomicRefPtr.
+// Пока поток загружает указатель из слота и добавляет ссылку, адрес объекта
+// лежит в m_pHazard, и писатель не отпускает ссылку слота на этот объект.
+// Записи никогда не освобождаются, запись завершившегося потока
+// достается следующему новому потоку
+struct alignas(XQBS_CACHE_LINE) XQBS_HazardRecord
+{
+    std::atomic<const void*> m_pHazard; // Защищаемый объект или NULL
+    std::atomic<bool>        m_InUse;   // Запись занята потоком
+    XQBS_HazardRecord*       m_pNext;   // Следующая запись в списке всех записей
+
+    // Конструктор
+    XQBS_HazardRecord() : m_pHazard(NULL), m_InUse(true), m_pNext(NULL) {}
+
+    // Запись текущего потока, NULL если поток уже завершается
+    static XQBS_HazardRecord* Current(void);
+    // Первое обращение потока к Current: захват записи и регистрация обработчика завершения
+    static XQBS_HazardRecord* CurrentSlow(void);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Список записей всех потоков (никогда не разрушается)
+class XQBS_HazardDomain
+{
+private:
+
+    std::atomic<XQBS_HazardRecord*> m_pRecords; // Записи всех потоков
+
+    // Конструктор
+    XQBS_HazardDomain() : m_pRecords(NULL) {}
+
+public:
+
+    // Единственный экземпляр
+    static XQBS_HazardDomain& Instance(void)
+    {
+        static XQBS_HazardDomain* s_pDomain = new XQBS_HazardDomain();
+        return *s_pDomain;
+    }
+
+    // Занять свободную запись или создать новую
+    XQBS_HazardRecord* Acquire(void)
+    {
+        for (XQBS_HazardRecord* pRecord = m_pRecords.load(std::memory_order_acquire); pRecord; pRecord = pRecord->m_pNext)
+        {
+            bool InUse = false;
+            if (!pRecord->m_InUse.load(std::memory_order_relaxed) &&
+                pRecord->m_InUse.compare_exchange_strong(InUse, true, std::memory_order_acquire, std::memory_order_relaxed))
+                return pRecord;
+        }
+
+        XQBS_HazardRecord* pRecord = new XQBS_HazardRecord();
+        XQBS_HazardRecord* Head = m_pRecords.load(std::memory_order_relaxed);
+        do
+        {
+            pRecord->m_pNext = Head;
+        }
+        while (!m_pRecords.compare_exchange_weak(Head, pRecord, std::memory_order_release, std::memory_order_relaxed));
+        return pRecord;
+    }
+
+    // Освободить запись
+    void Release(IN XQBS_HazardRecord* pRecord) { pRecord->m_InUse.store(false, std::memory_order_release); }
+
+    // Дождаться, пока ни один поток не защищает объект ptr. Новые потоки
+    // защитить его уже не могут: вызывающий код убрал объект из слота
+    void WaitUnprotected(IN const void* ptr)
+    {
+        for (XQBS_HazardRecord* pRecord = m_pRecords.load(std::memory_order_acquire); pRecord; pRecord = pRecord->m_pNext)
+        {
+            while (pRecord->m_pHazard.load(std::memory_order_seq_cst) == ptr)
+                std::this_thread::yield();
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Завершение потока: освобождаем запись для следующих потоков
+struct XQBS_HazardThreadExit
+{
+    XQBS_HazardRecord* m_pRecord; // Запись текущего потока
+
+    XQBS_HazardThreadExit() : m_pRecord(NULL) {}
+    ~XQBS_HazardThreadExit();
+};
+
+// Запись текущего потока (без проверки инициализации thread_local)
+inline XQBS_HazardRecord*& XQBS_HazardThreadSlot(void)
+{
+    static thread_local XQBS_HazardRecord* t_pRecord = NULL;
+    return t_pRecord;
+}
+
+// Признак того, что текущий поток уже завершается
+inline bool& XQBS_HazardThreadDead(void)
+{
+    static thread_local bool t_Dead = false;
+    return t_Dead;
+}
+
+inline XQBS_HazardThreadExit::~XQBS_HazardThreadExit()
+{
+    XQBS_HazardThreadDead() = true;
+    XQBS_HazardThreadSlot() = NULL;
+    if (m_pRecord)
+        XQBS_HazardDomain::Instance().Release(m_pRecord);
+}
+
+XQBS_FORCEINLINE XQBS_HazardRecord* XQBS_HazardRecord::Current(void)
+{
+    XQBS_HazardRecord* pRecord = XQBS_HazardThreadSlot();
+    if (XQBS_LIKELY(pRecord != NULL))
+        return pRecord;
+
+    return CurrentSlow();
+}
+
+XQBS_NOINLINE inline XQBS_HazardRecord* XQBS_HazardRecord::CurrentSlow(void)
+{
+    if (XQBS_HazardThreadDead())
+        return NULL;
+
+    static thread_local XQBS_HazardThreadExit t_Exit;
+    XQBS_HazardRecord* pRecord = XQBS_HazardDomain::Instance().Acquire();
+    t_Exit.m_pRecord = pRecord;
+    XQBS_HazardThreadSlot() = pRecord;
+    return pRecord;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Атомарный слот со ссылкой на объект для данных, которые часто читают и
+// редко заменяют (снимок конфигурации, таблица маршрутизации): аналог
+// std::atomic<std::shared_ptr<T>> для интрузивного счетчика ссылок.
+//
+// Читатель получает XQBS_RefPtr на текущую версию без блокировок: Load
+// публикует адрес объекта в указателе-опасности своего потока, проверяет,
+// что слот за это время не изменился, и добавляет ссылку. Писатель атомарно
+// меняет указатель в слоте (Store, Exchange, CompareExchange) и, прежде чем
+// отпустить ссылку слота на старую версию, ждет читателей, которые успели
+// опубликовать ее адрес. Окно читателя - одна загрузка и AddRef, поэтому
+// ожидание короткое. Старая версия уничтожается обычным Release, когда ее
+// отпустит последний читатель.
+//
+// Цена Load - AddRef и две атомарные записи в строку кеша своего потока,
+// общих строк кеша с другими читателями нет. Писатели не блокируют читателей
+// и могут работать одновременно.
+// T - это тип объекта (любой класс с AddRef/Release)
+template<class T>
+class XQBS_AtomicRefPtr
+{
+private:
+
+    std::atomic<T*> m_p; // Объект, слот владеет одной ссылкой на него
+
+    // Слот не копируется
+    XQBS_AtomicRefPtr(const XQBS_AtomicRefPtr&);
+    XQBS_AtomicRefPtr& operator= (const XQBS_AtomicRefPtr&);
+
+    // Отпустить ссылку слота на объект, убранный из слота
+    static XQBS_RefPtr<T> Retire(IN T* p)
+    {
+        if (p)
+            XQBS_HazardDomain::Instance().WaitUnprotected(p);
+        return XQBS_RefPtr<T>(p, XQBS_AdoptRef());
+    }
+
+    // Сброс указателя-опасности, в том числе при исключении из AddRef
+    struct HazardReset
+    {
+        XQBS_HazardRecord* m_pRecord;
+        ~HazardReset() { m_pRecord->m_pHazard.store(NULL, std::memory_order_release); }
+    };
+
+    // Load в потоке, который уже завершается и не имеет своей записи
+    XQBS_NOINLINE XQBS_RefPtr<T> LoadOrphan(void) const
+    {
+        XQBS_HazardRecord* pRecord = XQBS_HazardDomain::Instance().Acquire();
+        XQBS_RefPtr<T> p;
+        try { p = Load(pRecord); }
+        catch (...) { XQBS_HazardDomain::Instance().Release(pRecord); throw; }
+        XQBS_HazardDomain::Instance().Release(pRecord);
+        return p;
+    }
+
+    // Загрузить объект под защитой записи pRecord
+    XQBS_FORCEINLINE XQBS_RefPtr<T> Load(IN XQBS_HazardRecord* pRecord) const
+    {
+        T* p = m_p.load(std::memory_order_relaxed);
+        if (!p)
+            return XQBS_RefPtr<T>();
+
+        HazardReset reset = { pRecord };
+        for (;;)
+        {
+            pRecord->m_pHazard.store(p, std::memory_order_seq_cst);
+            T* Current = m_p.load(std::memory_order_seq_cst);
+            if (XQBS_LIKELY(Current == p))
+                break;
+            if (!Current)
+                return XQBS_RefPtr<T>();
+            p = Current;
+        }
+
+        return XQBS_RefPtr<T>(p);
+    }
+
+public:
+
+    // Конструктор пустого слота
+    XQBS_AtomicRefPtr() noexcept : m_p(NULL) {}
+    // Конструктор с добавлением новой ссылки на объект p
+    explicit XQBS_AtomicRefPtr(IN T* p) : m_p(p) { if (p) p->AddRef(); }
+    // Конструктор с передачей ссылки из умного указателя
+    explicit XQBS_AtomicRefPtr(IN XQBS_RefPtr<T> p) noexcept : m_p(p.Detach()) {}
+
+    // Деструктор. Одновременных читателей и писателей быть не должно
+    ~XQBS_AtomicRefPtr()
+    {
+        T* p = m_p.load(std::memory_order_relaxed);
+        if (p)
+            p->Release();
+    }
+
+    // Получить ссылку на текущий объект без блокировок
+    XQBS_RefPtr<T> Load(void) const
+    {
+        XQBS_HazardRecord* pRecord = XQBS_HazardRecord::Current();
+        if (XQBS_UNLIKELY(!pRecord))
+            return LoadOrphan();
+        return Load(pRecord);
+    }
+
+    // Заменить объект на p и вернуть прежний объект
+    XQBS_RefPtr<T> Exchange(IN XQBS_RefPtr<T> p)
+    {
+        return Retire(m_p.exchange(p.Detach(), std::memory_order_seq_cst));
+    }
+
+    // Заменить объект на p, ссылка слота на прежний объект отпускается
+    void Store(IN XQBS_RefPtr<T> p) { Exchange(std::move(p)); }
+
+    // Заменить объект на p, только если в слоте лежит expected.
+    // Возвращает false, если слот уже изменился (p остается у вызывающего кода)
+    bool CompareExchange(IN T* expected, IN OUT XQBS_RefPtr<T>& p)
+    {
+        if (!m_p.compare_exchange_strong(expected, p.Get(), std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        p.Detach();
+        Retire(expected);
+        return true;
+    }
+
+    // Очистить слот
+    void Reset(void) { Exchange(XQBS_RefPtr<T>()); }
+
+    // Текущий указатель без добавления ссылки (только для сравнения, например
+    // как expected в CompareExchange: объект может быть уже уничтожен)
+    T* Peek(void) const noexcept { return m_p.load(std::memory_order_acquire); }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_ATOMICREFPTR_H
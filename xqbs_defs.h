@@ -1,17 +1,74 @@
-/*
- * This software is copyright protected (C) 2009 XQBS
- *
- * Author:                Alexey N. Zhirov
- * E-mail:                src@xqbs.ru
- * Module:                xqbs_defs.h
- *
- */
-
-#ifndef XQBS_DEFS_H
-#define XQBS_DEFS_H
-
-#define	_XQBS_BEGIN	namespace XQBS {
-#define	_XQBS_END }
-#define	_XQBS ::XQBS::
-
-#endif //!XQBS_DEFS_H
+/*
+ * This software is copyright protected (C) 2009 XQBS
+ *
+ * Author:                Alexey N. Zhirov
+ * E-mail:                src@xqbs.ru
+ * Module:                xqbs_defs.h
+ *
+ */
+
+#ifndef XQBS_DEFS_H
+#define XQBS_DEFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define	_XQBS_BEGIN	namespace XQBS {
+#define	_XQBS_END }
+#define	_XQBS ::XQBS::
+
+// Типы и аннотации Win32, которых нет за пределами Windows
+#ifndef _WIN32
+#ifndef IN
+#define IN
+#endif
+#ifndef OUT
+#define OUT
+#endif
+typedef int32_t LONG;
+#endif // !_WIN32
+
+// Соглашение о вызове функций CRT (free и т.п.)
+#ifdef _MSC_VER
+#define XQBS_CDECL __cdecl
+#else
+#define XQBS_CDECL
+#endif
+
+// Принудительная подстановка функции, запрет подстановки и пометка редко исполняемого кода
+#if defined(_MSC_VER)
+#define XQBS_FORCEINLINE __forceinline
+#define XQBS_NOINLINE __declspec(noinline)
+#define XQBS_COLD
+#else
+#define XQBS_FORCEINLINE inline __attribute__((always_inline))
+#define XQBS_NOINLINE __attribute__((noinline))
+#define XQBS_COLD __attribute__((cold))
+#endif
+
+// Подсказки предсказателю ветвлений
+#if defined(__GNUC__) || defined(__clang__)
+#define XQBS_LIKELY(x) __builtin_expect(!!(x), 1)
+#define XQBS_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define XQBS_LIKELY(x) (x)
+#define XQBS_UNLIKELY(x) (x)
+#endif
+
+// Упреждающая загрузка в кеш строки, которую скоро будут изменять (адрес может быть любым, в том числе NULL)
+#if defined(__GNUC__) || defined(__clang__)
+#define XQBS_PREFETCH(p) __builtin_prefetch((p), 1)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define XQBS_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define XQBS_PREFETCH(p) ((void)(p))
+#endif
+
+// Размер строки кеша процессора: данные разных потоков, лежащие в одной
+// строке, мешают друг другу (false sharing)
+#ifndef XQBS_CACHE_LINE
+#define XQBS_CACHE_LINE 64
+#endif
+
+#endif //!XQBS_DEFS_H
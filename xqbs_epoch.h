@@ -0,0 +1,415 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_epoch.h
+*
+*/
+
+#ifndef XQBS_EPOCH_H
+#define XQBS_EPOCH_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "xqbs_defs.h"
+#include "xqbs_mem.h"
+#include "xqbs_refbase.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Отложенное уничтожение объектов по эпохам (epoch-based reclamation).
+//
+// После XQBS_EpochStart объекты XQBS_RefBase, XQBS_RefBaseT и XQBS_RefBaseImpl,
+// у которых Release (в том числе из XQBS_release и XQBS_SmartRelease) обнулил
+// счетчик, не уничтожаются в вызвавшем потоке. Они попадают в список текущего
+// потока без блокировок, а фоновый поток уничтожает их, когда глобальная эпоха
+// продвинется на две ступени: к этому времени ни один читатель, вошедший в
+// XQBS_EpochGuard до обнуления счетчика, уже не может видеть объект.
+//
+// Поэтому внутри XQBS_EpochGuard можно читать общие указатели на объекты
+// без AddRef:
+//
+//     std::atomic<CConfig*> g_pConfig;
+//     ...
+//     XQBS_EpochGuard guard;
+//     CConfig* pConfig = g_pConfig.load(std::memory_order_acquire);
+//     pConfig->Lookup(...);  // объект жив до выхода из guard
+//
+// Писатель заменяет указатель и делает Release старому объекту. Внутри guard
+// нельзя вызывать AddRef объекта, полученного без ссылки: его счетчик мог
+// уже обнулиться. Уничтожение откладывается только после XQBS_EpochStart,
+// до него и после XQBS_EpochStop объекты уничтожаются прямо в Release.
+
+// Объект, ожидающий уничтожения
+struct XQBS_EpochNode
+{
+    XQBS_EpochNode* m_pNext;               // Следующий объект в списке
+    void*           m_pObject;             // Объект
+    void          (*m_pfnDestroy)(void*);  // Функция уничтожения объекта
+    uint64_t        m_Epoch;               // Эпоха, в которой объект потерял последнюю ссылку
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Запись потока, участвующего в отложенном уничтожении.
+// Записи никогда не освобождаются, запись завершившегося потока
+// достается следующему новому потоку
+struct XQBS_EpochThread
+{
+    std::atomic<uint64_t>         m_Active;  // 0 - поток вне XQBS_EpochGuard, иначе (эпоха входа << 1) | 1
+    std::atomic<XQBS_EpochNode*>  m_Retired; // Объекты, потерявшие последнюю ссылку в этом потоке
+    std::atomic<bool>             m_InUse;   // Запись занята живым потоком
+    XQBS_EpochThread*             m_pNext;   // Следующая запись в списке всех записей
+    size_t                        m_Nesting; // Глубина вложенности XQBS_EpochGuard
+
+    // Конструктор
+    XQBS_EpochThread() : m_Active(0), m_Retired(NULL), m_InUse(true), m_pNext(NULL), m_Nesting(0) {}
+
+    // Запись текущего потока, NULL если поток уже завершается
+    static XQBS_EpochThread* Current(void);
+    // Первое обращение потока к Current: захват свободной записи или создание новой
+    static XQBS_EpochThread* CurrentSlow(void);
+
+    // Положить объект в список
+    static void Push(IN OUT std::atomic<XQBS_EpochNode*>& List, IN XQBS_EpochNode* pNode)
+    {
+        XQBS_EpochNode* Head = List.load(std::memory_order_relaxed);
+        do
+        {
+            pNode->m_pNext = Head;
+        }
+        while (!List.compare_exchange_weak(Head, pNode, std::memory_order_release, std::memory_order_relaxed));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Общее состояние отложенного уничтожения (никогда не разрушается)
+class XQBS_EpochDomain
+{
+    friend struct XQBS_EpochThread;
+
+private:
+
+    std::atomic<uint64_t>          m_Epoch;    // Глобальная эпоха
+    std::atomic<XQBS_EpochThread*> m_pThreads; // Записи всех потоков
+    std::atomic<XQBS_EpochNode*>   m_Orphans;  // Объекты из завершающихся потоков
+    std::atomic<bool>              m_Running;  // Отложенное уничтожение включено
+
+    std::mutex                     m_Lock;     // Блокировка сбора и продвижения эпохи
+    std::vector<XQBS_EpochNode*>   m_Pending;  // Собранные объекты, ожидающие своей эпохи
+
+    std::mutex                     m_ThreadLock; // Блокировка запуска и остановки фонового потока
+    std::condition_variable        m_Wake;       // Пробуждение фонового потока
+    std::thread                    m_Reclaimer;  // Фоновый поток
+    bool                           m_Stop;       // Фоновый поток должен завершиться
+
+    // Конструктор
+    XQBS_EpochDomain() : m_Epoch(1), m_pThreads(NULL), m_Orphans(NULL), m_Running(false), m_Stop(false) {}
+
+    // Продвинуть эпоху, если все потоки внутри XQBS_EpochGuard уже видели текущую
+    uint64_t TryAdvance(void)
+    {
+        uint64_t Epoch = m_Epoch.load(std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (XQBS_EpochThread* pThread = m_pThreads.load(std::memory_order_acquire); pThread; pThread = pThread->m_pNext)
+        {
+            uint64_t Active = pThread->m_Active.load(std::memory_order_seq_cst);
+            if (Active && (Active >> 1) != Epoch)
+                return Epoch;
+        }
+
+        m_Epoch.store(Epoch + 1, std::memory_order_seq_cst);
+        return Epoch + 1;
+    }
+
+    // Собрать объекты из списков потоков, продвинуть эпоху и вернуть объекты,
+    // которые уже можно уничтожить. Возвращает true, если уничтожать больше нечего
+    bool Collect(IN OUT std::vector<XQBS_EpochNode*>& Ready)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+
+        for (XQBS_EpochThread* pThread = m_pThreads.load(std::memory_order_acquire); pThread; pThread = pThread->m_pNext)
+        {
+            for (XQBS_EpochNode* pNode = pThread->m_Retired.exchange(NULL, std::memory_order_acquire); pNode; pNode = pNode->m_pNext)
+                m_Pending.push_back(pNode);
+        }
+        for (XQBS_EpochNode* pNode = m_Orphans.exchange(NULL, std::memory_order_acquire); pNode; pNode = pNode->m_pNext)
+            m_Pending.push_back(pNode);
+
+        if (m_Pending.empty())
+            return true;
+
+        // Объект, потерявший последнюю ссылку в эпохе E, безопасен начиная с эпохи E + 2
+        uint64_t Epoch = TryAdvance();
+        size_t Keep = 0;
+        for (size_t i = 0; i < m_Pending.size(); ++i)
+        {
+            if (m_Pending[i]->m_Epoch + 2 <= Epoch)
+                Ready.push_back(m_Pending[i]);
+            else
+                m_Pending[Keep++] = m_Pending[i];
+        }
+        m_Pending.resize(Keep);
+
+        return false;
+    }
+
+    // Уничтожить готовые объекты (вне блокировки: деструкторы отпускают вложенные
+    // объекты, и те снова попадают в списки)
+    static void Destroy(IN OUT std::vector<XQBS_EpochNode*>& Ready)
+    {
+        for (size_t i = 0; i < Ready.size(); ++i)
+        {
+            XQBS_EpochNode* pNode = Ready[i];
+            pNode->m_pfnDestroy(pNode->m_pObject);
+            XQBS_delete(pNode);
+        }
+        Ready.clear();
+    }
+
+    // Тело фонового потока
+    void Run(IN std::chrono::milliseconds Period)
+    {
+        std::vector<XQBS_EpochNode*> Ready;
+        std::unique_lock<std::mutex> lock(m_ThreadLock);
+        while (!m_Stop)
+        {
+            m_Wake.wait_for(lock, Period);
+            lock.unlock();
+            Collect(Ready);
+            Destroy(Ready);
+            lock.lock();
+        }
+    }
+
+    // Функция отложенного уничтожения, устанавливается в XQBS_RetireHook
+    static void RetireHook(IN void* pObject, IN void (*pfnDestroy)(void*)) { Instance().Retire(pObject, pfnDestroy); }
+
+public:
+
+    // Единственный экземпляр
+    static XQBS_EpochDomain& Instance(void)
+    {
+        static XQBS_EpochDomain* s_pDomain = new XQBS_EpochDomain();
+        return *s_pDomain;
+    }
+
+    // Текущая глобальная эпоха
+    uint64_t Epoch(void) const { return m_Epoch.load(std::memory_order_relaxed); }
+
+    // Отложить уничтожение объекта pObject функцией pfnDestroy до момента,
+    // когда его не сможет видеть ни один XQBS_EpochGuard
+    void Retire(IN void* pObject, IN void (*pfnDestroy)(void*))
+    {
+        // Отложенное уничтожение выключено: уничтожаем сразу
+        if (!m_Running.load(std::memory_order_acquire))
+        {
+            pfnDestroy(pObject);
+            return;
+        }
+
+        XQBS_EpochNode* pNode = XQBS_new<XQBS_EpochNode>();
+        pNode->m_pObject = pObject;
+        pNode->m_pfnDestroy = pfnDestroy;
+        pNode->m_Epoch = m_Epoch.load(std::memory_order_seq_cst);
+
+        XQBS_EpochThread* pThread = XQBS_EpochThread::Current();
+        XQBS_EpochThread::Push(pThread ? pThread->m_Retired : m_Orphans, pNode);
+    }
+
+    // Включить отложенное уничтожение и запустить фоновый поток,
+    // который раз в Period собирает и уничтожает объекты
+    bool Start(IN std::chrono::milliseconds Period)
+    {
+        std::lock_guard<std::mutex> lock(m_ThreadLock);
+        if (m_Running.load(std::memory_order_relaxed))
+            return false;
+
+        m_Stop = false;
+        m_Running.store(true, std::memory_order_release);
+        m_Reclaimer = std::thread(&XQBS_EpochDomain::Run, this, Period);
+        XQBS_RetireHook().store(&XQBS_EpochDomain::RetireHook, std::memory_order_release);
+        return true;
+    }
+
+    // Выключить отложенное уничтожение, остановить фоновый поток и уничтожить
+    // все отложенные объекты
+    void Stop(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_ThreadLock);
+            if (!m_Running.load(std::memory_order_relaxed))
+                return;
+
+            XQBS_RetireHook().store(NULL, std::memory_order_release);
+            m_Running.store(false, std::memory_order_release);
+            m_Stop = true;
+        }
+        m_Wake.notify_one();
+        m_Reclaimer.join();
+
+        Flush();
+    }
+
+    // Уничтожить все отложенные объекты, в том числе те, которые потеряют последнюю
+    // ссылку при уничтожении отложенных. Ждет выхода читателей из XQBS_EpochGuard,
+    // поэтому не вызывается внутри XQBS_EpochGuard. Возвращает количество уничтоженных объектов
+    size_t Flush(void)
+    {
+        std::vector<XQBS_EpochNode*> Ready;
+        size_t Count = 0;
+
+        while (!Collect(Ready))
+        {
+            if (Ready.empty())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            Count += Ready.size();
+            Destroy(Ready);
+        }
+
+        return Count;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Завершение потока: освобождаем запись для следующих потоков.
+// Отложенные объекты остаются в списке записи и будут собраны фоновым потоком
+struct XQBS_EpochThreadExit
+{
+    XQBS_EpochThread* m_pThread; // Запись текущего потока
+
+    XQBS_EpochThreadExit() : m_pThread(NULL) {}
+    ~XQBS_EpochThreadExit();
+};
+
+// Запись текущего потока (без проверки инициализации thread_local)
+inline XQBS_EpochThread*& XQBS_EpochThreadSlot(void)
+{
+    static thread_local XQBS_EpochThread* t_pThread = NULL;
+    return t_pThread;
+}
+
+// Признак того, что текущий поток уже завершается
+inline bool& XQBS_EpochThreadDead(void)
+{
+    static thread_local bool t_Dead = false;
+    return t_Dead;
+}
+
+inline XQBS_EpochThreadExit::~XQBS_EpochThreadExit()
+{
+    XQBS_EpochThreadDead() = true;
+    XQBS_EpochThreadSlot() = NULL;
+    if (m_pThread)
+        m_pThread->m_InUse.store(false, std::memory_order_release);
+}
+
+XQBS_FORCEINLINE XQBS_EpochThread* XQBS_EpochThread::Current(void)
+{
+    XQBS_EpochThread* pThread = XQBS_EpochThreadSlot();
+    if (XQBS_LIKELY(pThread != NULL))
+        return pThread;
+
+    return CurrentSlow();
+}
+
+XQBS_NOINLINE inline XQBS_EpochThread* XQBS_EpochThread::CurrentSlow(void)
+{
+    if (XQBS_EpochThreadDead())
+        return NULL;
+
+    // Первое обращение из потока: регистрируем обработчик завершения потока
+    static thread_local XQBS_EpochThreadExit t_Exit;
+
+    // Сначала пробуем занять запись завершившегося потока
+    XQBS_EpochDomain& Domain = XQBS_EpochDomain::Instance();
+    XQBS_EpochThread* pThread = Domain.m_pThreads.load(std::memory_order_acquire);
+    for (; pThread; pThread = pThread->m_pNext)
+    {
+        bool InUse = false;
+        if (!pThread->m_InUse.load(std::memory_order_relaxed) &&
+            pThread->m_InUse.compare_exchange_strong(InUse, true, std::memory_order_acquire, std::memory_order_relaxed))
+            break;
+    }
+
+    if (!pThread)
+    {
+        pThread = new XQBS_EpochThread();
+        XQBS_EpochThread* Head = Domain.m_pThreads.load(std::memory_order_relaxed);
+        do
+        {
+            pThread->m_pNext = Head;
+        }
+        while (!Domain.m_pThreads.compare_exchange_weak(Head, pThread, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    t_Exit.m_pThread = pThread;
+    XQBS_EpochThreadSlot() = pThread;
+    return pThread;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Критическая секция читателя: пока объект XQBS_EpochGuard жив, объекты,
+// которые поток прочитал из общих указателей, не будут уничтожены.
+// Секции могут быть вложенными, объект нельзя передавать в другой поток
+class XQBS_EpochGuard
+{
+private:
+
+    XQBS_EpochThread* m_pThread; // Запись текущего потока
+
+    // Секция не копируется
+    XQBS_EpochGuard(const XQBS_EpochGuard&);
+    XQBS_EpochGuard& operator= (const XQBS_EpochGuard&);
+
+public:
+
+    // Войти в критическую секцию
+    XQBS_EpochGuard() : m_pThread(XQBS_EpochThread::Current())
+    {
+        if (m_pThread && 0 == m_pThread->m_Nesting++)
+        {
+            // Объявляем эпоху входа до чтения общих указателей
+            m_pThread->m_Active.store((XQBS_EpochDomain::Instance().Epoch() << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    // Выйти из критической секции
+    ~XQBS_EpochGuard()
+    {
+        if (m_pThread && 0 == --m_pThread->m_Nesting)
+            m_pThread->m_Active.store(0, std::memory_order_release);
+    }
+};
+
+// Включить отложенное уничтожение объектов без ссылок и запустить фоновый поток,
+// который собирает и уничтожает их раз в PeriodMs миллисекунд.
+// Возвращает false, если отложенное уничтожение уже включено
+inline bool XQBS_EpochStart(IN unsigned PeriodMs = 10) { return XQBS_EpochDomain::Instance().Start(std::chrono::milliseconds(PeriodMs)); }
+
+// Выключить отложенное уничтожение: остановить фоновый поток и уничтожить все
+// отложенные объекты. Вызывается при завершении работы, когда другие потоки
+// уже не отпускают объекты
+inline void XQBS_EpochStop(void) { XQBS_EpochDomain::Instance().Stop(); }
+
+// Дождаться выхода читателей и уничтожить все отложенные объекты.
+// Нельзя вызывать внутри XQBS_EpochGuard. Возвращает количество уничтоженных объектов
+inline size_t XQBS_EpochFlush(void) { return XQBS_EpochDomain::Instance().Flush(); }
+
+// Отложить уничтожение произвольного объекта pObject функцией pfnDestroy
+inline void XQBS_EpochRetire(IN void* pObject, IN void (*pfnDestroy)(void*)) { XQBS_EpochDomain::Instance().Retire(pObject, pfnDestroy); }
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_EPOCH_H
@@ -0,0 +1,359 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_fdcloser.h
+*
+*/
+
+#ifndef XQBS_FDCLOSER_H
+#define XQBS_FDCLOSER_H
+
+#ifndef _WIN32
+
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <new>
+#include <mutex>
+#include <thread>
+
+#include "xqbs_defs.h"
+#include "xqbs_smartguard.h"
+
+// Размер очереди дескрипторов фонового потока закрытия (степень двойки)
+#ifndef XQBS_FD_CLOSER_QUEUE
+#define XQBS_FD_CLOSER_QUEUE 1024
+#endif
+
+_XQBS_BEGIN // XQBS namespace
+
+// Статистика фонового закрытия дескрипторов
+struct XQBS_FdCloserStats
+{
+    uint64_t m_Deferred; // Дескриптор передан фоновому потоку
+    uint64_t m_Inline;   // Очередь была полна или поток недоступен, close вызван на месте
+    uint64_t m_Closed;   // Фоновый поток закрыл дескриптор
+    size_t   m_Pending;  // Дескрипторов в очереди сейчас
+
+    XQBS_FdCloserStats() : m_Deferred(0), m_Inline(0), m_Closed(0), m_Pending(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Фоновый поток закрытия дескрипторов. close сокета с неотправленными
+// данными и SO_LINGER, файла на NFS или файла с большим отображением может
+// блокировать поток на миллисекунды, а деструктор XQBS_SmartFd часто работает
+// в потоке цикла событий. Close кладет дескриптор в ограниченную очередь без
+// блокировок (очередь Вьюкова на XQBS_FD_CLOSER_QUEUE ячеек, много
+// производителей и один потребитель) и сразу возвращается, close вызывает
+// фоновый поток. Если очередь полна, поток не удалось запустить или уже
+// вызван Shutdown, дескриптор закрывается на месте - как в XQBS_SmartFd.
+//
+// Поток запускается при первом Close и спит, пока очередь пуста: будит его
+// только тот Close, который застал поток спящим. Номер дескриптора остается
+// занятым до фактического close, поэтому повторно его не выдаст ни open,
+// ни accept. Для завершения программы есть Drain (дождаться закрытия всего,
+// что уже в очереди) и Shutdown (Drain и остановка потока).
+// Экземпляр никогда не разрушается. После fork в дочернем процессе фонового
+// потока нет: там вызовите AfterForkChild, дальнейшие Close пойдут на месте
+class XQBS_FdCloser
+{
+private:
+
+    enum { N = XQBS_FD_CLOSER_QUEUE };
+    static_assert(N > 0 && 0 == (N & (N - 1)), "XQBS_FD_CLOSER_QUEUE must be a power of two");
+
+    // Состояние фонового потока
+    enum { STOPPED, RUNNING, SHUTDOWN };
+
+    // Ячейка очереди
+    struct Cell
+    {
+        std::atomic<size_t> m_Seq; // Позиция, для которой ячейка готова
+        int                 m_Fd;  // Дескриптор
+    };
+
+    Cell                                         m_Cells[N]; // Ячейки
+    alignas(XQBS_CACHE_LINE) std::atomic<size_t> m_Push;     // Позиция записи
+    alignas(XQBS_CACHE_LINE) size_t              m_Pop;      // Позиция чтения (только фоновый поток)
+    alignas(XQBS_CACHE_LINE) std::atomic<size_t> m_Pending;  // Дескрипторов в очереди и в обработке
+    std::atomic<bool>                            m_bSleeping; // Фоновый поток ждет m_Wake
+    bool                                         m_bExited;  // Фоновый поток завершился (под m_Lock)
+    std::atomic<int>                             m_State;    // STOPPED, RUNNING, SHUTDOWN
+    std::atomic<uint64_t>                        m_Deferred; // Статистика XQBS_FdCloserStats
+    std::atomic<uint64_t>                        m_Inline;
+    std::atomic<uint64_t>                        m_Closed;
+    std::mutex                                   m_Lock;     // Защищает сон фонового потока, запуск и остановку
+    std::condition_variable                      m_Wake;     // Пробуждение фонового потока
+    std::condition_variable                      m_Drained;  // Очередь опустела или поток завершился
+
+    // Конструктор
+    XQBS_FdCloser() : m_Push(0), m_Pop(0), m_Pending(0), m_bSleeping(false), m_bExited(false), m_State(STOPPED), m_Deferred(0), m_Inline(0), m_Closed(0)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            m_Cells[i].m_Seq.store(i, std::memory_order_relaxed);
+            m_Cells[i].m_Fd = -1;
+        }
+    }
+
+    // Экземпляр не копируется
+    XQBS_FdCloser(const XQBS_FdCloser&);
+    XQBS_FdCloser& operator= (const XQBS_FdCloser&);
+
+    // Поместить дескриптор в очередь. Возвращает false, если очередь полна
+    bool Push(IN int fd)
+    {
+        size_t Pos = m_Push.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& c = m_Cells[Pos & (N - 1)];
+            size_t Seq = c.m_Seq.load(std::memory_order_acquire);
+            intptr_t Diff = static_cast<intptr_t>(Seq) - static_cast<intptr_t>(Pos);
+
+            if (0 == Diff)
+            {
+                if (m_Push.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+                {
+                    c.m_Fd = fd;
+                    c.m_Seq.store(Pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (Diff < 0)
+            {
+                return false; // ячейку еще не освободил фоновый поток
+            }
+            else
+            {
+                Pos = m_Push.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Взять дескриптор из очереди (только фоновый поток). Возвращает -1, если
+    // очередь пуста или следующую ячейку еще заполняет производитель
+    int Pop(void)
+    {
+        Cell& c = m_Cells[m_Pop & (N - 1)];
+        if (c.m_Seq.load(std::memory_order_acquire) != m_Pop + 1)
+            return -1;
+
+        int fd = c.m_Fd;
+        c.m_Seq.store(m_Pop + N, std::memory_order_release);
+        ++m_Pop;
+        return fd;
+    }
+
+    // Запустить фоновый поток. Возвращает false, если он остановлен или не запустился.
+    // Поток отсоединен: его завершение Shutdown ждет по m_bExited, а в дочернем
+    // процессе после fork ждать нечего
+    XQBS_NOINLINE bool Start(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        int State = m_State.load(std::memory_order_relaxed);
+        if (State != STOPPED)
+            return State == RUNNING;
+
+        try
+        {
+            std::thread(&XQBS_FdCloser::Run, this).detach();
+        }
+        catch (...)
+        {
+            return false;
+        }
+        m_State.store(RUNNING, std::memory_order_seq_cst);
+        return true;
+    }
+
+    // Снять count дескрипторов со счета очереди и разбудить Drain, если очередь опустела
+    void Done(IN size_t count)
+    {
+        if (m_Pending.fetch_sub(count, std::memory_order_acq_rel) == count)
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Drained.notify_all();
+        }
+    }
+
+    // Закрыть все, что осталось в очереди, в текущем потоке
+    void CloseQueued(void)
+    {
+        size_t Count = 0;
+        for (int fd = Pop(); fd >= 0; fd = Pop())
+        {
+            ::close(fd);
+            ++Count;
+        }
+        if (Count)
+            Done(Count);
+    }
+
+    // Цикл фонового потока
+    void Run(void)
+    {
+        for (;;)
+        {
+            size_t Count = 0;
+            for (int fd = Pop(); fd >= 0; fd = Pop())
+            {
+                ::close(fd);
+                ++Count;
+            }
+
+            if (Count)
+            {
+                m_Closed.fetch_add(Count, std::memory_order_relaxed);
+                Done(Count);
+                continue;
+            }
+
+            // Close сначала учитывает дескриптор в m_Pending и только потом
+            // проверяет состояние, поэтому после SHUTDOWN и пустого m_Pending
+            // новых дескрипторов в очереди не появится
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_bSleeping.store(true, std::memory_order_seq_cst);
+            bool bStop = m_State.load(std::memory_order_seq_cst) == SHUTDOWN;
+            if (0 != m_Pending.load(std::memory_order_seq_cst))
+            {
+                // Производитель уже занял ячейку, но еще не заполнил ее
+                m_bSleeping.store(false, std::memory_order_relaxed);
+                lock.unlock();
+                std::this_thread::yield();
+                continue;
+            }
+            if (bStop)
+            {
+                m_bExited = true;
+                m_Drained.notify_all();
+                return;
+            }
+            m_Wake.wait(lock);
+            m_bSleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+public:
+
+    // Единственный экземпляр
+    static XQBS_FdCloser& Instance(void)
+    {
+        static XQBS_FdCloser* s_pCloser = new XQBS_FdCloser();
+        return *s_pCloser;
+    }
+
+    // Закрыть дескриптор в фоновом потоке, если очередь полна - на месте.
+    // Возвращает true, если дескриптор передан фоновому потоку
+    bool Close(IN int fd)
+    {
+        if (fd < 0)
+            return false;
+
+        m_Pending.fetch_add(1, std::memory_order_seq_cst);
+        int State = m_State.load(std::memory_order_seq_cst);
+        if ((XQBS_UNLIKELY(State != RUNNING) && (State == SHUTDOWN || !Start())) || XQBS_UNLIKELY(!Push(fd)))
+        {
+            ::close(fd);
+            m_Inline.fetch_add(1, std::memory_order_relaxed);
+            Done(1);
+            return false;
+        }
+
+        m_Deferred.fetch_add(1, std::memory_order_relaxed);
+        if (m_bSleeping.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Wake.notify_one();
+        }
+        return true;
+    }
+
+    // Дождаться, пока фоновый поток закроет все дескрипторы в очереди.
+    // Если другие потоки продолжают вызывать Close, ожидание может затянуться
+    void Drain(void)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_Drained.wait(lock, [this]() { return 0 == m_Pending.load(std::memory_order_acquire); });
+    }
+
+    // Закрыть все дескрипторы в очереди и остановить фоновый поток, после
+    // этого Close закрывает дескрипторы на месте. Вызывается при завершении программы
+    void Shutdown(void)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        int State = m_State.exchange(SHUTDOWN, std::memory_order_seq_cst);
+        if (State == RUNNING)
+        {
+            m_Wake.notify_one();
+            m_Drained.wait(lock, [this]() { return m_bExited; });
+        }
+    }
+
+    // Вызвать в дочернем процессе сразу после fork: фонового потока там нет,
+    // дескрипторы из очереди (копии родительских) закрываются на месте, и
+    // дальше Close работает без фонового потока. Другие потоки дочернего
+    // процесса в это время не должны вызывать Close
+    void AfterForkChild(void)
+    {
+        m_State.store(SHUTDOWN, std::memory_order_seq_cst);
+        m_bSleeping.store(false, std::memory_order_relaxed);
+        new (&m_Lock) std::mutex();
+        new (&m_Wake) std::condition_variable();
+        new (&m_Drained) std::condition_variable();
+        m_bExited = true;
+        CloseQueued();
+        m_Pending.store(0, std::memory_order_relaxed); // Close родительских потоков, прерванные fork
+    }
+
+    // Статистика
+    XQBS_FdCloserStats Stats(void) const
+    {
+        XQBS_FdCloserStats stats;
+        stats.m_Deferred = m_Deferred.load(std::memory_order_relaxed);
+        stats.m_Inline = m_Inline.load(std::memory_order_relaxed);
+        stats.m_Closed = m_Closed.load(std::memory_order_relaxed);
+        stats.m_Pending = m_Pending.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+// Закрытие дескриптора POSIX в фоновом потоке XQBS_FdCloser, пустое значение -1
+struct XQBS_CloseFdDeferred
+{
+    static int Null(void) { return -1; }
+
+    void operator() (IN int fd) const { XQBS_FdCloser::Instance().Close(fd); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для дескриптора POSIX, закрытие которого может надолго
+// заблокировать поток: как XQBS_SmartFd, но close выполняется в фоновом
+// потоке XQBS_FdCloser. Перемещается в XQBS_SmartFd и обратно через Detach
+struct XQBS_SmartFdDeferred : public XQBS_SmartGuardLink<int, XQBS_CloseFdDeferred>
+{
+    // Конструктор
+    XQBS_SmartFdDeferred() {}
+    // Конструктор
+    XQBS_SmartFdDeferred(IN int fd) : XQBS_SmartGuardLink(fd) {}
+    // Конструктор, fd - переменная вызывающего кода, v - ее значение после закрытия
+    XQBS_SmartFdDeferred(IN OUT int& fd, IN int v) : XQBS_SmartGuardLink(fd, v) {}
+
+    using XQBS_SmartGuardLink::operator=;
+
+    // Дескриптор задан
+    bool IsValid(void) const noexcept { return Get() >= 0; }
+};
+
+static_assert(sizeof(XQBS_SmartFdDeferred) == sizeof(XQBS_SmartGuardLink<int, XQBS_CloseFdDeferred>), "XQBS_SmartFdDeferred must add no state");
+
+// Как XQBS_SmartFdRef, но close выполняется в фоновом потоке XQBS_FdCloser
+typedef XQBS_SmartGuardRef<int, XQBS_CloseFdDeferred> XQBS_SmartFdDeferredRef;
+
+_XQBS_END // !XQBS namespace
+
+#endif // !_WIN32
+
+#endif // !XQBS_FDCLOSER_H
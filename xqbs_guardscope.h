@@ -0,0 +1,226 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_guardscope.h
+*
+*/
+
+#ifndef XQBS_GUARD_SCOPE_H
+#define XQBS_GUARD_SCOPE_H
+
+#include <string.h>
+
+#include <type_traits>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // !_WIN32
+
+#include "xqbs_defs.h"
+#include "xqbs_alloc.h"
+#include "xqbs_smartguard.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Когда выполнять действие очистки XQBS_GuardScope
+enum XQBS_GuardKind
+{
+    XQBS_GUARD_ALWAYS,   // Всегда при выходе из области видимости
+    XQBS_GUARD_ROLLBACK  // Только при откате: если не был вызван Commit
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Стек действий очистки для функций, которые захватывают много ресурсов.
+// Вместо отдельного SmartGuard-а на каждый ресурс действия записываются
+// в массив внутри самого объекта (N записей по три слова) и выполняются в
+// обратном порядке при выходе из области видимости. Куча используется только
+// после N действий. Отдельное действие можно отменить (Dismiss) по номеру,
+// который вернула функция добавления.
+//
+// Для кода, который создает объект из нескольких частей, есть семантика
+// транзакции: действия XQBS_GUARD_ROLLBACK выполняются только при откате,
+// то есть если до выхода из области видимости не был вызван Commit:
+//
+//     XQBS_GuardScope<> scope;
+//     char* pBuffer = (char*)malloc(size);
+//     scope.Free(pBuffer);                              // временный буфер: всегда
+//     pObject->m_pData = XQBS_new<CData>();
+//     scope.Delete(pObject->m_pData, XQBS_GUARD_ROLLBACK); // часть объекта: только при ошибке
+//     ...
+//     scope.Commit();
+//
+// Функции очистки не должны генерировать исключения.
+// N - это количество действий, которые помещаются без обращения к куче
+template<size_t N = 8>
+class XQBS_GuardScope
+{
+private:
+
+    // Действие очистки
+    struct Entry
+    {
+        void (*m_pfn)(void*); // Функция очистки, NULL - действие отменено
+        void*  m_pArg;        // Параметр функции
+        bool   m_bRollback;   // Выполнять только при откате
+    };
+
+    Entry   m_Inline[N];   // Действия, которые помещаются в сам объект
+    Entry*  m_pEntries;    // Текущий массив действий (m_Inline или куча)
+    size_t  m_Count;       // Количество действий
+    size_t  m_Capacity;    // Емкость текущего массива
+    bool    m_bCommitted;  // Был вызван Commit
+
+    // Область видимости не копируется и не перемещается: записанные действия
+    // относятся к ресурсам конкретного кадра стека
+    XQBS_GuardScope(const XQBS_GuardScope&) = delete;
+    XQBS_GuardScope& operator= (const XQBS_GuardScope&) = delete;
+
+    // Упаковать значение P в параметр функции очистки
+    template<typename P>
+    static void* ToArg(IN P p)
+    {
+        static_assert(std::is_pointer<P>::value || (std::is_integral<P>::value && sizeof(P) <= sizeof(void*)),
+                      "XQBS_GuardScope stores pointers and integral handles only");
+        if constexpr (std::is_pointer<P>::value)
+            return const_cast<void*>(static_cast<const volatile void*>(p));
+        else
+            return reinterpret_cast<void*>(static_cast<intptr_t>(p));
+    }
+
+    // Распаковать значение P из параметра функции очистки
+    template<typename P>
+    static P FromArg(IN void* arg)
+    {
+        if constexpr (std::is_pointer<P>::value)
+            return static_cast<P>(arg);
+        else
+            return static_cast<P>(reinterpret_cast<intptr_t>(arg));
+    }
+
+    // Вызов функции очистки D (из xqbs_smartguard.h) для значения типа P
+    template<typename D, typename P>
+    static void Thunk(IN void* arg) { D()(FromArg<P>(arg)); }
+
+    // Увеличить массив действий, перенеся его в кучу
+    XQBS_NOINLINE void Grow(void)
+    {
+        size_t Capacity = m_Capacity * 2;
+        Entry* pEntries = static_cast<Entry*>(XQBS_mem_alloc(Capacity * sizeof(Entry)));
+        memcpy(pEntries, m_pEntries, m_Count * sizeof(Entry));
+        FreeHeap();
+        m_pEntries = pEntries;
+        m_Capacity = Capacity;
+    }
+
+    // Освободить массив в куче
+    void FreeHeap(void)
+    {
+        if (m_pEntries != m_Inline)
+            XQBS_mem_free(m_pEntries, m_Capacity * sizeof(Entry));
+        m_pEntries = m_Inline;
+        m_Capacity = N;
+    }
+
+public:
+
+    static_assert(N > 0, "XQBS_GuardScope needs inline capacity");
+
+    // Конструктор
+    XQBS_GuardScope() noexcept : m_pEntries(m_Inline), m_Count(0), m_Capacity(N), m_bCommitted(false) {}
+
+    // Деструктор выполняет действия в обратном порядке
+    ~XQBS_GuardScope() { Run(); }
+
+    // Добавить действие pfn(arg) и вернуть его номер для Dismiss.
+    // Если для записи действия не хватило памяти, оно выполняется сразу
+    // и генерируется std::bad_alloc, так что ресурс не теряется
+    size_t Add(IN void (*pfn)(void*), IN void* arg, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS)
+    {
+        if (XQBS_UNLIKELY(m_Count == m_Capacity))
+        {
+            try { Grow(); }
+            catch (...) { pfn(arg); throw; }
+        }
+
+        Entry& e = m_pEntries[m_Count];
+        e.m_pfn = pfn;
+        e.m_pArg = arg;
+        e.m_bRollback = XQBS_GUARD_ROLLBACK == kind;
+        return m_Count++;
+    }
+
+    // Добавить действие функцией очистки D из семейства SmartGuard для значения p
+    template<typename D, typename P>
+    size_t Push(IN P p, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Add(&Thunk<D, P>, ToArg(p), kind); }
+
+    // Освободить память, выделенную функцией malloc
+    size_t Free(IN void* ptr, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Push<XQBS_FreeMemory>(ptr, kind); }
+
+    // Удалить объект, созданный через XQBS_new
+    template<typename T>
+    size_t Delete(IN T* ptr, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Push<XQBS_DeleteObject>(ptr, kind); }
+
+    // Удалить массив объектов, созданный через XQBS_new(size)
+    template<typename T>
+    size_t DeleteArray(IN T* ptr, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Push<XQBS_DeleteObjectArray>(ptr, kind); }
+
+    // Удалить ссылку на объект со счетчиком ссылок
+    template<typename T>
+    size_t Release(IN T* ptr, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Push<XQBS_ReleaseObject>(ptr, kind); }
+
+#ifdef _WIN32
+    // Закрыть дескриптор Windows
+    size_t Close(IN HANDLE h, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return Push<XQBS_GuardFn<&::CloseHandle> >(h, kind); }
+#else
+    // Закрыть файловый дескриптор
+    size_t Close(IN int fd, IN XQBS_GuardKind kind = XQBS_GUARD_ALWAYS) { return fd < 0 ? size_t(-1) : Push<XQBS_GuardFn<&::close> >(fd, kind); }
+#endif // _WIN32
+
+    // Отменить действие с номером id (ресурс остается у вызывающего кода)
+    void Dismiss(IN size_t id) noexcept
+    {
+        if (id < m_Count)
+            m_pEntries[id].m_pfn = NULL;
+    }
+
+    // Отменить все действия
+    void DismissAll(void) noexcept
+    {
+        m_Count = 0;
+        m_bCommitted = false;
+        FreeHeap();
+    }
+
+    // Зафиксировать транзакцию: действия XQBS_GUARD_ROLLBACK выполняться не будут
+    void Commit(void) noexcept { m_bCommitted = true; }
+
+    // Откатить транзакцию: выполнить сейчас все действия, включая XQBS_GUARD_ROLLBACK
+    void Rollback(void)
+    {
+        m_bCommitted = false;
+        Run();
+    }
+
+    // Выполнить сейчас действия в обратном порядке (XQBS_GUARD_ROLLBACK - только если
+    // не было Commit) и очистить стек
+    void Run(void)
+    {
+        while (m_Count)
+        {
+            Entry& e = m_pEntries[--m_Count];
+            if (e.m_pfn && !(e.m_bRollback && m_bCommitted))
+                e.m_pfn(e.m_pArg);
+        }
+        m_bCommitted = false;
+        FreeHeap();
+    }
+
+    // Количество записанных действий (включая отмененные)
+    size_t Size(void) const noexcept { return m_Count; }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_GUARD_SCOPE_H
@@ -1,60 +1,584 @@
-/*
-* This software is copyright protected (C) 2009 XQBS
-*
-* Author:                Alexey N. Zhirov
-* E-mail:                src@xqbs.ru
-* Module:                xqbs_mem.h
-*
-*/
-
-#ifndef XQBS_MEM_H
-#define XQBS_MEM_H
-
-#include "xqbs_defs.h"
-
-_XQBS_BEGIN // XQBS namespace
-
-// Безопасное выделение памяти
-#define XQBS_SAFE_NEW(x) { T* ptr = x; if (!ptr) throw std::bad_alloc(); return ptr; }
-// Безопасное освобождение памяти
-#define XQBS_SAFE_DELETE(x) { if (ptr) { x; ptr = (T*)NULL; } }
-
-// Шаблонная функция для безопасного создания объекта с конструктором по умолчанию
-template<typename T>
-inline T* XQBS_new(void) { XQBS_SAFE_NEW(new T()) }
-
-// Шаблонная функция для безопасного создания массива объектов
-template<typename T>
-inline T* XQBS_new(IN size_t size) { XQBS_SAFE_NEW(new T[size]) }
-
-// Шаблонная функция для безопасного создания объекта с конструктором с одним параметром
-template<typename T, typename A>
-inline T* XQBS_new_ctor1(IN A& p1) { XQBS_SAFE_NEW(new T(p1)) }
-
-// Шаблонная функция для безопасного создания объекта с конструктором с двумя параметрами
-template<typename T, typename A, typename B>
-inline T* XQBS_new_ctor2(IN A& p1, IN B& p2) { XQBS_SAFE_NEW(new T(p1, p2)) }
-
-// Шаблонная функция для безопасного создания объекта с конструктором с тремя параметрами
-template<typename T, typename A, typename B, typename C>
-inline T* XQBS_new_ctor3(IN A& p1, IN B& p2, IN C& p3) { XQBS_SAFE_NEW(new T(p1, p2, p3)) }
-
-// Шаблонная функция для безопасного содания объекта с конструктором с четырьмя параметрами
-template<typename T, typename A, typename B, typename C, typename D>
-inline T* XQBS_new_ctor4(IN A& p1, IN B& p2, IN C& p3, IN D& p4) { XQBS_SAFE_NEW(new T(p1, p2, p3, p4)) }
-
-// Шаблонная функция для безопасного удаления объекта и инициализации указателя
-template<typename T>
-inline void XQBS_delete(IN OUT T*& ptr ) { XQBS_SAFE_DELETE(delete ptr) }
-
-// Шаблонная функция для безопасного удаления массива объектов и инициализации указателя
-template<typename T>
-inline void XQBS_delete_size(IN OUT T*& ptr) { XQBS_SAFE_DELETE(delete [] ptr) }
-
-// Шаблонная функция для безопасного удаления объекта без инициализации указателя
-template<typename T>
-inline void XQBS_delete_ptr(IN T* ptr ) { XQBS_SAFE_DELETE(delete ptr) }
-
-_XQBS_END // !XQBS namespace
-
-#endif // !XQBS_MEM_H
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_mem.h
+*
+*/
+
+#ifndef XQBS_MEM_H
+#define XQBS_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_alloc.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Безопасное выделение памяти
+#define XQBS_SAFE_NEW(x) { T* ptr = x; if (!ptr) throw std::bad_alloc(); return ptr; }
+// Безопасное освобождение памяти
+#define XQBS_SAFE_DELETE(x) { if (ptr) { x; ptr = (T*)NULL; } }
+
+// Размеры последних блоков, выделенных nothrow-формой operator new класса.
+// Если конструктор генерирует исключение, выражение new (std::nothrow) T
+// вызывает operator delete(void*, const std::nothrow_t&), в который размер
+// не передается, а менеджеру памяти он нужен. Поток помнит несколько последних
+// таких блоков: конструктор может успеть создать другие объекты той же формой new.
+// Блок, который не нашелся (больше COUNT вложенных выделений), не освобождается
+class XQBS_NothrowSizes
+{
+private:
+
+    enum { COUNT = 16 };
+
+    void*  m_Ptr[COUNT];  // Блоки
+    size_t m_Size[COUNT]; // Размеры блоков
+    size_t m_Next;        // Номер следующей записи
+
+public:
+
+    // Записи текущего потока
+    static XQBS_NothrowSizes& Current(void)
+    {
+        static thread_local XQBS_NothrowSizes t_Sizes = XQBS_NothrowSizes();
+        return t_Sizes;
+    }
+
+    // Запомнить размер блока ptr
+    void Remember(IN void* ptr, IN size_t size)
+    {
+        m_Ptr[m_Next % COUNT] = ptr;
+        m_Size[m_Next % COUNT] = size;
+        ++m_Next;
+    }
+
+    // Найти и забыть размер блока ptr, ноль если блок не найден
+    size_t Recall(IN void* ptr)
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            size_t n = (m_Next - 1 - i) % COUNT;
+            if (m_Ptr[n] == ptr)
+            {
+                m_Ptr[n] = NULL;
+                return m_Size[n];
+            }
+        }
+        return 0;
+    }
+};
+
+// Выделить size байт функцией alloc для nothrow-формы operator new класса,
+// NULL при нехватке памяти
+template<typename F>
+inline void* XQBS_nothrow_alloc(IN size_t size, IN F alloc) noexcept
+{
+    try
+    {
+        void* ptr = alloc(size);
+        XQBS_NothrowSizes::Current().Remember(ptr, size);
+        return ptr;
+    }
+    catch (...)
+    {
+        return NULL;
+    }
+}
+
+// Освободить функцией free(ptr, size) блок, выделенный XQBS_nothrow_alloc,
+// когда конструктор объекта сгенерировал исключение
+template<typename F>
+inline void XQBS_nothrow_free(IN void* ptr, IN F free) noexcept
+{
+    size_t size = XQBS_NothrowSizes::Current().Recall(ptr);
+    if (size)
+        free(ptr, size);
+}
+
+// Перенаправление operator new/delete класса в менеджер памяти XQBS_MEM_BACKEND.
+// Используется базовыми классами счетчиков ссылок, чтобы память объектов, созданных
+// как через XQBS_new, так и обычным new, возвращалась в тот же менеджер памяти
+// (при удалении через виртуальный деструктор operator delete получает размер потомка)
+#define XQBS_CLASS_ALLOCATOR \
+    typedef void XQBS_ClassAllocated; \
+    static void* operator new(size_t size) { return _XQBS XQBS_mem_alloc(size); } \
+    static void* operator new(size_t size, std::align_val_t al) { return ::operator new(size, al); } \
+    static void* operator new(size_t, void* where) noexcept { return where; } \
+    static void* operator new(size_t size, const std::nothrow_t&) noexcept { return _XQBS XQBS_nothrow_alloc(size, &_XQBS XQBS_mem_alloc); } \
+    static void operator delete(void* ptr, size_t size) { _XQBS XQBS_mem_free(ptr, size); } \
+    static void operator delete(void* ptr, const std::nothrow_t&) noexcept { _XQBS XQBS_nothrow_free(ptr, &_XQBS XQBS_mem_free); } \
+    static void operator delete(void* ptr, size_t, std::align_val_t al) { ::operator delete(ptr, al); } \
+    static void operator delete(void*, void*) noexcept {}
+
+// Мета-функция для определения классов с собственным operator new
+template<typename T, typename = void> struct XQBS_HasClassNew : std::false_type {};
+template<typename T> struct XQBS_HasClassNew<T, decltype((void)T::operator new(size_t(1)))> : std::true_type {};
+
+// Мета-функция для определения классов с XQBS_CLASS_ALLOCATOR
+template<typename T, typename = void> struct XQBS_HasClassAllocator : std::false_type {};
+template<typename T> struct XQBS_HasClassAllocator<T, typename T::XQBS_ClassAllocated> : std::true_type {};
+
+// Мета-функция, определяющая, что объект создается и удаляется выражениями new/delete:
+//  - объект с виртуальным деструктором может удаляться по указателю на базовый класс,
+//    и настоящий размер памяти при удалении знает только выражение delete;
+//  - класс с собственным operator new сам решает, откуда брать память
+//    (у наследников XQBS_RefBase он ведет в менеджер памяти XQBS_MEM_BACKEND);
+//  - менеджер памяти не выравнивает блоки сильнее, чем std::max_align_t.
+// Остальные объекты размещаются прямо в памяти менеджера XQBS_MEM_BACKEND.
+template<typename T> struct XQBS_NewExpression : std::integral_constant<bool,
+    std::has_virtual_destructor<T>::value || XQBS_HasClassNew<T>::value || (alignof(T) > alignof(std::max_align_t))> {};
+
+// Размер заголовка массива, в котором хранится количество элементов
+static const size_t XQBS_ARRAY_COOKIE = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+// Создать объект типа T через менеджер памяти, аргументы передаются конструктору
+template<typename T, typename... A>
+inline T* XQBS_construct(A&&... args)
+{
+    T* ptr;
+    if constexpr (XQBS_NewExpression<T>::value)
+    {
+        ptr = new T(std::forward<A>(args)...);
+        // Память выражения new учитывает только operator new из XQBS_CLASS_ALLOCATOR
+        if constexpr (!XQBS_HasClassAllocator<T>::value)
+            XQBS_MemStatsAlloc(sizeof(T));
+    }
+    else
+    {
+        void* p = XQBS_mem_alloc(sizeof(T));
+        try { ptr = ::new (p) T(std::forward<A>(args)...); }
+        catch (...) { XQBS_mem_free(p, sizeof(T)); throw; }
+    }
+    XQBS_MemStatsNew<T>(1);
+    return ptr;
+}
+
+// Размер заголовка массива объектов типа T: не меньше XQBS_ARRAY_COOKIE
+// и кратен выравниванию T, чтобы первый элемент был выровнен
+template<typename T> struct XQBS_ArrayCookie : std::integral_constant<size_t,
+    (alignof(T) > XQBS_ARRAY_COOKIE) ? alignof(T) : XQBS_ARRAY_COOKIE> {};
+
+// Выделить блок массива объектов типа T. Менеджер памяти не выравнивает блоки
+// сильнее, чем std::max_align_t, такие массивы берут память у глобального operator new
+template<typename T>
+inline void* XQBS_array_alloc(IN size_t bytes)
+{
+    if constexpr (alignof(T) > alignof(std::max_align_t))
+    {
+        void* p = ::operator new(bytes, std::align_val_t(alignof(T)));
+        XQBS_MemStatsAlloc(bytes);
+        return p;
+    }
+    else
+    {
+        return XQBS_mem_alloc(bytes);
+    }
+}
+
+// Освободить блок, выделенный XQBS_array_alloc<T>(bytes)
+template<typename T>
+inline void XQBS_array_free(IN void* p, IN size_t bytes)
+{
+    if constexpr (alignof(T) > alignof(std::max_align_t))
+    {
+        XQBS_MemStatsFree(bytes);
+        ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+    else
+    {
+        XQBS_mem_free(p, bytes);
+    }
+}
+
+// Создать массив из size объектов типа T через менеджер памяти.
+// Количество элементов хранится в заголовке перед массивом, как у new[]
+template<typename T>
+inline T* XQBS_construct_array(IN size_t size)
+{
+    const size_t cookie = XQBS_ArrayCookie<T>::value;
+    if (size > (SIZE_MAX - cookie) / sizeof(T))
+        throw std::bad_array_new_length();
+
+    size_t bytes = cookie + size * sizeof(T);
+    char* p = static_cast<char*>(XQBS_array_alloc<T>(bytes));
+    *reinterpret_cast<size_t*>(p) = size;
+
+    T* first = reinterpret_cast<T*>(p + cookie);
+    size_t i = 0;
+    try
+    {
+        for (; i < size; ++i)
+            ::new (static_cast<void*>(first + i)) T;
+    }
+    catch (...)
+    {
+        while (i)
+            first[--i].~T();
+        XQBS_array_free<T>(p, bytes);
+        throw;
+    }
+    XQBS_MemStatsNew<T>(size);
+    return first;
+}
+
+// Удалить массив, созданный XQBS_construct_array. Массив в арене не удаляется
+template<typename T>
+inline void XQBS_destruct_array(IN T* ptr)
+{
+    if (XQBS_InArena(ptr))
+        return;
+
+    const size_t cookie = XQBS_ArrayCookie<T>::value;
+    char* p = (char*)ptr - cookie;
+    size_t size = *reinterpret_cast<size_t*>(p);
+    XQBS_MemStatsDelete<T>(NULL, size);
+    for (size_t i = size; i > 0; --i)
+        ptr[i - 1].~T();
+    XQBS_array_free<T>(p, cookie + size * sizeof(T));
+}
+
+// Семейство XQBS_new/XQBS_delete размещает объекты и массивы в менеджере памяти
+// XQBS_MEM_BACKEND (см. xqbs_alloc.h). Память XQBS_new освобождается только
+// XQBS_delete, XQBS_delete_ptr и гардом XQBS_SmartDelete, память XQBS_new(size) -
+// только XQBS_delete_size и гардом XQBS_SmartDeleteArray. Смешивать их с
+// выражениями new и delete нельзя (кроме объектов, для которых XQBS_NewExpression).
+// Внутри XQBS_ArenaScope объекты и массивы XQBS_new размещаются в арене, а
+// XQBS_delete объектов любой открытой арены (в том числе XQBS_MmapArena::New)
+// ничего не делает: арена освобождается целиком, без вызова деструкторов.
+// В разбивке статистики по типам такие объекты остаются живыми
+
+// Шаблонная функция для безопасного создания объекта с конструктором по умолчанию
+template<typename T>
+inline T* XQBS_new(void) { XQBS_SAFE_NEW(XQBS_construct<T>()) }
+
+// Шаблонная функция для безопасного создания массива объектов
+template<typename T>
+inline T* XQBS_new(IN size_t size) { XQBS_SAFE_NEW(XQBS_construct_array<T>(size)) }
+
+// Шаблонная функция для безопасного создания объекта, аргументы передаются конструктору
+// без копирования (временные объекты перемещаются, ссылки остаются ссылками).
+// Единственный целочисленный аргумент означает размер массива, как в XQBS_new(size),
+// для конструктора с одним целочисленным параметром используйте XQBS_new_ctor1
+template<typename T, typename A1, typename... A,
+         typename = typename std::enable_if<(sizeof...(A) > 0) || !std::is_integral<typename std::decay<A1>::type>::value>::type>
+inline T* XQBS_new(IN A1&& p1, IN A&&... args) { XQBS_SAFE_NEW(XQBS_construct<T>(std::forward<A1>(p1), std::forward<A>(args)...)) }
+
+// Шаблонная функция для безопасного создания объекта с конструктором с одним параметром
+// (оставлена для совместимости, новый код использует XQBS_new<T>(args...))
+template<typename T, typename A>
+inline T* XQBS_new_ctor1(IN A& p1) { XQBS_SAFE_NEW(XQBS_construct<T>(p1)) }
+
+// Шаблонная функция для безопасного создания объекта с конструктором с двумя параметрами
+// (оставлена для совместимости, новый код использует XQBS_new<T>(args...))
+template<typename T, typename A, typename B>
+inline T* XQBS_new_ctor2(IN A& p1, IN B& p2) { XQBS_SAFE_NEW(XQBS_construct<T>(p1, p2)) }
+
+// Шаблонная функция для безопасного создания объекта с конструктором с тремя параметрами
+// (оставлена для совместимости, новый код использует XQBS_new<T>(args...))
+template<typename T, typename A, typename B, typename C>
+inline T* XQBS_new_ctor3(IN A& p1, IN B& p2, IN C& p3) { XQBS_SAFE_NEW(XQBS_construct<T>(p1, p2, p3)) }
+
+// Шаблонная функция для безопасного содания объекта с конструктором с четырьмя параметрами
+// (оставлена для совместимости, новый код использует XQBS_new<T>(args...))
+template<typename T, typename A, typename B, typename C, typename D>
+inline T* XQBS_new_ctor4(IN A& p1, IN B& p2, IN C& p3, IN D& p4) { XQBS_SAFE_NEW(XQBS_construct<T>(p1, p2, p3, p4)) }
+
+// Шаблонная функция для безопасного удаления объекта без инициализации указателя.
+// Удаление выполняется прямо здесь, а не во вспомогательной функции: классы с закрытым
+// деструктором объявляют другом именно XQBS_delete_ptr.
+// Для объекта в арене ничего не делает: ни деструктора, ни освобождения памяти
+template<typename T>
+inline void XQBS_delete_ptr(IN T* ptr )
+{
+    if (XQBS_InArena(ptr))
+        return;
+
+    if constexpr (XQBS_NewExpression<T>::value)
+    {
+        if constexpr (XQBS_HasClassAllocator<T>::value)
+            XQBS_SAFE_DELETE(XQBS_MemStatsDelete<T>(ptr, 1); delete ptr)
+        else
+            XQBS_SAFE_DELETE(XQBS_MemStatsFree(XQBS_MemStatsDelete<T>(ptr, 1)); delete ptr)
+    }
+    else
+    {
+        XQBS_SAFE_DELETE(XQBS_MemStatsDelete<T>(ptr, 1); ptr->~T(); XQBS_mem_free((void*)ptr, sizeof(T)))
+    }
+}
+
+// Шаблонная функция для безопасного удаления объекта и инициализации указателя
+template<typename T>
+inline void XQBS_delete(IN OUT T*& ptr ) { XQBS_SAFE_DELETE(XQBS_delete_ptr(ptr)) }
+
+// Шаблонная функция для безопасного удаления массива объектов и инициализации указателя
+template<typename T>
+inline void XQBS_delete_size(IN OUT T*& ptr) { XQBS_SAFE_DELETE(XQBS_destruct_array(ptr)) }
+
+// Заголовок блока XQBS_new_aligned, лежит непосредственно перед первым объектом
+struct XQBS_AlignedHeader
+{
+    size_t m_Count; // Количество объектов
+    size_t m_Align; // Выравнивание блока
+};
+
+// Создать count объектов типа T, выровненных на align байт (степень двойки).
+// Заголовок с количеством и выравниванием занимает align байт перед объектами.
+// Одиночный объект получает аргументы args, элементы массива создаются конструктором по умолчанию
+template<typename T, typename... A>
+inline T* XQBS_construct_aligned(IN size_t count, IN size_t align, IN A&&... args)
+{
+    static_assert(!XQBS_HasClassAllocator<T>::value, "Self-deleting objects cannot be allocated by XQBS_new_aligned");
+
+    if (!align || (align & (align - 1)))
+        // В этом месте вы должны использовать свой класс исключений!
+        throw std::invalid_argument("Alignment must be a power of two");
+    if (align < alignof(T))
+        align = alignof(T);
+    if (align < sizeof(XQBS_AlignedHeader))
+        align = sizeof(XQBS_AlignedHeader);
+    if (count > (SIZE_MAX - align) / sizeof(T))
+        throw std::bad_array_new_length();
+
+    char* p = static_cast<char*>(::operator new(align + count * sizeof(T), std::align_val_t(align)));
+    XQBS_MemStatsAlloc(align + count * sizeof(T));
+    T* first = reinterpret_cast<T*>(p + align);
+    XQBS_AlignedHeader* pHeader = reinterpret_cast<XQBS_AlignedHeader*>(first) - 1;
+    pHeader->m_Count = count;
+    pHeader->m_Align = align;
+
+    size_t i = 0;
+    try
+    {
+        if (1 == count)
+            ::new (static_cast<void*>(first)) T(std::forward<A>(args)...);
+        else
+            for (; i < count; ++i)
+                ::new (static_cast<void*>(first + i)) T;
+    }
+    catch (...)
+    {
+        while (i)
+            first[--i].~T();
+        XQBS_MemStatsFree(align + count * sizeof(T));
+        ::operator delete(p, std::align_val_t(align));
+        throw;
+    }
+    XQBS_MemStatsNew<T>(count);
+    return first;
+}
+
+// Удалить объекты, созданные XQBS_construct_aligned
+template<typename T>
+inline void XQBS_destruct_aligned(IN T* ptr)
+{
+    XQBS_AlignedHeader* pHeader = reinterpret_cast<XQBS_AlignedHeader*>(ptr) - 1;
+    size_t count = pHeader->m_Count, align = pHeader->m_Align;
+    XQBS_MemStatsDelete<T>(NULL, count);
+    for (size_t i = count; i > 0; --i)
+        ptr[i - 1].~T();
+    XQBS_MemStatsFree(align + count * sizeof(T));
+    ::operator delete(reinterpret_cast<char*>(ptr) - align, std::align_val_t(align));
+}
+
+// Шаблонная функция для безопасного создания объекта, выровненного на A байт
+// (например на строку кеша), аргументы передаются конструктору без копирования
+template<typename T, size_t A, typename... Args>
+inline T* XQBS_new_aligned(IN Args&&... args) { XQBS_SAFE_NEW(XQBS_construct_aligned<T>(1, A, std::forward<Args>(args)...)) }
+
+// Шаблонная функция для безопасного создания массива объектов, выровненного на align байт
+// (например для обработки SIMD-инструкциями)
+template<typename T>
+inline T* XQBS_new_aligned(IN size_t size, IN size_t align) { XQBS_SAFE_NEW(XQBS_construct_aligned<T>(size, align)) }
+
+// Шаблонная функция для безопасного удаления объекта или массива, созданного
+// через XQBS_new_aligned, и инициализации указателя
+template<typename T>
+inline void XQBS_delete_aligned(IN OUT T*& ptr) { XQBS_SAFE_DELETE(XQBS_destruct_aligned(ptr)) }
+
+///////////////////////////////////////////////////////////////////////////////
+// Пакет из N объектов типа T, созданных в одном непрерывном блоке памяти
+// одним выделением. Объекты лежат подряд, как массив, и уничтожаются либо
+// по одному (Destroy), либо все сразу (Clear или деструктор пакета).
+// Живые объекты отмечены битами в конце того же блока, блок освобождается,
+// когда уничтожен последний объект. Пакет не потокобезопасен и только перемещается.
+// Объекты, которые удаляют себя сами (наследники XQBS_RefBase и т.п.),
+// в пакете размещать нельзя
+template<typename T>
+class XQBS_Batch
+{
+    static_assert(!XQBS_HasClassAllocator<T>::value, "Self-deleting objects cannot live in XQBS_Batch");
+
+private:
+
+    T*     m_pObjects; // Первый объект пакета
+    size_t m_Count;    // Количество объектов в блоке
+    size_t m_Live;     // Количество еще не уничтоженных объектов
+
+    // Пакет не копируется
+    XQBS_Batch(const XQBS_Batch&);
+    XQBS_Batch& operator= (const XQBS_Batch&);
+
+    // Смещение битовой карты живых объектов от начала блока
+    static size_t BitsOffset(IN size_t count) { return (count * sizeof(T) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1); }
+    // Размер блока для count объектов
+    static size_t Bytes(IN size_t count) { return BitsOffset(count) + (count + 63) / 64 * sizeof(uint64_t); }
+
+    // Битовая карта живых объектов
+    uint64_t* Bits(void) const { return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(m_pObjects) + BitsOffset(m_Count)); }
+
+    // Выделить блок
+    static void* Alloc(IN size_t bytes)
+    {
+        if constexpr (alignof(T) > alignof(std::max_align_t))
+        {
+            void* ptr = ::operator new(bytes, std::align_val_t(alignof(T)));
+            XQBS_MemStatsAlloc(bytes);
+            return ptr;
+        }
+        else
+        {
+            return XQBS_mem_alloc(bytes);
+        }
+    }
+
+    // Освободить блок
+    void Free(void)
+    {
+        if constexpr (alignof(T) > alignof(std::max_align_t))
+        {
+            XQBS_MemStatsFree(Bytes(m_Count));
+            ::operator delete(static_cast<void*>(m_pObjects), std::align_val_t(alignof(T)));
+        }
+        else
+        {
+            XQBS_mem_free(static_cast<void*>(m_pObjects), Bytes(m_Count));
+        }
+        m_pObjects = NULL;
+        m_Count = m_Live = 0;
+    }
+
+public:
+
+    // Конструктор пустого пакета
+    XQBS_Batch() noexcept : m_pObjects(NULL), m_Count(0), m_Live(0) {}
+
+    // Конструктор пакета из count объектов, каждый создается с копиями аргументов args
+    template<typename... A>
+    explicit XQBS_Batch(IN size_t count, IN const A&... args) : m_pObjects(NULL), m_Count(0), m_Live(0) { Create(count, args...); }
+
+    // Конструктор перемещения
+    XQBS_Batch(IN OUT XQBS_Batch&& r) noexcept : m_pObjects(r.m_pObjects), m_Count(r.m_Count), m_Live(r.m_Live)
+    {
+        r.m_pObjects = NULL;
+        r.m_Count = r.m_Live = 0;
+    }
+
+    // Оператор присваивания перемещением
+    XQBS_Batch& operator= (IN OUT XQBS_Batch&& r) noexcept { XQBS_Batch(std::move(r)).Swap(*this); return *this; }
+
+    // Деструктор уничтожает все живые объекты
+    ~XQBS_Batch() { Clear(); }
+
+    // Уничтожить текущие объекты и создать count новых, каждый с копиями аргументов args.
+    // Если конструктор генерирует исключение, уже созданные объекты уничтожаются
+    template<typename... A>
+    void Create(IN size_t count, IN const A&... args)
+    {
+        Clear();
+        if (!count)
+            return;
+        if (count > (SIZE_MAX / 2) / sizeof(T))
+            throw std::bad_array_new_length();
+
+        T* pObjects = static_cast<T*>(Alloc(Bytes(count)));
+        size_t i = 0;
+        try
+        {
+            for (; i < count; ++i)
+                ::new (static_cast<void*>(pObjects + i)) T(args...);
+        }
+        catch (...)
+        {
+            while (i)
+                pObjects[--i].~T();
+            m_pObjects = pObjects;
+            m_Count = count;
+            Free();
+            throw;
+        }
+
+        m_pObjects = pObjects;
+        m_Count = m_Live = count;
+        XQBS_MemStatsNew<T>(count);
+
+        uint64_t* pBits = Bits();
+        for (size_t w = 0; w < (count + 63) / 64; ++w)
+            pBits[w] = ~uint64_t(0);
+    }
+
+    // Уничтожить один объект по номеру, повторное уничтожение игнорируется
+    void Destroy(IN size_t index)
+    {
+        if (!IsAlive(index))
+            return;
+
+        Bits()[index / 64] &= ~(uint64_t(1) << (index % 64));
+        XQBS_MemStatsDelete<T>(NULL, 1);
+        m_pObjects[index].~T();
+        if (0 == --m_Live)
+            Free();
+    }
+
+    // Уничтожить один объект по указателю на него
+    void Destroy(IN T* ptr) { Destroy(static_cast<size_t>(ptr - m_pObjects)); }
+
+    // Уничтожить все живые объекты и освободить блок
+    void Clear(void)
+    {
+        if (!m_pObjects)
+            return;
+
+        XQBS_MemStatsDelete<T>(NULL, m_Live);
+        uint64_t* pBits = Bits();
+        for (size_t i = m_Count; i > 0; --i)
+        {
+            if (pBits[(i - 1) / 64] & (uint64_t(1) << ((i - 1) % 64)))
+                m_pObjects[i - 1].~T();
+        }
+        Free();
+    }
+
+    // Объект с номером index еще не уничтожен
+    bool IsAlive(IN size_t index) const { return index < m_Count && (Bits()[index / 64] & (uint64_t(1) << (index % 64))); }
+
+    // Обменять содержимое двух пакетов
+    void Swap(IN OUT XQBS_Batch& r) noexcept
+    {
+        std::swap(m_pObjects, r.m_pObjects);
+        std::swap(m_Count, r.m_Count);
+        std::swap(m_Live, r.m_Live);
+    }
+
+    // Первый объект пакета
+    T* Get(void) const noexcept { return m_pObjects; }
+    // Количество объектов в блоке (включая уничтоженные)
+    size_t Size(void) const noexcept { return m_Count; }
+    // Количество живых объектов
+    size_t Live(void) const noexcept { return m_Live; }
+
+    T& operator[] (IN size_t index) const noexcept { return m_pObjects[index]; }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_MEM_H
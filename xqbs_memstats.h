@@ -0,0 +1,636 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_memstats.h
+*
+*/
+
+#ifndef XQBS_MEMSTATS_H
+#define XQBS_MEMSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <stdlib.h>
+#endif
+
+#include "xqbs_defs.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Статистика памяти семейства XQBS_new/XQBS_delete, включается при компиляции:
+//  -DXQBS_MEM_STATS        - количество и байты выделений и освобождений,
+//                            живые байты и их максимум;
+//  -DXQBS_MEM_STATS_TYPES  - дополнительно разбивка по типам объектов.
+// Без этих макросов функции учета пустые и исчезают при подстановке.
+//
+// Учитываются все функции семейства XQBS_new/XQBS_delete (XQBS_new, XQBS_new_ctorN,
+// XQBS_new(size), XQBS_delete, XQBS_delete_ptr, XQBS_delete_size), память менеджера
+// XQBS_MEM_BACKEND (наследники XQBS_RefBase и другие классы с XQBS_CLASS_ALLOCATOR,
+// XQBS_Batch), XQBS_new_aligned и XQBS_huge_alloc. Объекты, которые XQBS_new
+// создает выражением new (с виртуальным деструктором или выравниванием больше
+// std::max_align_t), учитываются самими XQBS_new и XQBS_delete. Объект с
+// виртуальным деструктором, удаленный по указателю на базовый класс, без
+// XQBS_MEM_STATS_TYPES освобождает в статистике sizeof базового класса.
+//
+// Каждый поток считает в своей записи обычными чтением и записью атомарных
+// переменных без блокирующих инструкций, общие атомарные переменные на горячем
+// пути не используются. Суммирование по потокам выполняется только при снимке
+// (XQBS_mem_stats). Поэтому живые байты потока могут быть отрицательными
+// (память освобождена не тем потоком, который ее выделил), а общий максимум
+// живых байтов известен в виде двух оценок: наблюдаемого при снимках (снизу)
+// и суммы максимумов потоков (сверху).
+#if defined(XQBS_MEM_STATS_TYPES) && !defined(XQBS_MEM_STATS)
+#define XQBS_MEM_STATS
+#endif
+
+// Количество типов в разбивке, остальные типы учитываются в первой строке "<other>"
+#ifndef XQBS_MEM_STATS_MAX_TYPES
+#define XQBS_MEM_STATS_MAX_TYPES 256
+#endif
+
+_XQBS_BEGIN // XQBS namespace
+
+// Читаемое имя из имени символа или типа, как его выдает компилятор (std::type_info::name)
+inline std::string XQBS_Demangle(IN const char* name)
+{
+#if defined(__GNUG__)
+    int status = 0;
+    char* pName = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if (pName)
+    {
+        std::string result(pName);
+        free(pName);
+        return result;
+    }
+#endif
+    return name;
+}
+
+// Статистика одного типа объектов
+struct XQBS_MemTypeStats
+{
+    std::string m_Name;        // Имя типа
+    size_t      m_Size;        // sizeof типа
+    uint64_t    m_News;        // Создано объектов
+    uint64_t    m_Deletes;     // Удалено объектов
+    uint64_t    m_NewBytes;    // Байтов в созданных объектах
+    uint64_t    m_DeleteBytes; // Байтов в удаленных объектах
+
+    XQBS_MemTypeStats() : m_Size(0), m_News(0), m_Deletes(0), m_NewBytes(0), m_DeleteBytes(0) {}
+
+    // Живые объекты и байты
+    int64_t LiveObjects(void) const { return int64_t(m_News - m_Deletes); }
+    int64_t LiveBytes(void) const { return int64_t(m_NewBytes - m_DeleteBytes); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Снимок статистики памяти
+struct XQBS_MemStatsSnapshot
+{
+    bool     m_bEnabled;       // Статистика включена при компиляции
+    size_t   m_Threads;        // Потоков со статистикой сейчас
+    uint64_t m_Allocs;         // Выделений
+    uint64_t m_Frees;          // Освобождений
+    uint64_t m_AllocBytes;     // Выделено байтов
+    uint64_t m_FreeBytes;      // Освобождено байтов
+    int64_t  m_LiveBytes;      // Живые байты
+    int64_t  m_PeakBytes;      // Максимум живых байтов, наблюдавшийся при снимках (оценка снизу)
+    int64_t  m_PeakBytesBound; // Сумма максимумов живых байтов потоков (оценка сверху)
+
+    std::vector<XQBS_MemTypeStats> m_Types; // Разбивка по типам (XQBS_MEM_STATS_TYPES), по убыванию живых байтов
+
+    XQBS_MemStatsSnapshot()
+        : m_bEnabled(false), m_Threads(0), m_Allocs(0), m_Frees(0), m_AllocBytes(0), m_FreeBytes(0),
+          m_LiveBytes(0), m_PeakBytes(0), m_PeakBytesBound(0) {}
+
+    // Текстовое представление для журнала
+    std::string ToText(void) const
+    {
+        std::string s;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "allocs %llu, frees %llu, alloc bytes %llu, free bytes %llu, live bytes %lld, peak bytes %lld..%lld, threads %zu\n",
+                 (unsigned long long)m_Allocs, (unsigned long long)m_Frees, (unsigned long long)m_AllocBytes,
+                 (unsigned long long)m_FreeBytes, (long long)m_LiveBytes, (long long)m_PeakBytes,
+                 (long long)m_PeakBytesBound, m_Threads);
+        s += line;
+        for (size_t i = 0; i < m_Types.size(); ++i)
+        {
+            const XQBS_MemTypeStats& t = m_Types[i];
+            snprintf(line, sizeof(line), "  %-48s size %6zu, live %10lld objects %14lld bytes, new %llu, delete %llu\n",
+                     t.m_Name.c_str(), t.m_Size, (long long)t.LiveObjects(), (long long)t.LiveBytes(),
+                     (unsigned long long)t.m_News, (unsigned long long)t.m_Deletes);
+            s += line;
+        }
+        return s;
+    }
+
+    // Представление в JSON для сбора метрик
+    std::string ToJson(void) const
+    {
+        std::string s;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"enabled\":%s,\"threads\":%zu,\"allocs\":%llu,\"frees\":%llu,\"alloc_bytes\":%llu,\"free_bytes\":%llu,"
+                 "\"live_bytes\":%lld,\"peak_bytes\":%lld,\"peak_bytes_bound\":%lld,\"types\":[",
+                 m_bEnabled ? "true" : "false", m_Threads, (unsigned long long)m_Allocs, (unsigned long long)m_Frees,
+                 (unsigned long long)m_AllocBytes, (unsigned long long)m_FreeBytes, (long long)m_LiveBytes,
+                 (long long)m_PeakBytes, (long long)m_PeakBytesBound);
+        s += line;
+        for (size_t i = 0; i < m_Types.size(); ++i)
+        {
+            const XQBS_MemTypeStats& t = m_Types[i];
+            s += i ? ",{\"name\":\"" : "{\"name\":\"";
+            for (size_t c = 0; c < t.m_Name.size(); ++c)
+            {
+                char ch = t.m_Name[c];
+                if ('"' == ch || '\\' == ch)
+                    s += '\\';
+                if (static_cast<unsigned char>(ch) >= 0x20)
+                    s += ch;
+            }
+            snprintf(line, sizeof(line),
+                     "\",\"size\":%zu,\"news\":%llu,\"deletes\":%llu,\"new_bytes\":%llu,\"delete_bytes\":%llu,"
+                     "\"live_objects\":%lld,\"live_bytes\":%lld}",
+                     t.m_Size, (unsigned long long)t.m_News, (unsigned long long)t.m_Deletes,
+                     (unsigned long long)t.m_NewBytes, (unsigned long long)t.m_DeleteBytes,
+                     (long long)t.LiveObjects(), (long long)t.LiveBytes());
+            s += line;
+        }
+        s += "]}";
+        return s;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Счетчики статистики. Каждая запись потока изменяется только своим потоком,
+// поэтому вместо атомарного сложения используется чтение и запись (Add)
+struct XQBS_MemStatsCounters
+{
+    // Счетчики одного типа объектов
+    struct Type
+    {
+        std::atomic<uint64_t> m_News;
+        std::atomic<uint64_t> m_Deletes;
+        std::atomic<uint64_t> m_NewBytes;
+        std::atomic<uint64_t> m_DeleteBytes;
+    };
+
+    std::atomic<uint64_t> m_Allocs;
+    std::atomic<uint64_t> m_Frees;
+    std::atomic<uint64_t> m_AllocBytes;
+    std::atomic<uint64_t> m_FreeBytes;
+    std::atomic<int64_t>  m_PeakBytes; // Максимум живых байтов потока
+
+#ifdef XQBS_MEM_STATS_TYPES
+    Type m_Types[XQBS_MEM_STATS_MAX_TYPES];
+#endif
+
+    XQBS_MemStatsCounters() { Clear(); }
+
+    // Прибавить value к счетчику, который изменяет только текущий поток
+    template<typename V>
+    static XQBS_FORCEINLINE void Add(IN OUT std::atomic<V>& counter, IN V value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Учесть выделение bytes байтов
+    XQBS_FORCEINLINE void Alloc(IN size_t bytes)
+    {
+        Add<uint64_t>(m_Allocs, 1);
+        Add<uint64_t>(m_AllocBytes, bytes);
+
+        int64_t Live = int64_t(m_AllocBytes.load(std::memory_order_relaxed) - m_FreeBytes.load(std::memory_order_relaxed));
+        if (Live > m_PeakBytes.load(std::memory_order_relaxed))
+            m_PeakBytes.store(Live, std::memory_order_relaxed);
+    }
+
+    // Учесть освобождение bytes байтов
+    XQBS_FORCEINLINE void Free(IN size_t bytes)
+    {
+        Add<uint64_t>(m_Frees, 1);
+        Add<uint64_t>(m_FreeBytes, bytes);
+    }
+
+    // Обнулить счетчики
+    void Clear(void)
+    {
+        m_Allocs.store(0, std::memory_order_relaxed);
+        m_Frees.store(0, std::memory_order_relaxed);
+        m_AllocBytes.store(0, std::memory_order_relaxed);
+        m_FreeBytes.store(0, std::memory_order_relaxed);
+        m_PeakBytes.store(0, std::memory_order_relaxed);
+#ifdef XQBS_MEM_STATS_TYPES
+        for (size_t i = 0; i < XQBS_MEM_STATS_MAX_TYPES; ++i)
+        {
+            m_Types[i].m_News.store(0, std::memory_order_relaxed);
+            m_Types[i].m_Deletes.store(0, std::memory_order_relaxed);
+            m_Types[i].m_NewBytes.store(0, std::memory_order_relaxed);
+            m_Types[i].m_DeleteBytes.store(0, std::memory_order_relaxed);
+        }
+#endif
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Запись потока со статистикой. Записи завершившихся потоков не освобождаются,
+// а обнуляются и достаются новым потокам
+struct XQBS_MemStatsThread
+{
+    XQBS_MemStatsCounters m_Counters; // Счетчики потока
+    XQBS_MemStatsThread*  m_pNext;    // Следующая запись в списке
+    bool                  m_bInUse;   // Запись занята потоком
+
+    XQBS_MemStatsThread() : m_pNext(NULL), m_bInUse(true) {}
+
+    // Запись текущего потока, NULL если поток уже завершается
+    static XQBS_MemStatsThread* Current(void);
+    // Первое обращение потока к Current: получение записи
+    static XQBS_MemStatsThread* CurrentSlow(void);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Общее состояние статистики (никогда не разрушается, чтобы переживать статические деструкторы)
+class XQBS_MemStatsRegistry
+{
+private:
+
+    // Зарегистрированный тип объектов
+    struct TypeEntry
+    {
+        const std::type_info* m_pType; // Тип
+        size_t                m_Size;  // sizeof типа
+    };
+
+    std::mutex           m_Lock;       // Блокировка списка записей и итогов
+    XQBS_MemStatsThread* m_pThreads;   // Записи потоков
+    uint64_t             m_Allocs;     // Итоги завершившихся потоков
+    uint64_t             m_Frees;
+    uint64_t             m_AllocBytes;
+    uint64_t             m_FreeBytes;
+    int64_t              m_PeakBound;  // Сумма максимумов завершившихся потоков
+    int64_t              m_PeakSeen;   // Максимум живых байтов по всем снимкам
+
+    TypeEntry            m_TypeTable[XQBS_MEM_STATS_MAX_TYPES]; // Типы, номер 0 - "<other>"
+    std::atomic<size_t>  m_TypeCount;                           // Количество опубликованных типов
+    std::vector<XQBS_MemTypeStats> m_RetiredTypes;              // Итоги типов завершившихся потоков
+
+    XQBS_MemStatsRegistry()
+        : m_pThreads(NULL), m_Allocs(0), m_Frees(0), m_AllocBytes(0), m_FreeBytes(0),
+          m_PeakBound(0), m_PeakSeen(0), m_TypeCount(1), m_RetiredTypes(XQBS_MEM_STATS_MAX_TYPES)
+    {
+        m_TypeTable[0].m_pType = NULL;
+        m_TypeTable[0].m_Size = 0;
+    }
+
+    // Прибавить счетчики потока к итогам завершившихся потоков (под блокировкой)
+    void Retire(IN const XQBS_MemStatsCounters& c)
+    {
+        m_Allocs += c.m_Allocs.load(std::memory_order_relaxed);
+        m_Frees += c.m_Frees.load(std::memory_order_relaxed);
+        m_AllocBytes += c.m_AllocBytes.load(std::memory_order_relaxed);
+        m_FreeBytes += c.m_FreeBytes.load(std::memory_order_relaxed);
+        m_PeakBound += c.m_PeakBytes.load(std::memory_order_relaxed);
+#ifdef XQBS_MEM_STATS_TYPES
+        for (size_t i = 0; i < XQBS_MEM_STATS_MAX_TYPES; ++i)
+            AddType(m_RetiredTypes[i], c.m_Types[i]);
+#endif
+    }
+
+    // Прибавить счетчики типа
+    static void AddType(IN OUT XQBS_MemTypeStats& t, IN const XQBS_MemStatsCounters::Type& c)
+    {
+        t.m_News += c.m_News.load(std::memory_order_relaxed);
+        t.m_Deletes += c.m_Deletes.load(std::memory_order_relaxed);
+        t.m_NewBytes += c.m_NewBytes.load(std::memory_order_relaxed);
+        t.m_DeleteBytes += c.m_DeleteBytes.load(std::memory_order_relaxed);
+    }
+
+public:
+
+    // Единственный экземпляр
+    static XQBS_MemStatsRegistry& Instance(void)
+    {
+        static XQBS_MemStatsRegistry* s_pRegistry = new XQBS_MemStatsRegistry();
+        return *s_pRegistry;
+    }
+
+    // Получить свободную запись или создать новую
+    XQBS_MemStatsThread* Acquire(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (XQBS_MemStatsThread* p = m_pThreads; p; p = p->m_pNext)
+        {
+            if (!p->m_bInUse)
+            {
+                p->m_bInUse = true;
+                return p;
+            }
+        }
+
+        XQBS_MemStatsThread* p = new XQBS_MemStatsThread();
+        p->m_pNext = m_pThreads;
+        m_pThreads = p;
+        return p;
+    }
+
+    // Вернуть запись завершившегося потока: ее счетчики переходят в итоги
+    void Release(IN XQBS_MemStatsThread* p)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        Retire(p->m_Counters);
+        p->m_Counters.Clear();
+        p->m_bInUse = false;
+    }
+
+    // Учесть операцию потока, который уже завершается: сразу в итоги под блокировкой
+    void RecordDead(IN const XQBS_MemStatsCounters& c)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        Retire(c);
+    }
+
+    // Номер типа pType размера size, при переполнении таблицы - 0
+    size_t RegisterType(IN const std::type_info* pType, IN size_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        size_t count = m_TypeCount.load(std::memory_order_relaxed);
+        for (size_t i = 1; i < count; ++i)
+        {
+            if (*m_TypeTable[i].m_pType == *pType)
+                return i;
+        }
+        if (count == XQBS_MEM_STATS_MAX_TYPES)
+            return 0;
+
+        m_TypeTable[count].m_pType = pType;
+        m_TypeTable[count].m_Size = size;
+        m_TypeCount.store(count + 1, std::memory_order_release);
+        return count;
+    }
+
+    // Найти номер зарегистрированного типа без блокировки, SIZE_MAX если тип не зарегистрирован
+    size_t FindType(IN const std::type_info& type, OUT size_t& size) const
+    {
+        size_t count = m_TypeCount.load(std::memory_order_acquire);
+        for (size_t i = 1; i < count; ++i)
+        {
+            if (*m_TypeTable[i].m_pType == type)
+            {
+                size = m_TypeTable[i].m_Size;
+                return i;
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    // Снимок статистики: сумма по записям потоков и итогам завершившихся потоков
+    XQBS_MemStatsSnapshot Snapshot(void)
+    {
+        XQBS_MemStatsSnapshot s;
+#ifdef XQBS_MEM_STATS
+        s.m_bEnabled = true;
+
+        std::lock_guard<std::mutex> lock(m_Lock);
+        s.m_Allocs = m_Allocs;
+        s.m_Frees = m_Frees;
+        s.m_AllocBytes = m_AllocBytes;
+        s.m_FreeBytes = m_FreeBytes;
+        s.m_PeakBytesBound = m_PeakBound;
+
+        std::vector<XQBS_MemTypeStats> types(m_RetiredTypes);
+        for (XQBS_MemStatsThread* p = m_pThreads; p; p = p->m_pNext)
+        {
+            if (!p->m_bInUse)
+                continue;
+
+            const XQBS_MemStatsCounters& c = p->m_Counters;
+            s.m_Threads++;
+            s.m_Allocs += c.m_Allocs.load(std::memory_order_relaxed);
+            s.m_Frees += c.m_Frees.load(std::memory_order_relaxed);
+            s.m_AllocBytes += c.m_AllocBytes.load(std::memory_order_relaxed);
+            s.m_FreeBytes += c.m_FreeBytes.load(std::memory_order_relaxed);
+            s.m_PeakBytesBound += c.m_PeakBytes.load(std::memory_order_relaxed);
+#ifdef XQBS_MEM_STATS_TYPES
+            for (size_t i = 0; i < XQBS_MEM_STATS_MAX_TYPES; ++i)
+                AddType(types[i], c.m_Types[i]);
+#endif
+        }
+
+        s.m_LiveBytes = int64_t(s.m_AllocBytes - s.m_FreeBytes);
+        m_PeakSeen = std::max(m_PeakSeen, s.m_LiveBytes);
+        s.m_PeakBytes = m_PeakSeen;
+        s.m_PeakBytesBound = std::max(s.m_PeakBytesBound, s.m_PeakBytes);
+
+#ifdef XQBS_MEM_STATS_TYPES
+        size_t count = m_TypeCount.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (0 == i && 0 == types[i].m_News && 0 == types[i].m_Deletes)
+                continue;
+            types[i].m_Name = m_TypeTable[i].m_pType ? XQBS_Demangle(m_TypeTable[i].m_pType->name()) : "<other>";
+            types[i].m_Size = m_TypeTable[i].m_Size;
+            s.m_Types.push_back(types[i]);
+        }
+        std::stable_sort(s.m_Types.begin(), s.m_Types.end(), [](const XQBS_MemTypeStats& a, const XQBS_MemTypeStats& b)
+        {
+            return a.LiveBytes() > b.LiveBytes();
+        });
+#else
+        (void)types;
+#endif
+#endif // XQBS_MEM_STATS
+        return s;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Завершение потока: запись возвращается в реестр
+struct XQBS_MemStatsThreadExit
+{
+    XQBS_MemStatsThread* m_pThread; // Запись текущего потока
+
+    XQBS_MemStatsThreadExit() : m_pThread(NULL) {}
+    ~XQBS_MemStatsThreadExit();
+};
+
+// Запись текущего потока (без проверки инициализации thread_local)
+inline XQBS_MemStatsThread*& XQBS_MemStatsThreadSlot(void)
+{
+    static thread_local XQBS_MemStatsThread* t_pThread = NULL;
+    return t_pThread;
+}
+
+// Признак того, что текущий поток уже завершается
+inline bool& XQBS_MemStatsThreadDead(void)
+{
+    static thread_local bool t_Dead = false;
+    return t_Dead;
+}
+
+inline XQBS_MemStatsThreadExit::~XQBS_MemStatsThreadExit()
+{
+    XQBS_MemStatsThreadDead() = true;
+    XQBS_MemStatsThreadSlot() = NULL;
+    if (m_pThread)
+        XQBS_MemStatsRegistry::Instance().Release(m_pThread);
+}
+
+XQBS_FORCEINLINE XQBS_MemStatsThread* XQBS_MemStatsThread::Current(void)
+{
+    XQBS_MemStatsThread* pThread = XQBS_MemStatsThreadSlot();
+    if (XQBS_LIKELY(pThread != NULL))
+        return pThread;
+
+    return CurrentSlow();
+}
+
+XQBS_NOINLINE inline XQBS_MemStatsThread* XQBS_MemStatsThread::CurrentSlow(void)
+{
+    if (XQBS_MemStatsThreadDead())
+        return NULL;
+
+    // Первое обращение из потока: получаем запись и регистрируем обработчик завершения потока
+    static thread_local XQBS_MemStatsThreadExit t_Exit;
+    XQBS_MemStatsThread* pThread = XQBS_MemStatsRegistry::Instance().Acquire();
+    t_Exit.m_pThread = pThread;
+    XQBS_MemStatsThreadSlot() = pThread;
+    return pThread;
+}
+
+// Учесть операцию f над счетчиками текущего потока
+template<typename F>
+XQBS_FORCEINLINE void XQBS_MemStatsRecord(IN F f)
+{
+    XQBS_MemStatsThread* pThread = XQBS_MemStatsThread::Current();
+    if (XQBS_LIKELY(pThread != NULL))
+    {
+        f(pThread->m_Counters);
+    }
+    else
+    {
+        // Поток завершается: считаем во временной записи и сразу переносим в итоги
+        XQBS_MemStatsCounters Counters;
+        f(Counters);
+        XQBS_MemStatsRegistry::Instance().RecordDead(Counters);
+    }
+}
+
+#ifdef XQBS_MEM_STATS_TYPES
+// Номер типа T в разбивке по типам, присваивается при первом обращении
+template<typename T>
+struct XQBS_MemTag
+{
+    static size_t Id(void)
+    {
+        static std::atomic<size_t> s_Id(0); // номер плюс один, ноль - номер еще не присвоен
+        size_t Id = s_Id.load(std::memory_order_relaxed);
+        if (XQBS_UNLIKELY(0 == Id))
+        {
+            Id = XQBS_MemStatsRegistry::Instance().RegisterType(&typeid(T), sizeof(T)) + 1;
+            s_Id.store(Id, std::memory_order_relaxed);
+        }
+        return Id - 1;
+    }
+};
+#endif // XQBS_MEM_STATS_TYPES
+
+///////////////////////////////////////////////////////////////////////////////
+// Функции учета, которые вызывает семейство XQBS_new/XQBS_delete
+
+// Выделено bytes байтов
+XQBS_FORCEINLINE void XQBS_MemStatsAlloc(IN size_t bytes)
+{
+#ifdef XQBS_MEM_STATS
+    XQBS_MemStatsRecord([bytes](XQBS_MemStatsCounters& c) { c.Alloc(bytes); });
+#else
+    (void)bytes;
+#endif
+}
+
+// Освобождено bytes байтов
+XQBS_FORCEINLINE void XQBS_MemStatsFree(IN size_t bytes)
+{
+#ifdef XQBS_MEM_STATS
+    XQBS_MemStatsRecord([bytes](XQBS_MemStatsCounters& c) { c.Free(bytes); });
+#else
+    (void)bytes;
+#endif
+}
+
+// Создано count объектов типа T
+template<typename T>
+XQBS_FORCEINLINE void XQBS_MemStatsNew(IN size_t count)
+{
+#ifdef XQBS_MEM_STATS_TYPES
+    size_t Id = XQBS_MemTag<T>::Id();
+    XQBS_MemStatsRecord([Id, count](XQBS_MemStatsCounters& c)
+    {
+        XQBS_MemStatsCounters::Add<uint64_t>(c.m_Types[Id].m_News, count);
+        XQBS_MemStatsCounters::Add<uint64_t>(c.m_Types[Id].m_NewBytes, count * sizeof(T));
+    });
+#else
+    (void)count;
+#endif
+}
+
+// Удаляется count объектов типа T, начиная с ptr (вызывается до деструктора).
+// Объект с виртуальным деструктором учитывается по своему настоящему типу,
+// ptr == NULL означает, что T и есть настоящий тип.
+// Возвращает размер одного объекта: настоящий размер объекта с виртуальным
+// деструктором известен только при разбивке по типам, без нее это sizeof(T)
+template<typename T>
+XQBS_FORCEINLINE size_t XQBS_MemStatsDelete(IN const T* ptr, IN size_t count)
+{
+#ifdef XQBS_MEM_STATS_TYPES
+    size_t Id, Size = sizeof(T);
+    if constexpr (std::is_polymorphic<T>::value)
+    {
+        if (!ptr)
+        {
+            Id = XQBS_MemTag<T>::Id();
+        }
+        else
+        {
+            const std::type_info& type = typeid(*ptr);
+            if (type == typeid(T) || SIZE_MAX == (Id = XQBS_MemStatsRegistry::Instance().FindType(type, Size)))
+                Id = XQBS_MemTag<T>::Id();
+        }
+    }
+    else
+    {
+        Id = XQBS_MemTag<T>::Id();
+    }
+
+    XQBS_MemStatsRecord([Id, Size, count](XQBS_MemStatsCounters& c)
+    {
+        XQBS_MemStatsCounters::Add<uint64_t>(c.m_Types[Id].m_Deletes, count);
+        XQBS_MemStatsCounters::Add<uint64_t>(c.m_Types[Id].m_DeleteBytes, count * Size);
+    });
+    return Size;
+#else
+    (void)ptr;
+    (void)count;
+    return sizeof(T);
+#endif
+}
+
+// Снимок статистики памяти всех потоков. Без XQBS_MEM_STATS все значения нулевые
+inline XQBS_MemStatsSnapshot XQBS_mem_stats(void) { return XQBS_MemStatsRegistry::Instance().Snapshot(); }
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_MEMSTATS_H
@@ -0,0 +1,69 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_offsetptr.h
+*
+*/
+
+#ifndef XQBS_OFFSETPTR_H
+#define XQBS_OFFSETPTR_H
+
+#include <cstddef>
+
+#include "xqbs_defs.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Самоотносительный указатель: хранит смещение объекта от собственного адреса,
+// поэтому остается верным, куда бы ни была отображена содержащая его память.
+// Используется вместо обычных указателей внутри объектов арены (xqbs_arena.h)
+// и разделяемой памяти (xqbs_refshm.h). Копирование пересчитывает смещение,
+// указатель нельзя копировать побайтно (memcpy)
+// T - это тип объекта
+template<class T>
+class XQBS_OffsetPtr
+{
+private:
+
+    intptr_t m_Offset; // Смещение объекта от адреса этого указателя, ноль - NULL
+
+    // Смещение объекта p от адреса self
+    static intptr_t Encode(IN const void* self, IN const T* p) noexcept
+    {
+        return p ? reinterpret_cast<const char*>(p) - static_cast<const char*>(self) : 0;
+    }
+
+public:
+
+    // Конструктор пустого указателя
+    XQBS_OffsetPtr() noexcept : m_Offset(0) {}
+    // Конструктор пустого указателя
+    XQBS_OffsetPtr(IN std::nullptr_t) noexcept : m_Offset(0) {}
+    // Конструктор из обычного указателя
+    XQBS_OffsetPtr(IN T* p) noexcept : m_Offset(Encode(this, p)) {}
+    // Конструктор копирования
+    XQBS_OffsetPtr(IN const XQBS_OffsetPtr& r) noexcept : m_Offset(Encode(this, r.Get())) {}
+
+    // Операторы присваивания
+    XQBS_OffsetPtr& operator= (IN const XQBS_OffsetPtr& r) noexcept { m_Offset = Encode(this, r.Get()); return *this; }
+    XQBS_OffsetPtr& operator= (IN T* p) noexcept { m_Offset = Encode(this, p); return *this; }
+    XQBS_OffsetPtr& operator= (IN std::nullptr_t) noexcept { m_Offset = 0; return *this; }
+
+    // Получить обычный указатель
+    T* Get(void) const noexcept
+    {
+        return m_Offset ? reinterpret_cast<T*>(const_cast<char*>(reinterpret_cast<const char*>(this)) + m_Offset) : NULL;
+    }
+
+    T* operator-> () const noexcept { return Get(); }
+    T& operator* () const noexcept { return *Get(); }
+    T& operator[] (IN size_t index) const noexcept { return Get()[index]; }
+    explicit operator bool () const noexcept { return m_Offset != 0; }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_OFFSETPTR_H
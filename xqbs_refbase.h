@@ -1,74 +1,569 @@
-/*
-* This software is copyright protected (C) 2009 XQBS
-*
-* Author:                Alexey N. Zhirov
-* E-mail:                src@xqbs.ru
-* Module:                xqbs_refbase.h
-*
-*/
-
-#ifndef XQBS_REFBASE_H
-#define XQBS_REFBASE_H
-
-#include "xqbs_refbase_i.h"
-
-_XQBS_BEGIN // XQBS namespace
-
-///////////////////////////////////////////////////////////////////////////////
-// Многопоточная версия счетчика ссылок
-class XQBS_RefBase
-{
-    // Дружественная функция
-    template<class T> friend inline void XQBS_delete_ptr( IN T* ptr );
-
-private:
-
-    // Счетчик ссылок
-    volatile LONG m_RefCount;
-
-protected:
-
-    // Деструктор
-    virtual ~XQBS_RefBase() {}
-
-public:
-
-    // Конструктор
-    XQBS_RefBase() : m_RefCount(1) {}
-
-    // Удалить объект если количество ссылок на него равно нулю
-    virtual LONG Release(void)
-    {
-        // Уменьшаем количество ссылок на одну
-        LONG RefCount = InterlockedDecrement(&m_RefCount);
-
-        // Если количество ссылок на объект равно нулю, следовательно, пришло время сделать себе харакири
-        if ( 0 == RefCount )
-        {
-            // Делаем себе харакири
-            XQBS_delete_ptr(this);
-        }
-
-        // Возвращаем полученное значение счетчика
-        return RefCount;
-    }
-
-    // Добавить ссылку на объект
-    virtual LONG AddRef(void)
-    {
-        // Накидываем одну ссылку
-        LONG RefCount = InterlockedIncrement(&m_RefCount);
-
-        // Проверяем счетчик на переполнение
-        if (0 >= RefCount)
-            // В этом месте вы должны использовать свой класс исключений!
-            throw std::exception("Invalid refcount value");
-
-        // Возвращаем полученное значение счетчика
-        return RefCount;
-    }
-};
-
-_XQBS_END // !XQBS namespace
-
-#endif // !XQBS_REFBASE_H
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refbase.h
+*
+*/
+
+#ifndef XQBS_REFBASE_H
+#define XQBS_REFBASE_H
+
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_refbase_i.h"
+#include "xqbs_refprofile.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Сообщить о недопустимом значении счетчика ссылок. Функция вынесена из AddRef,
+// чтобы генерация исключения не мешала подстановке AddRef в вызывающий код
+XQBS_NOINLINE XQBS_COLD inline void XQBS_RefCountError(void)
+{
+    // В этом месте вы должны использовать свой класс исключений!
+    throw std::runtime_error("Invalid refcount value");
+}
+
+// Функция отложенного уничтожения: получает объект без ссылок и функцию pfnDestroy,
+// которой объект надо уничтожить, когда это станет безопасно
+typedef void (*XQBS_RetireFn)(IN void* pObject, IN void (*pfnDestroy)(void*));
+
+// Установленная функция отложенного уничтожения (см. xqbs_epoch.h).
+// Пока она не установлена, объекты без ссылок уничтожаются прямо в Release
+inline std::atomic<XQBS_RetireFn>& XQBS_RetireHook(void)
+{
+    static std::atomic<XQBS_RetireFn> s_pfnRetire(NULL);
+    return s_pfnRetire;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Атомарный счетчик ссылок, политика по умолчанию для XQBS_RefBaseT
+class XQBS_RefCountAtomic
+{
+private:
+
+    // Счетчик ссылок
+    std::atomic<LONG> m_RefCount;
+
+    // Счетчик не копируется вместе с объектом
+    XQBS_RefCountAtomic(const XQBS_RefCountAtomic&);
+    XQBS_RefCountAtomic& operator= (const XQBS_RefCountAtomic&);
+
+public:
+
+    // Конструктор, объект создается с одной ссылкой
+    XQBS_RefCountAtomic() : m_RefCount(1) {}
+
+    // Добавить ссылку и вернуть новое значение счетчика.
+    // Новую ссылку может получить только тот, кто уже владеет ссылкой,
+    // поэтому упорядочивание памяти здесь не требуется
+    XQBS_FORCEINLINE LONG Increment(void)
+    {
+        LONG RefCount = m_RefCount.fetch_add(1, std::memory_order_relaxed);
+
+        // Проверяем счетчик на переполнение и на воскрешение удаленного объекта:
+        // допустимы значения от 1 до максимума минус один, проверка сделана одним сравнением
+        if (XQBS_UNLIKELY(static_cast<uint32_t>(RefCount) - 1u >= static_cast<uint32_t>(std::numeric_limits<LONG>::max()) - 1u))
+            XQBS_RefCountError();
+
+        return RefCount + 1;
+    }
+
+    // Удалить ссылку и вернуть новое значение счетчика.
+    // Уменьшение публикует все изменения объекта, сделанные владельцем ссылки,
+    // а на последней ссылке барьер захвата делает их видимыми для деструктора
+    XQBS_FORCEINLINE LONG Decrement(void)
+    {
+        LONG RefCount = m_RefCount.fetch_sub(1, std::memory_order_release);
+
+        if (1 == RefCount)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return 0;
+        }
+
+        return RefCount - 1;
+    }
+
+    // Текущее значение счетчика (только для диагностики)
+    LONG Count(void) const { return m_RefCount.load(std::memory_order_relaxed); }
+
+    // Привязать счетчик к объекту. Политики, которые могут обнаружить обнуление
+    // счетчика вне вызова Release, уничтожают объект функцией pfnDestroy(pObject).
+    // Атомарному счетчику это не нужно
+    void Attach(IN void* pObject, IN void (*pfnDestroy)(void*)) { (void)pObject; (void)pfnDestroy; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Счетчик ссылок на отдельной строке кеша: обертка над политикой C.
+// Объект с таким счетчиком выравнивается на XQBS_CACHE_LINE, а счетчик
+// занимает строку кеша целиком, поэтому AddRef/Release горячего объекта
+// не мешают ни соседним объектам, ни остальным полям самого объекта.
+// Цена - до двух строк кеша дополнительной памяти на объект
+template<class C = XQBS_RefCountAtomic>
+class alignas(XQBS_CACHE_LINE) XQBS_RefCountPadded : public C
+{
+public:
+
+    // Конструктор
+    XQBS_RefCountPadded() {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Счетчики объекта со слабыми ссылками (политика XQBS_RefCountWeak). Лежат в
+// заголовке перед объектом в том же блоке памяти, а не в самом объекте,
+// поэтому остаются доступны слабым ссылкам и после деструктора. Все сильные
+// ссылки вместе удерживают одну слабую, блок освобождается вместе с последней
+struct XQBS_WeakCounts
+{
+    std::atomic<LONG> m_RefCount;  // Счетчик сильных ссылок
+    std::atomic<LONG> m_WeakCount; // Счетчик слабых ссылок плюс одна на все сильные
+    size_t            m_Size;      // Размер объекта после заголовка
+
+    // Конструктор, объект создается с одной сильной ссылкой
+    explicit XQBS_WeakCounts(IN size_t size) : m_RefCount(1), m_WeakCount(1), m_Size(size) {}
+
+    // Размер заголовка перед объектом
+    static constexpr size_t HEADER = alignof(std::max_align_t) > 16 ? alignof(std::max_align_t) : 16;
+
+    // Проверить значение счетчика до увеличения: допустимы значения от 1 до максимума минус один
+    static XQBS_FORCEINLINE void CheckCount(IN LONG RefCount)
+    {
+        if (XQBS_UNLIKELY(static_cast<uint32_t>(RefCount) - 1u >= static_cast<uint32_t>(std::numeric_limits<LONG>::max()) - 1u))
+            XQBS_RefCountError();
+    }
+
+    // Попытаться добавить сильную ссылку без блокировок.
+    // Возвращает false, если сильных ссылок уже нет (деструктор вызван или будет вызван)
+    bool TryAddRef(void)
+    {
+        LONG RefCount = m_RefCount.load(std::memory_order_relaxed);
+        while (RefCount > 0)
+        {
+            CheckCount(RefCount);
+            if (m_RefCount.compare_exchange_weak(RefCount, RefCount + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    // Добавить слабую ссылку
+    LONG AddWeakRef(void)
+    {
+        LONG WeakCount = m_WeakCount.fetch_add(1, std::memory_order_relaxed);
+        CheckCount(WeakCount);
+        return WeakCount + 1;
+    }
+
+    // Удалить слабую ссылку, с последней освобождается блок памяти
+    LONG ReleaseWeak(void)
+    {
+        LONG WeakCount = m_WeakCount.fetch_sub(1, std::memory_order_release);
+
+        if (1 == WeakCount)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            size_t Size = m_Size;
+            this->~XQBS_WeakCounts();
+            XQBS_mem_free(this, HEADER + Size);
+            return 0;
+        }
+
+        return WeakCount - 1;
+    }
+
+    // Сильных ссылок больше нет (только для диагностики и ленивой очистки кешей)
+    bool Expired(void) const { return 0 == m_RefCount.load(std::memory_order_relaxed); }
+};
+
+static_assert(sizeof(XQBS_WeakCounts) <= XQBS_WeakCounts::HEADER, "XQBS_WeakCounts does not fit its header");
+
+// Заголовок блока, выделенного под объект, конструктор которого еще не создал
+// счетчик. Такие заголовки образуют стек потока: выражения new вложены друг в
+// друга (аргументы конструктора вычисляются после выделения памяти)
+struct XQBS_WeakPending
+{
+    XQBS_WeakPending* m_pNext; // Предыдущий блок в стеке потока
+    size_t            m_Size;  // Размер объекта после заголовка
+};
+
+// Вершина стека блоков, ожидающих создания счетчика, в текущем потоке
+inline XQBS_WeakPending*& XQBS_WeakConstructing(void)
+{
+    static thread_local XQBS_WeakPending* t_pTop = NULL;
+    return t_pTop;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Политика счетчика ссылок со слабыми ссылками (см. xqbs_refweak.h).
+// Политика сама размещает память объекта: operator new объекта выделяет блок
+// с заголовком XQBS_WeakCounts, в самом объекте хранится только указатель на
+// заголовок. При обнулении сильных ссылок объект уничтожается как обычно (в
+// том числе через XQBS_RetireHook), а operator delete удаляет слабую ссылку
+// сильных вместо освобождения памяти. Объект создается только выражением new
+// (XQBS_new), не на стеке и не членом другого объекта, и не может быть
+// выровнен сильнее std::max_align_t (поэтому не сочетается с XQBS_RefCountPadded).
+// Цена - заголовок и указатель на него, 24 байта на объект вместо 4
+class XQBS_RefCountWeak
+{
+private:
+
+    XQBS_WeakCounts* m_pCounts; // Счетчики в заголовке блока
+
+    // Счетчик не копируется вместе с объектом
+    XQBS_RefCountWeak(const XQBS_RefCountWeak&);
+    XQBS_RefCountWeak& operator= (const XQBS_RefCountWeak&);
+
+public:
+
+    // Политика сама размещает память объекта
+    typedef void XQBS_StorageTag;
+
+    // Выделить блок под объект размером size, вернуть адрес объекта
+    static void* Allocate(IN size_t size)
+    {
+        if (size > SIZE_MAX - XQBS_WeakCounts::HEADER)
+            throw std::bad_alloc();
+
+        char* p = static_cast<char*>(XQBS_mem_alloc(XQBS_WeakCounts::HEADER + size));
+        XQBS_WeakPending*& Top = XQBS_WeakConstructing();
+        XQBS_WeakPending* pPending = ::new (static_cast<void*>(p)) XQBS_WeakPending();
+        pPending->m_pNext = Top;
+        pPending->m_Size = size;
+        Top = pPending;
+        return p + XQBS_WeakCounts::HEADER;
+    }
+
+    // operator delete объекта: удалить слабую ссылку сильных. Если конструктор
+    // не дошел до счетчика (исключение), блок освобождается сразу
+    static void Deallocate(IN void* ptr, IN size_t size)
+    {
+        char* p = static_cast<char*>(ptr) - XQBS_WeakCounts::HEADER;
+        XQBS_WeakPending*& Top = XQBS_WeakConstructing();
+        if (reinterpret_cast<char*>(Top) == p)
+        {
+            Top = Top->m_pNext;
+            XQBS_mem_free(p, XQBS_WeakCounts::HEADER + size);
+            return;
+        }
+        reinterpret_cast<XQBS_WeakCounts*>(p)->ReleaseWeak();
+    }
+
+    // Конструктор: счетчики создаются в заголовке блока, который выделил operator new объекта
+    XQBS_RefCountWeak() : m_pCounts(NULL)
+    {
+        XQBS_WeakPending*& Top = XQBS_WeakConstructing();
+        uintptr_t Self = reinterpret_cast<uintptr_t>(this);
+        uintptr_t Object = reinterpret_cast<uintptr_t>(Top) + XQBS_WeakCounts::HEADER;
+
+        // Объект создан не выражением new, заголовка нет
+        if (XQBS_UNLIKELY(!Top || Self < Object || Self >= Object + Top->m_Size))
+            XQBS_RefCountError();
+
+        XQBS_WeakPending* pPending = Top;
+        size_t Size = pPending->m_Size;
+        Top = pPending->m_pNext;
+        m_pCounts = ::new (static_cast<void*>(pPending)) XQBS_WeakCounts(Size);
+    }
+
+    // Добавить ссылку и вернуть новое значение счетчика
+    XQBS_FORCEINLINE LONG Increment(void)
+    {
+        LONG RefCount = m_pCounts->m_RefCount.fetch_add(1, std::memory_order_relaxed);
+        XQBS_WeakCounts::CheckCount(RefCount);
+        return RefCount + 1;
+    }
+
+    // Удалить ссылку и вернуть новое значение счетчика
+    XQBS_FORCEINLINE LONG Decrement(void)
+    {
+        LONG RefCount = m_pCounts->m_RefCount.fetch_sub(1, std::memory_order_release);
+
+        if (1 == RefCount)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return 0;
+        }
+
+        return RefCount - 1;
+    }
+
+    // Текущее значение счетчика (только для диагностики)
+    LONG Count(void) const { return m_pCounts->m_RefCount.load(std::memory_order_relaxed); }
+
+    // Привязать счетчик к объекту (не нужно)
+    void Attach(IN void* pObject, IN void (*pfnDestroy)(void*)) { (void)pObject; (void)pfnDestroy; }
+
+    // Счетчики в заголовке блока
+    XQBS_WeakCounts* Counts(void) const { return m_pCounts; }
+};
+
+// Политика счетчика ссылок для XQBS_RefBase, выбирается при компиляции:
+// -DXQBS_REFBASE_COUNTER=XQBS::XQBS_RefCountPadded<> выносит счетчик на отдельную строку кеша,
+// -DXQBS_REFBASE_COUNTER=XQBS::XQBS_RefCountWeak добавляет слабые ссылки всем наследникам XQBS_RefBase.
+// Политика меняет раскладку XQBS_RefBase, поэтому должна быть одной во всех единицах
+// трансляции программы. В CMake она задается опцией XQBS_REFBASE_COUNTER
+// (Atomic, Padded или Weak) и передается всем, кто подключает xqbs::common
+#ifndef XQBS_REFBASE_COUNTER
+#define XQBS_REFBASE_COUNTER _XQBS XQBS_RefCountAtomic
+#endif
+
+// Мета-функция для определения политик счетчика с режимом "убийства" (см. xqbs_refsharded.h)
+template<class C, typename = void> struct XQBS_HasKill : std::false_type {};
+template<class C> struct XQBS_HasKill<C, decltype((void)std::declval<C&>().Kill())> : std::true_type {};
+
+// Мета-функция для определения политик счетчика, которые сами размещают память объекта (XQBS_RefCountWeak)
+template<class C, typename = void> struct XQBS_HasStorage : std::false_type {};
+template<class C> struct XQBS_HasStorage<C, typename C::XQBS_StorageTag> : std::true_type {};
+
+// Мета-функция для определения классов с повторным использованием объектов (см. xqbs_refrecycle.h)
+template<class T, typename = void> struct XQBS_IsRecyclable : std::false_type {};
+template<class T> struct XQBS_IsRecyclable<T, typename T::XQBS_RecycleTag> : std::true_type {};
+
+///////////////////////////////////////////////////////////////////////////////
+// Невиртуальная многопоточная версия счетчика ссылок.
+// AddRef и Release не виртуальные и целиком подставляются в вызывающий код.
+// T - это класс потомок (CRTP), который удаляется при обнулении счетчика
+// C - это политика счетчика ссылок
+template<class T, class C = XQBS_RefCountAtomic>
+class XQBS_RefBaseT
+{
+    // Дружественная функция
+    template<class P> friend inline void XQBS_delete_ptr( IN P* ptr );
+
+private:
+
+    // Счетчик ссылок
+    C m_RefCount;
+
+    // Удалить объект без ссылок или вернуть его в пул повторного использования
+    static void Dispose(IN T* ptr)
+    {
+        if constexpr (XQBS_IsRecyclable<T>::value)
+            T::XQBS_Recycle(ptr);
+        else
+            XQBS_delete_ptr(ptr);
+    }
+
+    // Удалить объект по указателю на XQBS_RefBaseT
+    static void DeleteObject(IN void* ptr) { Dispose(static_cast<T*>(static_cast<XQBS_RefBaseT*>(ptr))); }
+
+    // Уничтожить объект без ссылок: сразу или через функцию отложенного уничтожения
+    XQBS_FORCEINLINE void Destroy(void)
+    {
+        XQBS_RetireFn pfnRetire = XQBS_RetireHook().load(std::memory_order_acquire);
+        if (XQBS_UNLIKELY(pfnRetire != NULL))
+            pfnRetire(static_cast<XQBS_RefBaseT*>(this), &XQBS_RefBaseT::DeleteObject);
+        else
+            Dispose(static_cast<T*>(this));
+    }
+
+    // Уничтожить объект по указателю на XQBS_RefBaseT, передается в C::Attach
+    static void DestroyObject(IN void* ptr) { static_cast<XQBS_RefBaseT*>(ptr)->Destroy(); }
+
+protected:
+
+    // Деструктор
+    ~XQBS_RefBaseT() {}
+
+    // Вернуть объекту, взятому из пула повторного использования, ссылку создателя:
+    // счетчик создается заново, как у нового объекта
+    void Revive(void)
+    {
+        static_assert(!XQBS_HasStorage<C>::value, "Recycled objects cannot have weak references");
+        m_RefCount.~C();
+        ::new (static_cast<void*>(&m_RefCount)) C();
+        m_RefCount.Attach(static_cast<XQBS_RefBaseT*>(this), &XQBS_RefBaseT::DestroyObject);
+    }
+
+public:
+
+    // Память объектов всегда берется из менеджера памяти XQBS (как XQBS_CLASS_ALLOCATOR),
+    // политика со своим размещением (XQBS_RefCountWeak) добавляет к блоку заголовок
+    typedef void XQBS_ClassAllocated;
+    static void* operator new(size_t size)
+    {
+        if constexpr (XQBS_HasStorage<C>::value)
+            return C::Allocate(size);
+        else
+            return XQBS_mem_alloc(size);
+    }
+    static void* operator new(size_t size, std::align_val_t al)
+    {
+        static_assert(!XQBS_HasStorage<C>::value, "Over-aligned objects cannot have weak references");
+        return ::operator new(size, al);
+    }
+    static void* operator new(size_t, void* where) noexcept { return where; }
+    static void* operator new(size_t size, const std::nothrow_t&) noexcept
+    {
+        return XQBS_nothrow_alloc(size, [](IN size_t n) { return XQBS_RefBaseT::operator new(n); });
+    }
+    static void operator delete(void* ptr, size_t size)
+    {
+        if constexpr (XQBS_HasStorage<C>::value)
+            C::Deallocate(ptr, size);
+        else
+            XQBS_mem_free(ptr, size);
+    }
+    static void operator delete(void* ptr, const std::nothrow_t&) noexcept
+    {
+        XQBS_nothrow_free(ptr, [](IN void* p, IN size_t size) { XQBS_RefBaseT::operator delete(p, size); });
+    }
+    static void operator delete(void* ptr, size_t, std::align_val_t al) { ::operator delete(ptr, al); }
+    static void operator delete(void*, void*) noexcept {}
+
+    // Конструктор
+    XQBS_RefBaseT() { m_RefCount.Attach(static_cast<XQBS_RefBaseT*>(this), &XQBS_RefBaseT::DestroyObject); }
+
+    // Конструктор копирования: копия - это новый объект со своим счетчиком и одной ссылкой
+    XQBS_RefBaseT(IN const XQBS_RefBaseT&) : XQBS_RefBaseT() {}
+
+    // Оператор присваивания: счетчик ссылок не копируется и не меняется
+    XQBS_RefBaseT& operator= (IN const XQBS_RefBaseT&) { return *this; }
+
+    // Удалить объект если количество ссылок на него равно нулю
+    XQBS_FORCEINLINE LONG Release(void)
+    {
+        // Профилировщик записывает операцию до уменьшения, пока объект еще жив
+        XQBS_REFPROFILE(typeid(*static_cast<T*>(this)), XQBS_REFPROFILE_RELEASE)
+
+        // Уменьшаем количество ссылок на одну
+        LONG RefCount = m_RefCount.Decrement();
+
+        // Если количество ссылок на объект равно нулю, следовательно, пришло время сделать себе харакири
+        if ( 0 == RefCount )
+        {
+            // Делаем себе харакири (или откладываем его, если включено отложенное уничтожение)
+            Destroy();
+        }
+
+        // Возвращаем полученное значение счетчика
+        return RefCount;
+    }
+
+    // Добавить ссылку на объект
+    XQBS_FORCEINLINE LONG AddRef(void)
+    {
+        XQBS_REFPROFILE(typeid(*static_cast<T*>(this)), XQBS_REFPROFILE_ADDREF)
+        return m_RefCount.Increment();
+    }
+
+    // Политика счетчика ссылок (для XQBS_WeakPtr и диагностики)
+    C& RefCounter(void) { return m_RefCount; }
+
+    // Перевести счетчик в точный режим и удалить ссылку создателя объекта.
+    // Нужно политикам, которые до этого момента не могут обнаружить обнуление
+    // счетчика (XQBS_RefCountSharded), вызывается ровно один раз вместо Release
+    // той ссылки, с которой объект был создан. Для остальных политик это Release
+    LONG Kill(void)
+    {
+        if constexpr (XQBS_HasKill<C>::value)
+        {
+            LONG RefCount = m_RefCount.Kill();
+            if ( 0 == RefCount )
+                Destroy();
+            return RefCount;
+        }
+        else
+        {
+            return Release();
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Многопоточная версия счетчика ссылок для иерархий классов.
+// Потомки удаляются через виртуальный деструктор, но AddRef и Release
+// не виртуальные, поэтому не требуют косвенного вызова
+class XQBS_RefBase : public XQBS_RefBaseT<XQBS_RefBase, XQBS_REFBASE_COUNTER>
+{
+    // Дружественная функция
+    template<class T> friend inline void XQBS_delete_ptr( IN T* ptr );
+
+protected:
+
+    // Деструктор
+    virtual ~XQBS_RefBase() {}
+
+public:
+
+    // Конструктор
+    XQBS_RefBase() {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Реализация виртуального интерфейса XQBS_RefBase_I для существующего кода,
+// которому нужен вызов AddRef/Release через указатель на интерфейс
+// C - это политика счетчика ссылок
+template<class C = XQBS_RefCountAtomic>
+class XQBS_RefBaseImpl : public XQBS_RefBase_I
+{
+    // Дружественная функция
+    template<class T> friend inline void XQBS_delete_ptr( IN T* ptr );
+
+private:
+
+    // Счетчик ссылок
+    C m_RefCount;
+
+    // Удалить объект по указателю на XQBS_RefBaseImpl
+    static void DeleteObject(IN void* ptr) { XQBS_delete_ptr(static_cast<XQBS_RefBaseImpl*>(ptr)); }
+
+    // Уничтожить объект по указателю на XQBS_RefBaseImpl: сразу или через функцию
+    // отложенного уничтожения, передается в C::Attach
+    static void DestroyObject(IN void* ptr)
+    {
+        XQBS_RetireFn pfnRetire = XQBS_RetireHook().load(std::memory_order_acquire);
+        if (XQBS_UNLIKELY(pfnRetire != NULL))
+            pfnRetire(ptr, &XQBS_RefBaseImpl::DeleteObject);
+        else
+            DeleteObject(ptr);
+    }
+
+protected:
+
+    // Деструктор
+    virtual ~XQBS_RefBaseImpl() {}
+
+public:
+
+    // Память объектов всегда берется из менеджера памяти XQBS
+    XQBS_CLASS_ALLOCATOR
+
+    // Конструктор
+    XQBS_RefBaseImpl() { m_RefCount.Attach(static_cast<XQBS_RefBaseImpl*>(this), &XQBS_RefBaseImpl::DestroyObject); }
+
+    // Конструктор копирования: копия - это новый объект со своим счетчиком и одной ссылкой
+    XQBS_RefBaseImpl(IN const XQBS_RefBaseImpl&) : XQBS_RefBaseImpl() {}
+
+    // Оператор присваивания: счетчик ссылок не копируется и не меняется
+    XQBS_RefBaseImpl& operator= (IN const XQBS_RefBaseImpl&) { return *this; }
+
+    // Удалить объект если количество ссылок на него равно нулю
+    virtual LONG Release(void)
+    {
+        XQBS_REFPROFILE(typeid(*this), XQBS_REFPROFILE_RELEASE)
+        LONG RefCount = m_RefCount.Decrement();
+
+        if ( 0 == RefCount )
+            DestroyObject(static_cast<XQBS_RefBaseImpl*>(this));
+
+        return RefCount;
+    }
+
+    // Добавить ссылку на объект
+    virtual LONG AddRef(void)
+    {
+        XQBS_REFPROFILE(typeid(*this), XQBS_REFPROFILE_ADDREF)
+        return m_RefCount.Increment();
+    }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFBASE_H
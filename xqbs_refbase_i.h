@@ -1,52 +1,160 @@
-/*
- * This software is copyright protected (C) 2009 XQBS
- *
- * Author:                Alexey N. Zhirov
- * E-mail:                src@xqbs.ru
- * Module:                xqbs_refbase_i.h
- *
- */
-
-#ifndef XQBS_REFBASE_I_H
-#define XQBS_REFBASE_I_H
-
-#include "xqbs_defs.h"
-#include "xqbs_mem.h"
-
-_XQBS_BEGIN // XQBS namespace
-
-///////////////////////////////////////////////////////////////////////////////
-// Многопоточная версия счетчика ссылок
-class XQBS_RefBase_I
-{
-
-protected:
-
-    // Деструктор
-    virtual ~XQBS_RefBase_I() {}
-
-public:
-
-    // Конструктор
-    XQBS_RefBase_I() {}
-
-    // Удалить объект если количество ссылок на него равно нулю
-    virtual LONG Release(void) = 0;
-    // Добавить ссылку на объект
-    virtual LONG AddRef(void) = 0;
-};
-
-// Шаблонная функция для безопасного удаления ссылки
-template<typename T> inline void XQBS_release(IN OUT T*& ptr) { XQBS_SAFE_DELETE(ptr->Release()) }
-
-// Вспомогательная шаблонная функция для удаления ссылки с объектов потомков класса XQBS_RefBase
-template<typename T> inline void XQBS_destroy(IN XQBS_RefBase_I* fake,IN OUT T*& ptr ) { XQBS_release<T>(ptr); }
-// Вспомогательная шаблонная функция для удаления объектов не наследников XQBS_RefBase
-template<typename T> inline void XQBS_destroy(IN void* fake, IN OUT T*& ptr) { XQBS_delete<T>(ptr); }
-
-// Шаблонная функция для боезопасного удаления объекта или удаления ссылки в зависимости от типа объекта
-template<typename T> inline void XQBS_destroy(IN OUT T*& ptr) { XQBS_destroy<T>(ptr, ptr); }
-
-_XQBS_END // !XQBS namespace
-
-#endif // !XQBS_REFBASE_I_H
+/*
+ * This software is copyright protected (C) 2009 XQBS
+ *
+ * Author:                Alexey N. Zhirov
+ * E-mail:                src@xqbs.ru
+ * Module:                xqbs_refbase_i.h
+ *
+ */
+
+#ifndef XQBS_REFBASE_I_H
+#define XQBS_REFBASE_I_H
+
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_mem.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Многопоточная версия счетчика ссылок
+class XQBS_RefBase_I
+{
+
+protected:
+
+    // Деструктор
+    virtual ~XQBS_RefBase_I() {}
+
+public:
+
+    // Конструктор
+    XQBS_RefBase_I() {}
+
+    // Удалить объект если количество ссылок на него равно нулю
+    virtual LONG Release(void) = 0;
+    // Добавить ссылку на объект
+    virtual LONG AddRef(void) = 0;
+};
+
+// Шаблонная функция для безопасного удаления ссылки
+template<typename T> inline void XQBS_release(IN OUT T*& ptr) { XQBS_SAFE_DELETE(ptr->Release()) }
+
+// Вспомогательная шаблонная функция для удаления ссылки с объектов потомков класса XQBS_RefBase
+template<typename T> inline void XQBS_destroy(IN XQBS_RefBase_I* fake,IN OUT T*& ptr ) { XQBS_release<T>(ptr); }
+// Вспомогательная шаблонная функция для удаления объектов не наследников XQBS_RefBase
+template<typename T> inline void XQBS_destroy(IN void* fake, IN OUT T*& ptr) { XQBS_delete<T>(ptr); }
+
+// Мета-функция для определения объектов со счетчиком ссылок (наличие AddRef и Release),
+// подходит как для потомков XQBS_RefBase_I, так и для невиртуальных XQBS_RefBase/XQBS_RefBaseT
+template<typename T, typename = void> struct XQBS_IsRefCounted : std::false_type {};
+template<typename T> struct XQBS_IsRefCounted<T, decltype(std::declval<T&>().AddRef(), std::declval<T&>().Release(), void())> : std::true_type {};
+
+// Вспомогательная шаблонная функция для удаления ссылки с объектов со счетчиком ссылок
+template<typename T> inline void XQBS_destroy(IN std::true_type, IN OUT T*& ptr) { XQBS_release<T>(ptr); }
+// Вспомогательная шаблонная функция для удаления объектов без счетчика ссылок
+template<typename T> inline void XQBS_destroy(IN std::false_type, IN OUT T*& ptr) { XQBS_delete<T>(ptr); }
+
+// Шаблонная функция для боезопасного удаления объекта или удаления ссылки в зависимости от типа объекта
+template<typename T> inline void XQBS_destroy(IN OUT T*& ptr) { XQBS_destroy<T>(XQBS_IsRefCounted<T>(), ptr); }
+
+// Расстояние упреждающей загрузки объектов в XQBS_release_range/XQBS_destroy_range (в элементах)
+#ifndef XQBS_RANGE_PREFETCH
+#define XQBS_RANGE_PREFETCH 8
+#endif
+
+// Тип объекта, указатели на который лежат в диапазоне итераторов It
+template<typename It> using XQBS_RangeObject = typename std::remove_pointer<typename std::iterator_traits<It>::value_type>::type;
+
+// Обойти диапазон указателей [first, last) и вызвать f для каждого непустого,
+// заранее загружая в кеш объект на XQBS_RANGE_PREFETCH элементов впереди.
+// Возвращает количество непустых указателей
+template<typename It, typename F>
+inline size_t XQBS_for_each_prefetch(IN It first, IN It last, IN F f)
+{
+    It ahead = first;
+    for (size_t i = 0; i < XQBS_RANGE_PREFETCH && ahead != last; ++i, ++ahead)
+        XQBS_PREFETCH(*ahead);
+
+    size_t count = 0;
+    for (; first != last; ++first)
+    {
+        if (ahead != last)
+        {
+            XQBS_PREFETCH(*ahead);
+            ++ahead;
+        }
+        if (*first)
+        {
+            f(*first);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Удалить ссылку со всех объектов диапазона указателей [first, last) (итераторы
+// на T*, T со счетчиком ссылок). Пустые указатели пропускаются, сами указатели
+// в диапазоне не обнуляются и после вызова недействительны
+template<typename It>
+inline void XQBS_release_range(IN It first, IN It last)
+{
+    typedef XQBS_RangeObject<It> T;
+    static_assert(XQBS_IsRefCounted<T>::value, "XQBS_release_range needs objects with AddRef/Release");
+
+    XQBS_for_each_prefetch(first, last, [](T* ptr) { ptr->Release(); });
+}
+
+// Удалить объекты или ссылки на них из диапазона указателей [first, last).
+// Способ выбирается при компиляции по типу объекта, как в XQBS_destroy:
+//  - объекты со счетчиком ссылок получают Release;
+//  - тривиально разрушаемые объекты, размещенные прямо в менеджере памяти
+//    (см. XQBS_NewExpression), возвращают память без вызова деструкторов,
+//    статистика XQBS_MEM_STATS_TYPES учитывает их одним вызовом на диапазон;
+//  - остальные удаляются через XQBS_delete_ptr.
+// Объекты арены, как и в XQBS_delete_ptr, пропускаются.
+// Пустые указатели пропускаются, сами указатели в диапазоне не обнуляются
+// и после вызова недействительны (контейнер остается только очистить)
+template<typename It>
+inline void XQBS_destroy_range(IN It first, IN It last)
+{
+    typedef XQBS_RangeObject<It> T;
+
+    if constexpr (XQBS_IsRefCounted<T>::value)
+    {
+        XQBS_release_range(first, last);
+    }
+    else if constexpr (std::is_trivially_destructible<T>::value && !XQBS_NewExpression<T>::value)
+    {
+        size_t count = 0;
+        XQBS_for_each_prefetch(first, last, [&count](T* ptr)
+        {
+            if (!XQBS_InArena(ptr))
+            {
+                XQBS_mem_free((void*)ptr, sizeof(T));
+                ++count;
+            }
+        });
+        if (count)
+            XQBS_MemStatsDelete<T>(NULL, count);
+    }
+    else
+    {
+        XQBS_for_each_prefetch(first, last, [](T* ptr) { XQBS_delete_ptr(ptr); });
+    }
+}
+
+// Удалить ссылку со всех объектов контейнера указателей (vector, deque, массив и т.п.)
+template<typename R>
+inline auto XQBS_release_range(IN const R& range) -> decltype(std::begin(range), void()) { XQBS_release_range(std::begin(range), std::end(range)); }
+
+// Удалить объекты или ссылки на них из контейнера указателей (vector, deque, массив и т.п.)
+template<typename R>
+inline auto XQBS_destroy_range(IN const R& range) -> decltype(std::begin(range), void()) { XQBS_destroy_range(std::begin(range), std::end(range)); }
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFBASE_I_H
@@ -0,0 +1,376 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refbiased.h
+*
+*/
+
+#ifndef XQBS_REFBIASED_H
+#define XQBS_REFBIASED_H
+
+#include <atomic>
+#include <limits>
+
+#include "xqbs_defs.h"
+#include "xqbs_refbase.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+class XQBS_RefCountBiased;
+
+///////////////////////////////////////////////////////////////////////////////
+// Запись потока, владеющего объектами со смещенным счетчиком ссылок.
+// Записи никогда не освобождаются: объекты хранят указатель на запись
+// владельца и после завершения его потока. Запись завершившегося потока
+// достается следующему новому потоку, но только когда у всех ее объектов
+// счетчики слиты: иначе новый поток принял бы чужие объекты за свои
+struct XQBS_BiasedThread
+{
+    std::atomic<XQBS_RefCountBiased*> m_Queue;   // Стек объектов, ожидающих слияния счетчиков в потоке-владельце
+    std::atomic<int64_t>              m_Orphans; // Объекты с неслитыми счетчиками, оставшиеся после завершения потока
+    std::atomic<bool>                 m_InUse;   // Запись занята живым потоком
+    XQBS_BiasedThread*                m_pNext;   // Следующая запись в списке всех записей
+    size_t                            m_Objects; // Объекты с неслитыми счетчиками (только поток-владелец)
+
+    // Конструктор
+    XQBS_BiasedThread() : m_Queue(NULL), m_Orphans(0), m_InUse(true), m_pNext(NULL), m_Objects(0) {}
+
+    // Список записей всех потоков
+    static std::atomic<XQBS_BiasedThread*>& List(void)
+    {
+        static std::atomic<XQBS_BiasedThread*> s_pThreads(NULL);
+        return s_pThreads;
+    }
+
+    // Маркер очереди завершившегося потока, слияние выполняет тот, кто ставит объект в очередь
+    static XQBS_RefCountBiased* Dead(void) { return reinterpret_cast<XQBS_RefCountBiased*>(uintptr_t(1)); }
+
+    // Запись текущего потока, NULL если поток уже завершается
+    static XQBS_BiasedThread* Current(void);
+    // Первое обращение потока к Current: захват свободной записи или создание новой
+    static XQBS_BiasedThread* CurrentSlow(void);
+
+    // Выполнить слияние счетчиков всех объектов из очереди текущего потока
+    void ProcessQueue(void);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Смещенный (biased) счетчик ссылок, политика для XQBS_RefBaseT.
+// Поток, создавший объект, работает с обычным неатомарным счетчиком m_Local,
+// остальные потоки - с атомарным счетчиком m_Shared. Когда владелец отпускает
+// последнюю свою ссылку, счетчики сливаются и дальше объект живет на m_Shared.
+// Если другой поток уводит m_Shared в минус раньше слияния (владелец передал
+// свою ссылку), объект ставится в очередь владельца, который сливает счетчики
+// при ближайшем Release или при завершении потока.
+// Значения, которые возвращают Increment/Decrement, приблизительные,
+// точным является только ноль.
+class XQBS_RefCountBiased
+{
+    friend struct XQBS_BiasedThread;
+    friend struct XQBS_BiasedThreadExit;
+
+private:
+
+    // Флаги в младших битах m_Shared
+    enum
+    {
+        MERGED = 1, // счетчики слиты, m_Local больше не используется
+        QUEUED = 2, // объект стоит в очереди владельца на слияние
+        ONE    = 4  // единица счетчика
+    };
+
+    XQBS_BiasedThread*             m_pOwner;      // Поток-владелец
+    LONG                           m_Local;       // Счетчик владельца
+    bool                           m_Merged;      // Копия флага MERGED для владельца
+    std::atomic<int64_t>           m_Shared;      // Счетчик остальных потоков и флаги
+    XQBS_RefCountBiased*           m_pNext;       // Следующий объект в очереди владельца
+    void*                          m_pObject;     // Объект, которому принадлежит счетчик
+    void                         (*m_pfnDestroy)(void*); // Функция уничтожения объекта
+
+    // Счетчик не копируется вместе с объектом
+    XQBS_RefCountBiased(const XQBS_RefCountBiased&);
+    XQBS_RefCountBiased& operator= (const XQBS_RefCountBiased&);
+
+    // Количество ссылок в значении m_Shared
+    static int64_t SharedCount(IN int64_t v) { return v / ONE - (v % ONE < 0 ? 1 : 0); }
+
+    // Слить счетчики, вызывается владельцем (owner) или вместо завершившегося владельца.
+    // Возвращает true, если ссылок больше нет и объект надо уничтожить
+    bool ExplicitMerge(IN bool owner)
+    {
+        int64_t Local = m_Local;
+        bool Merged = m_Merged;
+        m_Local = 0;
+        m_Merged = true;
+
+        int64_t Shared = m_Shared.load(std::memory_order_relaxed), New;
+        do
+        {
+            New = ((Shared + Local * ONE) | MERGED) & ~int64_t(QUEUED);
+        }
+        while (!m_Shared.compare_exchange_weak(Shared, New, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        // Объект больше не держит запись владельца
+        if (!Merged)
+        {
+            if (owner)
+                --m_pOwner->m_Objects;
+            else
+                m_pOwner->m_Orphans.fetch_sub(1, std::memory_order_release);
+        }
+
+        return 0 == SharedCount(New);
+    }
+
+    // Владелец отпустил последнюю локальную ссылку.
+    // Возвращает true, если ссылок больше нет и объект надо уничтожить
+    bool OwnerMerge(void)
+    {
+        m_Merged = true;
+        --m_pOwner->m_Objects;
+        int64_t Shared = m_Shared.fetch_or(MERGED, std::memory_order_acq_rel);
+
+        // Если объект в очереди, его уничтожит обработка очереди
+        return 0 == SharedCount(Shared) && !(Shared & QUEUED);
+    }
+
+    // Поставить объект в очередь владельца.
+    // Возвращает true, если владелец уже завершился, слияние выполнено здесь и объект надо уничтожить
+    bool Enqueue(void)
+    {
+        XQBS_RefCountBiased* Head = m_pOwner->m_Queue.load(std::memory_order_acquire);
+        do
+        {
+            if (XQBS_BiasedThread::Dead() == Head)
+                return ExplicitMerge(false);
+            m_pNext = Head;
+        }
+        while (!m_pOwner->m_Queue.compare_exchange_weak(Head, this, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        return false;
+    }
+
+public:
+
+    // Конструктор, объект создается с одной ссылкой у текущего потока
+    XQBS_RefCountBiased()
+        : m_pOwner(XQBS_BiasedThread::Current()), m_Local(1), m_Merged(false), m_Shared(0),
+          m_pNext(NULL), m_pObject(NULL), m_pfnDestroy(NULL)
+    {
+        // Завершающийся поток не может обрабатывать очередь, объект сразу живет на общем счетчике
+        if (!m_pOwner)
+        {
+            m_Local = 0;
+            m_Merged = true;
+            m_Shared.store(ONE | MERGED, std::memory_order_relaxed);
+        }
+        else
+        {
+            ++m_pOwner->m_Objects;
+        }
+    }
+
+    // Привязать счетчик к объекту для уничтожения при обработке очереди
+    void Attach(IN void* pObject, IN void (*pfnDestroy)(void*)) { m_pObject = pObject; m_pfnDestroy = pfnDestroy; }
+
+    // Добавить ссылку и вернуть новое значение счетчика
+    XQBS_FORCEINLINE LONG Increment(void)
+    {
+        if (XQBS_BiasedThread::Current() == m_pOwner && !m_Merged)
+        {
+            // Проверяем счетчик на переполнение и на воскрешение удаленного объекта
+            if (XQBS_UNLIKELY(static_cast<uint32_t>(m_Local) - 1u >= static_cast<uint32_t>(std::numeric_limits<LONG>::max()) - 1u))
+                XQBS_RefCountError();
+            return ++m_Local;
+        }
+
+        int64_t Shared = m_Shared.fetch_add(ONE, std::memory_order_relaxed);
+        if (XQBS_UNLIKELY(SharedCount(Shared) >= std::numeric_limits<LONG>::max()))
+            XQBS_RefCountError();
+
+        return static_cast<LONG>(SharedCount(Shared) + 1);
+    }
+
+    // Удалить ссылку и вернуть новое значение счетчика, ноль - объект надо уничтожить
+    XQBS_FORCEINLINE LONG Decrement(void)
+    {
+        XQBS_BiasedThread* pThread = XQBS_BiasedThread::Current();
+
+        if (pThread == m_pOwner && !m_Merged)
+        {
+            // Сначала сливаем счетчики объектов, которые другие потоки поставили в очередь,
+            // при этом этот объект тоже может оказаться слитым
+            XQBS_RefCountBiased* Queue = pThread->m_Queue.load(std::memory_order_relaxed);
+            if (XQBS_UNLIKELY(Queue != NULL && Queue != XQBS_BiasedThread::Dead()))
+                pThread->ProcessQueue();
+
+            if (!m_Merged)
+            {
+                if (--m_Local > 0)
+                    return m_Local;
+
+                return OwnerMerge() ? 0 : 1;
+            }
+        }
+
+        int64_t Shared = m_Shared.load(std::memory_order_relaxed), New;
+        bool Queue;
+        do
+        {
+            New = Shared - ONE;
+            Queue = false;
+
+            // Владелец передал свою ссылку: счетчик ушел в минус, без владельца ноль не обнаружить
+            if (!(Shared & (MERGED | QUEUED)) && SharedCount(New) < 0)
+            {
+                New |= QUEUED;
+                Queue = true;
+            }
+        }
+        while (!m_Shared.compare_exchange_weak(Shared, New, std::memory_order_release, std::memory_order_relaxed));
+
+        if (Queue)
+            return Enqueue() ? 0 : 1;
+
+        if ((New & MERGED) && !(New & QUEUED) && 0 == SharedCount(New))
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return 0;
+        }
+
+        return SharedCount(New) > 0 ? static_cast<LONG>(SharedCount(New)) : 1;
+    }
+
+    // Текущее значение счетчика (только для диагностики, вызывать из потока-владельца)
+    LONG Count(void) const { return static_cast<LONG>(m_Local + SharedCount(m_Shared.load(std::memory_order_relaxed))); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Завершение потока: забираем очередь, ставим маркер Dead(), сливаем счетчики
+// и освобождаем запись для следующих потоков
+struct XQBS_BiasedThreadExit
+{
+    XQBS_BiasedThread* m_pThread; // Запись текущего потока
+
+    XQBS_BiasedThreadExit() : m_pThread(NULL) {}
+    ~XQBS_BiasedThreadExit();
+};
+
+// Запись текущего потока (без проверки инициализации thread_local)
+inline XQBS_BiasedThread*& XQBS_BiasedThreadSlot(void)
+{
+    static thread_local XQBS_BiasedThread* t_pThread = NULL;
+    return t_pThread;
+}
+
+// Признак того, что текущий поток уже завершается
+inline bool& XQBS_BiasedThreadDead(void)
+{
+    static thread_local bool t_Dead = false;
+    return t_Dead;
+}
+
+inline XQBS_BiasedThreadExit::~XQBS_BiasedThreadExit()
+{
+    XQBS_BiasedThreadDead() = true;
+    XQBS_BiasedThreadSlot() = NULL;
+    if (!m_pThread)
+        return;
+
+    // После маркера Dead() слияние делают сами потоки, которые ставят объекты в очередь
+    XQBS_RefCountBiased* pList = m_pThread->m_Queue.exchange(XQBS_BiasedThread::Dead(), std::memory_order_acq_rel);
+    while (pList)
+    {
+        XQBS_RefCountBiased* pNext = pList->m_pNext;
+        if (pList->ExplicitMerge(true))
+            pList->m_pfnDestroy(pList->m_pObject);
+        pList = pNext;
+    }
+
+    // Оставшиеся объекты сливают потоки, которые отпускают последние ссылки
+    m_pThread->m_Orphans.fetch_add(static_cast<int64_t>(m_pThread->m_Objects), std::memory_order_relaxed);
+    m_pThread->m_Objects = 0;
+    m_pThread->m_InUse.store(false, std::memory_order_release);
+}
+
+XQBS_FORCEINLINE XQBS_BiasedThread* XQBS_BiasedThread::Current(void)
+{
+    XQBS_BiasedThread* pThread = XQBS_BiasedThreadSlot();
+    if (XQBS_LIKELY(pThread != NULL))
+        return pThread;
+
+    return CurrentSlow();
+}
+
+XQBS_NOINLINE inline XQBS_BiasedThread* XQBS_BiasedThread::CurrentSlow(void)
+{
+    if (XQBS_BiasedThreadDead())
+        return NULL;
+
+    // Первое обращение из потока: регистрируем обработчик завершения потока
+    static thread_local XQBS_BiasedThreadExit t_Exit;
+
+    // Сначала пробуем занять запись завершившегося потока, все объекты которой слиты
+    std::atomic<XQBS_BiasedThread*>& Threads = List();
+    XQBS_BiasedThread* pThread = Threads.load(std::memory_order_acquire);
+    for (; pThread; pThread = pThread->m_pNext)
+    {
+        bool InUse = false;
+        if (pThread->m_InUse.load(std::memory_order_relaxed) ||
+            !pThread->m_InUse.compare_exchange_strong(InUse, true, std::memory_order_acquire, std::memory_order_relaxed))
+            continue;
+
+        if (0 == pThread->m_Orphans.load(std::memory_order_acquire))
+        {
+            pThread->m_Queue.store(NULL, std::memory_order_relaxed);
+            break;
+        }
+        pThread->m_InUse.store(false, std::memory_order_release);
+    }
+
+    if (!pThread)
+    {
+        pThread = new XQBS_BiasedThread();
+        XQBS_BiasedThread* Head = Threads.load(std::memory_order_relaxed);
+        do
+        {
+            pThread->m_pNext = Head;
+        }
+        while (!Threads.compare_exchange_weak(Head, pThread, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    t_Exit.m_pThread = pThread;
+    XQBS_BiasedThreadSlot() = pThread;
+    return pThread;
+}
+
+inline void XQBS_BiasedThread::ProcessQueue(void)
+{
+    XQBS_RefCountBiased* pList = m_Queue.exchange(NULL, std::memory_order_acquire);
+    while (pList)
+    {
+        XQBS_RefCountBiased* pNext = pList->m_pNext;
+        if (pList->ExplicitMerge(true))
+            pList->m_pfnDestroy(pList->m_pObject);
+        pList = pNext;
+    }
+}
+
+// Явно слить счетчики объектов, которые другие потоки поставили в очередь текущего потока.
+// Вызывается в удобных точках потоков, которые долго не делают Release своих объектов
+inline void XQBS_BiasedProcessQueue(void)
+{
+    XQBS_BiasedThread* pThread = XQBS_BiasedThread::Current();
+    if (pThread)
+    {
+        XQBS_RefCountBiased* Queue = pThread->m_Queue.load(std::memory_order_relaxed);
+        if (Queue != NULL && Queue != XQBS_BiasedThread::Dead())
+            pThread->ProcessQueue();
+    }
+}
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFBIASED_H
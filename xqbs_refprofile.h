@@ -0,0 +1,523 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refprofile.h
+*
+*/
+
+#ifndef XQBS_REFPROFILE_H
+#define XQBS_REFPROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define XQBS_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define XQBS_RETURN_ADDRESS() __builtin_extract_return_addr(__builtin_return_address(0))
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define XQBS_REFPROFILE_BACKTRACE
+#endif
+#endif
+
+#include "xqbs_defs.h"
+#include "xqbs_memstats.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Профилировщик трафика счетчиков ссылок: в среднем каждая N-я операция AddRef/Release
+// потока (XQBS_RefBaseT, XQBS_RefBase, XQBS_RefBaseImpl) записывается вместе
+// с настоящим типом объекта и стеком вызовов в кольцевой буфер этого потока.
+// Отчет (XQBS_RefProfileReport) сводит записи всех потоков в самые активные
+// типы и места вызова.
+//
+// Профилировщик встроен в AddRef/Release всегда и включается во время работы
+// (XQBS_RefProfileStart). Пока он выключен, его цена - чтение одного глобального
+// флага и ветвление, которое процессор всегда предсказывает верно.
+// -DXQBS_NO_REFPROFILE убирает и это (нужно, например, при сборке без RTTI).
+//
+// Стек снимается функцией backtrace (glibc, macOS, BSD) или CaptureStackBackTrace
+// (Windows), на остальных системах записывается только адрес возврата.
+// Для читаемых имен функций в отчете программу собирают с -rdynamic
+
+// Глубина записываемого стека
+#ifndef XQBS_REFPROFILE_DEPTH
+#define XQBS_REFPROFILE_DEPTH 8
+#endif
+
+// Количество записей в кольцевом буфере потока
+#ifndef XQBS_REFPROFILE_RING
+#define XQBS_REFPROFILE_RING 1024
+#endif
+
+_XQBS_BEGIN // XQBS namespace
+
+// Записываемая операция
+enum XQBS_RefProfileOp
+{
+    XQBS_REFPROFILE_ADDREF  = 0,
+    XQBS_REFPROFILE_RELEASE = 1
+};
+
+// Строка отчета: тип объекта или место вызова
+struct XQBS_RefProfileEntry
+{
+    std::string m_Name;     // Имя типа или функции
+    uint64_t    m_AddRefs;  // Записано AddRef
+    uint64_t    m_Releases; // Записано Release
+
+    std::vector<std::string> m_Stack; // Для места вызова: вызывающие функции из одной записи
+
+    XQBS_RefProfileEntry() : m_AddRefs(0), m_Releases(0) {}
+
+    // Записано операций
+    uint64_t Samples(void) const { return m_AddRefs + m_Releases; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Отчет профилировщика. Оценка количества операций - записи, умноженные на период
+struct XQBS_RefProfileReportData
+{
+    unsigned                          m_Period;  // Период выборки (каждая N-я операция потока)
+    uint64_t                          m_Samples; // Записей в буферах
+    std::vector<XQBS_RefProfileEntry> m_Types;   // Типы по убыванию количества записей
+    std::vector<XQBS_RefProfileEntry> m_Sites;   // Места вызова AddRef/Release по убыванию количества записей
+
+    XQBS_RefProfileReportData() : m_Period(0), m_Samples(0) {}
+
+    // Строка JSON в кавычках
+    static std::string Quote(IN const std::string& value)
+    {
+        std::string s("\"");
+        for (size_t c = 0; c < value.size(); ++c)
+        {
+            char ch = value[c];
+            if ('"' == ch || '\\' == ch)
+                s += '\\';
+            if (static_cast<unsigned char>(ch) >= 0x20)
+                s += ch;
+        }
+        return s + "\"";
+    }
+
+    // Текстовое представление для журнала
+    std::string ToText(void) const
+    {
+        std::string s;
+        char line[512];
+        snprintf(line, sizeof(line), "refcount samples %llu, period %u\n", (unsigned long long)m_Samples, m_Period);
+        s += line;
+        for (int k = 0; k < 2; ++k)
+        {
+            const std::vector<XQBS_RefProfileEntry>& v = k ? m_Sites : m_Types;
+            s += k ? "top call sites:\n" : "top types:\n";
+            for (size_t i = 0; i < v.size(); ++i)
+            {
+                snprintf(line, sizeof(line), "  %10llu AddRef %10llu Release  %s\n",
+                         (unsigned long long)v[i].m_AddRefs, (unsigned long long)v[i].m_Releases, v[i].m_Name.c_str());
+                s += line;
+                for (size_t f = 0; f < v[i].m_Stack.size(); ++f)
+                    s += "                                       <- " + v[i].m_Stack[f] + "\n";
+            }
+        }
+        return s;
+    }
+
+    // Представление в JSON
+    std::string ToJson(void) const
+    {
+        std::string s;
+        char line[128];
+        snprintf(line, sizeof(line), "{\"period\":%u,\"samples\":%llu", m_Period, (unsigned long long)m_Samples);
+        s += line;
+        for (int k = 0; k < 2; ++k)
+        {
+            const std::vector<XQBS_RefProfileEntry>& v = k ? m_Sites : m_Types;
+            s += k ? ",\"sites\":[" : ",\"types\":[";
+            for (size_t i = 0; i < v.size(); ++i)
+            {
+                s += i ? ",{\"name\":" : "{\"name\":";
+                s += Quote(v[i].m_Name);
+                snprintf(line, sizeof(line), ",\"addref\":%llu,\"release\":%llu",
+                         (unsigned long long)v[i].m_AddRefs, (unsigned long long)v[i].m_Releases);
+                s += line;
+                if (k)
+                {
+                    s += ",\"stack\":[";
+                    for (size_t f = 0; f < v[i].m_Stack.size(); ++f)
+                        s += (f ? "," : "") + Quote(v[i].m_Stack[f]);
+                    s += "]";
+                }
+                s += "}";
+            }
+            s += "]";
+        }
+        s += "}";
+        return s;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Кольцевой буфер записей потока. Пишет только поток-владелец, отчет читает
+// буфер без блокировки и отбрасывает записи, которые могли быть перезаписаны
+// во время чтения (как seqlock)
+struct XQBS_RefProfileThread
+{
+    // Запись об операции
+    struct Sample
+    {
+        std::atomic<const std::type_info*> m_pType;  // Настоящий тип объекта
+        std::atomic<uint32_t>              m_Info;   // Операция и глубина стека (op | depth << 8)
+        std::atomic<void*>                 m_Frames[XQBS_REFPROFILE_DEPTH]; // Стек, первый - место вызова
+    };
+
+    Sample                 m_Ring[XQBS_REFPROFILE_RING]; // Кольцевой буфер
+    std::atomic<uint64_t>  m_Seq;       // Удвоенное количество записей, нечетное - запись идет
+    unsigned               m_Countdown; // Операций до следующей записи
+    uint32_t               m_Random;    // Состояние xorshift для случайного интервала между записями
+    XQBS_RefProfileThread* m_pNext;     // Следующий буфер в списке
+    bool                   m_bInUse;    // Буфер занят потоком
+
+    XQBS_RefProfileThread() : m_Seq(0), m_Countdown(0), m_Random(0x9E3779B9u ^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this) >> 4)), m_pNext(NULL), m_bInUse(true) {}
+
+    // Буфер текущего потока, NULL если поток уже завершается
+    static XQBS_RefProfileThread* Current(void);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Общее состояние профилировщика (никогда не разрушается)
+class XQBS_RefProfileRegistry
+{
+private:
+
+    std::mutex             m_Lock;     // Блокировка списка буферов
+    XQBS_RefProfileThread* m_pThreads; // Буферы потоков, буферы завершившихся потоков сохраняют записи
+
+    XQBS_RefProfileRegistry() : m_pThreads(NULL) {}
+
+    // Имя функции по адресу в ней
+    static std::string SiteName(IN void* pAddress)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%p", pAddress);
+        std::string name(buffer);
+
+#if defined(XQBS_REFPROFILE_BACKTRACE)
+        // Строка backtrace_symbols: "модуль(символ+смещение) [адрес]"
+        char** ppSymbols = ::backtrace_symbols(&pAddress, 1);
+        if (ppSymbols)
+        {
+            std::string symbol(ppSymbols[0]);
+            free(ppSymbols);
+
+            size_t open = symbol.find('('), plus = symbol.find('+', open);
+            if (std::string::npos != open && std::string::npos != plus && plus > open + 1)
+                name = XQBS_Demangle(symbol.substr(open + 1, plus - open - 1).c_str()) + " " + symbol.substr(plus, symbol.find(')', plus) - plus);
+            else
+                name = symbol;
+        }
+#endif
+        return name;
+    }
+
+    // Первые top строк по убыванию количества записей
+    template<typename K>
+    static std::vector<std::pair<K, XQBS_RefProfileEntry> > Top(IN const std::map<K, XQBS_RefProfileEntry>& counts, IN size_t top)
+    {
+        std::vector<std::pair<K, XQBS_RefProfileEntry> > v(counts.begin(), counts.end());
+        std::stable_sort(v.begin(), v.end(), [](const std::pair<K, XQBS_RefProfileEntry>& a, const std::pair<K, XQBS_RefProfileEntry>& b)
+        {
+            return a.second.Samples() > b.second.Samples();
+        });
+        if (v.size() > top)
+            v.resize(top);
+        return v;
+    }
+
+public:
+
+    // Период выборки, 0 - профилировщик выключен
+    std::atomic<unsigned> m_Period;
+
+    // Единственный экземпляр
+    static XQBS_RefProfileRegistry& Instance(void)
+    {
+        static XQBS_RefProfileRegistry* s_pRegistry = new XQBS_RefProfileRegistry();
+        return *s_pRegistry;
+    }
+
+    // Получить свободный буфер или создать новый
+    XQBS_RefProfileThread* Acquire(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (XQBS_RefProfileThread* p = m_pThreads; p; p = p->m_pNext)
+        {
+            if (!p->m_bInUse)
+            {
+                p->m_bInUse = true;
+                return p;
+            }
+        }
+
+        XQBS_RefProfileThread* p = new XQBS_RefProfileThread();
+        p->m_pNext = m_pThreads;
+        m_pThreads = p;
+        return p;
+    }
+
+    // Вернуть буфер завершившегося потока, записи остаются для отчета
+    void Release(IN XQBS_RefProfileThread* p)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        p->m_bInUse = false;
+    }
+
+    // Удалить все записи. Записи, которые потоки делают в это время, могут остаться
+    void Clear(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (XQBS_RefProfileThread* p = m_pThreads; p; p = p->m_pNext)
+        {
+            for (size_t i = 0; i < XQBS_REFPROFILE_RING; ++i)
+                p->m_Ring[i].m_pType.store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    // Свести записи всех буферов в отчет из top самых активных типов и мест вызова
+    XQBS_RefProfileReportData Report(IN size_t top)
+    {
+        XQBS_RefProfileReportData report;
+        report.m_Period = m_Period.load(std::memory_order_relaxed);
+
+        // Копия записи из буфера
+        struct Copy
+        {
+            const std::type_info* m_pType;
+            uint32_t              m_Info;
+            void*                 m_Frames[XQBS_REFPROFILE_DEPTH];
+        };
+
+        std::map<const std::type_info*, XQBS_RefProfileEntry> types;
+        std::map<void*, XQBS_RefProfileEntry> sites;
+        std::map<void*, std::vector<void*> > stacks; // Стек первой записи каждого места вызова
+
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (XQBS_RefProfileThread* p = m_pThreads; p; p = p->m_pNext)
+        {
+            uint64_t Head = p->m_Seq.load(std::memory_order_acquire) / 2;
+            uint64_t First = Head > XQBS_REFPROFILE_RING ? Head - XQBS_REFPROFILE_RING : 0;
+
+            // Копируем записи, затем отбрасываем те, которые владелец мог перезаписать во время копирования
+            std::vector<Copy> copy(size_t(Head - First));
+            for (uint64_t i = First; i < Head; ++i)
+            {
+                const XQBS_RefProfileThread::Sample& s = p->m_Ring[i % XQBS_REFPROFILE_RING];
+                Copy& c = copy[size_t(i - First)];
+                c.m_pType = s.m_pType.load(std::memory_order_relaxed);
+                c.m_Info = s.m_Info.load(std::memory_order_relaxed);
+                for (size_t f = 0; f < XQBS_REFPROFILE_DEPTH; ++f)
+                    c.m_Frames[f] = s.m_Frames[f].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t Started = (p->m_Seq.load(std::memory_order_relaxed) + 1) / 2;
+            uint64_t Valid = Started > XQBS_REFPROFILE_RING ? Started - XQBS_REFPROFILE_RING : 0;
+
+            for (uint64_t i = std::max(First, Valid); i < Head; ++i)
+            {
+                const Copy& c = copy[size_t(i - First)];
+                if (!c.m_pType)
+                    continue;
+
+                bool bRelease = XQBS_REFPROFILE_RELEASE == (c.m_Info & 0xff);
+                size_t Depth = std::min<size_t>(c.m_Info >> 8, XQBS_REFPROFILE_DEPTH);
+                XQBS_RefProfileEntry& t = types[c.m_pType];
+                XQBS_RefProfileEntry& e = sites[c.m_Frames[0]];
+                (bRelease ? t.m_Releases : t.m_AddRefs)++;
+                (bRelease ? e.m_Releases : e.m_AddRefs)++;
+                if (1 == e.Samples() && Depth > 1)
+                    stacks[c.m_Frames[0]].assign(c.m_Frames + 1, c.m_Frames + Depth);
+                report.m_Samples++;
+            }
+        }
+
+        std::vector<std::pair<const std::type_info*, XQBS_RefProfileEntry> > t = Top(types, top);
+        for (size_t i = 0; i < t.size(); ++i)
+        {
+            report.m_Types.push_back(t[i].second);
+            report.m_Types.back().m_Name = XQBS_Demangle(t[i].first->name());
+        }
+
+        // Имена функций ищутся только для мест вызова, попавших в отчет
+        std::vector<std::pair<void*, XQBS_RefProfileEntry> > c = Top(sites, top);
+        for (size_t i = 0; i < c.size(); ++i)
+        {
+            report.m_Sites.push_back(c[i].second);
+            report.m_Sites.back().m_Name = SiteName(c[i].first);
+
+            const std::vector<void*>& stack = stacks[c[i].first];
+            for (size_t f = 0; f < stack.size(); ++f)
+                report.m_Sites.back().m_Stack.push_back(SiteName(stack[f]));
+        }
+        return report;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Завершение потока: буфер возвращается в реестр вместе с записями
+struct XQBS_RefProfileThreadExit
+{
+    XQBS_RefProfileThread* m_pThread; // Буфер текущего потока
+
+    XQBS_RefProfileThreadExit() : m_pThread(NULL) {}
+    ~XQBS_RefProfileThreadExit();
+};
+
+// Буфер текущего потока (без проверки инициализации thread_local)
+inline XQBS_RefProfileThread*& XQBS_RefProfileThreadSlot(void)
+{
+    static thread_local XQBS_RefProfileThread* t_pThread = NULL;
+    return t_pThread;
+}
+
+// Признак того, что текущий поток уже завершается
+inline bool& XQBS_RefProfileThreadDead(void)
+{
+    static thread_local bool t_Dead = false;
+    return t_Dead;
+}
+
+inline XQBS_RefProfileThreadExit::~XQBS_RefProfileThreadExit()
+{
+    XQBS_RefProfileThreadDead() = true;
+    XQBS_RefProfileThreadSlot() = NULL;
+    if (m_pThread)
+        XQBS_RefProfileRegistry::Instance().Release(m_pThread);
+}
+
+inline XQBS_RefProfileThread* XQBS_RefProfileThread::Current(void)
+{
+    XQBS_RefProfileThread* pThread = XQBS_RefProfileThreadSlot();
+    if (pThread || XQBS_RefProfileThreadDead())
+        return pThread;
+
+    // Первая запись из потока: получаем буфер и регистрируем обработчик завершения потока
+    static thread_local XQBS_RefProfileThreadExit t_Exit;
+    pThread = XQBS_RefProfileRegistry::Instance().Acquire();
+    t_Exit.m_pThread = pThread;
+    XQBS_RefProfileThreadSlot() = pThread;
+    return pThread;
+}
+
+// Флаг включенного профилировщика: единственное, что проверяют AddRef/Release.
+// Инициализируется константой, поэтому обращение к нему не требует проверок
+inline std::atomic<bool>& XQBS_RefProfileFlag(void)
+{
+    static std::atomic<bool> s_bEnabled(false);
+    return s_bEnabled;
+}
+
+// Учесть операцию op над объектом типа pType и, если подошла очередь, записать ее
+XQBS_NOINLINE inline void XQBS_RefProfileSample(IN const std::type_info* pType, IN XQBS_RefProfileOp op)
+{
+    unsigned Period = XQBS_RefProfileRegistry::Instance().m_Period.load(std::memory_order_relaxed);
+    XQBS_RefProfileThread* pThread = XQBS_RefProfileThread::Current();
+    if (!Period || !pThread)
+        return;
+
+    if (pThread->m_Countdown > 1 && pThread->m_Countdown <= 2 * Period)
+    {
+        pThread->m_Countdown--;
+        return;
+    }
+
+    // Интервал до следующей записи случайный, от 1 до 2*Period-1 (в среднем Period):
+    // при строгом периоде чередующиеся AddRef/Release попадали бы в выборку
+    // только одной из операций
+    uint32_t Random = pThread->m_Random;
+    Random ^= Random << 13;
+    Random ^= Random >> 17;
+    Random ^= Random << 5;
+    pThread->m_Random = Random;
+    pThread->m_Countdown = Period > 1 ? 1 + Random % (2 * Period - 1) : 1;
+
+    // Место вызова - адрес возврата из этой функции в функцию, куда подставлен
+    // AddRef/Release. Стек продолжается кадрами, которые идут за ним в backtrace
+    // (кадры до него - эта функция и перехватчики самого backtrace)
+    void* Frames[XQBS_REFPROFILE_DEPTH];
+    Frames[0] = XQBS_RETURN_ADDRESS();
+    int Depth = 1;
+#if defined(_WIN32) || defined(XQBS_REFPROFILE_BACKTRACE)
+    void* Trace[XQBS_REFPROFILE_DEPTH + 4];
+#if defined(_WIN32)
+    int Count = ::CaptureStackBackTrace(0, XQBS_REFPROFILE_DEPTH + 4, Trace, NULL);
+#else
+    int Count = ::backtrace(Trace, XQBS_REFPROFILE_DEPTH + 4);
+#endif
+    int i = 0;
+    while (i < Count && Trace[i] != Frames[0])
+        ++i;
+    for (++i; i < Count && Depth < XQBS_REFPROFILE_DEPTH; ++i)
+        Frames[Depth++] = Trace[i];
+#endif
+
+    uint64_t Seq = pThread->m_Seq.load(std::memory_order_relaxed);
+    XQBS_RefProfileThread::Sample& s = pThread->m_Ring[(Seq / 2) % XQBS_REFPROFILE_RING];
+
+    // Сначала объявляем слот перезаписываемым, затем пишем запись
+    pThread->m_Seq.store(Seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.m_pType.store(pType, std::memory_order_relaxed);
+    s.m_Info.store(static_cast<uint32_t>(op) | (static_cast<uint32_t>(Depth) << 8), std::memory_order_relaxed);
+    for (int i = 0; i < XQBS_REFPROFILE_DEPTH; ++i)
+        s.m_Frames[i].store(i < Depth ? Frames[i] : NULL, std::memory_order_relaxed);
+    pThread->m_Seq.store(Seq + 2, std::memory_order_release);
+}
+
+// Включить профилировщик: записывать в среднем каждую period-ю операцию AddRef/Release каждого потока
+inline void XQBS_RefProfileStart(IN unsigned period = 1000)
+{
+    XQBS_RefProfileRegistry::Instance().m_Period.store(period ? period : 1, std::memory_order_relaxed);
+    XQBS_RefProfileFlag().store(true, std::memory_order_relaxed);
+}
+
+// Выключить профилировщик, записи остаются для отчета
+inline void XQBS_RefProfileStop(void)
+{
+    XQBS_RefProfileFlag().store(false, std::memory_order_relaxed);
+}
+
+// Удалить все записи
+inline void XQBS_RefProfileClear(void) { XQBS_RefProfileRegistry::Instance().Clear(); }
+
+// Отчет: top самых активных типов и мест вызова AddRef/Release
+inline XQBS_RefProfileReportData XQBS_RefProfileReport(IN size_t top = 20) { return XQBS_RefProfileRegistry::Instance().Report(top); }
+
+_XQBS_END // !XQBS namespace
+
+// Проверка в AddRef/Release: одно ветвление, пока профилировщик выключен.
+// type - выражение typeid настоящего типа объекта, вычисляется только при записи
+#ifndef XQBS_NO_REFPROFILE
+#define XQBS_REFPROFILE(type, op) \
+    { if (XQBS_UNLIKELY(_XQBS XQBS_RefProfileFlag().load(std::memory_order_relaxed))) _XQBS XQBS_RefProfileSample(&(type), _XQBS op); }
+#else
+#define XQBS_REFPROFILE(type, op)
+#endif
+
+#endif // !XQBS_REFPROFILE_H
@@ -0,0 +1,172 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refptr.h
+*
+*/
+
+#ifndef XQBS_REFPTR_H
+#define XQBS_REFPTR_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_refbase.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Мета-триггер для захвата уже существующей ссылки без вызова AddRef
+struct XQBS_AdoptRef{};
+
+template<class T> class XQBS_Borrowed;
+
+///////////////////////////////////////////////////////////////////////////////
+// Интрузивный умный указатель на объект со счетчиком ссылок (XQBS_RefBase,
+// XQBS_RefBaseT, XQBS_RefBase_I и любой класс с AddRef/Release).
+// Занимает ровно один указатель. Копирование вызывает AddRef, а перемещение
+// только передает указатель и не делает ни одной атомарной операции.
+// T - это тип объекта
+template<class T>
+class XQBS_RefPtr
+{
+    template<class U> friend class XQBS_RefPtr;
+
+private:
+
+    T* m_p; // Указатель на объект, которым владеет XQBS_RefPtr
+
+public:
+
+    // Конструктор пустого указателя
+    XQBS_RefPtr() noexcept : m_p(NULL) {}
+    // Конструктор пустого указателя
+    XQBS_RefPtr(IN std::nullptr_t) noexcept : m_p(NULL) {}
+
+    // Конструктор с добавлением новой ссылки на объект p
+    explicit XQBS_RefPtr(IN T* p) : m_p(p) { if (m_p) m_p->AddRef(); }
+    // Конструктор с захватом ссылки, которой уже владеет вызывающий код (без AddRef)
+    XQBS_RefPtr(IN T* p, IN XQBS_AdoptRef) noexcept : m_p(p) {}
+
+    // Конструктор копирования
+    XQBS_RefPtr(IN const XQBS_RefPtr& r) : m_p(r.m_p) { if (m_p) m_p->AddRef(); }
+    // Конструктор копирования из указателя на потомка
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    XQBS_RefPtr(IN const XQBS_RefPtr<U>& r) : m_p(r.m_p) { if (m_p) m_p->AddRef(); }
+
+    // Конструктор перемещения
+    XQBS_RefPtr(IN OUT XQBS_RefPtr&& r) noexcept : m_p(r.m_p) { r.m_p = NULL; }
+    // Конструктор перемещения из указателя на потомка
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    XQBS_RefPtr(IN OUT XQBS_RefPtr<U>&& r) noexcept : m_p(r.m_p) { r.m_p = NULL; }
+
+    // Конструктор из заимствованной ссылки (добавляет собственную ссылку)
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    XQBS_RefPtr(IN XQBS_Borrowed<U> r) : m_p(r.Get()) { if (m_p) m_p->AddRef(); }
+
+    // Деструктор
+    ~XQBS_RefPtr() { if (m_p) m_p->Release(); }
+
+    // Оператор присваивания копированием
+    XQBS_RefPtr& operator= (IN const XQBS_RefPtr& r) { XQBS_RefPtr(r).Swap(*this); return *this; }
+    // Оператор присваивания перемещением
+    XQBS_RefPtr& operator= (IN OUT XQBS_RefPtr&& r) noexcept { XQBS_RefPtr(std::move(r)).Swap(*this); return *this; }
+    // Оператор присваивания перемещением из указателя на потомка
+    template<class U>
+    XQBS_RefPtr& operator= (IN OUT XQBS_RefPtr<U>&& r) noexcept { XQBS_RefPtr(std::move(r)).Swap(*this); return *this; }
+    // Оператор присваивания копированием из указателя на потомка
+    template<class U>
+    XQBS_RefPtr& operator= (IN const XQBS_RefPtr<U>& r) { XQBS_RefPtr(r).Swap(*this); return *this; }
+    // Оператор присваивания пустого указателя
+    XQBS_RefPtr& operator= (IN std::nullptr_t) { Reset(); return *this; }
+
+    // Освободить ссылку и обнулить указатель
+    void Reset(void) { T* p = m_p; m_p = NULL; if (p) p->Release(); }
+    // Заменить объект на p с добавлением новой ссылки
+    void Reset(IN T* p) { XQBS_RefPtr(p).Swap(*this); }
+    // Заменить объект на p с захватом уже существующей ссылки
+    void Reset(IN T* p, IN XQBS_AdoptRef a) { XQBS_RefPtr(p, a).Swap(*this); }
+
+    // Отдать ссылку вызывающему коду без Release, например для XQBS_release
+    T* Detach(void) noexcept { T* p = m_p; m_p = NULL; return p; }
+
+    // Обменять содержимое двух указателей
+    void Swap(IN OUT XQBS_RefPtr& r) noexcept { T* p = m_p; m_p = r.m_p; r.m_p = p; }
+
+    // Получить указатель без передачи владения
+    T* Get(void) const noexcept { return m_p; }
+    // Получить заимствованную ссылку для передачи в вызываемые функции
+    XQBS_Borrowed<T> Borrow(void) const noexcept { return XQBS_Borrowed<T>(m_p); }
+
+    T* operator-> () const noexcept { return m_p; }
+    T& operator* () const noexcept { return *m_p; }
+    explicit operator bool () const noexcept { return m_p != NULL; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Заимствованная ссылка на объект со счетчиком ссылок для передачи в параметрах.
+// Не владеет объектом и не трогает счетчик: вызывающий код гарантирует, что
+// объект жив на время вызова. Если вызываемой функции нужно сохранить объект,
+// она явно делает из заимствованной ссылки XQBS_RefPtr.
+// T - это тип объекта
+template<class T>
+class XQBS_Borrowed
+{
+private:
+
+    T* m_p; // Указатель на объект, которым XQBS_Borrowed не владеет
+
+public:
+
+    // Конструктор пустой ссылки
+    XQBS_Borrowed() noexcept : m_p(NULL) {}
+    // Конструктор пустой ссылки
+    XQBS_Borrowed(IN std::nullptr_t) noexcept : m_p(NULL) {}
+    // Конструктор из обычного указателя
+    XQBS_Borrowed(IN T* p) noexcept : m_p(p) {}
+    // Конструктор из заимствованной ссылки на потомка
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    XQBS_Borrowed(IN XQBS_Borrowed<U> r) noexcept : m_p(r.Get()) {}
+    // Конструктор из владеющего указателя (в том числе на потомка)
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    XQBS_Borrowed(IN const XQBS_RefPtr<U>& r) noexcept : m_p(r.Get()) {}
+
+    // Получить собственную ссылку на объект
+    XQBS_RefPtr<T> Share(void) const { return XQBS_RefPtr<T>(m_p); }
+
+    // Получить указатель
+    T* Get(void) const noexcept { return m_p; }
+
+    T* operator-> () const noexcept { return m_p; }
+    T& operator* () const noexcept { return *m_p; }
+    explicit operator bool () const noexcept { return m_p != NULL; }
+};
+
+// Операторы сравнения
+template<class T, class U> inline bool operator== (IN const XQBS_RefPtr<T>& a, IN const XQBS_RefPtr<U>& b) noexcept { return a.Get() == b.Get(); }
+template<class T, class U> inline bool operator!= (IN const XQBS_RefPtr<T>& a, IN const XQBS_RefPtr<U>& b) noexcept { return a.Get() != b.Get(); }
+template<class T, class U> inline bool operator== (IN const XQBS_RefPtr<T>& a, IN const U* b) noexcept { return a.Get() == b; }
+template<class T, class U> inline bool operator!= (IN const XQBS_RefPtr<T>& a, IN const U* b) noexcept { return a.Get() != b; }
+template<class T> inline bool operator== (IN const XQBS_RefPtr<T>& a, IN std::nullptr_t) noexcept { return !a; }
+template<class T> inline bool operator!= (IN const XQBS_RefPtr<T>& a, IN std::nullptr_t) noexcept { return !!a; }
+
+// Захватить ссылку, которой уже владеет вызывающий код, например результат XQBS_new
+template<class T> inline XQBS_RefPtr<T> XQBS_adopt(IN T* ptr) noexcept { return XQBS_RefPtr<T>(ptr, XQBS_AdoptRef()); }
+// Добавить новую ссылку на объект
+template<class T> inline XQBS_RefPtr<T> XQBS_share(IN T* ptr) { return XQBS_RefPtr<T>(ptr); }
+
+// Шаблонная функция для безопасного удаления ссылки, хранящейся в XQBS_RefPtr
+template<class T> inline void XQBS_release(IN OUT XQBS_RefPtr<T>& ptr) { ptr.Reset(); }
+// Шаблонная функция для безопасного удаления ссылки, хранящейся в XQBS_RefPtr
+template<class T> inline void XQBS_destroy(IN OUT XQBS_RefPtr<T>& ptr) { ptr.Reset(); }
+
+// Оба указателя должны занимать не больше обычного указателя
+static_assert(sizeof(XQBS_RefPtr<XQBS_RefBase>) == sizeof(void*), "XQBS_RefPtr must be pointer-sized");
+static_assert(sizeof(XQBS_Borrowed<XQBS_RefBase>) == sizeof(void*), "XQBS_Borrowed must be pointer-sized");
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFPTR_H
@@ -0,0 +1,460 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refrecycle.h
+*
+*/
+
+#ifndef XQBS_REFRECYCLE_H
+#define XQBS_REFRECYCLE_H
+
+#include <atomic>
+
+#include "xqbs_defs.h"
+#include "xqbs_refbase.h"
+
+// Размер кеша свободных объектов каждого потока для каждого типа (см. XQBS_RefBaseRecycled)
+#ifndef XQBS_RECYCLE_LOCAL
+#define XQBS_RECYCLE_LOCAL 16
+#endif
+
+_XQBS_BEGIN // XQBS namespace
+
+// Статистика пула повторного использования объектов
+struct XQBS_RecycleStats
+{
+    uint64_t m_Hits;     // Объект выдан из пула
+    uint64_t m_Misses;   // Пул был пуст, объект создан заново
+    uint64_t m_Recycled; // Объект без ссылок вернулся в пул
+    uint64_t m_Dropped;  // Пул был полон, объект без ссылок удален
+    size_t   m_Pooled;   // Объектов в общем пуле сейчас (без кешей потоков)
+    size_t   m_Limit;    // Предел количества объектов в пуле
+
+    XQBS_RecycleStats() : m_Hits(0), m_Misses(0), m_Recycled(0), m_Dropped(0), m_Pooled(0), m_Limit(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Ограниченный пул свободных объектов типа T: очередь без блокировок на
+// N ячеек для многих производителей и потребителей (очередь Вьюкова).
+// Каждая ячейка хранит номер позиции, для которой она свободна или заполнена,
+// поэтому Push и Pop обходятся одним compare_exchange над своей позицией.
+// Пул никогда не разрушается: объекты могут возвращаться в него и при
+// завершении программы
+template<class T, size_t N>
+class XQBS_RecyclePool
+{
+private:
+
+    static_assert(N > 0 && 0 == (N & (N - 1)), "XQBS_RecyclePool size must be a power of two");
+
+    // Ячейка очереди
+    struct Cell
+    {
+        std::atomic<size_t> m_Seq;     // Позиция, для которой ячейка готова
+        T*                  m_pObject; // Свободный объект
+    };
+
+    Cell                                         m_Cells[N]; // Ячейки
+    alignas(XQBS_CACHE_LINE) std::atomic<size_t> m_Push;     // Позиция записи
+    alignas(XQBS_CACHE_LINE) std::atomic<size_t> m_Pop;      // Позиция чтения
+    alignas(XQBS_CACHE_LINE) std::atomic<size_t> m_Limit;    // Предел количества объектов в пуле
+    std::atomic<uint64_t>                        m_Hits;     // Статистика XQBS_RecycleStats,
+    std::atomic<uint64_t>                        m_Misses;   // пополняется потоками пачками
+    std::atomic<uint64_t>                        m_Recycled;
+    std::atomic<uint64_t>                        m_Dropped;
+
+    // Конструктор
+    XQBS_RecyclePool() : m_Push(0), m_Pop(0), m_Limit(N), m_Hits(0), m_Misses(0), m_Recycled(0), m_Dropped(0)
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            m_Cells[i].m_Seq.store(i, std::memory_order_relaxed);
+            m_Cells[i].m_pObject = NULL;
+        }
+    }
+
+    // Пул не копируется
+    XQBS_RecyclePool(const XQBS_RecyclePool&);
+    XQBS_RecyclePool& operator= (const XQBS_RecyclePool&);
+
+public:
+
+    // Пул типа T (никогда не разрушается)
+    static XQBS_RecyclePool& Instance(void)
+    {
+        static XQBS_RecyclePool* s_pPool = new XQBS_RecyclePool();
+        return *s_pPool;
+    }
+
+    // Поместить объект в пул. Возвращает false, если пул полон (или достигнут предел)
+    bool Push(IN T* ptr)
+    {
+        size_t Pos = m_Push.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (Pos - m_Pop.load(std::memory_order_relaxed) >= m_Limit.load(std::memory_order_relaxed))
+                return false;
+
+            Cell& c = m_Cells[Pos & (N - 1)];
+            size_t Seq = c.m_Seq.load(std::memory_order_acquire);
+            intptr_t Diff = static_cast<intptr_t>(Seq) - static_cast<intptr_t>(Pos);
+
+            if (0 == Diff)
+            {
+                if (m_Push.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+                {
+                    c.m_pObject = ptr;
+                    c.m_Seq.store(Pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (Diff < 0)
+            {
+                return false; // ячейку еще не освободил отстающий Pop
+            }
+            else
+            {
+                Pos = m_Push.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Взять объект из пула. Возвращает NULL, если пул пуст
+    T* Pop(void)
+    {
+        size_t Pos = m_Pop.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& c = m_Cells[Pos & (N - 1)];
+            size_t Seq = c.m_Seq.load(std::memory_order_acquire);
+            intptr_t Diff = static_cast<intptr_t>(Seq) - static_cast<intptr_t>(Pos + 1);
+
+            if (0 == Diff)
+            {
+                if (m_Pop.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+                {
+                    T* ptr = c.m_pObject;
+                    c.m_Seq.store(Pos + N, std::memory_order_release);
+                    return ptr;
+                }
+            }
+            else if (Diff < 0)
+            {
+                return NULL;
+            }
+            else
+            {
+                Pos = m_Pop.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Добавить к статистике накопленные потоком счетчики
+    void AddStats(IN uint64_t hits, IN uint64_t misses, IN uint64_t recycled, IN uint64_t dropped)
+    {
+        if (hits)
+            m_Hits.fetch_add(hits, std::memory_order_relaxed);
+        if (misses)
+            m_Misses.fetch_add(misses, std::memory_order_relaxed);
+        if (recycled)
+            m_Recycled.fetch_add(recycled, std::memory_order_relaxed);
+        if (dropped)
+            m_Dropped.fetch_add(dropped, std::memory_order_relaxed);
+    }
+
+    // Количество объектов в пуле (приблизительное при одновременной работе)
+    size_t Size(void) const
+    {
+        size_t Pop = m_Pop.load(std::memory_order_relaxed);
+        size_t Push = m_Push.load(std::memory_order_relaxed);
+        return Push > Pop ? Push - Pop : 0;
+    }
+
+    // Установить предел количества объектов в пуле (не больше N)
+    void SetLimit(IN size_t limit) { m_Limit.store(limit < N ? limit : N, std::memory_order_relaxed); }
+
+    // Статистика пула
+    XQBS_RecycleStats Stats(void) const
+    {
+        XQBS_RecycleStats stats;
+        stats.m_Hits = m_Hits.load(std::memory_order_relaxed);
+        stats.m_Misses = m_Misses.load(std::memory_order_relaxed);
+        stats.m_Recycled = m_Recycled.load(std::memory_order_relaxed);
+        stats.m_Dropped = m_Dropped.load(std::memory_order_relaxed);
+        stats.m_Pooled = Size();
+        stats.m_Limit = m_Limit.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Счетчик ссылок с повторным использованием объектов (примесь вместо
+// XQBS_RefBaseT). Для типов, которые создаются и уничтожаются очень часто
+// и каждый раз одинаковыми (контекст запроса, буфер сообщения), полный
+// деструктор и освобождение памяти в Release заменяются возвратом объекта
+// в пул своего типа, а XQBS_new_recycled выдает сначала объекты из пула.
+// Внутренние буферы объекта (строки, вектора) при этом сохраняют выделенную
+// память.
+//
+// Когда счетчик обнуляется (в том числе после отложенного уничтожения через
+// XQBS_RetireHook), вызывается T::Reset(), который должен привести объект
+// в состояние только что созданного и не должен генерировать исключения.
+// Объект из пула получает новый счетчик с одной ссылкой, как новый объект.
+//
+// Перед общим пулом (XQBS_RecyclePool на N объектов) у каждого потока есть
+// кеш на XQBS_RECYCLE_LOCAL объектов без атомарных операций. Переполненный
+// кеш отдает половину объектов в общий пул, пустой - забирает половину из
+// него, при завершении потока кеш целиком уходит в общий пул. Если общий пул
+// полон, объект удаляется как обычно через XQBS_delete_ptr. Статистика
+// копится в кеше и переносится в пул при обмене с ним, но не реже чем через
+// 256 операций, поэтому она отстает от действительности на эти операции.
+//
+// T - это класс потомок (CRTP), он должен быть конечным классом иерархии:
+// пул хранит объекты ровно типа T
+// C - это политика счетчика ссылок
+// N - наибольшее количество объектов в общем пуле, степень двойки
+template<class T, class C = XQBS_RefCountAtomic, size_t N = 256>
+class XQBS_RefBaseRecycled : public XQBS_RefBaseT<T, C>
+{
+    // Дружественная функция
+    template<class P> friend inline void XQBS_delete_ptr( IN P* ptr );
+
+public:
+
+    // Признак повторного использования для XQBS_RefBaseT
+    typedef void XQBS_RecycleTag;
+
+    // Пул объектов типа T
+    typedef XQBS_RecyclePool<T, N> Pool;
+
+private:
+
+    static_assert(XQBS_RECYCLE_LOCAL >= 2, "XQBS_RECYCLE_LOCAL must be at least 2");
+
+    // Кеш свободных объектов потока. Тривиальный тип: thread_local без
+    // деструктора остается доступным до самого конца потока
+    struct Local
+    {
+        T*       m_Items[XQBS_RECYCLE_LOCAL]; // Свободные объекты
+        unsigned m_Count;    // Количество свободных объектов
+        unsigned m_Hits;     // Статистика, еще не перенесенная в пул
+        unsigned m_Misses;
+        unsigned m_Recycled;
+        unsigned m_Dropped;
+        bool     m_bInit;    // Обработчик завершения потока зарегистрирован
+        bool     m_bDead;    // Поток завершается, кеш больше не используется
+    };
+
+    // Обработчик завершения потока: отдать кеш в общий пул
+    struct LocalExit
+    {
+        ~LocalExit()
+        {
+            Local& l = Cache();
+            Spill(l, l.m_Count);
+            Publish(l);
+            l.m_bInit = false;
+            l.m_bDead = true;
+        }
+    };
+
+    // Кеш текущего потока
+    static Local& Cache(void)
+    {
+        static thread_local Local t_Local; // нулевая инициализация
+        return t_Local;
+    }
+
+    // Первое обращение потока к кешу: регистрация обработчика завершения
+    XQBS_NOINLINE static void InitCache(IN Local& l)
+    {
+        static thread_local LocalExit t_Exit;
+        (void)t_Exit;
+        l.m_bInit = true;
+    }
+
+    // Перенести статистику кеша в пул
+    static void Publish(IN OUT Local& l)
+    {
+        Pool::Instance().AddStats(l.m_Hits, l.m_Misses, l.m_Recycled, l.m_Dropped);
+        l.m_Hits = l.m_Misses = l.m_Recycled = l.m_Dropped = 0;
+    }
+
+    // Перенести статистику в пул, если накопилось достаточно операций
+    XQBS_FORCEINLINE static void Account(IN OUT Local& l)
+    {
+        if (XQBS_UNLIKELY(l.m_Hits + l.m_Misses + l.m_Recycled >= 256))
+            Publish(l);
+    }
+
+    // Отдать count объектов из кеша в общий пул, не поместившиеся удаляются
+    XQBS_NOINLINE static void Spill(IN OUT Local& l, IN unsigned count)
+    {
+        for (; count > 0; --count)
+        {
+            T* ptr = l.m_Items[--l.m_Count];
+            if (!Pool::Instance().Push(ptr))
+            {
+                l.m_Dropped++;
+                XQBS_delete_ptr(ptr);
+            }
+        }
+        Publish(l);
+    }
+
+    // Забрать до count объектов из общего пула в кеш
+    XQBS_NOINLINE static void Refill(IN OUT Local& l, IN unsigned count)
+    {
+        for (; count > 0; --count)
+        {
+            T* ptr = Pool::Instance().Pop();
+            if (!ptr)
+                break;
+            l.m_Items[l.m_Count++] = ptr;
+        }
+        Publish(l);
+    }
+
+    // Вернуть объект в общий пул в обход кеша (поток завершается)
+    XQBS_NOINLINE static void RecycleShared(IN T* ptr)
+    {
+        bool bPushed = Pool::Instance().Push(ptr);
+        Pool::Instance().AddStats(0, 0, 1, bPushed ? 0 : 1);
+        if (!bPushed)
+            XQBS_delete_ptr(ptr);
+    }
+
+    // Взять объект из общего пула в обход кеша (поток завершается)
+    XQBS_NOINLINE static T* ReuseShared(void)
+    {
+        T* ptr = Pool::Instance().Pop();
+        Pool::Instance().AddStats(ptr ? 1 : 0, ptr ? 0 : 1, 0, 0);
+        return ptr;
+    }
+
+protected:
+
+    // Деструктор
+    ~XQBS_RefBaseRecycled() {}
+
+public:
+
+    // Конструктор
+    XQBS_RefBaseRecycled() {}
+
+    // Привести объект к состоянию нового перед возвратом в пул. Потомок
+    // объявляет свой Reset, этот вариант ничего не делает
+    void Reset(void) {}
+
+    // Вернуть объект без ссылок в пул или удалить, если пул полон (вызывается XQBS_RefBaseT)
+    static void XQBS_Recycle(IN T* ptr)
+    {
+        ptr->Reset();
+
+        Local& l = Cache();
+        if (XQBS_UNLIKELY(!l.m_bInit))
+        {
+            if (l.m_bDead)
+                return RecycleShared(ptr);
+            InitCache(l);
+        }
+
+        if (XQBS_UNLIKELY(XQBS_RECYCLE_LOCAL == l.m_Count))
+            Spill(l, XQBS_RECYCLE_LOCAL / 2);
+        l.m_Items[l.m_Count++] = ptr;
+        l.m_Recycled++;
+        Account(l);
+    }
+
+    // Взять объект из пула. Возвращает NULL, если пул пуст
+    static T* XQBS_Reuse(void)
+    {
+        T* ptr = NULL;
+
+        Local& l = Cache();
+        if (XQBS_UNLIKELY(!l.m_bInit))
+        {
+            if (l.m_bDead)
+                ptr = ReuseShared();
+            else
+                InitCache(l);
+        }
+
+        if (XQBS_LIKELY(!l.m_bDead))
+        {
+            if (XQBS_UNLIKELY(0 == l.m_Count))
+                Refill(l, XQBS_RECYCLE_LOCAL / 2);
+            if (XQBS_LIKELY(l.m_Count != 0))
+            {
+                ptr = l.m_Items[--l.m_Count];
+                l.m_Hits++;
+            }
+            else
+            {
+                l.m_Misses++;
+            }
+            Account(l);
+        }
+
+        if (ptr)
+            ptr->Revive();
+        return ptr;
+    }
+
+    // Удалить объекты из кеша текущего потока и из общего пула, пока в общем
+    // пуле больше keep объектов. Кеши других потоков не затрагиваются
+    static void Trim(IN size_t keep = 0)
+    {
+        Local& l = Cache();
+        if (!l.m_bDead)
+        {
+            while (l.m_Count)
+                XQBS_delete_ptr(l.m_Items[--l.m_Count]);
+            Publish(l);
+        }
+
+        while (Pool::Instance().Size() > keep)
+        {
+            T* ptr = Pool::Instance().Pop();
+            if (!ptr)
+                break;
+            XQBS_delete_ptr(ptr);
+        }
+    }
+
+    // Установить предел количества объектов в общем пуле (не больше N) и удалить лишние
+    static void SetPoolLimit(IN size_t limit)
+    {
+        Pool::Instance().SetLimit(limit);
+        Trim(limit);
+    }
+
+    // Статистика пула. Включает статистику текущего потока, остальные потоки
+    // переносят свою не реже чем через 256 операций
+    static XQBS_RecycleStats PoolStats(void)
+    {
+        Local& l = Cache();
+        if (!l.m_bDead)
+            Publish(l);
+        return Pool::Instance().Stats();
+    }
+};
+
+// Создать объект типа T (потомка XQBS_RefBaseRecycled) конструктором по умолчанию
+// или взять его из пула. Объект из пула приходит в состоянии после T::Reset()
+template<typename T>
+inline T* XQBS_new_recycled(void)
+{
+    static_assert(XQBS_IsRecyclable<T>::value, "XQBS_new_recycled needs a XQBS_RefBaseRecycled class");
+
+    T* ptr = T::XQBS_Reuse();
+    if (XQBS_LIKELY(ptr != NULL))
+        return ptr;
+    return XQBS_new<T>();
+}
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFRECYCLE_H
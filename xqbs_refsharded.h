@@ -0,0 +1,208 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refsharded.h
+*
+*/
+
+#ifndef XQBS_REFSHARDED_H
+#define XQBS_REFSHARDED_H
+
+#include <atomic>
+#include <limits>
+
+#if defined(XQBS_SHARD_BY_CPU) && defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "xqbs_defs.h"
+#include "xqbs_refbase.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Номер шарда текущего потока. По умолчанию потоки получают номера по кругу
+// при первом обращении, с -DXQBS_SHARD_BY_CPU (Linux) используется номер
+// процессора, на котором поток выполняется сейчас
+XQBS_FORCEINLINE unsigned XQBS_ShardIndex(void)
+{
+#if defined(XQBS_SHARD_BY_CPU) && defined(__linux__)
+    int cpu = ::sched_getcpu();
+    return cpu < 0 ? 0u : static_cast<unsigned>(cpu);
+#else
+    static std::atomic<unsigned> s_Next(0);
+    static thread_local unsigned t_Index = 0; // номер плюс один, ноль - номер еще не выдан
+
+    unsigned Index = t_Index;
+    if (XQBS_UNLIKELY(0 == Index))
+        t_Index = Index = s_Next.fetch_add(1, std::memory_order_relaxed) + 1;
+    return Index - 1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Шардированный счетчик ссылок, политика для XQBS_RefBaseT (аналог percpu_ref
+// из ядра Linux). Предназначен для немногих очень горячих общих объектов
+// (снимок конфигурации, таблица маршрутизации), которые AddRef/Release-ят все
+// потоки сразу: один m_RefCount для них становится строкой кеша, которую
+// процессоры передают друг другу на каждой операции.
+//
+// Пока объект "жив", AddRef/Release меняют один из N шардов, каждый на своей
+// строке кеша; шард выбирается по потоку (XQBS_ShardIndex). Значения шардов
+// могут быть отрицательными (ссылку взяли в одном потоке, отпустили в другом),
+// а ссылка создателя и большое смещение BIAS лежат в центральном счетчике,
+// поэтому в этом режиме счетчик не обнуляется и объект не удаляется.
+//
+// Владелец ссылки создателя вызывает Kill (XQBS_RefBaseT::Kill) вместо ее
+// Release, когда объект больше не раздается новым пользователям. Kill помечает
+// каждый шард флагом DEAD, забирая его значение атомарным обменом, и сворачивает
+// сумму в центральный счетчик вместе со снятием BIAS и ссылки создателя.
+// Операция, которая увидела DEAD в своем шарде, переходит на центральный
+// счетчик, так что ни одна ссылка не теряется и не считается дважды. После
+// Kill объект живет как с обычным атомарным счетчиком и уничтожается в Release
+// последней ссылки через XQBS_delete_ptr (или функцию отложенного уничтожения).
+//
+// Цена - (N + 1) строк кеша на объект и Kill за O(N). Объект без Kill не
+// удаляется никогда. Значения, которые возвращают Increment/Decrement до Kill,
+// приблизительные, точным является только ноль.
+// N - количество шардов, разумно брать не меньше количества ядер
+template<size_t N = 16>
+class alignas(XQBS_CACHE_LINE) XQBS_RefCountSharded
+{
+private:
+
+    enum : int64_t
+    {
+        DEAD = 1, // Флаг шарда: счетчик свернут, операции идут в m_Central
+        ONE  = 2  // Единица счетчика в шарде
+    };
+
+    // Смещение центрального счетчика до Kill: он не может дойти до нуля,
+    // пока шарды еще не свернуты
+    static const int64_t BIAS = int64_t(1) << 40;
+
+    // Шард счетчика на отдельной строке кеша
+    struct alignas(XQBS_CACHE_LINE) Shard
+    {
+        std::atomic<int64_t> m_Value; // Изменение счетчика в единицах ONE и флаг DEAD
+    };
+
+    std::atomic<int64_t> m_Central;   // Центральный счетчик: ссылка создателя и BIAS до Kill, все ссылки после
+    Shard                m_Shards[N]; // Шарды
+
+    // Счетчик не копируется вместе с объектом
+    XQBS_RefCountSharded(const XQBS_RefCountSharded&);
+    XQBS_RefCountSharded& operator= (const XQBS_RefCountSharded&);
+
+    // Шард текущего потока
+    XQBS_FORCEINLINE std::atomic<int64_t>& Current(void) { return m_Shards[XQBS_ShardIndex() % N].m_Value; }
+
+    // Значение центрального счетчика для возврата из Increment/Decrement
+    static LONG Clamp(IN int64_t RefCount)
+    {
+        return RefCount < std::numeric_limits<LONG>::max() ? static_cast<LONG>(RefCount) : std::numeric_limits<LONG>::max();
+    }
+
+    // Добавить ссылку в центральный счетчик (после Kill)
+    XQBS_NOINLINE LONG IncrementCentral(void)
+    {
+        int64_t RefCount = m_Central.fetch_add(1, std::memory_order_relaxed);
+
+        // Проверяем на воскрешение удаленного объекта, переполнение 64-битного счетчика невозможно
+        if (XQBS_UNLIKELY(RefCount <= 0))
+            XQBS_RefCountError();
+
+        return Clamp(RefCount + 1);
+    }
+
+    // Удалить ссылку из центрального счетчика (после Kill)
+    XQBS_NOINLINE LONG DecrementCentral(void)
+    {
+        int64_t RefCount = m_Central.fetch_sub(1, std::memory_order_release);
+
+        if (1 == RefCount)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return 0;
+        }
+
+        return Clamp(RefCount - 1);
+    }
+
+public:
+
+    static_assert(N > 0, "XQBS_RefCountSharded needs at least one shard");
+
+    // Конструктор, объект создается с одной ссылкой (ссылкой создателя)
+    XQBS_RefCountSharded() : m_Central(BIAS + 1)
+    {
+        for (size_t i = 0; i < N; ++i)
+            m_Shards[i].m_Value.store(0, std::memory_order_relaxed);
+    }
+
+    // Добавить ссылку. Шард, помеченный DEAD, после Kill больше никто не читает,
+    // поэтому сложение в него безвредно и проверка делается уже после fetch_add
+    XQBS_FORCEINLINE LONG Increment(void)
+    {
+        if (XQBS_LIKELY(!(Current().fetch_add(ONE, std::memory_order_relaxed) & DEAD)))
+            return 2; // есть еще ссылка создателя
+
+        return IncrementCentral();
+    }
+
+    // Удалить ссылку и вернуть новое значение счетчика, ноль - объект надо уничтожить.
+    // До Kill счетчик не обнуляется
+    XQBS_FORCEINLINE LONG Decrement(void)
+    {
+        if (XQBS_LIKELY(!(Current().fetch_sub(ONE, std::memory_order_release) & DEAD)))
+            return 1;
+
+        return DecrementCentral();
+    }
+
+    // Свернуть шарды в центральный счетчик и удалить ссылку создателя.
+    // Возвращает новое значение счетчика, ноль - объект надо уничтожить
+    LONG Kill(void)
+    {
+        int64_t Sum = 0;
+        for (size_t i = 0; i < N; ++i)
+        {
+            int64_t Value = m_Shards[i].m_Value.exchange(DEAD, std::memory_order_acq_rel);
+
+            // Повторный Kill
+            if (XQBS_UNLIKELY(Value & DEAD))
+                XQBS_RefCountError();
+
+            Sum += Value / ONE;
+        }
+
+        int64_t RefCount = m_Central.fetch_add(Sum - BIAS - 1, std::memory_order_acq_rel) + Sum - BIAS - 1;
+        if (0 == RefCount)
+            return 0;
+
+        if (XQBS_UNLIKELY(RefCount < 0))
+            XQBS_RefCountError();
+
+        return Clamp(RefCount);
+    }
+
+    // Текущее значение счетчика (только для диагностики, до Kill - приблизительное)
+    LONG Count(void) const
+    {
+        int64_t RefCount = m_Central.load(std::memory_order_relaxed);
+        if (m_Shards[0].m_Value.load(std::memory_order_relaxed) & DEAD)
+            return Clamp(RefCount);
+
+        for (size_t i = 0; i < N; ++i)
+            RefCount += m_Shards[i].m_Value.load(std::memory_order_relaxed) / ONE;
+        return Clamp(RefCount - BIAS);
+    }
+
+    // Привязать счетчик к объекту. Обнуление обнаруживается только в Release и Kill
+    void Attach(IN void* pObject, IN void (*pfnDestroy)(void*)) { (void)pObject; (void)pfnDestroy; }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFSHARDED_H
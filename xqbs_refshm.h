@@ -0,0 +1,967 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refshm.h
+*
+*/
+
+#ifndef XQBS_REFSHM_H
+#define XQBS_REFSHM_H
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_offsetptr.h"
+#include "xqbs_refbase.h"
+#include "xqbs_refptr.h"
+#include "xqbs_smartmmap.h"
+
+// Количество слотов процессов в сегменте разделяемой памяти, включая слот 0
+// самого сегмента (ссылки каталога имен): одновременно сегмент могут открыть
+// XQBS_SHM_PROCESSES - 1 процессов
+#ifndef XQBS_SHM_PROCESSES
+#define XQBS_SHM_PROCESSES 16
+#endif
+
+// Количество имен в каталоге сегмента разделяемой памяти
+#ifndef XQBS_SHM_NAMES
+#define XQBS_SHM_NAMES 32
+#endif
+
+_XQBS_BEGIN // XQBS namespace
+
+// Ошибка работы с сегментом разделяемой памяти. Вынесена в отдельную функцию,
+// чтобы генерация исключения не мешала подстановке AddRef в вызывающий код
+XQBS_NOINLINE XQBS_COLD inline void XQBS_ShmError(IN const char* pszWhat)
+{
+    // В этом месте вы должны использовать свой класс исключений!
+    throw std::runtime_error(pszWhat);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Заголовок блока памяти в сегменте разделяемой памяти. У блока объекта
+// (OBJECT) здесь же лежит счетчик ссылок: общий и по слотам процессов.
+// Общий счетчик решает, когда уничтожить объект, а счетчики процессов
+// позволяют снять ссылки процесса, который завершился аварийно.
+// AddRef сначала увеличивает общий счетчик, Release сначала уменьшает
+// счетчик процесса, поэтому процесс, упавший между двумя операциями,
+// оставляет лишнюю ссылку (утечку), но никогда не приводит к раннему удалению
+struct alignas(XQBS_CACHE_LINE) XQBS_ShmBlock
+{
+    enum { FREE, OBJECT, DATA };
+
+    uint64_t             m_Size;     // Размер блока вместе с заголовком
+    uint64_t             m_Next;     // FREE - следующий свободный блок, DATA - следующий блок того же владельца
+    uint64_t             m_Children; // OBJECT - первый блок данных, принадлежащий объекту
+    uint32_t             m_Kind;     // FREE, OBJECT или DATA
+    uint32_t             m_Reserved;
+    std::atomic<int64_t> m_Total;    // Общий счетчик ссылок
+    std::atomic<int32_t> m_Process[XQBS_SHM_PROCESSES]; // Ссылки по слотам процессов
+
+    XQBS_ShmBlock() : m_Size(0), m_Next(0), m_Children(0), m_Kind(FREE), m_Reserved(0), m_Total(0)
+    {
+        for (size_t i = 0; i < XQBS_SHM_PROCESSES; ++i)
+            m_Process[i].store(0, std::memory_order_relaxed);
+    }
+};
+
+static_assert(std::atomic<int64_t>::is_always_lock_free && std::atomic<int32_t>::is_always_lock_free,
+    "XQBS_ShmBlock counters must be address-free");
+
+class XQBS_ShmSegment;
+
+///////////////////////////////////////////////////////////////////////////////
+// Сегменты разделяемой памяти, открытые в этом процессе: по адресу объекта
+// счетчик ссылок находит свой сегмент и слот процесса в нем. Реестр никогда
+// не разрушается, поиск не берет блокировок
+class XQBS_ShmRegistry
+{
+public:
+
+    enum { MAX = 16 }; // Одновременно открытых сегментов
+
+    // Открытый сегмент
+    struct Entry
+    {
+        std::atomic<uintptr_t> m_Low;      // Начало отображения
+        std::atomic<uintptr_t> m_High;     // Конец отображения, ноль - запись свободна
+        XQBS_ShmSegment*       m_pSegment; // Сегмент
+        int                    m_Slot;     // Слот процесса в сегменте
+    };
+
+private:
+
+    Entry      m_Entries[MAX]; // Сегменты
+    std::mutex m_Lock;         // Защищает добавление и удаление
+
+    // Конструктор
+    XQBS_ShmRegistry()
+    {
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            m_Entries[i].m_Low.store(0, std::memory_order_relaxed);
+            m_Entries[i].m_High.store(0, std::memory_order_relaxed);
+            m_Entries[i].m_pSegment = NULL;
+            m_Entries[i].m_Slot = 0;
+        }
+    }
+
+public:
+
+    // Единственный экземпляр
+    static XQBS_ShmRegistry& Instance(void)
+    {
+        static XQBS_ShmRegistry* s_pRegistry = new XQBS_ShmRegistry();
+        return *s_pRegistry;
+    }
+
+    // Добавить сегмент, отображенный в [low, high). Возвращает false, если мест нет
+    bool Add(IN const void* low, IN const void* high, IN XQBS_ShmSegment* pSegment, IN int slot)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            Entry& e = m_Entries[i];
+            if (0 != e.m_High.load(std::memory_order_relaxed))
+                continue;
+            e.m_pSegment = pSegment;
+            e.m_Slot = slot;
+            e.m_Low.store(reinterpret_cast<uintptr_t>(low), std::memory_order_relaxed);
+            e.m_High.store(reinterpret_cast<uintptr_t>(high), std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // Удалить сегмент
+    void Remove(IN const XQBS_ShmSegment* pSegment)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            if (m_Entries[i].m_pSegment == pSegment && 0 != m_Entries[i].m_High.load(std::memory_order_relaxed))
+                m_Entries[i].m_High.store(0, std::memory_order_release);
+        }
+    }
+
+    // Найти сегмент, которому принадлежит адрес ptr, NULL если такого нет
+    const Entry* Find(IN const void* ptr) const
+    {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+        for (size_t i = 0; i < MAX; ++i)
+        {
+            const Entry& e = m_Entries[i];
+            uintptr_t High = e.m_High.load(std::memory_order_acquire);
+            if (addr < High && addr >= e.m_Low.load(std::memory_order_relaxed))
+                return &e;
+        }
+        return NULL;
+    }
+};
+
+// Блок объекта, который сейчас создает XQBS_ShmSegment::New в этом потоке
+inline XQBS_ShmBlock*& XQBS_ShmConstructing(void)
+{
+    static thread_local XQBS_ShmBlock* t_pBlock = NULL;
+    return t_pBlock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Политика счетчика ссылок для объектов в разделяемой памяти (XQBS_RefBaseShm).
+// Сам счетчик лежит в заголовке блока объекта, здесь только смещение до него.
+// AddRef и Release учитывают ссылку в слоте текущего процесса, слот
+// находится по адресу объекта в XQBS_ShmRegistry
+class XQBS_RefCountShm
+{
+private:
+
+    intptr_t m_Block; // Смещение заголовка блока объекта от адреса счетчика
+
+    // Счетчик не копируется вместе с объектом
+    XQBS_RefCountShm(const XQBS_RefCountShm&);
+    XQBS_RefCountShm& operator= (const XQBS_RefCountShm&);
+
+    // Заголовок блока объекта
+    XQBS_ShmBlock* Block(void) const
+    {
+        return reinterpret_cast<XQBS_ShmBlock*>(const_cast<char*>(reinterpret_cast<const char*>(this)) + m_Block);
+    }
+
+    // Слот текущего процесса в сегменте объекта
+    int Slot(void) const
+    {
+        const XQBS_ShmRegistry::Entry* pEntry = XQBS_ShmRegistry::Instance().Find(this);
+        if (XQBS_UNLIKELY(!pEntry))
+            XQBS_ShmError("XQBS_RefCountShm: shared memory segment is not open");
+        return pEntry->m_Slot;
+    }
+
+public:
+
+    // Конструктор, ссылку создателя объекта уже записал XQBS_ShmSegment::New
+    XQBS_RefCountShm() : m_Block(0)
+    {
+        XQBS_ShmBlock* pBlock = XQBS_ShmConstructing();
+        if (!pBlock)
+            XQBS_ShmError("XQBS_RefBaseShm objects must be created by XQBS_ShmSegment::New");
+        XQBS_ShmConstructing() = NULL;
+        m_Block = reinterpret_cast<char*>(pBlock) - reinterpret_cast<char*>(this);
+    }
+
+    // Добавить ссылку и вернуть новое значение общего счетчика
+    LONG Increment(void)
+    {
+        XQBS_ShmBlock* pBlock = Block();
+        int64_t RefCount = pBlock->m_Total.fetch_add(1, std::memory_order_relaxed);
+        pBlock->m_Process[Slot()].fetch_add(1, std::memory_order_relaxed);
+
+        if (XQBS_UNLIKELY(RefCount <= 0))
+            XQBS_RefCountError();
+
+        return static_cast<LONG>(RefCount + 1);
+    }
+
+    // Удалить ссылку и вернуть новое значение общего счетчика
+    LONG Decrement(void)
+    {
+        XQBS_ShmBlock* pBlock = Block();
+        pBlock->m_Process[Slot()].fetch_sub(1, std::memory_order_relaxed);
+        int64_t RefCount = pBlock->m_Total.fetch_sub(1, std::memory_order_release);
+
+        if (1 == RefCount)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return 0;
+        }
+
+        return static_cast<LONG>(RefCount - 1);
+    }
+
+    // Текущее значение общего счетчика (только для диагностики)
+    LONG Count(void) const { return static_cast<LONG>(Block()->m_Total.load(std::memory_order_relaxed)); }
+
+    // Объект уничтожается только в Release
+    void Attach(IN void* pObject, IN void (*pfnDestroy)(void*)) { (void)pObject; (void)pfnDestroy; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Сегмент разделяемой памяти POSIX (shm_open) для объектов со счетчиком
+// ссылок, общих для нескольких процессов одной машины: большой набор данных
+// строится один раз и читается всеми процессами без копирования.
+//
+// Память сегмента раздает распределитель со списком свободных блоков под
+// межпроцессной блокировкой (pthread_mutex с PTHREAD_PROCESS_SHARED, в Linux
+// еще и PTHREAD_MUTEX_ROBUST: если процесс упал, держа блокировку, следующий
+// владелец перестраивает список свободных блоков). Объекты создаются New,
+// данные объекта (массивы и т.п.) - Alloc/NewArray с владельцем: они
+// освобождаются вместе с объектом. Каждый процесс занимает в сегменте слот,
+// ссылки считаются и по слотам. Recover (и каждый новый Open) снимает ссылки
+// процессов, которые завершились, не закрыв сегмент, и освобождает объекты,
+// которые держали только они; деструкторы таких объектов не вызываются.
+//
+// Сегмент отображается в разные процессы по разным адресам, поэтому объекты
+// не должны содержать обычных указателей, указателей на таблицы виртуальных
+// функций и ссылок на память процесса (std::string, std::vector). Связи
+// хранятся в XQBS_OffsetPtr, доступ к общим объектам - через каталог имен
+// (Publish/Lookup). Ссылки между объектами сегмента не поддерживаются: их
+// учет привязан к слоту процесса, который их взял. После fork дочерний
+// процесс должен открыть сегмент заново и не использовать унаследованные ссылки
+class XQBS_ShmSegment
+{
+private:
+
+    // Слот процесса в заголовке сегмента
+    struct Process
+    {
+        int32_t  m_Pid;      // Процесс, ноль - слот свободен, -1 - слот самого сегмента
+        uint32_t m_Reserved;
+        uint64_t m_Start;    // Время запуска процесса (защита от повторного pid), ноль - неизвестно
+    };
+
+    // Имя в каталоге сегмента
+    struct Name
+    {
+        char     m_Name[48]; // Имя, пустая строка - запись свободна
+        uint64_t m_Block;    // Смещение блока объекта
+        uint64_t m_TypeSize; // sizeof типа объекта для проверки в Lookup
+    };
+
+    // Заголовок в начале сегмента
+    struct alignas(XQBS_CACHE_LINE) Header
+    {
+        char            m_Magic[8];   // Сигнатура (Magic)
+        uint32_t        m_Version;    // Версия формата
+        uint32_t        m_HeaderSize; // Размер заголовка
+        uint64_t        m_Size;       // Размер сегмента
+        pthread_mutex_t m_Lock;       // Межпроцессная блокировка распределителя, слотов и каталога
+        uint64_t        m_Free;       // Первый свободный блок, ноль - свободных нет
+        uint64_t        m_FreeBytes;  // Байтов в свободных блоках
+        Process         m_Process[XQBS_SHM_PROCESSES]; // Слоты процессов
+        Name            m_Names[XQBS_SHM_NAMES];       // Каталог имен
+    };
+
+    enum { VERSION = 1, ALIGN = XQBS_CACHE_LINE };
+
+    XQBS_SmartMmap m_Map;  // Отображение сегмента
+    int            m_Slot; // Слот этого процесса
+
+    // Сегмент не копируется
+    XQBS_ShmSegment(const XQBS_ShmSegment&);
+    XQBS_ShmSegment& operator= (const XQBS_ShmSegment&);
+
+    static const char* Magic(void) { return "XQBSSHM"; }
+
+    // Смещение первого блока
+    static uint64_t First(void) { return (sizeof(Header) + ALIGN - 1) & ~uint64_t(ALIGN - 1); }
+
+    Header* GetHeader(void) const { return static_cast<Header*>(m_Map.Get()); }
+    XQBS_ShmBlock* At(IN uint64_t offset) const { return reinterpret_cast<XQBS_ShmBlock*>(static_cast<char*>(m_Map.Get()) + offset); }
+    uint64_t OffsetOf(IN const XQBS_ShmBlock* pBlock) const { return reinterpret_cast<const char*>(pBlock) - static_cast<const char*>(m_Map.Get()); }
+
+    // Блок объекта или данных по адресу, который вернули New или Alloc
+    static XQBS_ShmBlock* BlockOf(IN const void* ptr)
+    {
+        return reinterpret_cast<XQBS_ShmBlock*>(const_cast<char*>(static_cast<const char*>(ptr)) - sizeof(XQBS_ShmBlock));
+    }
+
+    // Блокировка сегмента. Если прежний владелец блокировки завершился, не
+    // отпустив ее, распределитель мог остаться в промежуточном состоянии:
+    // список свободных блоков строится заново по цепочке блоков
+    class Guard
+    {
+    private:
+        Header* m_pHeader;
+    public:
+        Guard(IN const XQBS_ShmSegment& segment) : m_pHeader(segment.GetHeader())
+        {
+            int rc = pthread_mutex_lock(&m_pHeader->m_Lock);
+#ifdef __linux__
+            if (EOWNERDEAD == rc)
+            {
+                segment.Rebuild();
+                rc = pthread_mutex_consistent(&m_pHeader->m_Lock);
+            }
+#endif
+            if (rc)
+                throw std::system_error(rc, std::generic_category(), "XQBS_ShmSegment lock");
+        }
+        ~Guard() { pthread_mutex_unlock(&m_pHeader->m_Lock); }
+    };
+
+    // Время запуска процесса pid, ноль - неизвестно
+    static uint64_t ProcessStart(IN int pid)
+    {
+#ifdef __linux__
+        char path[64], buf[1024];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return 0;
+        ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+        ::close(fd);
+        if (n <= 0)
+            return 0;
+        buf[n] = 0;
+
+        // Поля после имени процесса в скобках: state (3-е поле) ... starttime (22-е поле)
+        const char* p = strrchr(buf, ')');
+        for (int field = 2; p && field < 22; ++field)
+            p = strchr(p + 1, ' ');
+        return p ? strtoull(p + 1, NULL, 10) : 0;
+#else
+        (void)pid;
+        return 0;
+#endif
+    }
+
+    // Процесс слота жив
+    static bool IsAlive(IN const Process& process)
+    {
+        if (0 != ::kill(process.m_Pid, 0) && ESRCH == errno)
+            return false;
+        return 0 == process.m_Start || ProcessStart(process.m_Pid) == process.m_Start;
+    }
+
+    // Перестроить список свободных блоков по цепочке блоков, соседние свободные
+    // блоки объединяются. Испорченный хвост цепочки становится свободным блоком.
+    // Вызывается под блокировкой
+    void Rebuild(void) const
+    {
+        Header* pHeader = GetHeader();
+        uint64_t Last = 0, FreeBytes = 0;
+        pHeader->m_Free = 0;
+
+        for (uint64_t Offset = First(); Offset < pHeader->m_Size; )
+        {
+            XQBS_ShmBlock* pBlock = At(Offset);
+            if (pBlock->m_Size < sizeof(XQBS_ShmBlock) || pBlock->m_Size > pHeader->m_Size - Offset || 0 != pBlock->m_Size % ALIGN)
+            {
+                pBlock->m_Size = pHeader->m_Size - Offset;
+                pBlock->m_Kind = XQBS_ShmBlock::FREE;
+            }
+
+            uint64_t Size = pBlock->m_Size;
+            if (XQBS_ShmBlock::FREE == pBlock->m_Kind)
+            {
+                FreeBytes += Size;
+                if (Last && Last + At(Last)->m_Size == Offset)
+                {
+                    At(Last)->m_Size += Size;
+                }
+                else
+                {
+                    pBlock->m_Next = 0;
+                    if (Last)
+                        At(Last)->m_Next = Offset;
+                    else
+                        pHeader->m_Free = Offset;
+                    Last = Offset;
+                }
+            }
+            Offset += Size;
+        }
+        pHeader->m_FreeBytes = FreeBytes;
+    }
+
+    // Выделить блок вида kind не меньше size байт, ноль - места нет. Вызывается под блокировкой
+    uint64_t AllocBlock(IN size_t size, IN uint32_t kind)
+    {
+        Header* pHeader = GetHeader();
+        if (size > pHeader->m_Size)
+            return 0;
+        uint64_t Need = ((size + ALIGN - 1) & ~uint64_t(ALIGN - 1)) + sizeof(XQBS_ShmBlock);
+
+        for (uint64_t Prev = 0, Offset = pHeader->m_Free; Offset; Prev = Offset, Offset = At(Offset)->m_Next)
+        {
+            XQBS_ShmBlock* pBlock = At(Offset);
+            if (pBlock->m_Size < Need)
+                continue;
+
+            uint64_t Next = pBlock->m_Next;
+            if (pBlock->m_Size - Need >= sizeof(XQBS_ShmBlock) + ALIGN)
+            {
+                // Остаток становится свободным блоком. Его заголовок пишется раньше,
+                // чем уменьшается размер блока, чтобы цепочка блоков оставалась целой
+                XQBS_ShmBlock* pRest = ::new (At(Offset + Need)) XQBS_ShmBlock();
+                pRest->m_Size = pBlock->m_Size - Need;
+                pRest->m_Next = Next;
+                Next = Offset + Need;
+                pBlock->m_Size = Need;
+            }
+
+            if (Prev)
+                At(Prev)->m_Next = Next;
+            else
+                pHeader->m_Free = Next;
+            pHeader->m_FreeBytes -= pBlock->m_Size;
+
+            pBlock->m_Next = 0;
+            pBlock->m_Children = 0;
+            pBlock->m_Total.store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < XQBS_SHM_PROCESSES; ++i)
+                pBlock->m_Process[i].store(0, std::memory_order_relaxed);
+            pBlock->m_Kind = kind;
+            return Offset;
+        }
+        return 0;
+    }
+
+    // Вернуть блок в список свободных с объединением соседей. Вызывается под блокировкой
+    void FreeBlock(IN uint64_t offset)
+    {
+        Header* pHeader = GetHeader();
+        XQBS_ShmBlock* pBlock = At(offset);
+        pBlock->m_Kind = XQBS_ShmBlock::FREE;
+        pHeader->m_FreeBytes += pBlock->m_Size;
+
+        uint64_t Prev = 0, Next = pHeader->m_Free;
+        while (Next && Next < offset)
+        {
+            Prev = Next;
+            Next = At(Next)->m_Next;
+        }
+
+        pBlock->m_Next = Next;
+        if (Next && offset + pBlock->m_Size == Next)
+        {
+            pBlock->m_Size += At(Next)->m_Size;
+            pBlock->m_Next = At(Next)->m_Next;
+        }
+
+        if (!Prev)
+        {
+            pHeader->m_Free = offset;
+        }
+        else if (Prev + At(Prev)->m_Size == offset)
+        {
+            At(Prev)->m_Size += pBlock->m_Size;
+            At(Prev)->m_Next = pBlock->m_Next;
+        }
+        else
+        {
+            At(Prev)->m_Next = offset;
+        }
+    }
+
+    // Освободить блок объекта вместе с его данными. Вызывается под блокировкой
+    void FreeObject(IN uint64_t offset)
+    {
+        for (uint64_t Child = At(offset)->m_Children; Child; )
+        {
+            uint64_t Next = At(Child)->m_Next;
+            FreeBlock(Child);
+            Child = Next;
+        }
+        FreeBlock(offset);
+    }
+
+    // Снять ссылки слота slot и освободить слот. Объекты, на которые больше
+    // нет ссылок, освобождаются без вызова деструктора. Вызывается под блокировкой
+    void Reap(IN int slot)
+    {
+        Header* pHeader = GetHeader();
+        bool bFreed = false;
+
+        for (uint64_t Offset = First(); Offset < pHeader->m_Size; Offset += At(Offset)->m_Size)
+        {
+            XQBS_ShmBlock* pBlock = At(Offset);
+            if (XQBS_ShmBlock::OBJECT != pBlock->m_Kind)
+                continue;
+
+            int32_t Count = pBlock->m_Process[slot].exchange(0, std::memory_order_relaxed);
+            if (Count && pBlock->m_Total.fetch_sub(Count, std::memory_order_acq_rel) == Count)
+            {
+                // Только отмечаем блоки свободными, список перестроит Rebuild
+                for (uint64_t Child = pBlock->m_Children; Child; Child = At(Child)->m_Next)
+                    At(Child)->m_Kind = XQBS_ShmBlock::FREE;
+                pBlock->m_Kind = XQBS_ShmBlock::FREE;
+                bFreed = true;
+            }
+        }
+
+        pHeader->m_Process[slot].m_Pid = 0;
+        pHeader->m_Process[slot].m_Start = 0;
+        if (bFreed)
+            Rebuild();
+    }
+
+    // Снять ссылки всех завершившихся процессов, вернуть их количество. Вызывается под блокировкой
+    size_t ReapDead(void)
+    {
+        Header* pHeader = GetHeader();
+        size_t Count = 0;
+        for (int i = 1; i < XQBS_SHM_PROCESSES; ++i)
+        {
+            if (pHeader->m_Process[i].m_Pid > 0 && !IsAlive(pHeader->m_Process[i]))
+            {
+                Reap(i);
+                ++Count;
+            }
+        }
+        return Count;
+    }
+
+    // Занять слот для этого процесса и зарегистрировать сегмент. Возвращает false при ошибке
+    bool Attach(void)
+    {
+        {
+            Guard lock(*this);
+            Header* pHeader = GetHeader();
+            ReapDead();
+            for (int i = 1; i < XQBS_SHM_PROCESSES && !m_Slot; ++i)
+            {
+                if (0 == pHeader->m_Process[i].m_Pid)
+                {
+                    pHeader->m_Process[i].m_Pid = static_cast<int32_t>(::getpid());
+                    pHeader->m_Process[i].m_Start = ProcessStart(::getpid());
+                    m_Slot = i;
+                }
+            }
+        }
+
+        if (!m_Slot)
+        {
+            m_Map.Reset();
+            errno = EUSERS;
+            return false;
+        }
+
+        if (!XQBS_ShmRegistry::Instance().Add(m_Map.Get(), static_cast<char*>(m_Map.Get()) + m_Map.Size(), this, m_Slot))
+        {
+            Detach();
+            errno = EMFILE;
+            return false;
+        }
+        return true;
+    }
+
+    // Освободить слот этого процесса и снять отображение
+    void Detach(void)
+    {
+        {
+            Guard lock(*this);
+            Reap(m_Slot);
+        }
+        m_Slot = 0;
+        m_Map.Reset();
+    }
+
+    // Найти имя в каталоге, NULL если его нет. Вызывается под блокировкой
+    Name* FindName(IN const char* name) const
+    {
+        for (size_t i = 0; i < XQBS_SHM_NAMES; ++i)
+        {
+            if (0 == strncmp(GetHeader()->m_Names[i].m_Name, name, sizeof(Name::m_Name)))
+                return &GetHeader()->m_Names[i];
+        }
+        return NULL;
+    }
+
+    // Объект по смещению его блока
+    template<class T>
+    T* ObjectAt(IN uint64_t offset) const { return reinterpret_cast<T*>(reinterpret_cast<char*>(At(offset)) + sizeof(XQBS_ShmBlock)); }
+
+    // Выделить блок данных с владельцем owner (объект этого сегмента или NULL)
+    void* AllocData(IN size_t size, IN const void* owner)
+    {
+        Guard lock(*this);
+        uint64_t Offset = AllocBlock(size, XQBS_ShmBlock::DATA);
+        if (!Offset)
+            return NULL;
+
+        if (owner)
+        {
+            XQBS_ShmBlock* pOwner = BlockOf(owner);
+            At(Offset)->m_Next = pOwner->m_Children;
+            pOwner->m_Children = Offset;
+        }
+        return reinterpret_cast<char*>(At(Offset)) + sizeof(XQBS_ShmBlock);
+    }
+
+public:
+
+    // Конструктор
+    XQBS_ShmSegment() : m_Slot(0) {}
+
+    // Деструктор закрывает сегмент (см. Close)
+    ~XQBS_ShmSegment() { Close(); }
+
+    // Создать сегмент name (имя shm_open, "/name") размером size байт.
+    // Возвращает false при ошибке, причина в errno (EEXIST - сегмент уже есть)
+    bool Create(IN const char* name, IN size_t size, IN mode_t mode = 0600)
+    {
+        Close();
+        size = (size + ALIGN - 1) & ~size_t(ALIGN - 1);
+        if (size < First() + sizeof(XQBS_ShmBlock) + ALIGN)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+        if (fd < 0)
+            return false;
+
+        bool bResult = 0 == ::ftruncate(fd, static_cast<off_t>(size)) && m_Map.Map(fd, size, 0, XQBS_MMAP_WRITE);
+
+        int err = errno;
+        ::close(fd);
+        if (!bResult)
+        {
+            ::shm_unlink(name);
+            errno = err;
+            return false;
+        }
+
+        Header* pHeader = ::new (m_Map.Get()) Header;
+        pHeader->m_Version = VERSION;
+        pHeader->m_HeaderSize = sizeof(Header);
+        pHeader->m_Size = size;
+        memset(pHeader->m_Process, 0, sizeof(pHeader->m_Process));
+        memset(pHeader->m_Names, 0, sizeof(pHeader->m_Names));
+        pHeader->m_Process[0].m_Pid = -1;
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        pthread_mutex_init(&pHeader->m_Lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        XQBS_ShmBlock* pBlock = ::new (At(First())) XQBS_ShmBlock();
+        pBlock->m_Size = size - First();
+        pHeader->m_Free = First();
+        pHeader->m_FreeBytes = pBlock->m_Size;
+
+        // Сигнатура пишется последней: Open не примет недостроенный сегмент
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(pHeader->m_Magic, Magic(), sizeof(pHeader->m_Magic));
+
+        if (!Attach())
+        {
+            ::shm_unlink(name);
+            return false;
+        }
+        return true;
+    }
+
+    // Открыть существующий сегмент name. Возвращает false при ошибке, причина
+    // в errno (EINVAL - не сегмент XQBS, EUSERS - все слоты процессов заняты)
+    bool Open(IN const char* name)
+    {
+        Close();
+        int fd = ::shm_open(name, O_RDWR, 0);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        bool bResult = 0 == ::fstat(fd, &st) && m_Map.Map(fd, static_cast<size_t>(st.st_size), 0, XQBS_MMAP_WRITE);
+
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        if (!bResult)
+            return false;
+
+        const Header* pHeader = GetHeader();
+        if (m_Map.Size() < First() || 0 != memcmp(pHeader->m_Magic, Magic(), sizeof(pHeader->m_Magic)) ||
+            pHeader->m_Version != VERSION || pHeader->m_HeaderSize != sizeof(Header) || pHeader->m_Size != m_Map.Size())
+        {
+            m_Map.Reset();
+            errno = EINVAL;
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        return Attach();
+    }
+
+    // Закрыть сегмент: снять ссылки этого процесса (объекты, на которые больше
+    // никто не ссылается, освобождаются без деструктора) и снять отображение.
+    // Ссылки процесса на объекты сегмента после этого недействительны
+    void Close(void)
+    {
+        if (!m_Map.IsMapped())
+            return;
+        XQBS_ShmRegistry::Instance().Remove(this);
+        Detach();
+    }
+
+    // Удалить имя сегмента (сам сегмент живет, пока его не закроют все процессы)
+    static bool Unlink(IN const char* name) { return 0 == ::shm_unlink(name); }
+
+    // Создать объект T в сегменте с одной ссылкой этого процесса.
+    // Бросает std::bad_alloc, если место в сегменте кончилось
+    template<class T, class... A>
+    T* New(A&&... args)
+    {
+        static_assert(!std::is_polymorphic<T>::value, "XQBS_ShmSegment objects must not have a vtable");
+        static_assert(alignof(T) <= ALIGN, "XQBS_ShmSegment objects must not be over-aligned");
+
+        uint64_t Offset;
+        {
+            Guard lock(*this);
+            Offset = AllocBlock(sizeof(T), XQBS_ShmBlock::OBJECT);
+        }
+        if (!Offset)
+            throw std::bad_alloc();
+
+        XQBS_ShmBlock* pBlock = At(Offset);
+        pBlock->m_Total.store(1, std::memory_order_relaxed);
+        pBlock->m_Process[m_Slot].store(1, std::memory_order_relaxed);
+
+        XQBS_ShmConstructing() = pBlock;
+        try
+        {
+            T* ptr = ::new (reinterpret_cast<char*>(pBlock) + sizeof(XQBS_ShmBlock)) T(std::forward<A>(args)...);
+            XQBS_ShmConstructing() = NULL;
+            return ptr;
+        }
+        catch (...)
+        {
+            XQBS_ShmConstructing() = NULL;
+            Guard lock(*this);
+            FreeObject(Offset);
+            throw;
+        }
+    }
+
+    // Выделить size байт данных в сегменте. Данные с владельцем owner (объект
+    // этого сегмента) освобождаются вместе с ним, без владельца - через Free.
+    // Возвращает NULL, если место кончилось
+    void* Alloc(IN size_t size, IN const void* owner = NULL) { return AllocData(size, owner); }
+
+    // Массив из count элементов тривиального типа T (значения не инициализируются)
+    template<class T>
+    T* NewArray(IN size_t count, IN const void* owner = NULL)
+    {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value, "XQBS_ShmSegment arrays must be trivial");
+        static_assert(alignof(T) <= ALIGN, "XQBS_ShmSegment arrays must not be over-aligned");
+
+        if (count > (size_t(-1) - ALIGN) / sizeof(T))
+            return NULL;
+        return static_cast<T*>(AllocData(count * sizeof(T), owner));
+    }
+
+    // Освободить данные без владельца, выделенные Alloc или NewArray
+    void Free(IN void* ptr)
+    {
+        if (!ptr)
+            return;
+        Guard lock(*this);
+        FreeBlock(OffsetOf(BlockOf(ptr)));
+    }
+
+    // Уничтожить объект без ссылок (вызывается из XQBS_RefBaseShm)
+    template<class T>
+    static void Destroy(IN T* ptr)
+    {
+        const XQBS_ShmRegistry::Entry* pEntry = XQBS_ShmRegistry::Instance().Find(ptr);
+        if (!pEntry)
+            XQBS_ShmError("XQBS_ShmSegment: shared memory segment is not open");
+
+        XQBS_ShmSegment* pSegment = pEntry->m_pSegment;
+        ptr->~T();
+
+        Guard lock(*pSegment);
+        pSegment->FreeObject(pSegment->OffsetOf(BlockOf(ptr)));
+    }
+
+    // Опубликовать объект под именем name: каталог сегмента держит на него
+    // свою ссылку, не привязанную ни к одному процессу. Возвращает false, если
+    // имя занято (EEXIST), слишком длинное (ENAMETOOLONG) или каталог полон (ENOSPC)
+    template<class T>
+    bool Publish(IN const char* name, IN T* ptr)
+    {
+        if (!*name || strlen(name) >= sizeof(Name::m_Name))
+        {
+            errno = *name ? ENAMETOOLONG : EINVAL;
+            return false;
+        }
+
+        Guard lock(*this);
+        if (FindName(name))
+        {
+            errno = EEXIST;
+            return false;
+        }
+
+        Name* pName = FindName("");
+        if (!pName)
+        {
+            errno = ENOSPC;
+            return false;
+        }
+
+        XQBS_ShmBlock* pBlock = BlockOf(ptr);
+        pBlock->m_Total.fetch_add(1, std::memory_order_relaxed);
+        pBlock->m_Process[0].fetch_add(1, std::memory_order_relaxed);
+
+        strncpy(pName->m_Name, name, sizeof(pName->m_Name) - 1);
+        pName->m_Block = OffsetOf(pBlock);
+        pName->m_TypeSize = sizeof(T);
+        return true;
+    }
+
+    // Получить ссылку на опубликованный объект, пустой указатель если имени
+    // нет или объект под ним другого размера
+    template<class T>
+    XQBS_RefPtr<T> Lookup(IN const char* name) const
+    {
+        Guard lock(*this);
+        const Name* pName = name && *name ? FindName(name) : NULL;
+        if (!pName || pName->m_TypeSize != sizeof(T))
+            return XQBS_RefPtr<T>();
+        return XQBS_RefPtr<T>(ObjectAt<T>(pName->m_Block));
+    }
+
+    // Убрать имя из каталога и отпустить ссылку каталога на объект.
+    // Возвращает false, если имени нет
+    template<class T>
+    bool Unpublish(IN const char* name)
+    {
+        T* ptr = NULL;
+        {
+            Guard lock(*this);
+            Name* pName = name && *name ? FindName(name) : NULL;
+            if (!pName || pName->m_TypeSize != sizeof(T))
+                return false;
+
+            // Ссылка каталога переходит к этому процессу и отпускается обычным Release
+            XQBS_ShmBlock* pBlock = At(pName->m_Block);
+            pBlock->m_Process[m_Slot].fetch_add(1, std::memory_order_relaxed);
+            pBlock->m_Process[0].fetch_sub(1, std::memory_order_relaxed);
+            ptr = ObjectAt<T>(pName->m_Block);
+            memset(pName, 0, sizeof(*pName));
+        }
+        ptr->Release();
+        return true;
+    }
+
+    // Снять ссылки процессов, которые завершились, не закрыв сегмент.
+    // Возвращает количество таких процессов
+    size_t Recover(void)
+    {
+        Guard lock(*this);
+        return ReapDead();
+    }
+
+    // Сегмент открыт
+    bool IsOpen(void) const { return m_Map.IsMapped(); }
+    // Размер сегмента
+    size_t Size(void) const { return m_Map.Size(); }
+    // Свободно байтов (вместе с заголовками свободных блоков)
+    size_t FreeBytes(void) const { Guard lock(*this); return static_cast<size_t>(GetHeader()->m_FreeBytes); }
+    // Слот этого процесса
+    int Slot(void) const { return m_Slot; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Базовый класс объектов со счетчиком ссылок в разделяемой памяти: AddRef и
+// Release работают в любом процессе, открывшем сегмент, последний Release
+// в любом из них вызывает деструктор и возвращает память распределителю
+// сегмента. Объекты создаются только XQBS_ShmSegment::New.
+// T - это класс потомок (CRTP)
+template<class T>
+class XQBS_RefBaseShm : public XQBS_RefBaseT<T, XQBS_RefCountShm>
+{
+    // Дружественная функция
+    template<class P> friend inline void XQBS_delete_ptr( IN P* ptr );
+
+public:
+
+    // Объект без ссылок уничтожается через XQBS_Recycle, а не XQBS_delete
+    typedef void XQBS_RecycleTag;
+
+    // Уничтожить объект без ссылок и вернуть память сегменту
+    static void XQBS_Recycle(IN T* ptr) { XQBS_ShmSegment::Destroy(ptr); }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !_WIN32
+
+#endif // !XQBS_REFSHM_H
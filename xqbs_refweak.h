@@ -0,0 +1,127 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_refweak.h
+*
+*/
+
+#ifndef XQBS_REFWEAK_H
+#define XQBS_REFWEAK_H
+
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include "xqbs_defs.h"
+#include "xqbs_refbase.h"
+#include "xqbs_refptr.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+// Мета-функция для определения объектов со слабыми ссылками (политика счетчика XQBS_RefCountWeak)
+template<class T, typename = void> struct XQBS_HasWeakRef : std::false_type {};
+template<class T> struct XQBS_HasWeakRef<T, decltype((void)std::declval<T&>().RefCounter().Counts())> : std::true_type {};
+
+///////////////////////////////////////////////////////////////////////////////
+// Многопоточная версия счетчика ссылок для иерархий классов со слабыми ссылками.
+// То же, что XQBS_RefBase, но со счетчиком XQBS_RefCountWeak: счетчики сильных
+// и слабых ссылок лежат в заголовке перед объектом, отдельного блока управления,
+// как у std::shared_ptr, нет.
+//  - при обнулении сильных ссылок вызывается деструктор объекта
+//    (сразу или через XQBS_RetireHook, как у XQBS_RefBase);
+//  - при обнулении слабых ссылок освобождается память объекта.
+// Чтобы дать слабые ссылки всем наследникам XQBS_RefBase сразу, соберите
+// проект с опцией CMake XQBS_REFBASE_COUNTER=Weak
+class XQBS_WeakRefBase : public XQBS_RefBaseT<XQBS_WeakRefBase, XQBS_RefCountWeak>
+{
+    // Дружественная функция
+    template<class T> friend inline void XQBS_delete_ptr( IN T* ptr );
+
+protected:
+
+    // Деструктор
+    virtual ~XQBS_WeakRefBase() {}
+
+public:
+
+    // Конструктор
+    XQBS_WeakRefBase() {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Слабая ссылка на объект со счетчиком XQBS_RefCountWeak. Не продлевает жизнь
+// объекта, но удерживает его блок памяти со счетчиками, поэтому Lock() безопасен
+// в любой момент. Хранит указатель на объект и указатель на счетчики: после
+// деструктора объект не читается, только заголовок.
+// T - это тип объекта
+template<class T>
+class XQBS_WeakPtr
+{
+    static_assert(XQBS_HasWeakRef<T>::value, "XQBS_WeakPtr needs an object with XQBS_RefCountWeak counter");
+
+private:
+
+    T*               m_p;       // Объект, на который удерживается слабая ссылка
+    XQBS_WeakCounts* m_pCounts; // Счетчики объекта
+
+public:
+
+    // Конструктор пустой ссылки
+    XQBS_WeakPtr() noexcept : m_p(NULL), m_pCounts(NULL) {}
+    // Конструктор из указателя на живой объект, по которому у вызывающего кода есть сильная ссылка
+    explicit XQBS_WeakPtr(IN T* p) : m_p(p), m_pCounts(p ? p->RefCounter().Counts() : NULL) { if (m_pCounts) m_pCounts->AddWeakRef(); }
+    // Конструктор из сильной ссылки
+    XQBS_WeakPtr(IN const XQBS_RefPtr<T>& r) : XQBS_WeakPtr(r.Get()) {}
+    // Конструктор копирования
+    XQBS_WeakPtr(IN const XQBS_WeakPtr& r) : m_p(r.m_p), m_pCounts(r.m_pCounts) { if (m_pCounts) m_pCounts->AddWeakRef(); }
+    // Конструктор перемещения
+    XQBS_WeakPtr(IN OUT XQBS_WeakPtr&& r) noexcept : m_p(r.m_p), m_pCounts(r.m_pCounts) { r.m_p = NULL; r.m_pCounts = NULL; }
+
+    // Деструктор
+    ~XQBS_WeakPtr() { if (m_pCounts) m_pCounts->ReleaseWeak(); }
+
+    // Оператор присваивания копированием
+    XQBS_WeakPtr& operator= (IN const XQBS_WeakPtr& r) { XQBS_WeakPtr(r).Swap(*this); return *this; }
+    // Оператор присваивания перемещением
+    XQBS_WeakPtr& operator= (IN OUT XQBS_WeakPtr&& r) noexcept { XQBS_WeakPtr(std::move(r)).Swap(*this); return *this; }
+    // Оператор присваивания сильной ссылки
+    XQBS_WeakPtr& operator= (IN const XQBS_RefPtr<T>& r) { XQBS_WeakPtr(r).Swap(*this); return *this; }
+
+    // Освободить слабую ссылку
+    void Reset(void)
+    {
+        XQBS_WeakCounts* pCounts = m_pCounts;
+        m_p = NULL;
+        m_pCounts = NULL;
+        if (pCounts)
+            pCounts->ReleaseWeak();
+    }
+
+    // Обменять содержимое двух ссылок
+    void Swap(IN OUT XQBS_WeakPtr& r) noexcept
+    {
+        std::swap(m_p, r.m_p);
+        std::swap(m_pCounts, r.m_pCounts);
+    }
+
+    // Получить сильную ссылку без блокировок, пустую если объект уже уничтожен
+    // или вот-вот будет уничтожен
+    XQBS_RefPtr<T> Lock(void) const
+    {
+        if (!m_pCounts || !m_pCounts->TryAddRef())
+            return XQBS_RefPtr<T>();
+
+        // Объект жив, профилировщик видит удачный Lock как AddRef
+        XQBS_REFPROFILE(typeid(*m_p), XQBS_REFPROFILE_ADDREF)
+        return XQBS_RefPtr<T>(m_p, XQBS_AdoptRef());
+    }
+
+    // Признак того, что объект уже уничтожен или ссылка пустая
+    bool Expired(void) const { return !m_pCounts || m_pCounts->Expired(); }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_REFWEAK_H
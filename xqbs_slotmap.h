@@ -0,0 +1,358 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_slotmap.h
+*
+*/
+
+#ifndef XQBS_SLOTMAP_H
+#define XQBS_SLOTMAP_H
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "xqbs_defs.h"
+#include "xqbs_smartguard.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Описатель объекта в XQBS_SlotMap: 32 бита, из них 22 бита - номер слота
+// и 10 бит - поколение слота. Нулевое значение - пустой описатель (поколения
+// начинаются с единицы). Описатель вдвое короче указателя и не висит: после
+// удаления объекта поколение слота меняется, и старый описатель перестает
+// находить объект
+class XQBS_SlotHandle
+{
+public:
+
+    enum
+    {
+        INDEX_BITS      = 22,                             // Бит на номер слота
+        GENERATION_BITS = 10,                             // Бит на поколение
+        MAX_INDEX       = (1u << INDEX_BITS) - 1,         // Наибольший номер слота
+        MAX_GENERATION  = (1u << GENERATION_BITS) - 1     // Наибольшее поколение
+    };
+
+private:
+
+    uint32_t m_Value; // Поколение в старших битах, номер слота в младших
+
+public:
+
+    // Конструктор пустого описателя
+    XQBS_SlotHandle() noexcept : m_Value(0) {}
+    // Конструктор из номера слота и поколения
+    XQBS_SlotHandle(IN uint32_t index, IN uint32_t generation) noexcept : m_Value((generation << INDEX_BITS) | index) {}
+
+    // Описатель из сохраненного значения (см. Value)
+    static XQBS_SlotHandle FromValue(IN uint32_t value) noexcept { XQBS_SlotHandle h; h.m_Value = value; return h; }
+
+    // Номер слота
+    uint32_t Index(void) const noexcept { return m_Value & MAX_INDEX; }
+    // Поколение слота
+    uint32_t Generation(void) const noexcept { return m_Value >> INDEX_BITS; }
+    // Значение для хранения и передачи
+    uint32_t Value(void) const noexcept { return m_Value; }
+    // Пустой описатель
+    bool IsNull(void) const noexcept { return 0 == m_Value; }
+
+    bool operator== (IN const XQBS_SlotHandle& r) const noexcept { return m_Value == r.m_Value; }
+    bool operator!= (IN const XQBS_SlotHandle& r) const noexcept { return m_Value != r.m_Value; }
+};
+
+static_assert(sizeof(XQBS_SlotHandle) == sizeof(uint32_t), "XQBS_SlotHandle must be 32-bit");
+
+///////////////////////////////////////////////////////////////////////////////
+// Таблица объектов с описателями (slot map): объекты типа T лежат подряд в
+// одном массиве, а вместо указателей на них хранятся 32-битные описатели
+// XQBS_SlotHandle. Get по описателю - два обращения к массивам без поиска,
+// устаревший описатель (объект удален, слот занят другим объектом) дает NULL.
+// Полный обход (begin/end, ForEach) идет по плотному массиву в порядке памяти,
+// без переходов по разбросанным по куче указателям.
+//
+// Remove переносит последний объект массива на место удаленного, поэтому
+// адреса объектов меняются при удалении и при росте массива: между вызовами
+// храните описатели, а не указатели. Слот, поколение которого дошло до
+// MAX_GENERATION, выводится из оборота, чтобы старый описатель никогда не
+// совпал с новым. Освободившиеся слоты выдаются в порядке освобождения (FIFO),
+// так поколение одного слота растет медленнее.
+//
+// Поэтому за время жизни таблицы в нее можно добавить не больше
+// (MAX_INDEX + 1) * MAX_GENERATION, то есть около 4.3e9 объектов, дальше
+// Insert бросает std::length_error. Таблица с постоянной сменой объектов
+// должна время от времени возвращать выведенные слоты в оборот через Recycle
+// (например после Clear), когда ни одного описателя удаленных объектов
+// больше нигде не хранится. Таблица не потокобезопасна, как и стандартные
+// контейнеры.
+// T - это тип объекта (перемещаемый)
+template<class T>
+class XQBS_SlotMap
+{
+private:
+
+    enum { NONE = 0xFFFFFFFFu };
+
+    // Слот
+    struct Slot
+    {
+        uint32_t m_Dense;      // Занятый слот - индекс объекта в m_Values, свободный - следующий свободный слот
+        uint32_t m_Generation; // Текущее поколение, ноль - слот выведен из оборота
+    };
+
+    std::vector<T>        m_Values;   // Объекты подряд
+    std::vector<uint32_t> m_Owners;   // Номер слота для каждого объекта m_Values
+    std::vector<Slot>     m_Slots;    // Слоты
+    uint32_t              m_FreeHead; // Первый свободный слот
+    uint32_t              m_FreeTail; // Последний свободный слот
+    size_t                m_Retired;  // Количество слотов, выведенных из оборота
+
+    // Слот описателя h, NULL если описатель устарел
+    const Slot* Find(IN XQBS_SlotHandle h) const noexcept
+    {
+        uint32_t Index = h.Index();
+        if (Index >= m_Slots.size())
+            return NULL;
+        const Slot& s = m_Slots[Index];
+        return s.m_Generation == h.Generation() && 0 != s.m_Generation ? &s : NULL;
+    }
+
+    // Добавить слот в конец списка свободных
+    void PushFree(IN uint32_t index) noexcept
+    {
+        m_Slots[index].m_Dense = NONE;
+        if (NONE == m_FreeTail)
+            m_FreeHead = index;
+        else
+            m_Slots[m_FreeTail].m_Dense = index;
+        m_FreeTail = index;
+    }
+
+    // Занять слот для объекта с индексом dense, вернуть описатель
+    XQBS_SlotHandle TakeSlot(IN uint32_t dense)
+    {
+        uint32_t Index;
+        if (NONE != m_FreeHead)
+        {
+            Index = m_FreeHead;
+            m_FreeHead = m_Slots[Index].m_Dense;
+            if (NONE == m_FreeHead)
+                m_FreeTail = NONE;
+        }
+        else
+        {
+            Index = static_cast<uint32_t>(m_Slots.size());
+            Slot s = { 0, 1 };
+            m_Slots.push_back(s);
+        }
+
+        m_Slots[Index].m_Dense = dense;
+        return XQBS_SlotHandle(Index, m_Slots[Index].m_Generation);
+    }
+
+    // Освободить слот: следующее поколение или вывод из оборота
+    void ReleaseSlot(IN uint32_t index) noexcept
+    {
+        Slot& s = m_Slots[index];
+        if (s.m_Generation >= XQBS_SlotHandle::MAX_GENERATION)
+        {
+            s.m_Generation = 0;
+            s.m_Dense = NONE;
+            ++m_Retired;
+            return;
+        }
+        ++s.m_Generation;
+        PushFree(index);
+    }
+
+public:
+
+    typedef T*       iterator;
+    typedef const T* const_iterator;
+
+    // Конструктор
+    XQBS_SlotMap() : m_FreeHead(NONE), m_FreeTail(NONE), m_Retired(0) {}
+
+    // Зарезервировать место под count объектов
+    void Reserve(IN size_t count)
+    {
+        m_Values.reserve(count);
+        m_Owners.reserve(count);
+        m_Slots.reserve(count);
+    }
+
+    // Создать объект из аргументов args и вернуть его описатель.
+    // Бросает std::length_error, если свободных слотов нет, а новых уже
+    // MAX_INDEX + 1 (в том числе когда все слоты выведены из оборота, см. Recycle)
+    template<class... A>
+    XQBS_SlotHandle Insert(A&&... args)
+    {
+        if (NONE == m_FreeHead && m_Slots.size() > XQBS_SlotHandle::MAX_INDEX)
+            throw std::length_error("XQBS_SlotMap: out of slots");
+
+        // Сначала все, что может бросить исключение, потом изменение слотов
+        m_Owners.reserve(m_Values.size() + 1);
+        m_Slots.reserve(m_Slots.size() + 1);
+        m_Values.emplace_back(std::forward<A>(args)...);
+
+        uint32_t Dense = static_cast<uint32_t>(m_Values.size() - 1);
+        XQBS_SlotHandle h = TakeSlot(Dense);
+        m_Owners.push_back(h.Index());
+        return h;
+    }
+
+    // Удалить объект. Возвращает false, если описатель устарел
+    bool Remove(IN XQBS_SlotHandle h)
+    {
+        const Slot* s = Find(h);
+        if (!s)
+            return false;
+
+        uint32_t Dense = s->m_Dense;
+        uint32_t Last = static_cast<uint32_t>(m_Values.size() - 1);
+        if (Dense != Last)
+        {
+            m_Values[Dense] = std::move(m_Values[Last]);
+            m_Owners[Dense] = m_Owners[Last];
+            m_Slots[m_Owners[Dense]].m_Dense = Dense;
+        }
+        m_Values.pop_back();
+        m_Owners.pop_back();
+
+        ReleaseSlot(h.Index());
+        return true;
+    }
+
+    // Удалить все объекты, все выданные описатели устаревают
+    void Clear(void)
+    {
+        for (size_t i = 0; i < m_Owners.size(); ++i)
+            ReleaseSlot(m_Owners[i]);
+        m_Values.clear();
+        m_Owners.clear();
+    }
+
+    // Вернуть в оборот слоты, поколение которых дошло до MAX_GENERATION,
+    // поколения этих слотов начинаются заново. Вызывающий код гарантирует,
+    // что описателей удаленных объектов больше нигде нет: иначе такой
+    // описатель может снова найти объект. Описатели живых объектов остаются
+    // действительными
+    void Recycle(void)
+    {
+        if (!m_Retired)
+            return;
+        for (size_t i = 0; i < m_Slots.size(); ++i)
+        {
+            if (0 == m_Slots[i].m_Generation)
+            {
+                m_Slots[i].m_Generation = 1;
+                PushFree(static_cast<uint32_t>(i));
+            }
+        }
+        m_Retired = 0;
+    }
+
+    // Количество слотов, выведенных из оборота (возвращаются через Recycle)
+    size_t Retired(void) const noexcept { return m_Retired; }
+
+    // Объект по описателю, NULL если описатель устарел
+    T* Get(IN XQBS_SlotHandle h) noexcept
+    {
+        const Slot* s = Find(h);
+        return s ? &m_Values[s->m_Dense] : NULL;
+    }
+
+    const T* Get(IN XQBS_SlotHandle h) const noexcept
+    {
+        const Slot* s = Find(h);
+        return s ? &m_Values[s->m_Dense] : NULL;
+    }
+
+    // Описатель указывает на живой объект
+    bool Contains(IN XQBS_SlotHandle h) const noexcept { return NULL != Find(h); }
+
+    // Описатель объекта с индексом index плотного массива (0..Size()-1)
+    XQBS_SlotHandle HandleAt(IN size_t index) const noexcept
+    {
+        uint32_t Index = m_Owners[index];
+        return XQBS_SlotHandle(Index, m_Slots[Index].m_Generation);
+    }
+
+    // Вызвать f(h, object) для каждого живого объекта в порядке памяти.
+    // Внутри f нельзя добавлять и удалять объекты
+    template<class F>
+    void ForEach(F&& f)
+    {
+        for (size_t i = 0; i < m_Values.size(); ++i)
+            f(HandleAt(i), m_Values[i]);
+    }
+
+    // Количество объектов
+    size_t Size(void) const noexcept { return m_Values.size(); }
+    // Таблица пуста
+    bool Empty(void) const noexcept { return m_Values.empty(); }
+    // Объекты подряд (Size() штук)
+    T* Data(void) noexcept { return m_Values.data(); }
+    const T* Data(void) const noexcept { return m_Values.data(); }
+
+    // Обход живых объектов в порядке памяти
+    iterator begin(void) noexcept { return m_Values.data(); }
+    iterator end(void) noexcept { return m_Values.data() + m_Values.size(); }
+    const_iterator begin(void) const noexcept { return m_Values.data(); }
+    const_iterator end(void) const noexcept { return m_Values.data() + m_Values.size(); }
+};
+
+// Удаление объекта из XQBS_SlotMap по описателю (функция очистки с состоянием)
+template<class T>
+struct XQBS_SlotMapRemove
+{
+    XQBS_SlotMap<T>* m_pMap; // Таблица, которой принадлежит описатель
+
+    XQBS_SlotMapRemove() noexcept : m_pMap(NULL) {}
+
+    static XQBS_SlotHandle Null(void) { return XQBS_SlotHandle(); }
+
+    void operator() (IN XQBS_SlotHandle h) const { if (m_pMap) m_pMap->Remove(h); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для объекта, который живет в XQBS_SlotMap до выхода из
+// области видимости: хранит описатель и таблицу и обеспечивает автоматический
+// вызов Remove. Устаревший описатель (объект уже удален) просто пропускается
+template<class T>
+class XQBS_SmartSlot : public XQBS_SmartGuard<XQBS_SlotHandle, _XQBS XQBS_SlotMapRemove<T> >
+{
+private:
+
+    typedef XQBS_SmartGuard<XQBS_SlotHandle, _XQBS XQBS_SlotMapRemove<T> > Base;
+
+public:
+
+    // Конструктор пустого SmartSlot-а
+    XQBS_SmartSlot() {}
+    // Конструктор, SmartSlot становится владельцем описателя h таблицы map
+    XQBS_SmartSlot(IN XQBS_SlotMap<T>& map, IN XQBS_SlotHandle h) : Base(h) { this->GetCleanup().m_pMap = &map; }
+
+    using Base::operator=;
+
+    // Создать объект в таблице map и стать владельцем его описателя
+    template<class... A>
+    static XQBS_SmartSlot Insert(IN XQBS_SlotMap<T>& map, A&&... args)
+    {
+        return XQBS_SmartSlot(map, map.Insert(std::forward<A>(args)...));
+    }
+
+    // Объект, NULL если описатель пуст или устарел
+    T* Object(void) const noexcept
+    {
+        XQBS_SlotMap<T>* pMap = this->GetCleanup().m_pMap;
+        return pMap ? pMap->Get(this->Get()) : NULL;
+    }
+};
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_SLOTMAP_H
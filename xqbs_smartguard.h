@@ -1,352 +1,631 @@
-/*
-* This software is copyright protected (C) 2009 XQBS
-*
-* Author:                Alexey N. Zhirov
-* E-mail:                src@xqbs.ru
-* Module:                xqbs_smartguard.h
-*
-*/
-
-#ifndef XQBS_SMART_GUARD_H
-#define XQBS_SMART_GUARD_H
-
-#include "xqbs_defs.h"
-#include "xqbs_mem.h"
-#include "xqbs_refbase.h"
-
-_XQBS_BEGIN // XQBS namespace
-
-// Мета-триггер для вызова глобальной функции
-struct XQBS_GuardClassDefault{};
-// Мета-триггер для вызова функции с параметром
-struct XQBS_GuardWithParam{};
-// Мета-триггер для вызова функции без параметра
-struct XQBS_GuardWithoutParam{};
-
-// Мнимый тип для определения функции удаления объектов через XQBS_SmartGuardBase::DeleteObject
-struct XQBS_DeleteObjectFakeType{};
-// Мнимый тип для определения функции удаления объектов через XQBS_SmartGuardBase::DeleteObjectArray
-struct XQBS_DeleteObjectArrayFakeType{};
-
-
-// Прототип функции для удаление объекта через XQBS_SmartGuardBase::DeleteObject
-typedef XQBS_DeleteObjectFakeType* (*XQBS_DeleteObject)(void*);
-// Прототип функции для удаление массива объектов через XQBS_SmartGuardBase::DeleteObjectArray
-typedef XQBS_DeleteObjectArrayFakeType* (*XQBS_DeleteObjectArray)(void*);
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Базовый класс SmartGuard-а с реализацией базовой функциональности
-// P - это тип объекта (обычно это указатель на тип, например int* или std::string* и т.д.,
-//     но может быть и не указатель, а например HANDLE)
-// F - это прототип глобальной функции (например void(__cdecl*)(void*) - прототип функции free)
-template< typename P, typename F >
-class XQBS_SmartGuardBase
-{
-public:
-
-    // Функция для удаления памяти выделенной через new
-    static XQBS_DeleteObjectFakeType* DeleteObject(IN void* ptr) { XQBS_delete( reinterpret_cast<P&>(ptr) ); return NULL; }
-    // Функция для удаления памяти выделенной через new []
-    static XQBS_DeleteObjectArrayFakeType* DeleteObjectArray(IN void* ptr) { XQBS_delete_size( reinterpret_cast<P&>(ptr) ); return NULL; }
-
-    // Конструктор для варианта, когда нельзя передать ссылку на указатель
-    // p - это указатель на объект типа P;
-    // f - это указатель на функцию, которую надо вызвать
-    XQBS_SmartGuardBase(IN P p, IN F f) : m_d(p), m_p(m_d), m_f(f), m_v(NULL) {}
-
-    // Конструктор для варианта, когда и функцию вызвать надо и указатель проинициализировать надо
-    // p - это ссылка на указатель на объект;
-    // f - это функция, которую надо вызвать
-    // v - это значение которым надо проинициализировать указатель после вызова функции f
-    XQBS_SmartGuardBase(IN OUT P& p, IN F f, IN P v) : m_p(p), m_f(f), m_v(v) {}
-
-    // Оператор присваивания для инициализации SmartGuard-а другим указателем,
-    // старый указатель перетирается БЕЗ вызова предзаданной функции!
-    // p - это указатель, который необходимо поставить на контроль.
-    //
-    // ВНИМАНИЕ!!!
-    //   1. При использовании данного оператора указатель p не инициализируется после вызова функции F
-    //   2. При использовании данного оператора вызов функции F не делается!
-    //   3. Для вызова функции F используйте явный вызов функции Reset() потомка.
-    XQBS_SmartGuardBase& operator= (IN P p) { m_p = p; return *this; }
-
-    // Для того, чтобы SmartGuard вел себя как указатель, определим неявное приведение к P&
-    operator P& () { return m_p; }
-
-    // Выполнить принудительный вызов функции F
-    void Reset(void)
-    {
-        if (m_f && m_p != m_v)
-        {
-            m_f(m_p);
-            m_p = m_v;
-        }
-    }
-
-protected:
-
-    // Виртуальный деструктор
-    virtual ~XQBS_SmartGuardBase() {}
-
-protected:
-
-    P&   m_p; // Ссылка на указатель для обратной связи
-    F    m_f; // Указатель на функцию
-    P    m_v; // Значение для инициализации (по умолчанию NULL)
-    P    m_d; // m_p - это всегда ссылка, поэтому для того, чтобы можно было инициализировать m_p
-    // не только ссылкой на переменную, но и константой, используется этот финт ушами с m_d
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Реализация SmartGuard-а для случая, когда надо вызывать функцию член класса
-// P - указатель на тип
-// F - прототип функции члена класса C, которую надо вызвать
-// C - класс из которого надо вызвать функцию член,
-//     имеет значение мета-триггера XQBS_GuardClassDefault, для того, чтобы можно было
-//     вызывать частичную специализацию класса SmartGuard без указания С
-// B - Мета-триггер для управления поведением SmartGuard-а, может принимать следующие значения:
-//     XQBS_GuardWithParam    - для вызова функции F с параметром P (данное значение мета-триггера
-//                              используется по умолчанию, т.к. чаще приходится вызывать функцию F
-//                              с параметром P)
-//     XQBS_GuardWithoutParam - для вызова функции F без параметра P
-template< typename P, typename F, typename B = XQBS_GuardWithParam, typename C = XQBS_GuardClassDefault >
-class XQBS_SmartGuard : public XQBS_SmartGuardBase<P, F>
-{
-protected:
-
-    C&   m_c;  // Ссылка на объект класса C, используется для вызова функции члена f
-
-protected:
-
-    // Определение шаблона для управления поведением SmartGuard-а, определяемое мета-триггером B
-    template<typename O, typename T> struct _Reset {};
-
-    // Частичная спецификация шаблона для случая вызова функции F члена класса C с параметром P
-    template<typename O> struct _Reset<O, XQBS_GuardWithParam>
-    {
-        // Конструктор с параметром, о - это объект класса C
-        _Reset(IN OUT O& o)
-        {
-            if (o.m_f && o.m_p != o.m_v)
-            {
-                (o.m_c.*o.m_f)(o.m_p);
-                o.m_p = o.m_v;
-            }
-        }
-    };
-
-    // Частичная спецификация шаблона для случая вызова функции F члена класса C без параметра
-    template<typename O> struct _Reset<O, XQBS_GuardWithoutParam>
-    {
-        // Конструктор с параметром, о - это объект класса C
-        _Reset(IN OUT O& o)
-        {
-            if (o.m_f && o.m_p != o.m_v)
-            {
-                (o.m_c.*o.m_f)();
-                o.m_p = o.m_v;
-            }
-        }
-    };
-
-public:
-
-    /// Конструктор для варианта, когда нельзя передать ссылку на указатель
-    // p - это указатель на объект
-    // f - это указатель на функцию член класса c
-    // c - это объект класса C
-    XQBS_SmartGuard(IN P p, IN F f, IN C& c) : XQBS_SmartGuardBase(p, f), m_c(c) {}
-    // Конструктор для варианта, когда надо вызвать функцию f член класса c и
-    // после этого проинициализировать указатель значением v
-    // p - это указатель на объект
-    // f - это указатель на функцию член класса C
-    // v - это значение, которым надо проинициализировать p после вызова функции f
-    // c - это объект класса C
-    XQBS_SmartGuard(IN OUT P& p, IN F f, IN P v, IN C& c) : XQBS_SmartGuardBase(p, f, v), m_c(c) {}
-
-    // Виртуальный деструктор с автоматическим вызовом функции Reset
-    virtual ~XQBS_SmartGuard() {  Reset(); }
-
-    // Выполнить принудительный вызов функции F с учетом значения мета-триггера B
-    void Reset(void) { _Reset<XQBS_SmartGuard, B> R(*this); }
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Частичная специализация SmartGuard-а для случая, когда надо вызывать глобальную функцию F
-// P - это указатель на тип
-// F - это прототип глобальной функции
-template< typename P, typename F, typename B >
-class XQBS_SmartGuard < P, F, B, XQBS_GuardClassDefault> : public XQBS_SmartGuardBase<P, F>
-{
-protected:
-
-    // Определение шаблона для управления поведением SmartGuard-а, определяемое мета-триггером B
-    template<typename O, typename T> struct _Reset {};
-
-    // Частичная спецификация шаблона для случая вызова функции F члена класса C с параметром P
-    template<typename O> struct _Reset<O, XQBS_GuardWithParam>
-    {
-        // Конструктор с параметром, о - это объект класса C
-        _Reset(IN OUT O& o)
-        {
-            if (o.m_f && o.m_p != o.m_v)
-            {
-                o.m_f(o.m_p);
-                o.m_p = o.m_v;
-            }
-        }
-    };
-
-    // Частичная спецификация шаблона для случая вызова функции F члена класса C без параметра
-    template<typename O> struct _Reset<O, XQBS_GuardWithoutParam>
-    {
-        // Конструктор с параметром, о - это объект класса C
-        _Reset(IN OUT O& o)
-        {
-            if (o.m_f && o.m_p != o.m_v)
-            {
-                o.m_f();
-                o.m_p = o.m_v;
-            }
-        }
-    };
-
-public:
-
-    // Конструктор для варианта, когда нельзя передать ссылку на указатель
-    // p - это указатель на объект
-    // f - это указатель на функцию, которую надо вызвать
-    XQBS_SmartGuard(IN P p, IN F f) : XQBS_SmartGuardBase(p, f) {}
-    // Конструктор для варианта, когда и функцию вызвать надо и указатель проинициализировать надо
-    // p - это указатель на объект
-    // f - это указатель на функцию, которую надо вызвать
-    // v - это значение, которым надо проинициализировать p после вызова функции f
-    XQBS_SmartGuard(IN OUT P& p, IN F f, IN P v) : XQBS_SmartGuardBase(p, f, v) {}
-
-    // Виртуальный деструктор с автоматическим вызовом функции Reset
-    virtual ~XQBS_SmartGuard() { Reset(); }
-
-    // Выполнить принудительный вызов функции F с учетом значения мета-триггера B
-    void Reset(void) { _Reset<XQBS_SmartGuard, B> R(*this); }
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Частичная специализация SmartGuard-а для случая, когда надо вызывать DeleteObject
-// P - это указатель на тип
-template< typename P >
-class XQBS_SmartGuard < P, XQBS_DeleteObject, XQBS_GuardWithParam, XQBS_GuardClassDefault > : public XQBS_SmartGuardBase<P, XQBS_DeleteObject>
-{
-public:
-
-    /// Конструктор для варианта, когда нельзя передать ссылку на указатель
-    // p - это указатель на объект
-    XQBS_SmartGuard(IN P p) : XQBS_SmartGuardBase(p, XQBS_SmartGuardBase<P, XQBS_DeleteObject>::DeleteObject) {}
-    // Конструктор для варианта, когда и функцию вызвать надо и указатель занулить надо
-    // p - это указатель на объект
-    // v - это значение, которым надо проинициализировать p после вызова DeleteObject
-    XQBS_SmartGuard(IN OUT P& p, IN P v) : XQBS_SmartGuardBase(p, XQBS_SmartGuardBase<P, XQBS_DeleteObject>::DeleteObject, v) {}
-
-    // Виртуальный деструктор с автоматическим вызовом функции Reset
-    virtual ~XQBS_SmartGuard() { Reset();  }
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Частичная специализация SmartGuard-а для случая, когда надо вызывать DeleteObjectArray
-// P - это указатель на тип
-template< typename P >
-class XQBS_SmartGuard < P, XQBS_DeleteObjectArray, XQBS_GuardWithParam, XQBS_GuardClassDefault > : public XQBS_SmartGuardBase<P, XQBS_DeleteObjectArray>
-{
-public:
-
-    // Конструктор для варианта, когда нельзя передать ссылку на указатель
-    // p - это указатель на объект
-    XQBS_SmartGuard(IN P p) : XQBS_SmartGuardBase(p, XQBS_SmartGuardBase<P, XQBS_DeleteObjectArray>::DeleteObjectArray) {}
-    // Конструктор для варианта, когда и функцию вызвать надо и указатель инициализировать надо
-    // p - это указатель на объект
-    // v - это значение, которым надо проинициализировать p после вызова DeleteObject
-    XQBS_SmartGuard(IN OUT P& p, IN P v) : XQBS_SmartGuardBase(p, XQBS_SmartGuardBase<P, XQBS_DeleteObjectArray>::DeleteObjectArray, v) {}
-
-    // Виртуальный деструктор с автоматическим вызовом функции Reset
-    virtual ~XQBS_SmartGuard() { Reset();  }
-};
-
-
-////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////
-//// Определение наиболее часто используемых определений класса XQBS_SmartGuard ////
-////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Это класс удобен для хранения указателя на память выделенную функцией malloc,
-// а также он обеспечивает автоматический вызов функции free.
-template<typename P>
-struct XQBS_SmartFree : public XQBS_SmartGuard<P, void(__cdecl*)(void*)>
-{
-    // Конструктор
-    XQBS_SmartFree(IN P p) : XQBS_SmartGuard(p, ::free) {}
-    // Конструктор
-    XQBS_SmartFree(IN P& p, IN P v) : XQBS_SmartGuard(p, ::free, v) {}
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Это класс удобен для хранения указателя на память выделенную оператором new,
-// а также он обеспечивает автоматический вызов оператора delete.
-template<typename P>
-struct XQBS_SmartDelete : public XQBS_SmartGuard<P, XQBS_DeleteObject>
-{
-    // Конструктор
-    XQBS_SmartDelete(IN P p) : XQBS_SmartGuard(p) {}
-    // Конструктор
-    XQBS_SmartDelete(IN P& p, IN P v) : XQBS_SmartGuard(p, v) {}
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Это класс удобен для хранения указателя на память выделенную оператором new[],
-// а также он обеспечивает автоматический вызов оператора delete[].
-template<typename P>
-struct XQBS_SmartDeleteArray : public XQBS_SmartGuard<P, XQBS_DeleteObjectArray>
-{
-    // Конструктор
-    XQBS_SmartDeleteArray(IN P p) : XQBS_SmartGuard(p) {}
-    // Конструктор
-    XQBS_SmartDeleteArray(IN P& p, IN P v) : XQBS_SmartGuard(p, v) {}
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Это класс удобен для хранения указателя на ссылочный объект, которому нельзя
-// делать delete, поэтому он обеспечивает автоматический вызов функции Release()
-template<typename P>
-struct XQBS_SmartRelease : public XQBS_SmartGuard<P, LONG (XQBS_RefBase::*)(void), XQBS_GuardWithoutParam, XQBS_RefBase>
-{
-    // Конструктор
-    XQBS_SmartRelease(IN P p) : XQBS_SmartGuard(p, &XQBS_RefBase::Release, *p) {}
-    // Конструктор
-    XQBS_SmartRelease(IN P& p, IN P v) : XQBS_SmartGuard(p, &XQBS_RefBase::Release, v, *p) {}
-};
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Это класс удобен для хранения дескриптора Windows, такие дескрипторы часто
-// используются при программировании на Win32 API, поэтому данный класс
-// обеспечивает автоматический вызов функции CloseHandle
-struct XQBS_SmartHandle : public XQBS_SmartGuard<HANDLE, BOOL (__stdcall*)(HANDLE)>
-{
-    // Конструктор
-    XQBS_SmartHandle(IN HANDLE h) : XQBS_SmartGuard(h, ::CloseHandle) {}
-    // Конструктор
-    XQBS_SmartHandle(IN HANDLE& h, IN HANDLE v) : XQBS_SmartGuard(h, ::CloseHandle, v) {}
-};
-
-_XQBS_END // !XQBS namespace
-
-#endif // !XQBS_SMART_GUARD_H
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_smartguard.h
+*
+*/
+
+#ifndef XQBS_SMART_GUARD_H
+#define XQBS_SMART_GUARD_H
+
+#include <stdlib.h>
+
+#include <type_traits>
+#include <utility>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "xqbs_defs.h"
+#include "xqbs_mem.h"
+#include "xqbs_refbase.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Функции очистки для SmartGuard-а. Это пустые классы: SmartGuard наследует
+// их закрыто и за счет оптимизации пустого базового класса не тратит на них
+// ни байта, а вызов известен при компиляции и подставляется в деструктор.
+// Функция очистки может объявить static P Null() - пустое значение, для
+// которого очистка не вызывается (по умолчанию P(), то есть NULL для указателей)
+
+// Освобождение памяти, выделенной функцией malloc
+struct XQBS_FreeMemory
+{
+    void operator() (IN void* ptr) const noexcept { ::free(ptr); }
+};
+
+// Удаление объекта, созданного через XQBS_new
+struct XQBS_DeleteObject
+{
+    template<typename T> void operator() (IN T* ptr) const { XQBS_delete(ptr); }
+};
+
+// Удаление массива объектов, созданного через XQBS_new(size)
+struct XQBS_DeleteObjectArray
+{
+    template<typename T> void operator() (IN T* ptr) const { XQBS_delete_size(ptr); }
+};
+
+// Удаление объекта или массива, созданного через XQBS_new_aligned
+struct XQBS_DeleteAligned
+{
+    template<typename T> void operator() (IN T* ptr) const { XQBS_delete_aligned(ptr); }
+};
+
+// Освобождение буфера на больших страницах с запомненным размером
+struct XQBS_FreeHuge
+{
+    size_t m_Size; // Размер, переданный в XQBS_huge_alloc
+
+    XQBS_FreeHuge() noexcept : m_Size(0) {}
+
+    void operator() (IN void* ptr) const noexcept { XQBS_huge_free(ptr, m_Size); }
+};
+
+// Удаление ссылки на объект со счетчиком ссылок
+struct XQBS_ReleaseObject
+{
+    template<typename T> void operator() (IN T* ptr) const { ptr->Release(); }
+};
+
+#ifndef _WIN32
+
+// Закрытие дескриптора POSIX, пустое значение -1. При EINTR close не
+// повторяется: в Linux дескриптор к этому моменту уже освобожден
+struct XQBS_CloseFd
+{
+    static int Null(void) { return -1; }
+
+    void operator() (IN int fd) const noexcept { ::close(fd); }
+};
+
+#endif // !_WIN32
+
+// Вызов глобальной функции F, известной при компиляции (например XQBS_GuardFn<&::fclose>)
+template<auto F>
+struct XQBS_GuardFn
+{
+    template<typename P> void operator() (IN P p) const { F(p); }
+};
+
+// Пустое значение SmartGuard-а: D::Null(), если функция очистки его объявляет, иначе P()
+template<typename P, typename D, typename = void>
+struct XQBS_GuardNull
+{
+    static P Value(void) { return P(); }
+};
+
+template<typename P, typename D>
+struct XQBS_GuardNull<P, D, decltype((void)D::Null())>
+{
+    static P Value(void) { return D::Null(); }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SmartGuard: владеет значением P и вызывает для него функцию очистки D
+// в деструкторе. Хранит только само значение, поэтому занимает ровно
+// sizeof(P), не имеет таблицы виртуальных функций и не делает косвенных
+// вызовов. Только перемещается: копия привела бы к двойной очистке, зато
+// SmartGuard можно хранить в std::vector и возвращать из функций.
+// Слежение за переменной вызывающего кода - см. XQBS_SmartGuardRef и XQBS_SmartGuardLink.
+//
+// P - это тип значения (обычно указатель, но может быть и не указатель, например HANDLE или int)
+// D - это функция очистки (см. XQBS_FreeMemory, XQBS_DeleteObject, XQBS_GuardFn и т.п.)
+template<typename P, typename D>
+class XQBS_SmartGuard : private D
+{
+private:
+
+    P m_p; // Значение, которым владеет SmartGuard
+
+    // Вызвать функцию очистки для p, если оно не пустое
+    void Cleanup(IN P p)
+    {
+        if (p != Null())
+            static_cast<D&>(*this)(p);
+    }
+
+public:
+
+    // SmartGuard не копируется: копия привела бы к двойной очистке
+    XQBS_SmartGuard(const XQBS_SmartGuard&) = delete;
+    XQBS_SmartGuard& operator= (const XQBS_SmartGuard&) = delete;
+
+    // Пустое значение
+    static P Null(void) { return XQBS_GuardNull<P, D>::Value(); }
+
+    // Конструктор пустого SmartGuard-а
+    XQBS_SmartGuard() noexcept : m_p(Null()) {}
+
+    // Конструктор, SmartGuard становится владельцем значения p
+    explicit XQBS_SmartGuard(IN P p) noexcept : m_p(p) {}
+
+    // Конструктор перемещения
+    XQBS_SmartGuard(IN OUT XQBS_SmartGuard&& r) noexcept : D(std::move(static_cast<D&>(r))), m_p(r.m_p) { r.m_p = Null(); }
+
+    // Оператор присваивания перемещением: текущее значение очищается
+    XQBS_SmartGuard& operator= (IN OUT XQBS_SmartGuard&& r) noexcept
+    {
+        if (this != &r)
+        {
+            Reset();
+            static_cast<D&>(*this) = std::move(static_cast<D&>(r));
+            m_p = r.m_p;
+            r.m_p = Null();
+        }
+        return *this;
+    }
+
+    // Деструктор с автоматическим вызовом функции очистки
+    ~XQBS_SmartGuard() { Reset(); }
+
+    // Оператор присваивания для инициализации SmartGuard-а другим значением,
+    // старое значение перетирается БЕЗ вызова функции очистки!
+    // Для очистки старого значения используйте Reset(p)
+    XQBS_SmartGuard& operator= (IN P p) noexcept { m_p = p; return *this; }
+
+    // Выполнить принудительный вызов функции очистки и обнулить значение
+    void Reset(void)
+    {
+        P p = m_p;
+        m_p = Null();
+        Cleanup(p);
+    }
+
+    // Очистить текущее значение и стать владельцем значения p
+    void Reset(IN P p)
+    {
+        Reset();
+        m_p = p;
+    }
+
+    // Отдать значение вызывающему коду без очистки
+    P Detach(void) noexcept
+    {
+        P p = m_p;
+        m_p = Null();
+        return p;
+    }
+
+    // Обменять содержимое двух SmartGuard-ов
+    void Swap(IN OUT XQBS_SmartGuard& r) noexcept { std::swap(static_cast<D&>(*this), static_cast<D&>(r)); std::swap(m_p, r.m_p); }
+
+    // Получить значение без передачи владения
+    P Get(void) const noexcept { return m_p; }
+
+    // Функция очистки (нужна функциям очистки с состоянием)
+    D& GetCleanup(void) noexcept { return *this; }
+    const D& GetCleanup(void) const noexcept { return *this; }
+
+    // Для того, чтобы SmartGuard вел себя как указатель, определим неявное приведение к P&
+    // (SmartGuard можно передать в функцию, которая возвращает значение через P&)
+    operator P& () noexcept { return m_p; }
+    // Приведение к P для константного SmartGuard-а
+    operator P () const noexcept { return m_p; }
+
+    // Доступ к объекту, если P - это указатель на класс
+    template<typename Q = P, typename = typename std::enable_if<std::is_pointer<Q>::value>::type>
+    Q operator-> () const noexcept { return m_p; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SmartGuard для варианта, когда и функцию очистки вызвать надо, и переменную
+// вызывающего кода проинициализировать надо. Следит за переменной p: функция
+// очистки D вызывается для ее значения на момент Reset или деструктора, если
+// оно не равно v и не пустое, после чего переменной присваивается v.
+// Хранит адрес переменной и значение v отдельно от самого значения, поэтому
+// годится для любых значений (HANDLE, int, указатели с любым выравниванием).
+// Не копируется и не перемещается: живет в той же области видимости, что и переменная
+//
+// P - это тип значения (обычно указатель, но может быть и не указатель, например HANDLE или int)
+// D - это функция очистки (см. XQBS_FreeMemory, XQBS_DeleteObject, XQBS_GuardFn и т.п.)
+template<typename P, typename D>
+class XQBS_SmartGuardRef : private D
+{
+private:
+
+    P& m_p; // Переменная вызывающего кода
+    P  m_v; // Значение для инициализации переменной после очистки (по умолчанию пустое)
+
+public:
+
+    // SmartGuard не копируется и не перемещается
+    XQBS_SmartGuardRef(const XQBS_SmartGuardRef&) = delete;
+    XQBS_SmartGuardRef& operator= (const XQBS_SmartGuardRef&) = delete;
+
+    // Пустое значение
+    static P Null(void) { return XQBS_GuardNull<P, D>::Value(); }
+
+    // Конструктор
+    // p - это ссылка на переменную со значением;
+    // v - это значение, которым надо проинициализировать p после вызова функции очистки
+    explicit XQBS_SmartGuardRef(IN OUT P& p, IN P v = Null()) noexcept : m_p(p), m_v(v) {}
+
+    // Деструктор с автоматическим вызовом функции очистки
+    ~XQBS_SmartGuardRef() { Reset(); }
+
+    // Оператор присваивания переменной другого значения,
+    // старое значение перетирается БЕЗ вызова функции очистки!
+    // Для очистки старого значения используйте Reset(p)
+    XQBS_SmartGuardRef& operator= (IN P p) noexcept { m_p = p; return *this; }
+
+    // Выполнить принудительный вызов функции очистки и присвоить переменной v
+    void Reset(void)
+    {
+        if (m_p != m_v)
+        {
+            P p = m_p;
+            m_p = m_v;
+            if (p != Null())
+                static_cast<D&>(*this)(p);
+        }
+    }
+
+    // Очистить текущее значение и присвоить переменной p
+    void Reset(IN P p)
+    {
+        Reset();
+        m_p = p;
+    }
+
+    // Отдать значение вызывающему коду без очистки, переменной присваивается v
+    P Detach(void) noexcept
+    {
+        P p = m_p;
+        m_p = m_v;
+        return p;
+    }
+
+    // Получить значение переменной
+    P Get(void) const noexcept { return m_p; }
+
+    // Функция очистки (нужна функциям очистки с состоянием)
+    D& GetCleanup(void) noexcept { return *this; }
+    const D& GetCleanup(void) const noexcept { return *this; }
+
+    // Неявное приведение к переменной вызывающего кода
+    operator P& () const noexcept { return m_p; }
+
+    // Доступ к объекту, если P - это указатель на класс
+    template<typename Q = P, typename = typename std::enable_if<std::is_pointer<Q>::value>::type>
+    Q operator-> () const noexcept { return m_p; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SmartGuard, который в зависимости от конструктора либо сам владеет значением
+// (как XQBS_SmartGuard), либо следит за переменной вызывающего кода (как
+// XQBS_SmartGuardRef). На нем построены XQBS_SmartFree, XQBS_SmartDelete и
+// другие гарды с прежним конструктором (P& p, P v). Хранит значение и адрес
+// переменной: в режиме владения это адрес собственного значения, в режиме
+// слежения собственное значение не нужно и в нем лежит v. Поэтому занимает
+// два слова, а не одно; там, где важен каждый байт, используйте XQBS_SmartGuard.
+// Только перемещается, слежение за переменной при перемещении передается.
+//
+// P - это тип значения (обычно указатель, но может быть и не указатель, например HANDLE или int)
+// D - это функция очистки (см. XQBS_FreeMemory, XQBS_DeleteObject, XQBS_GuardFn и т.п.)
+template<typename P, typename D>
+class XQBS_SmartGuardLink : private D
+{
+private:
+
+    P  m_d;  // Собственное значение, при слежении за переменной - значение v
+    P* m_pp; // Адрес значения: &m_d или переменная вызывающего кода
+
+    // SmartGuard следит за переменной вызывающего кода
+    bool IsLinked(void) const noexcept { return m_pp != &m_d; }
+
+    // Значение, которое получает переменная после очистки
+    P ResetValue(void) const { return IsLinked() ? m_d : Null(); }
+
+    // Забрать значение или слежение у r, r становится пустым
+    void Take(IN OUT XQBS_SmartGuardLink& r) noexcept
+    {
+        m_d = r.m_d;
+        m_pp = r.IsLinked() ? r.m_pp : &m_d;
+        r.m_d = Null();
+        r.m_pp = &r.m_d;
+    }
+
+public:
+
+    // SmartGuard не копируется: копия привела бы к двойной очистке
+    XQBS_SmartGuardLink(const XQBS_SmartGuardLink&) = delete;
+    XQBS_SmartGuardLink& operator= (const XQBS_SmartGuardLink&) = delete;
+
+    // Пустое значение
+    static P Null(void) { return XQBS_GuardNull<P, D>::Value(); }
+
+    // Конструктор пустого SmartGuard-а
+    XQBS_SmartGuardLink() noexcept : m_d(Null()), m_pp(&m_d) {}
+
+    // Конструктор, SmartGuard становится владельцем значения p
+    explicit XQBS_SmartGuardLink(IN P p) noexcept : m_d(p), m_pp(&m_d) {}
+
+    // Конструктор для варианта, когда и функцию очистки вызвать надо, и переменную проинициализировать надо
+    // p - это ссылка на переменную со значением;
+    // v - это значение, которым надо проинициализировать p после вызова функции очистки
+    XQBS_SmartGuardLink(IN OUT P& p, IN P v) noexcept : m_d(v), m_pp(&p) {}
+
+    // Конструктор перемещения
+    XQBS_SmartGuardLink(IN OUT XQBS_SmartGuardLink&& r) noexcept : D(std::move(static_cast<D&>(r))) { Take(r); }
+
+    // Оператор присваивания перемещением: текущее значение очищается
+    XQBS_SmartGuardLink& operator= (IN OUT XQBS_SmartGuardLink&& r) noexcept
+    {
+        if (this != &r)
+        {
+            Reset();
+            static_cast<D&>(*this) = std::move(static_cast<D&>(r));
+            Take(r);
+        }
+        return *this;
+    }
+
+    // Деструктор с автоматическим вызовом функции очистки
+    ~XQBS_SmartGuardLink() { Reset(); }
+
+    // Оператор присваивания для инициализации SmartGuard-а другим значением,
+    // старое значение перетирается БЕЗ вызова функции очистки!
+    // Для очистки старого значения используйте Reset(p)
+    XQBS_SmartGuardLink& operator= (IN P p) noexcept { *m_pp = p; return *this; }
+
+    // Выполнить принудительный вызов функции очистки, значение становится
+    // пустым (при слежении за переменной ей присваивается v)
+    void Reset(void)
+    {
+        P v = ResetValue();
+        P p = *m_pp;
+        if (p != v)
+        {
+            *m_pp = v;
+            if (p != Null())
+                static_cast<D&>(*this)(p);
+        }
+    }
+
+    // Очистить текущее значение и стать владельцем значения p
+    void Reset(IN P p)
+    {
+        Reset();
+        *m_pp = p;
+    }
+
+    // Отдать значение вызывающему коду без очистки
+    P Detach(void) noexcept
+    {
+        P p = *m_pp;
+        *m_pp = ResetValue();
+        return p;
+    }
+
+    // Обменять содержимое двух SmartGuard-ов
+    void Swap(IN OUT XQBS_SmartGuardLink& r) noexcept
+    {
+        XQBS_SmartGuardLink t(std::move(r));
+        r = std::move(*this);
+        *this = std::move(t);
+    }
+
+    // Получить значение без передачи владения
+    P Get(void) const noexcept { return *m_pp; }
+
+    // Функция очистки (нужна функциям очистки с состоянием)
+    D& GetCleanup(void) noexcept { return *this; }
+    const D& GetCleanup(void) const noexcept { return *this; }
+
+    // Неявное приведение к P& (SmartGuard можно передать в функцию, которая возвращает значение через P&)
+    operator P& () noexcept { return *m_pp; }
+    // Приведение к P для константного SmartGuard-а
+    operator P () const noexcept { return *m_pp; }
+
+    // Доступ к объекту, если P - это указатель на класс
+    template<typename Q = P, typename = typename std::enable_if<std::is_pointer<Q>::value>::type>
+    Q operator-> () const noexcept { return *m_pp; }
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////
+//// Определение наиболее часто используемых определений класса XQBS_SmartGuard ////
+////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения указателя на память выделенную функцией malloc,
+// а также он обеспечивает автоматический вызов функции free.
+template<typename P>
+struct XQBS_SmartFree : public XQBS_SmartGuardLink<P, XQBS_FreeMemory>
+{
+    // Конструктор
+    XQBS_SmartFree() {}
+    // Конструктор
+    XQBS_SmartFree(IN P p) : XQBS_SmartGuardLink<P, XQBS_FreeMemory>(p) {}
+    // Конструктор, p - переменная вызывающего кода, v - ее значение после очистки
+    XQBS_SmartFree(IN OUT P& p, IN P v) : XQBS_SmartGuardLink<P, XQBS_FreeMemory>(p, v) {}
+
+    using XQBS_SmartGuardLink<P, XQBS_FreeMemory>::operator=;
+};
+
+// SmartGuard, который следит за переменной вызывающего кода и вызывает для ее значения XQBS_FreeMemory
+template<typename P> using XQBS_SmartFreeRef = XQBS_SmartGuardRef<P, XQBS_FreeMemory>;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения указателя на память выделенную через XQBS_new,
+// а также он обеспечивает автоматический вызов XQBS_delete.
+template<typename P>
+struct XQBS_SmartDelete : public XQBS_SmartGuardLink<P, XQBS_DeleteObject>
+{
+    // Конструктор
+    XQBS_SmartDelete() {}
+    // Конструктор
+    XQBS_SmartDelete(IN P p) : XQBS_SmartGuardLink<P, XQBS_DeleteObject>(p) {}
+    // Конструктор, p - переменная вызывающего кода, v - ее значение после очистки
+    XQBS_SmartDelete(IN OUT P& p, IN P v) : XQBS_SmartGuardLink<P, XQBS_DeleteObject>(p, v) {}
+
+    using XQBS_SmartGuardLink<P, XQBS_DeleteObject>::operator=;
+};
+
+// SmartGuard, который следит за переменной вызывающего кода и вызывает для ее значения XQBS_DeleteObject
+template<typename P> using XQBS_SmartDeleteRef = XQBS_SmartGuardRef<P, XQBS_DeleteObject>;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения указателя на память выделенную через XQBS_new(size),
+// а также он обеспечивает автоматический вызов XQBS_delete_size.
+template<typename P>
+struct XQBS_SmartDeleteArray : public XQBS_SmartGuardLink<P, XQBS_DeleteObjectArray>
+{
+    // Конструктор
+    XQBS_SmartDeleteArray() {}
+    // Конструктор
+    XQBS_SmartDeleteArray(IN P p) : XQBS_SmartGuardLink<P, XQBS_DeleteObjectArray>(p) {}
+    // Конструктор, p - переменная вызывающего кода, v - ее значение после очистки
+    XQBS_SmartDeleteArray(IN OUT P& p, IN P v) : XQBS_SmartGuardLink<P, XQBS_DeleteObjectArray>(p, v) {}
+
+    using XQBS_SmartGuardLink<P, XQBS_DeleteObjectArray>::operator=;
+};
+
+// SmartGuard, который следит за переменной вызывающего кода и вызывает для ее значения XQBS_DeleteObjectArray
+template<typename P> using XQBS_SmartDeleteArrayRef = XQBS_SmartGuardRef<P, XQBS_DeleteObjectArray>;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения указателя на ссылочный объект, которому нельзя
+// делать delete, поэтому он обеспечивает автоматический вызов функции Release()
+template<typename P>
+struct XQBS_SmartRelease : public XQBS_SmartGuardLink<P, XQBS_ReleaseObject>
+{
+    // Конструктор
+    XQBS_SmartRelease() {}
+    // Конструктор
+    XQBS_SmartRelease(IN P p) : XQBS_SmartGuardLink<P, XQBS_ReleaseObject>(p) {}
+    // Конструктор, p - переменная вызывающего кода, v - ее значение после очистки
+    XQBS_SmartRelease(IN OUT P& p, IN P v) : XQBS_SmartGuardLink<P, XQBS_ReleaseObject>(p, v) {}
+
+    using XQBS_SmartGuardLink<P, XQBS_ReleaseObject>::operator=;
+};
+
+// SmartGuard, который следит за переменной вызывающего кода и вызывает для ее значения XQBS_ReleaseObject
+template<typename P> using XQBS_SmartReleaseRef = XQBS_SmartGuardRef<P, XQBS_ReleaseObject>;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения указателя на выровненную память, выделенную
+// через XQBS_new_aligned, а также он обеспечивает автоматический вызов XQBS_delete_aligned.
+template<typename P>
+struct XQBS_SmartDeleteAligned : public XQBS_SmartGuard<P, XQBS_DeleteAligned>
+{
+    // Конструктор
+    XQBS_SmartDeleteAligned() {}
+    // Конструктор
+    XQBS_SmartDeleteAligned(IN P p) : XQBS_SmartGuard<P, XQBS_DeleteAligned>(p) {}
+
+    using XQBS_SmartGuard<P, XQBS_DeleteAligned>::operator=;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для большого буфера на больших страницах памяти: выделяет
+// его через XQBS_huge_alloc и обеспечивает автоматический вызов XQBS_huge_free
+// с тем же размером. Хранит адрес и размер буфера
+class XQBS_SmartHugeBuffer : public XQBS_SmartGuard<void*, _XQBS XQBS_FreeHuge>
+{
+public:
+
+    // Конструктор пустого буфера
+    XQBS_SmartHugeBuffer() {}
+    // Конструктор с выделением буфера не меньше size байт
+    explicit XQBS_SmartHugeBuffer(IN size_t size) { Alloc(size); }
+
+    // Освободить текущий буфер и выделить новый не меньше size байт
+    void Alloc(IN size_t size)
+    {
+        Reset();
+        void* ptr = XQBS_huge_alloc(size);
+        GetCleanup().m_Size = size;
+        XQBS_SmartGuard<void*, _XQBS XQBS_FreeHuge>::operator= (ptr);
+    }
+
+    // Размер буфера, запрошенный при выделении
+    size_t Size(void) const noexcept { return Get() ? GetCleanup().m_Size : 0; }
+
+    // Буфер как указатель на T
+    template<typename T> T* Data(void) const noexcept { return static_cast<T*>(Get()); }
+};
+
+
+#ifdef _WIN32
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения дескриптора Windows, такие дескрипторы часто
+// используются при программировании на Win32 API, поэтому данный класс
+// обеспечивает автоматический вызов функции CloseHandle
+struct XQBS_SmartHandle : public XQBS_SmartGuardLink<HANDLE, XQBS_GuardFn<&::CloseHandle> >
+{
+    // Конструктор
+    XQBS_SmartHandle() {}
+    // Конструктор
+    XQBS_SmartHandle(IN HANDLE h) : XQBS_SmartGuardLink(h) {}
+    // Конструктор, h - переменная вызывающего кода, v - ее значение после очистки
+    XQBS_SmartHandle(IN OUT HANDLE& h, IN HANDLE v) : XQBS_SmartGuardLink(h, v) {}
+
+    using XQBS_SmartGuardLink::operator=;
+};
+
+// SmartGuard, который следит за дескриптором Windows в переменной вызывающего кода
+typedef XQBS_SmartGuardRef<HANDLE, XQBS_GuardFn<&::CloseHandle> > XQBS_SmartHandleRef;
+
+#else // _WIN32
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для хранения дескриптора POSIX (файл, сокет, pipe, eventfd),
+// пустое значение -1, обеспечивает автоматический вызов функции close.
+// Если close может надолго заблокировать поток (сокет с SO_LINGER, файл на
+// NFS), используйте XQBS_SmartFdDeferred из xqbs_fdcloser.h
+struct XQBS_SmartFd : public XQBS_SmartGuardLink<int, XQBS_CloseFd>
+{
+    // Конструктор
+    XQBS_SmartFd() {}
+    // Конструктор
+    XQBS_SmartFd(IN int fd) : XQBS_SmartGuardLink(fd) {}
+    // Конструктор, fd - переменная вызывающего кода, v - ее значение после закрытия
+    XQBS_SmartFd(IN OUT int& fd, IN int v) : XQBS_SmartGuardLink(fd, v) {}
+
+    using XQBS_SmartGuardLink::operator=;
+
+    // Дескриптор задан
+    bool IsValid(void) const noexcept { return Get() >= 0; }
+};
+
+static_assert(sizeof(XQBS_SmartFd) == sizeof(XQBS_SmartGuardLink<int, XQBS_CloseFd>), "XQBS_SmartFd must add no state");
+
+// SmartGuard, который следит за дескриптором POSIX в переменной вызывающего кода:
+// закрывает его и присваивает переменной v (по умолчанию -1)
+typedef XQBS_SmartGuardRef<int, XQBS_CloseFd> XQBS_SmartFdRef;
+
+#endif // _WIN32
+
+// SmartGuard занимает ровно столько же, сколько хранимое значение
+static_assert(sizeof(XQBS_SmartGuard<char*, XQBS_FreeMemory>) == sizeof(void*), "XQBS_SmartGuard must be pointer-sized");
+static_assert(sizeof(XQBS_SmartGuard<int*, XQBS_DeleteObject>) == sizeof(void*), "XQBS_SmartGuard must be pointer-sized");
+static_assert(sizeof(XQBS_SmartGuard<XQBS_RefBase*, XQBS_ReleaseObject>) == sizeof(void*), "XQBS_SmartGuard must be pointer-sized");
+static_assert(sizeof(XQBS_SmartDeleteAligned<float*>) == sizeof(void*), "XQBS_SmartDeleteAligned must be pointer-sized");
+// Гарды с конструктором (P& p, P v) хранят значение и адрес переменной
+static_assert(sizeof(XQBS_SmartFree<char*>) == 2 * sizeof(void*), "XQBS_SmartFree must be two pointers");
+static_assert(sizeof(XQBS_SmartDelete<int*>) == 2 * sizeof(void*), "XQBS_SmartDelete must be two pointers");
+static_assert(sizeof(XQBS_SmartDeleteArray<int*>) == 2 * sizeof(void*), "XQBS_SmartDeleteArray must be two pointers");
+static_assert(sizeof(XQBS_SmartRelease<XQBS_RefBase*>) == 2 * sizeof(void*), "XQBS_SmartRelease must be two pointers");
+static_assert(!std::is_copy_constructible<XQBS_SmartDelete<int*> >::value, "XQBS_SmartGuard must be move-only");
+static_assert(std::is_nothrow_move_constructible<XQBS_SmartDelete<int*> >::value, "XQBS_SmartGuard must be nothrow-movable");
+
+_XQBS_END // !XQBS namespace
+
+#endif // !XQBS_SMART_GUARD_H
@@ -0,0 +1,194 @@
+/*
+* This software is copyright protected (C) 2009 XQBS
+*
+* Author:                Alexey N. Zhirov
+* E-mail:                src@xqbs.ru
+* Module:                xqbs_smartmmap.h
+*
+*/
+
+#ifndef XQBS_SMART_MMAP_H
+#define XQBS_SMART_MMAP_H
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xqbs_defs.h"
+#include "xqbs_smartguard.h"
+
+_XQBS_BEGIN // XQBS namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Непрерывный участок памяти из size элементов типа T без владения (аналог std::span)
+template<typename T>
+struct XQBS_Span
+{
+    T*     m_pData; // Первый элемент
+    size_t m_Size;  // Количество элементов
+
+    XQBS_Span() noexcept : m_pData(NULL), m_Size(0) {}
+    XQBS_Span(IN T* pData, IN size_t size) noexcept : m_pData(pData), m_Size(size) {}
+
+    T* Data(void) const noexcept { return m_pData; }
+    size_t Size(void) const noexcept { return m_Size; }
+    bool Empty(void) const noexcept { return 0 == m_Size; }
+
+    T* begin(void) const noexcept { return m_pData; }
+    T* end(void) const noexcept { return m_pData + m_Size; }
+    T& operator[] (IN size_t index) const noexcept { return m_pData[index]; }
+
+    // Часть участка: count элементов, начиная с offset (обрезается по концу участка)
+    XQBS_Span Sub(IN size_t offset, IN size_t count = size_t(-1)) const noexcept
+    {
+        if (offset > m_Size)
+            offset = m_Size;
+        if (count > m_Size - offset)
+            count = m_Size - offset;
+        return XQBS_Span(m_pData + offset, count);
+    }
+};
+
+// Функция очистки для отображения файла в память: munmap с запомненным размером
+struct XQBS_UnmapMemory
+{
+    size_t m_Size; // Размер отображения в байтах
+
+    XQBS_UnmapMemory() noexcept : m_Size(0) {}
+
+    void operator() (IN void* ptr) const noexcept { ::munmap(ptr, m_Size); }
+};
+
+// Флаги отображения файла в память
+enum
+{
+    XQBS_MMAP_READ       = 0x00, // Только чтение
+    XQBS_MMAP_WRITE      = 0x01, // Чтение и запись, изменения попадают в файл
+    XQBS_MMAP_POPULATE   = 0x02, // Заранее загрузить все страницы (MAP_POPULATE)
+    XQBS_MMAP_SEQUENTIAL = 0x04, // Подсказка: последовательное чтение (MADV_SEQUENTIAL)
+    XQBS_MMAP_RANDOM     = 0x08, // Подсказка: произвольный доступ (MADV_RANDOM)
+    XQBS_MMAP_WILLNEED   = 0x10, // Подсказка: начать чтение страниц заранее (MADV_WILLNEED)
+    XQBS_MMAP_HUGEPAGE   = 0x20  // Подсказка: использовать большие страницы (MADV_HUGEPAGE)
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Это класс удобен для отображения файла в память вместо чтения его в буфер
+// XQBS_new(size): нет копирования данных и большого выделения памяти в куче.
+// Файл отображается целиком или участком, дескриптор файла закрывается сразу
+// после отображения. Отображение снимается ровно один раз - в деструкторе или
+// в Reset, SmartMmap только перемещается.
+// Подсказки madvise носят рекомендательный характер: если ядро их не
+// поддерживает, отображение все равно остается рабочим
+class XQBS_SmartMmap : public XQBS_SmartGuard<void*, XQBS_UnmapMemory>
+{
+private:
+
+    typedef XQBS_SmartGuard<void*, _XQBS XQBS_UnmapMemory> Base;
+
+public:
+
+    // Конструктор пустого отображения
+    XQBS_SmartMmap() {}
+
+    // Отобразить файл path целиком, флаги XQBS_MMAP_*. Результат проверяется через IsMapped
+    explicit XQBS_SmartMmap(IN const char* path, IN unsigned flags = XQBS_MMAP_READ) { Map(path, flags); }
+
+    // Отобразить файл path целиком. Возвращает false при ошибке, причина в errno.
+    // Пустой файл отображается успешно в пустой участок
+    bool Map(IN const char* path, IN unsigned flags = XQBS_MMAP_READ)
+    {
+        Reset();
+
+        int fd = ::open(path, (flags & XQBS_MMAP_WRITE) ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        bool bResult = 0 == ::fstat(fd, &st) && Map(fd, static_cast<size_t>(st.st_size), 0, flags);
+
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return bResult;
+    }
+
+    // Отобразить size байт открытого файла fd, начиная со смещения offset
+    // (кратного размеру страницы). Дескриптор остается открытым у вызывающего кода
+    bool Map(IN int fd, IN size_t size, IN off_t offset, IN unsigned flags = XQBS_MMAP_READ)
+    {
+        Reset();
+        if (!size)
+            return true;
+
+        int prot = PROT_READ | ((flags & XQBS_MMAP_WRITE) ? PROT_WRITE : 0);
+        int map = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (flags & XQBS_MMAP_POPULATE)
+            map |= MAP_POPULATE;
+#endif
+
+        void* ptr = ::mmap(NULL, size, prot, map, fd, offset);
+        if (MAP_FAILED == ptr)
+            return false;
+
+        GetCleanup().m_Size = size;
+        Base::operator= (ptr);
+        Advise(flags);
+        return true;
+    }
+
+    // Передать ядру подсказки XQBS_MMAP_SEQUENTIAL, XQBS_MMAP_RANDOM, XQBS_MMAP_WILLNEED,
+    // XQBS_MMAP_HUGEPAGE для всего отображения. Возвращает false, если какая-то подсказка не принята
+    bool Advise(IN unsigned flags) const
+    {
+        if (!IsMapped())
+            return true;
+
+        bool bResult = true;
+        if (flags & XQBS_MMAP_SEQUENTIAL)
+            bResult &= 0 == ::madvise(Get(), Size(), MADV_SEQUENTIAL);
+        if (flags & XQBS_MMAP_RANDOM)
+            bResult &= 0 == ::madvise(Get(), Size(), MADV_RANDOM);
+        if (flags & XQBS_MMAP_WILLNEED)
+            bResult &= 0 == ::madvise(Get(), Size(), MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        if (flags & XQBS_MMAP_HUGEPAGE)
+            bResult &= 0 == ::madvise(Get(), Size(), MADV_HUGEPAGE);
+#endif
+        return bResult;
+    }
+
+    // Записать измененные страницы в файл (только для XQBS_MMAP_WRITE)
+    bool Sync(IN bool bWait = true) const
+    {
+        return !IsMapped() || 0 == ::msync(Get(), Size(), bWait ? MS_SYNC : MS_ASYNC);
+    }
+
+    // Файл отображен (пустой файл не отображается)
+    bool IsMapped(void) const noexcept { return NULL != Get(); }
+
+    // Размер отображения в байтах
+    size_t Size(void) const noexcept { return IsMapped() ? GetCleanup().m_Size : 0; }
+
+    // Отображение как непрерывный участок байтов
+    XQBS_Span<const char> Bytes(void) const noexcept { return XQBS_Span<const char>(static_cast<const char*>(Get()), Size()); }
+    // Отображение как изменяемый участок байтов (только для XQBS_MMAP_WRITE)
+    XQBS_Span<char> MutableBytes(void) const noexcept { return XQBS_Span<char>(static_cast<char*>(Get()), Size()); }
+
+    // Отображение как массив элементов типа T (хвост меньше sizeof(T) не входит)
+    template<typename T>
+    XQBS_Span<const T> View(void) const noexcept { return XQBS_Span<const T>(static_cast<const T*>(Get()), Size() / sizeof(T)); }
+};
+
+// SmartMmap хранит только адрес и размер отображения
+static_assert(sizeof(XQBS_SmartMmap) == 2 * sizeof(void*), "XQBS_SmartMmap must hold only address and size");
+
+_XQBS_END // !XQBS namespace
+
+#endif // !_WIN32
+
+#endif // !XQBS_SMART_MMAP_H